@@ -0,0 +1,354 @@
+#include "appcast_binary.h"
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+namespace SparkleLite {
+
+static_assert(sizeof(BinHeader) % 8 == 0, "binary appcast header must keep 8-byte alignment");
+static_assert(sizeof(BinItem) % 8 == 0, "binary appcast item must keep 8-byte alignment");
+static_assert(sizeof(BinEnclosure) % 8 == 0, "binary appcast enclosure must keep 8-byte alignment");
+
+//
+// Reader
+//
+std::string_view BinaryAppcastEnclosure::Url() const {
+	return owner_.String(e_.url);
+}
+
+std::string_view BinaryAppcastEnclosure::Signature() const {
+	return owner_.String(e_.signature);
+}
+
+std::string_view BinaryAppcastEnclosure::Mime() const {
+	return owner_.String(e_.mime);
+}
+
+std::string_view BinaryAppcastEnclosure::InstallArgs() const {
+	return owner_.String(e_.installArgs);
+}
+
+std::string_view BinaryAppcastEnclosure::OS() const {
+	return owner_.String(e_.os);
+}
+
+AppcastEnclosure BinaryAppcastEnclosure::Materialize() const {
+	AppcastEnclosure result;
+	result.url = Url();
+	result.signType = SignType();
+	result.signature = Signature();
+	result.size = Size();
+	result.mime = Mime();
+	result.installArgs = InstallArgs();
+	result.os = OS();
+	return result;
+}
+
+std::string_view BinaryAppcastItem::Channel() const {
+	return owner_.String(item_.channel);
+}
+
+std::string_view BinaryAppcastItem::Version() const {
+	return owner_.String(item_.version);
+}
+
+std::string_view BinaryAppcastItem::ShortVersion() const {
+	return owner_.String(item_.shortVersion);
+}
+
+std::string_view BinaryAppcastItem::PubDate() const {
+	return owner_.String(item_.pubDate);
+}
+
+std::string_view BinaryAppcastItem::Title() const {
+	return owner_.String(item_.title);
+}
+
+std::string_view BinaryAppcastItem::Link() const {
+	return owner_.String(item_.link);
+}
+
+std::string_view BinaryAppcastItem::MinSystemVerRequire() const {
+	return owner_.String(item_.minSystemVerRequire);
+}
+
+std::string_view BinaryAppcastItem::CriticalUpdateVerBarrier() const {
+	return owner_.String(item_.criticalUpdateVerBarrier);
+}
+
+std::string_view BinaryAppcastItem::MinAutoUpdateVerRequire() const {
+	return owner_.String(item_.minAutoUpdateVerRequire);
+}
+
+std::string_view BinaryAppcastItem::Description(uint16_t lang) const {
+	return LangString(item_.description, lang);
+}
+
+std::string_view BinaryAppcastItem::ReleaseNoteLink(uint16_t lang) const {
+	return LangString(item_.releaseNoteLink, lang);
+}
+
+std::string_view BinaryAppcastItem::InformationalUpdateVer(size_t idx) const {
+	if (idx >= item_.informationalUpdateVers.count) {
+		return {};
+	}
+	return owner_.String(owner_.Array<BinStrRef>(item_.informationalUpdateVers)[idx]);
+}
+
+BinaryAppcastEnclosure BinaryAppcastItem::Enclosure(size_t idx) const {
+	// out of range, an empty one (no url, no size)
+	static const BinEnclosure empty = { 0 };
+	if (idx >= item_.enclosures.count) {
+		return BinaryAppcastEnclosure(owner_, empty);
+	}
+	return BinaryAppcastEnclosure(owner_, owner_.Array<BinEnclosure>(item_.enclosures)[idx]);
+}
+
+std::string_view BinaryAppcastItem::LangString(const BinArrayRef &arr, uint16_t lang) const {
+	auto strings = owner_.Array<BinLangString>(arr);
+	const BinLangString *fallback = nullptr;
+	for (uint32_t idx = 0; idx < arr.count; idx++) {
+		if (strings[idx].lang == lang) {
+			return owner_.String(strings[idx].str);
+		}
+		if (strings[idx].lang == 0) {
+			fallback = &strings[idx];
+		}
+	}
+	return fallback ? owner_.String(fallback->str) : std::string_view();
+}
+
+bool BinaryAppcast::Open(const std::string &fileName) {
+	std::error_code error;
+	mmap_ = mio::make_mmap_source(fileName, error);
+	if (error) {
+		return false;
+	}
+	buffer_.clear();
+	return Validate(mmap_.data(), mmap_.size());
+}
+
+bool BinaryAppcast::Load(std::string &&buffer) {
+	mmap_.unmap();
+	buffer_ = std::move(buffer);
+	return Validate(buffer_.data(), buffer_.size());
+}
+
+BinaryAppcastItem BinaryAppcast::Item(size_t idx) const {
+	auto table = (const uint32_t *)(data_ + header_->itemTableOffset);
+	return BinaryAppcastItem(*this, *(const BinItem *)(data_ + table[idx]));
+}
+
+std::string_view BinaryAppcast::String(const BinStrRef &ref) const {
+	if ((uint64_t)ref.offset + ref.length > header_->stringPoolSize) {
+		return {};
+	}
+	return std::string_view(data_ + header_->stringPoolOffset + ref.offset, ref.length);
+}
+
+bool BinaryAppcast::Validate(const char *data, size_t size) {
+	data_ = nullptr;
+	size_ = 0;
+	header_ = nullptr;
+
+	// the content comes from the network, check every offset once so accessors can trust them
+	auto inRange = [&](uint64_t offset, uint64_t length) -> bool {
+		return offset <= size && length <= size - offset;
+	};
+	// records are read in place, as the writer aligns them
+	auto isAligned = [](uint64_t offset) -> bool {
+		return offset % 8 == 0;
+	};
+
+	if (!data || size < sizeof(BinHeader)) {
+		return false;
+	}
+	auto header = (const BinHeader *)data;
+	if (header->magic != BINARY_APPCAST_MAGIC ||
+			header->version != BINARY_APPCAST_VERSION ||
+			header->totalSize != size ||
+			!isAligned(header->itemTableOffset) ||
+			!inRange(header->itemTableOffset, (uint64_t)header->itemCount * sizeof(uint32_t)) ||
+			!inRange(header->stringPoolOffset, header->stringPoolSize)) {
+		return false;
+	}
+
+	auto version = [&](const BinItem *item) -> std::string_view {
+		auto &ref = item->version;
+		if ((uint64_t)ref.offset + ref.length > header->stringPoolSize) {
+			return {};
+		}
+		return std::string_view(data + header->stringPoolOffset + ref.offset, ref.length);
+	};
+
+	auto table = (const uint32_t *)(data + header->itemTableOffset);
+	std::string_view newer;
+	uint64_t newerKey = 0;
+	for (uint32_t idx = 0; idx < header->itemCount; idx++) {
+		if (!isAligned(table[idx]) || !inRange(table[idx], sizeof(BinItem))) {
+			return false;
+		}
+		auto item = (const BinItem *)(data + table[idx]);
+		if (!isAligned(item->description.offset) ||
+				!isAligned(item->releaseNoteLink.offset) ||
+				!isAligned(item->informationalUpdateVers.offset) ||
+				!isAligned(item->enclosures.offset) ||
+				!inRange(item->description.offset, (uint64_t)item->description.count * sizeof(BinLangString)) ||
+				!inRange(item->releaseNoteLink.offset, (uint64_t)item->releaseNoteLink.count * sizeof(BinLangString)) ||
+				!inRange(item->informationalUpdateVers.offset, (uint64_t)item->informationalUpdateVers.count * sizeof(BinStrRef)) ||
+				!inRange(item->enclosures.offset, (uint64_t)item->enclosures.count * sizeof(BinEnclosure))) {
+			return false;
+		}
+
+		// selecting stops at the first item older than the running version, so the order must hold
+		auto current = version(item);
+		auto currentKey = MakeVersionKey(current);
+		if (idx > 0 && SafeVersionCompare(newerKey, newer, currentKey, current) < 0) {
+			return false;
+		}
+		newer = current;
+		newerKey = currentKey;
+	}
+
+	data_ = data;
+	size_ = size;
+	header_ = header;
+	return true;
+}
+
+//
+// Writer
+//
+class BinaryAppcastWriter {
+public:
+	std::string Write(const Appcast &appcast) {
+		std::vector<const AppcastItem *> items;
+		for (const auto &item : appcast.items) {
+			items.push_back(&item);
+		}
+		std::stable_sort(items.begin(), items.end(), [](const AppcastItem *a, const AppcastItem *b) -> bool {
+			return SafeVersionCompare(a->versionKey, a->version, b->versionKey, b->version) > 0;
+		});
+
+		BinHeader header = { 0 };
+		header.magic = BINARY_APPCAST_MAGIC;
+		header.version = BINARY_APPCAST_VERSION;
+		header.itemCount = (uint32_t)items.size();
+		Append(&header, sizeof(header));
+
+		header.itemTableOffset = (uint32_t)out_.size();
+		Reserve(items.size() * sizeof(uint32_t));
+		Align();
+
+		for (size_t idx = 0; idx < items.size(); idx++) {
+			auto offset = WriteItem(*items[idx]);
+			memcpy(&out_[header.itemTableOffset + idx * sizeof(uint32_t)], &offset, sizeof(offset));
+		}
+
+		// every offset and length written so far is below the total size, none of them was truncated if it fits
+		if (out_.size() + pool_.size() > UINT32_MAX) {
+			return {};
+		}
+		header.stringPoolOffset = (uint32_t)out_.size();
+		header.stringPoolSize = (uint32_t)pool_.size();
+		out_ += pool_;
+		header.totalSize = (uint32_t)out_.size();
+		memcpy(&out_[0], &header, sizeof(header));
+		return std::move(out_);
+	}
+
+private:
+	uint32_t WriteItem(const AppcastItem &item) {
+		auto offset = Reserve(sizeof(BinItem));
+
+		BinItem bin = { 0 };
+		bin.channel = Str(item.channel);
+		bin.version = Str(item.version);
+		bin.shortVersion = Str(item.shortVersion);
+		bin.pubDate = Str(item.pubDate);
+		bin.title = Str(item.title);
+		bin.link = Str(item.link);
+		bin.minSystemVerRequire = Str(item.minSystemVerRequire);
+		bin.criticalUpdateVerBarrier = Str(item.criticalUpdateVerBarrier);
+		bin.minAutoUpdateVerRequire = Str(item.minAutoUpdateVerRequire);
+		bin.rollOutInterval = item.rollOutInterval;
+		bin.description = LangStrings(item.description);
+		bin.releaseNoteLink = LangStrings(item.releaseNoteLink);
+
+		bin.informationalUpdateVers = { (uint32_t)item.informationalUpdateVers.size(), (uint32_t)out_.size() };
+		for (const auto &ver : item.informationalUpdateVers) {
+			auto ref = Str(ver);
+			Append(&ref, sizeof(ref));
+		}
+		Align();
+
+		bin.enclosures = { (uint32_t)item.enclosures.size(), (uint32_t)out_.size() };
+		for (const auto &enclosure : item.enclosures) {
+			BinEnclosure e = { 0 };
+			e.url = Str(enclosure.url);
+			e.signature = Str(enclosure.signature);
+			e.mime = Str(enclosure.mime);
+			e.installArgs = Str(enclosure.installArgs);
+			e.os = Str(enclosure.os);
+			e.size = enclosure.size;
+			e.signType = (uint32_t)enclosure.signType;
+			Append(&e, sizeof(e));
+		}
+
+		memcpy(&out_[offset], &bin, sizeof(bin));
+		return offset;
+	}
+
+	BinArrayRef LangStrings(const MultiLangString &strings) {
+		BinArrayRef arr = { (uint32_t)strings.size(), (uint32_t)out_.size() };
+		for (const auto &[lang, str] : strings) {
+			BinLangString ls = { 0 };
+			ls.lang = lang;
+			ls.str = Str(str);
+			Append(&ls, sizeof(ls));
+		}
+		Align();
+		return arr;
+	}
+
+	BinStrRef Str(const std::string &s) {
+		if (s.empty()) {
+			return { 0, 0 };
+		}
+
+		// channels, OS names and such repeat a lot, store them once
+		auto it = interned_.find(s);
+		if (it != interned_.end()) {
+			return { it->second, (uint32_t)s.size() };
+		}
+		auto offset = (uint32_t)pool_.size();
+		pool_ += s;
+		interned_.emplace(s, offset);
+		return { offset, (uint32_t)s.size() };
+	}
+
+	uint32_t Reserve(size_t size) {
+		auto offset = (uint32_t)out_.size();
+		out_.resize(out_.size() + size);
+		return offset;
+	}
+
+	void Append(const void *p, size_t size) {
+		out_.append((const char *)p, size);
+	}
+
+	void Align() {
+		out_.resize((out_.size() + 7) & ~(size_t)7);
+	}
+
+private:
+	std::string out_;
+	std::string pool_;
+	std::unordered_map<std::string, uint32_t> interned_;
+};
+
+std::string SerializeAppcastBinary(const Appcast &appcast) {
+	return BinaryAppcastWriter().Write(appcast);
+}
+
+} //namespace SparkleLite
@@ -0,0 +1,184 @@
+#ifndef _APPCAST_BINARY_H_
+#define _APPCAST_BINARY_H_
+
+#include "sparkle_internal.h"
+#include "third_party/mio.hpp"
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace SparkleLite {
+
+//
+// Compact binary appcast encoding
+//
+// All integers are little-endian, every record is 8-byte aligned and every string is a (offset, length)
+// reference into the string pool, so the loader works on the mapped bytes directly.
+//
+//	Header
+//	uint32_t[itemCount]		offsets of item records, sorted by version (newest first)
+//	BinItem[itemCount]		each followed by its BinLangString/BinStrRef/BinEnclosure arrays
+//	char[]					string pool
+//
+#define BINARY_APPCAST_MIME ("application/vnd.sparkle-lite.appcast")
+#define BINARY_APPCAST_MAGIC (0x43415053) // "SPAC"
+#define BINARY_APPCAST_VERSION (1)
+
+#pragma pack(push, 1)
+struct BinStrRef {
+	uint32_t offset;
+	uint32_t length;
+};
+
+struct BinLangString {
+	uint16_t lang;
+	uint16_t reserved;
+	BinStrRef str;
+};
+
+struct BinArrayRef {
+	uint32_t count;
+	uint32_t offset;
+};
+
+struct BinEnclosure {
+	BinStrRef url;
+	BinStrRef signature;
+	BinStrRef mime;
+	BinStrRef installArgs;
+	BinStrRef os;
+	uint64_t size;
+	uint32_t signType;
+	uint32_t reserved;
+};
+
+struct BinItem {
+	BinStrRef channel;
+	BinStrRef version;
+	BinStrRef shortVersion;
+	BinStrRef pubDate;
+	BinStrRef title;
+	BinStrRef link;
+	BinStrRef minSystemVerRequire;
+	BinStrRef criticalUpdateVerBarrier;
+	BinStrRef minAutoUpdateVerRequire;
+	BinArrayRef description; // BinLangString
+	BinArrayRef releaseNoteLink; // BinLangString
+	BinArrayRef informationalUpdateVers; // BinStrRef
+	BinArrayRef enclosures; // BinEnclosure
+	uint64_t rollOutInterval;
+};
+
+struct BinHeader {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t flags;
+	uint32_t totalSize;
+	uint32_t itemCount;
+	uint32_t itemTableOffset;
+	uint32_t stringPoolOffset;
+	uint32_t stringPoolSize;
+	uint32_t reserved;
+};
+#pragma pack(pop)
+
+class BinaryAppcast;
+
+class BinaryAppcastEnclosure {
+public:
+	BinaryAppcastEnclosure(const BinaryAppcast &owner, const BinEnclosure &e) :
+			owner_(owner), e_(e) {}
+
+	std::string_view Url() const;
+	std::string_view Signature() const;
+	std::string_view Mime() const;
+	std::string_view InstallArgs() const;
+	std::string_view OS() const;
+	uint64_t Size() const { return e_.size; }
+	SignatureAlgo SignType() const { return (SignatureAlgo)e_.signType; }
+
+	AppcastEnclosure Materialize() const;
+
+private:
+	const BinaryAppcast &owner_;
+	const BinEnclosure &e_;
+};
+
+class BinaryAppcastItem {
+public:
+	BinaryAppcastItem(const BinaryAppcast &owner, const BinItem &item) :
+			owner_(owner), item_(item) {}
+
+	std::string_view Channel() const;
+	std::string_view Version() const;
+	std::string_view ShortVersion() const;
+	std::string_view PubDate() const;
+	std::string_view Title() const;
+	std::string_view Link() const;
+	std::string_view MinSystemVerRequire() const;
+	std::string_view CriticalUpdateVerBarrier() const;
+	std::string_view MinAutoUpdateVerRequire() const;
+	uint64_t RollOutInterval() const { return item_.rollOutInterval; }
+
+	// localized strings, falls back to the default (lang code 0) one
+	std::string_view Description(uint16_t lang) const;
+	std::string_view ReleaseNoteLink(uint16_t lang) const;
+
+	size_t InformationalUpdateVerCount() const { return item_.informationalUpdateVers.count; }
+	std::string_view InformationalUpdateVer(size_t idx) const;
+
+	size_t EnclosureCount() const { return item_.enclosures.count; }
+	// an empty one past EnclosureCount()
+	BinaryAppcastEnclosure Enclosure(size_t idx) const;
+
+private:
+	std::string_view LangString(const BinArrayRef &arr, uint16_t lang) const;
+
+private:
+	const BinaryAppcast &owner_;
+	const BinItem &item_;
+};
+
+//
+// Read-only view over a binary appcast, either mapped from a file or adopted from a response body
+//
+class BinaryAppcast {
+	friend class BinaryAppcastItem;
+	friend class BinaryAppcastEnclosure;
+
+public:
+	bool Open(const std::string &fileName);
+
+	bool Load(std::string &&buffer);
+
+	size_t ItemCount() const { return header_ ? header_->itemCount : 0; }
+
+	// items are sorted by version, newest first
+	BinaryAppcastItem Item(size_t idx) const;
+
+private:
+	bool Validate(const char *data, size_t size);
+
+	std::string_view String(const BinStrRef &ref) const;
+
+	template <typename T>
+	const T *Array(const BinArrayRef &arr) const {
+		return (const T *)(data_ + arr.offset);
+	}
+
+private:
+	mio::mmap_source mmap_;
+	std::string buffer_;
+	const char *data_ = nullptr;
+	size_t size_ = 0;
+	const BinHeader *header_ = nullptr;
+};
+
+//
+// encode a parsed appcast into the binary format, empty on failure
+//
+std::string SerializeAppcastBinary(const Appcast &appcast);
+
+} //namespace SparkleLite
+
+#endif //_APPCAST_BINARY_H_
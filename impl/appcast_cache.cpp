@@ -0,0 +1,235 @@
+#include "appcast_cache.h"
+#include "third_party/mio.hpp"
+#include <openssl/sha.h>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <random>
+#include <system_error>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace SparkleLite {
+
+namespace fs = std::filesystem;
+
+#define APPCAST_CACHE_MAGIC ("SPARKLE-APPCAST-CACHE 1\n")
+
+// response headers kept with the body
+static const char *cachedHeaders[] = { "Content-Type", "ETag", "Last-Modified" };
+
+//
+// EntryLock
+//
+SharedAppcastCache::EntryLock::EntryLock(const std::string &path) {
+#ifdef _WIN32
+	auto file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return;
+	}
+	handle_ = (intptr_t)file;
+	OVERLAPPED ov = { 0 };
+	locked_ = !!LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &ov);
+#else
+	// flock() needs no write access, every user of the cache can open it (whatever the creator's umask was)
+	auto fd = open(path.c_str(), O_RDONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+	if (fd >= 0) {
+		fchmod(fd, 0666);
+	} else if (errno == EEXIST) {
+		fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	}
+	if (fd < 0) {
+		return;
+	}
+	handle_ = fd;
+	while (flock(fd, LOCK_EX) != 0) {
+		if (errno != EINTR) {
+			return;
+		}
+	}
+	locked_ = true;
+#endif
+}
+
+SharedAppcastCache::EntryLock::~EntryLock() {
+	if (handle_ == -1) {
+		return;
+	}
+#ifdef _WIN32
+	if (locked_) {
+		OVERLAPPED ov = { 0 };
+		UnlockFileEx((HANDLE)handle_, 0, 1, 0, &ov);
+	}
+	CloseHandle((HANDLE)handle_);
+#else
+	if (locked_) {
+		flock((int)handle_, LOCK_UN);
+	}
+	close((int)handle_);
+#endif
+}
+
+//
+// SharedAppcastCache
+//
+bool SharedAppcastCache::Enable(const std::string &dir, long long ttl) {
+	// shared by the processes of every user, any of them replaces entries
+	std::error_code error;
+	if (fs::create_directories(dir, error)) {
+		fs::permissions(dir, fs::perms::all, error);
+	}
+	if (!fs::is_directory(dir, error)) {
+		return false;
+	}
+
+	std::unique_lock<std::mutex> lck(lock_);
+	dir_ = dir;
+	ttl_ = ttl;
+	return true;
+}
+
+void SharedAppcastCache::Disable() {
+	std::unique_lock<std::mutex> lck(lock_);
+	dir_.clear();
+}
+
+bool SharedAppcastCache::IsEnabled() {
+	std::unique_lock<std::mutex> lck(lock_);
+	return !dir_.empty();
+}
+
+long long SharedAppcastCache::TTL() {
+	std::unique_lock<std::mutex> lck(lock_);
+	return ttl_;
+}
+
+std::string SharedAppcastCache::EntryPath(const std::string &url, const char *suffix) {
+	std::unique_lock<std::mutex> lck(lock_);
+	if (dir_.empty()) {
+		return {};
+	}
+
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	SHA256((const unsigned char *)url.data(), url.size(), digest);
+
+	static const char hex[] = "0123456789abcdef";
+	std::string name;
+	name.reserve(SHA256_DIGEST_LENGTH * 2 + 8);
+	for (auto c : digest) {
+		name.push_back(hex[c >> 4]);
+		name.push_back(hex[c & 0x0f]);
+	}
+	name += suffix;
+	return (fs::path(dir_) / name).string();
+}
+
+std::string SharedAppcastCache::LockPath(const std::string &url) {
+	return EntryPath(url, ".lock");
+}
+
+//
+// the file is a small text header and the raw body:
+//
+//	SPARKLE-APPCAST-CACHE 1
+//	fetched: <epoch>
+//	expires: <epoch>
+//	<header>: <value>
+//	...
+//	<empty line>
+//	<body>
+//
+bool SharedAppcastCache::Read(const std::string &url, Entry &entry) {
+	auto path = EntryPath(url, ".feed");
+	if (path.empty()) {
+		return false;
+	}
+
+	std::error_code error;
+	mio::mmap_source mmap = mio::make_mmap_source(path, error);
+	if (error || mmap.size() < strlen(APPCAST_CACHE_MAGIC)) {
+		return false;
+	}
+
+	std::string_view content(mmap.data(), mmap.size());
+	if (content.compare(0, strlen(APPCAST_CACHE_MAGIC), APPCAST_CACHE_MAGIC) != 0) {
+		return false;
+	}
+
+	entry = {};
+	size_t pos = strlen(APPCAST_CACHE_MAGIC);
+	while (true) {
+		auto end = content.find('\n', pos);
+		if (end == std::string_view::npos) {
+			return false;
+		}
+		auto line = content.substr(pos, end - pos);
+		pos = end + 1;
+		if (line.empty()) {
+			break;
+		}
+
+		auto colon = line.find(": ");
+		if (colon == std::string_view::npos) {
+			return false;
+		}
+		std::string key(line.substr(0, colon));
+		std::string value(line.substr(colon + 2));
+		if (key == "fetched") {
+			entry.fetched = std::strtoll(value.c_str(), nullptr, 10);
+		} else if (key == "expires") {
+			entry.expires = std::strtoll(value.c_str(), nullptr, 10);
+		} else {
+			entry.headers.emplace(std::move(key), std::move(value));
+		}
+	}
+	entry.body.assign(content.substr(pos));
+	return true;
+}
+
+bool SharedAppcastCache::Write(const std::string &url, const Entry &entry) {
+	auto path = EntryPath(url, ".feed");
+	if (path.empty()) {
+		return false;
+	}
+
+	std::string head = APPCAST_CACHE_MAGIC;
+	head += "fetched: " + std::to_string(entry.fetched) + "\n";
+	head += "expires: " + std::to_string(entry.expires) + "\n";
+	for (auto key : cachedHeaders) {
+		auto value = simple_http_find_header(entry.headers, key);
+		if (value && value->find('\n') == std::string::npos) {
+			head += std::string(key) + ": " + *value + "\n";
+		}
+	}
+	head += "\n";
+
+	// write aside, then swap it in, readers keep the mapping of the old one
+	std::random_device rd;
+	auto tmpPath = path + "." + std::to_string(rd()) + ".tmp";
+	FILE *fd = nullptr;
+	if (fopen_s(&fd, tmpPath.c_str(), "wb") != 0 || !fd) {
+		return false;
+	}
+	auto ok = fwrite(head.data(), 1, head.size(), fd) == head.size() &&
+			fwrite(entry.body.data(), 1, entry.body.size(), fd) == entry.body.size();
+	ok = fclose(fd) == 0 && ok;
+
+	std::error_code error;
+	if (ok) {
+		fs::rename(tmpPath, path, error);
+		ok = !error;
+	}
+	if (!ok) {
+		fs::remove(tmpPath, error);
+	}
+	return ok;
+}
+
+} //namespace SparkleLite
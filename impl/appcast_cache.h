@@ -0,0 +1,73 @@
+#ifndef _APPCAST_CACHE_H_
+#define _APPCAST_CACHE_H_
+
+#include "simple_http.h"
+#include <mutex>
+#include <string>
+
+namespace SparkleLite {
+
+//
+// A machine-wide cache of raw appcast responses, shared by every process pointing at the same directory:
+//
+//	+ a fresh entry is read straight from the cache file (mapped), no request at all
+//	+ a stale one is revalidated by a single process holding the entry lock, with If-None-Match / If-Modified-Since,
+//	  the others wait on the lock and read what it stored
+//	+ entries are replaced by rename, so readers never see a half written one
+//
+class SharedAppcastCache {
+public:
+	struct Entry {
+		long long fetched = 0; // seconds since the epoch
+		long long expires = 0;
+		HttpHeaders headers; // validators and Content-Type of the response
+		std::string body;
+	};
+
+	// an exclusive lock of one entry, across processes
+	class EntryLock {
+	public:
+		explicit EntryLock(const std::string &path);
+
+		~EntryLock();
+
+		EntryLock(const EntryLock &) = delete;
+		EntryLock &operator=(const EntryLock &) = delete;
+
+		bool IsLocked() const {
+			return locked_;
+		}
+
+	private:
+		intptr_t handle_ = -1;
+		bool locked_ = false;
+	};
+
+	bool Enable(const std::string &dir, long long ttl);
+
+	void Disable();
+
+	bool IsEnabled();
+
+	// the default lifetime of an entry, "Cache-Control: max-age" can only make it longer
+	long long TTL();
+
+	bool Read(const std::string &url, Entry &entry);
+
+	bool Write(const std::string &url, const Entry &entry);
+
+	// the lock path of [url], empty if the cache is off
+	std::string LockPath(const std::string &url);
+
+private:
+	std::string EntryPath(const std::string &url, const char *suffix);
+
+private:
+	std::mutex lock_;
+	std::string dir_;
+	long long ttl_ = 0;
+};
+
+} //namespace SparkleLite
+
+#endif //_APPCAST_CACHE_H_
@@ -0,0 +1,254 @@
+#include "appcast_index.h"
+#include "simple_http.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+namespace SparkleLite {
+
+// rollout groups of <sparkle:phasedRolloutInterval>, as Sparkle does
+#define PHASED_ROLLOUT_GROUPS (7)
+
+static std::string LowerCase(const std::string &value) {
+	std::string lower(value);
+	for (auto &c : lower) {
+		c = (char)std::tolower((unsigned char)c);
+	}
+	return lower;
+}
+
+// same ordering as _stricmp()
+static int CompareNoCase(std::string_view x, std::string_view y) {
+	auto ret = strncasecmp(x.data(), y.data(), std::min(x.size(), y.size()));
+	if (ret != 0 || x.size() == y.size()) {
+		return ret;
+	}
+	return x.size() < y.size() ? -1 : 1;
+}
+
+AppcastIndex::Id AppcastIndex::InternTable::Intern(const std::string &value, bool ignoreCase) {
+	auto [it, inserted] = ids.emplace(ignoreCase ? LowerCase(value) : value, (Id)values.size());
+	if (inserted) {
+		values.push_back(value);
+	}
+	return it->second;
+}
+
+AppcastIndex::Id AppcastIndex::InternTable::Find(const std::string &value, bool ignoreCase) const {
+	auto it = ids.find(ignoreCase ? LowerCase(value) : value);
+	return it == ids.end() ? kNoId : it->second;
+}
+
+AppcastIndex::AppcastIndex(Appcast &&appcast) :
+		appcast_(std::move(appcast)) {
+	auto &items = appcast_.items;
+	std::stable_sort(items.begin(), items.end(), [&](const AppcastItem &a, const AppcastItem &b) -> bool {
+		return SafeVersionCompare(a.versionKey, a.version, b.versionKey, b.version) > 0;
+	});
+
+	// languages present anywhere in the feed
+	for (auto &item : items) {
+		for (auto *strings : { &item.description, &item.releaseNoteLink }) {
+			for (auto &[code, str] : *strings) {
+				if (code && langSlots_.emplace(code, langSlotCount_).second) {
+					++langSlotCount_;
+				}
+			}
+		}
+	}
+
+	channels_.Intern("", true);
+	enclosureBegin_.reserve(items.size() + 1);
+	itemMinSystemVer_.reserve(items.size());
+	itemPubDate_.reserve(items.size());
+	descriptions_.resize(items.size() * langSlotCount_, nullptr);
+	releaseNoteLinks_.resize(items.size() * langSlotCount_, nullptr);
+
+	for (uint32_t idx = 0; idx < items.size(); idx++) {
+		auto &item = items[idx];
+
+		auto channel = channels_.Intern(item.channel, true);
+		if (channel >= channelItems_.size()) {
+			channelItems_.resize(channel + 1);
+		}
+		channelItems_[channel].push_back(idx);
+
+		enclosureBegin_.push_back((uint32_t)enclosureOs_.size());
+		for (auto &enclosure : item.enclosures) {
+			enclosureOs_.push_back(osNames_.Intern(enclosure.os, true));
+		}
+
+		itemMinSystemVer_.push_back(item.minSystemVerRequire.empty() ? kNoId : minSystemVers_.Intern(item.minSystemVerRequire, false));
+		itemPubDate_.push_back(item.rollOutInterval ? simple_http_parse_date(item.pubDate) : -1);
+
+		// same rules as before: the exact language, otherwise the default one
+		auto resolve = [&](const MultiLangString &strings, std::vector<const std::string *> &table) {
+			auto row = &table[idx * langSlotCount_];
+			auto fallback = strings.find(0);
+			row[1] = fallback == strings.end() ? nullptr : &fallback->second;
+			for (auto &[code, slot] : langSlots_) {
+				auto it = strings.find(code);
+				row[slot] = it == strings.end() ? row[1] : &it->second;
+			}
+		};
+		resolve(item.description, descriptions_);
+		resolve(item.releaseNoteLink, releaseNoteLinks_);
+	}
+	enclosureBegin_.push_back((uint32_t)enclosureOs_.size());
+	if (channelItems_.empty()) {
+		channelItems_.resize(1);
+	}
+}
+
+std::vector<AppcastIndex::Id> AppcastIndex::ChannelIds(const std::vector<std::string> &channels) const {
+	std::vector<Id> ids;
+	ids.reserve(channels.size());
+	for (auto &channel : channels) {
+		auto id = channels_.Find(channel, true);
+		if (id != kNoId && id != 0 && std::find(ids.begin(), ids.end(), id) == ids.end()) {
+			ids.push_back(id);
+		}
+	}
+	return ids;
+}
+
+size_t AppcastIndex::LangSlot(const std::string &lang) const {
+	auto code = LangCode(lang);
+	if (!code) {
+		return 0;
+	}
+	auto it = langSlots_.find(code);
+	return it == langSlots_.end() ? 1 : it->second;
+}
+
+const std::string *AppcastIndex::Description(uint32_t item, const std::string &lang) const {
+	auto slot = LangSlot(lang);
+	return slot ? descriptions_[item * langSlotCount_ + slot] : nullptr;
+}
+
+const std::string *AppcastIndex::ReleaseNoteLink(uint32_t item, const std::string &lang) const {
+	auto slot = LangSlot(lang);
+	return slot ? releaseNoteLinks_[item * langSlotCount_ + slot] : nullptr;
+}
+
+bool AppcastIndex::IsRolledOut(uint32_t item, int group, long long now) const {
+	// group N gets it N intervals after the publish date
+	auto pubDate = itemPubDate_[item];
+	if (group < 0 || pubDate < 0) {
+		return true;
+	}
+	group = std::min(group, PHASED_ROLLOUT_GROUPS - 1);
+	return now >= pubDate + (long long)(group * appcast_.items[item].rollOutInterval);
+}
+
+uint32_t AppcastIndex::ItemFlags(uint32_t idx, std::string_view appVer) const {
+	auto &item = appcast_.items[idx];
+	uint32_t flags = 0;
+	for (auto &ver : item.informationalUpdateVers) {
+		if (CompareNoCase(ver, appVer) == 0) {
+			flags |= kInformationalUpdate;
+		}
+	}
+
+	if (!item.criticalUpdateVerBarrier.empty() &&
+			CompareNoCase(item.criticalUpdateVerBarrier, appVer) > 0) {
+		flags |= kCriticalUpdate;
+	}
+
+	if (!item.minAutoUpdateVerRequire.empty() &&
+			CompareNoCase(item.minAutoUpdateVerRequire, appVer) <= 0) {
+		flags |= kAutoUpdateSupported;
+	}
+	return flags;
+}
+
+bool AppcastIndex::Select(const Query &query, Match &match) const {
+	auto &items = appcast_.items;
+
+	// items at and after [newerEnd] are not newer than the app
+	auto appVersionKey = MakeVersionKey(query.appVersion);
+	auto newerEnd = (uint32_t)(std::partition_point(items.begin(), items.end(), [&](const AppcastItem &item) -> bool {
+		return SafeVersionCompare(item.versionKey, item.version, appVersionKey, query.appVersion) > 0;
+	}) - items.begin());
+	if (!newerEnd) {
+		return false;
+	}
+
+	// the default channel, plus the requested ones
+	struct Cursor {
+		const std::vector<uint32_t> *items;
+		size_t pos;
+	};
+	std::vector<Cursor> cursors;
+	cursors.reserve(query.channelCount + 1);
+	cursors.push_back({ &channelItems_[0], 0 });
+	for (size_t idx = 0; idx < query.channelCount; idx++) {
+		cursors.push_back({ &channelItems_[query.channels[idx]], 0 });
+	}
+
+	// the OS predicates are evaluated once per distinct value, on demand
+	std::vector<int8_t> osFit(osNames_.values.size(), -2);
+	std::vector<int8_t> sysVerAccepted(minSystemVers_.values.size(), -1);
+	static const EnclosureFormats noFormats;
+	auto &formats = query.formats ? *query.formats : noFormats;
+
+	while (true) {
+		// merge the channel lists, they are all ordered newest first
+		Cursor *next = nullptr;
+		for (auto &cursor : cursors) {
+			if (cursor.pos < cursor.items->size() && (*cursor.items)[cursor.pos] < newerEnd &&
+					(!next || (*cursor.items)[cursor.pos] < (*next->items)[next->pos])) {
+				next = &cursor;
+			}
+		}
+		if (!next) {
+			return false;
+		}
+		auto idx = (*next->items)[next->pos++];
+
+		// match enclosure, the cheapest of the matched ones
+		int enclosureIndex = -1;
+		EnclosureCost cheapest;
+		for (auto e = enclosureBegin_[idx]; e < enclosureBegin_[idx + 1]; e++) {
+			auto &fit = osFit[enclosureOs_[e]];
+			if (fit == -2) {
+				fit = (int8_t)get_os_fit(*query.os, osNames_.values[enclosureOs_[e]]);
+			}
+			if (fit < 0) {
+				continue;
+			}
+			auto &enclosure = items[idx].enclosures[e - enclosureBegin_[idx]];
+			EnclosureCost cost{ fit, enclosure_format_rank(formats, enclosure.mime, enclosure.url), enclosure.size };
+			if (enclosureIndex == -1 || cost.IsCheaperThan(cheapest)) {
+				enclosureIndex = (int)(e - enclosureBegin_[idx]);
+				cheapest = cost;
+			}
+		}
+		if (enclosureIndex == -1) {
+			continue;
+		}
+
+		// match system version
+		auto sysVer = itemMinSystemVer_[idx];
+		if (sysVer != kNoId) {
+			auto &accepted = sysVerAccepted[sysVer];
+			if (accepted < 0) {
+				accepted = is_acceptable_os_version(*query.os, minSystemVers_.values[sysVer]) ? 1 : 0;
+			}
+			if (!accepted) {
+				continue;
+			}
+		}
+
+		// phased rollout
+		if (!IsRolledOut(idx, query.rolloutGroup, query.now)) {
+			continue;
+		}
+
+		match.item = idx;
+		match.enclosure = (uint32_t)enclosureIndex;
+		return true;
+	}
+}
+
+} //namespace SparkleLite
@@ -0,0 +1,113 @@
+#ifndef _APPCAST_INDEX_H_
+#define _APPCAST_INDEX_H_
+
+#include "enclosure_cost.h"
+#include "os_support.h"
+#include "sparkle_internal.h"
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace SparkleLite {
+
+//
+// A parsed appcast prepared for many (channels, lang, os) queries:
+//
+//	+ items are sorted by version once
+//	+ channel / OS names / minimum system versions are interned into ids
+//	+ every channel has its own version ordered item list
+//	+ localized strings are resolved per language up front
+//
+// Nothing modifies the index after construction, so one index can be shared by any number of threads.
+//
+class AppcastIndex {
+public:
+	using Id = uint32_t;
+
+	static constexpr Id kNoId = (Id)-1;
+
+	enum Flags : uint32_t {
+		kInformationalUpdate = 1,
+		kCriticalUpdate = 2,
+		kAutoUpdateSupported = 4,
+	};
+
+	struct Query {
+		const OSFacts *os = nullptr;
+		const Id *channels = nullptr; // from ChannelIds(), the default channel is always accepted
+		size_t channelCount = 0;
+		std::string_view appVersion;
+		int rolloutGroup = -1; // phased rollout group (0 ~ 6), -1 to ignore <sparkle:phasedRolloutInterval>
+		long long now = 0; // seconds since the epoch, for phased rollouts
+		const EnclosureFormats *formats = nullptr; // optional, the host's preferred formats
+	};
+
+	struct Match {
+		uint32_t item = 0; // index into Feed().items
+		uint32_t enclosure = 0;
+	};
+
+	explicit AppcastIndex(Appcast &&appcast);
+
+	// sorted by version, newest first
+	const Appcast &Feed() const {
+		return appcast_;
+	}
+
+	// channel names to ids, the ones not used by this feed are dropped
+	std::vector<Id> ChannelIds(const std::vector<std::string> &channels) const;
+
+	//
+	// the newest item above the app version, for the OS and channels of [query],
+	// and the cheapest of its enclosures (see EnclosureCost)
+	//
+	bool Select(const Query &query, Match &match) const;
+
+	// Flags of the selected [item] for the app running [appVer]
+	uint32_t ItemFlags(uint32_t item, std::string_view appVer) const;
+
+	// localized strings of [item], falling back to the default ones, nullptr if there is none
+	const std::string *Description(uint32_t item, const std::string &lang) const;
+
+	const std::string *ReleaseNoteLink(uint32_t item, const std::string &lang) const;
+
+private:
+	// ids of the interned strings, [values] keeps the first spelling seen
+	struct InternTable {
+		std::unordered_map<std::string, Id> ids;
+		std::vector<std::string> values;
+
+		Id Intern(const std::string &value, bool ignoreCase);
+		Id Find(const std::string &value, bool ignoreCase) const;
+	};
+
+	// 0: no usable language, 1: a language not in the feed (default strings), 2..: the ones in the feed
+	size_t LangSlot(const std::string &lang) const;
+
+	bool IsRolledOut(uint32_t item, int group, long long now) const;
+
+private:
+	Appcast appcast_;
+
+	InternTable channels_; // id 0 is the default channel ("")
+	std::vector<std::vector<uint32_t>> channelItems_; // per channel id, item indices (newest first)
+
+	InternTable osNames_;
+	std::vector<uint32_t> enclosureBegin_; // per item, into [enclosureOs_], one extra at the end
+	std::vector<Id> enclosureOs_;
+
+	InternTable minSystemVers_;
+	std::vector<Id> itemMinSystemVer_; // kNoId if not restricted
+
+	std::vector<long long> itemPubDate_; // -1 if unknown, phased rollout doesn't apply then
+
+	std::unordered_map<uint16_t, size_t> langSlots_;
+	std::vector<const std::string *> descriptions_; // [item * langSlotCount + slot]
+	std::vector<const std::string *> releaseNoteLinks_;
+	size_t langSlotCount_ = 2;
+};
+
+} //namespace SparkleLite
+
+#endif //_APPCAST_INDEX_H_
@@ -1,9 +1,18 @@
 #include "appcast_parser.h"
 #include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
 #include <pugixml.hpp>
+#include <system_error>
+#include <thread>
 #include <tuple>
 
 namespace SparkleLite {
+
+// items handed to a thread at a time
+#define PARSE_CHUNK_SIZE (256)
+
 pugi::xml_attribute findAttributeByName(pugi::xml_node &node, const std::string &name) {
 	return node.find_attribute([&](const pugi::xml_attribute &attr) -> bool {
 		return _stricmp(attr.name(), name.c_str()) == 0;
@@ -134,12 +143,15 @@ bool resolveAppcastItem(pugi::xml_node &itemNode, AppcastItem &item) {
 		return false;
 	}
 
+	// the sort key, while the version is at hand
+	result.versionKey = MakeVersionKey(result.version);
+
 	// done
 	item = std::move(result);
 	return true;
 }
 
-Appcast ParseAppcastXML(std::string &xml) {
+Appcast ParseAppcastXML(std::string &xml, unsigned threads) {
 	pugi::xml_document doc;
 	auto result = doc.load_buffer_inplace(&xml[0], xml.size());
 	if (!result) {
@@ -147,14 +159,12 @@ Appcast ParseAppcastXML(std::string &xml) {
 	}
 
 	Appcast appcast;
+	std::vector<pugi::xml_node> itemNodes;
 	auto channel = doc.child("rss").child("channel");
 	for (auto &node : channel.children()) {
 		if (_stricmp(node.name(), "item") == 0) {
-			// we have an item
-			AppcastItem item;
-			if (resolveAppcastItem(node, item)) {
-				appcast.items.emplace_back(std::move(item));
-			}
+			// we have an item, resolved below
+			itemNodes.push_back(node);
 		} else if (_stricmp(node.name(), "title") == 0) {
 			appcast.title = node.child_value();
 		} else if (_stricmp(node.name(), "description") == 0) {
@@ -166,6 +176,65 @@ Appcast ParseAppcastXML(std::string &xml) {
 		}
 	}
 
+	// one slot per item node, the document is only read from here on
+	std::vector<AppcastItem> slots(itemNodes.size());
+	std::vector<char> resolved(itemNodes.size(), 0);
+	auto chunks = (itemNodes.size() + PARSE_CHUNK_SIZE - 1) / PARSE_CHUNK_SIZE;
+	if (!threads) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	threads = (unsigned)std::min<size_t>(threads, std::max<size_t>(chunks, 1));
+
+	// what a worker throws (e.g. std::bad_alloc) stops the others and is thrown again here, as without threads
+	std::atomic<size_t> nextChunk{ 0 };
+	std::mutex errorLock;
+	std::exception_ptr error;
+	auto worker = [&]() {
+		try {
+			while (true) {
+				auto chunk = nextChunk.fetch_add(1);
+				if (chunk >= chunks) {
+					break;
+				}
+				auto end = std::min((chunk + 1) * PARSE_CHUNK_SIZE, itemNodes.size());
+				for (auto idx = chunk * PARSE_CHUNK_SIZE; idx < end; idx++) {
+					resolved[idx] = resolveAppcastItem(itemNodes[idx], slots[idx]) ? 1 : 0;
+				}
+			}
+		} catch (...) {
+			nextChunk = chunks;
+			std::unique_lock<std::mutex> lck(errorLock);
+			if (!error) {
+				error = std::current_exception();
+			}
+		}
+	};
+
+	// fewer threads if some can't be created, the caller's own one is enough
+	std::vector<std::thread> pool;
+	pool.reserve(threads - 1);
+	for (unsigned idx = 1; idx < threads; idx++) {
+		try {
+			pool.emplace_back(worker);
+		} catch (const std::system_error &) {
+			break;
+		}
+	}
+	worker();
+	for (auto &thread : pool) {
+		thread.join();
+	}
+	if (error) {
+		std::rethrow_exception(error);
+	}
+
+	// in document order, without the invalid ones
+	appcast.items.reserve(std::count(resolved.begin(), resolved.end(), 1));
+	for (size_t idx = 0; idx < slots.size(); idx++) {
+		if (resolved[idx]) {
+			appcast.items.emplace_back(std::move(slots[idx]));
+		}
+	}
 	return appcast;
 }
 }; //namespace SparkleLite
\ No newline at end of file
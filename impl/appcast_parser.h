@@ -8,7 +8,12 @@
 #include <vector>
 
 namespace SparkleLite {
-Appcast ParseAppcastXML(std::string &xml);
+//
+// Parse an appcast in place. Its items are resolved by [threads] threads (0 for one per core), each takes the next
+// run of items into their own slots, so the result (order, items dropped as invalid) is the same for any thread count.
+// Only worth it for feeds of thousands of items, small ones are resolved on the calling thread anyway
+//
+Appcast ParseAppcastXML(std::string &xml, unsigned threads = 1);
 };
 
 #endif //_APPCAST_RESOLVER_H_
\ No newline at end of file
@@ -0,0 +1,552 @@
+#include "archive_extractor.h"
+#include "sparkle_internal.h"
+#include "stream_codec.h"
+#include <zlib.h>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+
+namespace SparkleLite {
+
+namespace fs = std::filesystem;
+
+#define TAR_BLOCK_SIZE (512)
+#define ZIP_LOCAL_HEADER_SIG (0x04034b50)
+#define ZIP_CENTRAL_HEADER_SIG (0x02014b50)
+#define ZIP_END_OF_CENTRAL_SIG (0x06054b50)
+#define ZIP_DATA_DESCRIPTOR_SIG (0x08074b50)
+#define EXTRACT_BUFFER_SIZE (256 * 1024)
+
+//
+// ChunkReader
+//
+std::string_view ChunkReader::Peek() {
+	while (pos_ >= chunk_.size()) {
+		pos_ = 0;
+		chunk_.clear();
+		if (!queue_.Pop(chunk_)) {
+			return {};
+		}
+	}
+	return std::string_view(chunk_.data() + pos_, chunk_.size() - pos_);
+}
+
+void ChunkReader::Consume(size_t size) {
+	pos_ += size;
+}
+
+bool ChunkReader::ReadExact(void *buf, size_t size) {
+	auto p = (char *)buf;
+	while (size) {
+		auto view = Peek();
+		if (view.empty()) {
+			return false;
+		}
+		auto n = std::min(size, view.size());
+		memcpy(p, view.data(), n);
+		Consume(n);
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+bool ChunkReader::Skip(uint64_t size) {
+	while (size) {
+		auto view = Peek();
+		if (view.empty()) {
+			return false;
+		}
+		auto n = (size_t)std::min<uint64_t>(size, view.size());
+		Consume(n);
+		size -= n;
+	}
+	return true;
+}
+
+//
+// helpers
+//
+static uint64_t tar_number(const char *field, size_t len) {
+	// GNU base-256 encoding for large values
+	if ((unsigned char)field[0] & 0x80) {
+		uint64_t v = (unsigned char)field[0] & 0x7f;
+		for (size_t idx = 1; idx < len; idx++) {
+			v = (v << 8) | (unsigned char)field[idx];
+		}
+		return v;
+	}
+
+	uint64_t v = 0;
+	for (size_t idx = 0; idx < len && field[idx]; idx++) {
+		if (field[idx] >= '0' && field[idx] <= '7') {
+			v = (v << 3) | (uint64_t)(field[idx] - '0');
+		}
+	}
+	return v;
+}
+
+static bool tar_checksum_ok(const char *block) {
+	auto expected = tar_number(block + 148, 8);
+	uint64_t sum = 0;
+	for (int idx = 0; idx < TAR_BLOCK_SIZE; idx++) {
+		// the checksum field itself counts as spaces
+		sum += (idx >= 148 && idx < 156) ? ' ' : (unsigned char)block[idx];
+	}
+	return sum == expected;
+}
+
+static std::string tar_string(const char *field, size_t len) {
+	return std::string(field, strnlen(field, len));
+}
+
+static uint16_t le16(const unsigned char *p) {
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t le32(const unsigned char *p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void drain(ChunkReader &reader) {
+	while (true) {
+		auto view = reader.Peek();
+		if (view.empty()) {
+			break;
+		}
+		reader.Consume(view.size());
+	}
+}
+
+//
+// ArchiveExtractor
+//
+ArchiveExtractor::ArchiveExtractor(const std::string &stagingDir) :
+		stagingDir_(stagingDir) {
+}
+
+ArchiveExtractor::~ArchiveExtractor() {
+	Abort();
+}
+
+bool ArchiveExtractor::Start() {
+	std::error_code ec;
+	fs::create_directories(stagingDir_, ec);
+	if (ec) {
+		return false;
+	}
+	decompressor_ = std::thread(&ArchiveExtractor::DecompressStage, this);
+	extractor_ = std::thread(&ArchiveExtractor::ExtractStage, this);
+	return true;
+}
+
+bool ArchiveExtractor::Feed(const void *data, size_t size) {
+	// the transfer buffer is reused by curl, so this is the only copy in the pipeline
+	return compressed_.Push(std::string((const char *)data, size));
+}
+
+bool ArchiveExtractor::Finish() {
+	compressed_.Close();
+	if (decompressor_.joinable()) {
+		decompressor_.join();
+	}
+	if (extractor_.joinable()) {
+		extractor_.join();
+	}
+	return decompressOk_ && extractOk_;
+}
+
+void ArchiveExtractor::Abort() {
+	Fail();
+	Finish();
+}
+
+void ArchiveExtractor::Fail() {
+	compressed_.Abort();
+	decompressed_.Abort();
+}
+
+void ArchiveExtractor::DecompressStage() {
+	ChunkReader reader(compressed_);
+	auto head = reader.Peek();
+	auto decoder = StreamDecoder::Create(sniff_stream_codec(head.data(), head.size()));
+	if (!decoder) {
+		// compressed with something we are not built with
+		Fail();
+		return;
+	}
+
+	DecodedDataSink sink = [this](const void *data, size_t size) -> bool {
+		return decompressed_.Push(std::string((const char *)data, size));
+	};
+	while (true) {
+		auto view = reader.Peek();
+		if (view.empty()) {
+			break;
+		}
+		if (!decoder->Decode(view.data(), view.size(), sink)) {
+			Fail();
+			return;
+		}
+		reader.Consume(view.size());
+	}
+
+	if (compressed_.IsAborted() || !decoder->Finish(sink)) {
+		Fail();
+		return;
+	}
+	decompressOk_ = true;
+	decompressed_.Close();
+}
+
+void ArchiveExtractor::ExtractStage() {
+	ChunkReader reader(decompressed_);
+	auto head = reader.Peek();
+	bool ok = false;
+	if (head.size() >= 4 && le32((const unsigned char *)head.data()) == ZIP_LOCAL_HEADER_SIG) {
+		ok = ExtractZip(reader);
+	} else {
+		ok = ExtractTar(reader);
+	}
+
+	if (!ok) {
+		Fail();
+		return;
+	}
+	extractOk_ = true;
+}
+
+bool ArchiveExtractor::ExtractTar(ChunkReader &reader) {
+	char block[TAR_BLOCK_SIZE];
+	std::string longName;
+	while (true) {
+		if (!reader.ReadExact(block, sizeof(block))) {
+			return false;
+		}
+
+		// two zero blocks mark the end, one is enough for us
+		if (std::all_of(block, block + sizeof(block), [](char c) { return c == 0; })) {
+			drain(reader);
+			return true;
+		}
+		if (!tar_checksum_ok(block)) {
+			return false;
+		}
+
+		auto size = tar_number(block + 124, 12);
+		auto padding = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+		auto type = block[156];
+		auto mode = (unsigned)tar_number(block + 100, 8);
+
+		std::string name;
+		if (!longName.empty()) {
+			name = std::move(longName);
+			longName.clear();
+		} else {
+			name = tar_string(block, 100);
+			if (memcmp(block + 257, "ustar", 5) == 0 && block[345]) {
+				name = tar_string(block + 345, 155) + "/" + name;
+			}
+		}
+
+		bool ok = true;
+		switch (type) {
+			case 'L': {
+				// GNU long name of the next entry
+				if (size > 64 * 1024) {
+					return false;
+				}
+				longName.resize((size_t)size);
+				ok = reader.ReadExact(&longName[0], longName.size());
+				longName.resize(strnlen(longName.c_str(), longName.size()));
+				break;
+			}
+			case 'x': {
+				// pax extended header, we only care about "path"
+				if (size > 64 * 1024) {
+					return false;
+				}
+				std::string pax;
+				pax.resize((size_t)size);
+				ok = reader.ReadExact(&pax[0], pax.size());
+
+				// records are "<len> <key>=<value>\n"
+				size_t off = 0;
+				while (ok && off < pax.size()) {
+					auto len = strtoul(pax.c_str() + off, nullptr, 10);
+					auto space = pax.find(' ', off);
+					if (!len || space == std::string::npos || off + len > pax.size()) {
+						break;
+					}
+					auto record = pax.substr(space + 1, off + len - space - 2);
+					if (record.compare(0, 5, "path=") == 0) {
+						longName = record.substr(5);
+					}
+					off += len;
+				}
+				break;
+			}
+			case '5':
+				ok = MakeDirectory(name) && reader.Skip(size);
+				break;
+			case '0':
+			case '7':
+			case '\0':
+				ok = WriteEntry(name, reader, size, mode);
+				break;
+			default:
+				// links, devices and global headers are not extracted
+				ok = reader.Skip(size);
+				break;
+		}
+		if (!ok || !reader.Skip(padding)) {
+			return false;
+		}
+	}
+}
+
+bool ArchiveExtractor::ExtractZip(ChunkReader &reader) {
+	while (true) {
+		unsigned char sig[4];
+		if (!reader.ReadExact(sig, sizeof(sig))) {
+			return false;
+		}
+		if (le32(sig) == ZIP_CENTRAL_HEADER_SIG || le32(sig) == ZIP_END_OF_CENTRAL_SIG) {
+			// every entry is already out, the central directory adds nothing for us
+			drain(reader);
+			return true;
+		}
+		if (le32(sig) != ZIP_LOCAL_HEADER_SIG) {
+			return false;
+		}
+
+		unsigned char header[26];
+		if (!reader.ReadExact(header, sizeof(header))) {
+			return false;
+		}
+		auto flags = le16(header + 2);
+		auto method = le16(header + 4);
+		auto compressedSize = le32(header + 14);
+		auto nameLen = le16(header + 22);
+		auto extraLen = le16(header + 24);
+
+		std::string name;
+		name.resize(nameLen);
+		if (!reader.ReadExact(&name[0], name.size()) || !reader.Skip(extraLen)) {
+			return false;
+		}
+
+		if (flags & 0x01) {
+			// encrypted
+			return false;
+		}
+
+		bool ok = false;
+		bool hasDescriptor = (flags & 0x08) != 0;
+		if (!name.empty() && name.back() == '/') {
+			ok = MakeDirectory(name) && reader.Skip(compressedSize);
+		} else if (method == 0 && !hasDescriptor) {
+			// stored
+			ok = WriteEntry(name, reader, compressedSize, 0);
+		} else if (method == 0) {
+			// stored, streamed by a writer that didn't know the size (the descriptor is read with it)
+			ok = WriteDescribedEntry(name, reader);
+			hasDescriptor = false;
+		} else if (method == 8) {
+			// deflate ends by itself, so it's fine even when sizes come after the data
+			ok = InflateEntry(name, reader);
+		}
+		if (!ok) {
+			return false;
+		}
+
+		if (hasDescriptor) {
+			// data descriptor, with an optional signature
+			unsigned char desc[12];
+			if (!reader.ReadExact(desc, 4)) {
+				return false;
+			}
+			auto rest = le32(desc) == ZIP_DATA_DESCRIPTOR_SIG ? 12 : 8;
+			if (!reader.ReadExact(desc, rest)) {
+				return false;
+			}
+		}
+	}
+}
+
+bool ArchiveExtractor::MakeDirectory(const std::string &name) {
+	std::string path;
+	if (!ResolvePath(name, path)) {
+		return false;
+	}
+	std::error_code ec;
+	fs::create_directories(path, ec);
+	return !ec;
+}
+
+bool ArchiveExtractor::WriteEntry(const std::string &name, ChunkReader &reader, uint64_t size, unsigned mode) {
+	std::string path;
+	if (!ResolvePath(name, path)) {
+		return false;
+	}
+	std::error_code ec;
+	fs::create_directories(fs::path(path).parent_path(), ec);
+
+	FILE *fd = nullptr;
+	if (fopen_s(&fd, path.c_str(), "wb") != 0) {
+		return false;
+	}
+
+	bool ok = true;
+	while (ok && size) {
+		auto view = reader.Peek();
+		if (view.empty()) {
+			ok = false;
+			break;
+		}
+		auto n = (size_t)std::min<uint64_t>(size, view.size());
+		ok = fwrite(view.data(), 1, n, fd) == n;
+		reader.Consume(n);
+		size -= n;
+	}
+	fclose(fd);
+
+#ifndef _WIN32
+	// keep the executable bits of installers & scripts
+	if (ok && (mode & 0111)) {
+		fs::permissions(path, (fs::perms)(mode & 0777), ec);
+	}
+#endif
+	return ok;
+}
+
+bool ArchiveExtractor::WriteDescribedEntry(const std::string &name, ChunkReader &reader) {
+	std::string path;
+	if (!ResolvePath(name, path)) {
+		return false;
+	}
+	std::error_code ec;
+	fs::create_directories(fs::path(path).parent_path(), ec);
+
+	FILE *fd = nullptr;
+	if (fopen_s(&fd, path.c_str(), "wb") != 0) {
+		return false;
+	}
+
+	// [signature][crc32][compressed size][size], the signature alone may well be in the data,
+	// only a descriptor whose CRC and sizes match all the bytes before it ends the entry
+	const size_t descSize = 16;
+	auto crc = crc32(0, Z_NULL, 0);
+	uint64_t written = 0;
+	std::string work; // the tail of what was already consumed (it may start a descriptor), then the current chunk
+	bool ok = false;
+	while (true) {
+		auto view = reader.Peek();
+		if (view.empty()) {
+			break;
+		}
+		auto kept = work.size();
+		work.append(view.data(), view.size());
+
+		size_t end = std::string::npos;
+		for (size_t pos = 0; pos + descSize <= work.size(); pos++) {
+			auto p = (const unsigned char *)work.data() + pos;
+			if (le32(p) != ZIP_DATA_DESCRIPTOR_SIG || le32(p + 8) != le32(p + 12) || written + pos != le32(p + 8)) {
+				continue;
+			}
+			if (crc32(crc, (const Bytef *)work.data(), (uInt)pos) == le32(p + 4)) {
+				end = pos;
+				break;
+			}
+		}
+
+		// write what can't be a part of a descriptor, keep the rest for the next chunk
+		auto flush = end != std::string::npos ? end : work.size() - std::min(work.size(), descSize - 1);
+		if (flush && fwrite(work.data(), 1, flush, fd) != flush) {
+			break;
+		}
+		crc = crc32(crc, (const Bytef *)work.data(), (uInt)flush);
+		written += flush;
+		if (end != std::string::npos) {
+			reader.Consume(end + descSize - kept);
+			ok = true;
+			break;
+		}
+		reader.Consume(view.size());
+		work.erase(0, flush);
+	}
+	fclose(fd);
+	return ok;
+}
+
+bool ArchiveExtractor::InflateEntry(const std::string &name, ChunkReader &reader) {
+	std::string path;
+	if (!ResolvePath(name, path)) {
+		return false;
+	}
+	std::error_code ec;
+	fs::create_directories(fs::path(path).parent_path(), ec);
+
+	FILE *fd = nullptr;
+	if (fopen_s(&fd, path.c_str(), "wb") != 0) {
+		return false;
+	}
+
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	if (inflateInit2(&zs, -15) != Z_OK) {
+		fclose(fd);
+		return false;
+	}
+
+	std::string out;
+	out.resize(EXTRACT_BUFFER_SIZE);
+	bool ok = false;
+	while (true) {
+		auto view = reader.Peek();
+		if (view.empty()) {
+			break;
+		}
+
+		// only consume what inflate takes, the next entry may follow in the same chunk
+		zs.next_in = (Bytef *)view.data();
+		zs.avail_in = (uInt)view.size();
+		zs.next_out = (Bytef *)&out[0];
+		zs.avail_out = (uInt)out.size();
+		auto ret = inflate(&zs, Z_NO_FLUSH);
+		reader.Consume(view.size() - zs.avail_in);
+		if (ret != Z_OK && ret != Z_STREAM_END) {
+			break;
+		}
+
+		auto have = out.size() - zs.avail_out;
+		if (have && fwrite(out.data(), 1, have, fd) != have) {
+			break;
+		}
+		if (ret == Z_STREAM_END) {
+			ok = true;
+			break;
+		}
+	}
+	inflateEnd(&zs);
+	fclose(fd);
+	return ok;
+}
+
+bool ArchiveExtractor::ResolvePath(const std::string &name, std::string &path) {
+	// never write outside of the staging directory
+	auto rel = fs::path(name).lexically_normal();
+	if (name.empty() || rel.empty() || rel.has_root_path() || rel.is_absolute()) {
+		return false;
+	}
+	for (const auto &part : rel) {
+		if (part == "..") {
+			return false;
+		}
+	}
+	path = (fs::path(stagingDir_) / rel).string();
+	return true;
+}
+
+} //namespace SparkleLite
@@ -0,0 +1,92 @@
+#ifndef _ARCHIVE_EXTRACTOR_H_
+#define _ARCHIVE_EXTRACTOR_H_
+
+#include "chunk_queue.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace SparkleLite {
+
+//
+// Pull-style reader over a ChunkQueue, used by the stage that consumes it
+//
+class ChunkReader {
+public:
+	explicit ChunkReader(ChunkQueue &queue) :
+			queue_(queue) {}
+
+	// data available right now, empty at the end of stream
+	std::string_view Peek();
+
+	void Consume(size_t size);
+
+	// read exactly [size] bytes, false on a premature end of stream
+	bool ReadExact(void *buf, size_t size);
+
+	bool Skip(uint64_t size);
+
+private:
+	ChunkQueue &queue_;
+	std::string chunk_;
+	size_t pos_ = 0;
+};
+
+//
+// Extract a .tar / .tar.gz / .tar.zst / .zip stream while it is still downloading:
+//
+//	Feed() (download thread) -> decompress thread -> extract thread -> files in [stagingDir]
+//
+// The caller owns the staging directory, it's only published once the package signature is verified.
+//
+class ArchiveExtractor {
+public:
+	explicit ArchiveExtractor(const std::string &stagingDir);
+
+	~ArchiveExtractor();
+
+	bool Start();
+
+	bool Feed(const void *data, size_t size);
+
+	// end of input, wait for the pipeline to drain, true if everything got extracted
+	bool Finish();
+
+	void Abort();
+
+private:
+	void DecompressStage();
+
+	void ExtractStage();
+
+	bool ExtractTar(ChunkReader &reader);
+
+	bool ExtractZip(ChunkReader &reader);
+
+	bool MakeDirectory(const std::string &name);
+
+	bool WriteEntry(const std::string &name, ChunkReader &reader, uint64_t size, unsigned mode);
+
+	bool InflateEntry(const std::string &name, ChunkReader &reader);
+
+	// a stored entry whose sizes come after the data, it ends at the data descriptor (with its signature) that matches it
+	bool WriteDescribedEntry(const std::string &name, ChunkReader &reader);
+
+	bool ResolvePath(const std::string &name, std::string &path);
+
+	void Fail();
+
+private:
+	std::string stagingDir_;
+	ChunkQueue compressed_{ 64 };
+	ChunkQueue decompressed_{ 64 };
+	std::thread decompressor_;
+	std::thread extractor_;
+	bool decompressOk_ = false;
+	bool extractOk_ = false;
+};
+
+} //namespace SparkleLite
+
+#endif //_ARCHIVE_EXTRACTOR_H_
@@ -0,0 +1,46 @@
+#include "chunk_queue.h"
+
+namespace SparkleLite {
+
+bool ChunkQueue::Push(std::string &&chunk) {
+	std::unique_lock<std::mutex> lck(lock_);
+	cond_.wait(lck, [this]() { return aborted_ || chunks_.size() < capacity_; });
+	if (aborted_ || closed_) {
+		return false;
+	}
+	chunks_.emplace_back(std::move(chunk));
+	cond_.notify_all();
+	return true;
+}
+
+bool ChunkQueue::Pop(std::string &chunk) {
+	std::unique_lock<std::mutex> lck(lock_);
+	cond_.wait(lck, [this]() { return aborted_ || closed_ || !chunks_.empty(); });
+	if (aborted_ || chunks_.empty()) {
+		return false;
+	}
+	chunk = std::move(chunks_.front());
+	chunks_.pop_front();
+	cond_.notify_all();
+	return true;
+}
+
+void ChunkQueue::Close() {
+	std::unique_lock<std::mutex> lck(lock_);
+	closed_ = true;
+	cond_.notify_all();
+}
+
+void ChunkQueue::Abort() {
+	std::unique_lock<std::mutex> lck(lock_);
+	aborted_ = true;
+	chunks_.clear();
+	cond_.notify_all();
+}
+
+bool ChunkQueue::IsAborted() {
+	std::unique_lock<std::mutex> lck(lock_);
+	return aborted_;
+}
+
+} //namespace SparkleLite
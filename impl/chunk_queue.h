@@ -0,0 +1,43 @@
+#ifndef _CHUNK_QUEUE_H_
+#define _CHUNK_QUEUE_H_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+
+namespace SparkleLite {
+
+//
+// A bounded queue of data chunks between two pipeline stages
+//
+class ChunkQueue {
+public:
+	explicit ChunkQueue(size_t capacity) :
+			capacity_(capacity) {}
+
+	bool Push(std::string &&chunk);
+
+	// false once the queue is drained and closed, or aborted
+	bool Pop(std::string &chunk);
+
+	// no more data from the producer
+	void Close();
+
+	// wake everybody up and drop the data, the pipeline is going down
+	void Abort();
+
+	bool IsAborted();
+
+private:
+	std::mutex lock_;
+	std::condition_variable cond_;
+	std::deque<std::string> chunks_;
+	size_t capacity_;
+	bool closed_ = false;
+	bool aborted_ = false;
+};
+
+} //namespace SparkleLite
+
+#endif //_CHUNK_QUEUE_H_
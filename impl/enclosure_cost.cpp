@@ -0,0 +1,47 @@
+#include "enclosure_cost.h"
+#include "sparkle_internal.h"
+
+namespace SparkleLite {
+
+bool EnclosureCost::IsCheaperThan(const EnclosureCost &other) const {
+	if (fit != other.fit) {
+		return fit > other.fit;
+	}
+	if (formatRank != other.formatRank) {
+		return formatRank < other.formatRank;
+	}
+	if (size != other.size) {
+		// unknown is never cheaper
+		return size && (!other.size || size < other.size);
+	}
+	return false;
+}
+
+size_t enclosure_format_rank(const EnclosureFormats &formats, std::string_view mime, std::string_view url) {
+	if (formats.empty()) {
+		return 0;
+	}
+
+	// the path only, "https://host/setup.msi?token=..." is a ".msi"
+	auto path = url.substr(0, url.find_first_of("?#"));
+
+	// the type only, "application/zip; encoding=zstd" is an "application/zip"
+	auto type = trim_spaces(mime.substr(0, mime.find(';')));
+	for (size_t rank = 0; rank < formats.size(); rank++) {
+		std::string_view format = formats[rank];
+		if (format.empty()) {
+			continue;
+		}
+		// a suffix is compared with the end of the path, a MIME type with the whole type
+		auto value = format.front() == '.' ? path : type;
+		if (format.front() == '.' && value.size() > format.size()) {
+			value.remove_prefix(value.size() - format.size());
+		}
+		if (equals_no_case(value, format)) {
+			return rank;
+		}
+	}
+	return formats.size();
+}
+
+} //namespace SparkleLite
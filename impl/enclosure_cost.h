@@ -0,0 +1,40 @@
+#ifndef _ENCLOSURE_COST_H_
+#define _ENCLOSURE_COST_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace SparkleLite {
+
+//
+// Formats the host would rather download, most wanted first. An entry is either a MIME type
+// ("application/zstd", case ignored) or a file suffix of the URL path (".msi")
+//
+using EnclosureFormats = std::vector<std::string>;
+
+//
+// What an enclosure costs this client, when an item has several it can take:
+//
+//	+ the closer fit wins: built for the OS and architecture, then for the OS, then for any
+//	+ then the more wanted format, the ones not listed come last
+//	+ then the smaller download, an unknown length comes last
+//
+// equal costs keep the appcast order
+//
+struct EnclosureCost {
+	int fit = -1; // get_os_fit()
+	size_t formatRank = 0; // enclosure_format_rank()
+	uint64_t size = 0; // <enclosure length>, 0 if unknown
+
+	bool IsCheaperThan(const EnclosureCost &other) const;
+};
+
+// position of the first entry of [formats] the enclosure is in, formats.size() if none
+size_t enclosure_format_rank(const EnclosureFormats &formats, std::string_view mime, std::string_view url);
+
+} //namespace SparkleLite
+
+#endif //_ENCLOSURE_COST_H_
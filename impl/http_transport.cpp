@@ -0,0 +1,234 @@
+#include "http_transport.h"
+#include "appcast_binary.h"
+#include "third_party/mio.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+
+namespace SparkleLite {
+
+// slices of a mapped file handed to the content handler, so progress callbacks keep coming
+#define FILE_TRANSPORT_SLICE_SIZE (1 << 20)
+
+int HttpTransport::Get(const std::string &url, const HttpHeaders &requestHeaders, HttpHeaders &responseHeaders, std::string &responseBody) {
+	auto key = url;
+	for (const auto &[field, value] : requestHeaders) {
+		key.append("\n").append(field).append(": ").append(value);
+	}
+
+	auto response = getFlights_.Do(key, [&]() {
+		auto fetched = std::make_shared<BufferedResponse>();
+		auto &body = fetched->body;
+		fetched->status = Get(url, requestHeaders, fetched->headers,
+				[&](size_t total, const void *data, size_t size) -> bool {
+					if (total && body.capacity() < total) {
+						body.reserve(std::min<size_t>(total, HTTP_MAX_BODY_RESERVE));
+					}
+					body.append((const char *)data, size);
+					return true;
+				});
+		return std::shared_ptr<const BufferedResponse>(fetched);
+	});
+
+	responseHeaders = response->headers;
+	responseBody.append(response->body);
+	return response->status;
+}
+
+//
+// CurlTransport
+//
+CurlTransport::CurlTransport(bool direct) :
+		direct_(direct) {
+}
+
+int CurlTransport::Perform(const std::string &url, const HttpHeaders &requestHeaders, HttpHeaders &responseHeaders, HttpRawContentHandler handler, void *ctx) {
+	return simple_http_get(url, requestHeaders, responseHeaders, handler, ctx, direct_);
+}
+
+//
+// FileTransport
+//
+FileTransport::FileTransport(std::shared_ptr<HttpTransport> fallback) :
+		fallback_(fallback ? fallback : std::make_shared<CurlTransport>()) {
+}
+
+void FileTransport::AddMirror(const std::string &urlPrefix, const std::string &localDir) {
+	std::unique_lock<std::mutex> lck(lock_);
+	mirrors_[urlPrefix] = localDir;
+}
+
+// "%XX" escapes decoded, false if one is malformed or decodes to a NUL
+static bool percent_decode(std::string_view in, std::string &out) {
+	auto hex = [](char c) -> int {
+		return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+	};
+	out.clear();
+	for (size_t i = 0; i < in.size(); i++) {
+		if (in[i] != '%') {
+			out.push_back(in[i]);
+			continue;
+		}
+		if (i + 2 >= in.size() || hex(in[i + 1]) < 0 || hex(in[i + 2]) < 0) {
+			return false;
+		}
+		auto c = (char)(hex(in[i + 1]) * 16 + hex(in[i + 2]));
+		if (c == '\0') {
+			return false;
+		}
+		out.push_back(c);
+		i += 2;
+	}
+	return true;
+}
+
+bool FileTransport::ResolveLocalPath(const std::string &url, std::string &path) {
+	namespace fs = std::filesystem;
+
+	// drop query & fragment
+	auto end = url.find_first_of("?#");
+	auto location = std::string_view(url).substr(0, end);
+
+	if (strncasecmp(url.c_str(), "file://", 7) == 0) {
+		if (!percent_decode(location.substr(7), path)) {
+			return false;
+		}
+#ifdef _WIN32
+		// file:///C:/path
+		if (path.size() > 2 && path[0] == '/' && path[2] == ':') {
+			path.erase(0, 1);
+		}
+#endif
+		return !path.empty();
+	}
+
+	std::unique_lock<std::mutex> lck(lock_);
+	for (const auto &[prefix, dir] : mirrors_) {
+		if (url.compare(0, prefix.size(), prefix) != 0) {
+			continue;
+		}
+
+		// a mirror serves what's under its directory and nothing else, whatever the URL says
+		std::string relative;
+		if (prefix.size() > location.size() || !percent_decode(location.substr(prefix.size()), relative)) {
+			return false;
+		}
+		fs::path joined(dir);
+		size_t pos = 0;
+		while (pos <= relative.size()) {
+			auto next = relative.find_first_of("/\\", pos);
+			if (next == std::string::npos) {
+				next = relative.size();
+			}
+			auto segment = relative.substr(pos, next - pos);
+			if (segment == "..") {
+				return false;
+			}
+			if (!segment.empty() && segment != ".") {
+				joined /= fs::path(segment);
+			}
+			pos = next + 1;
+		}
+
+		auto root = fs::path(dir).lexically_normal();
+		auto normal = joined.lexically_normal();
+		auto rel = normal.lexically_relative(root);
+		if (normal.has_root_name() != root.has_root_name() || rel.empty() || *rel.begin() == "..") {
+			return false;
+		}
+		path = normal.string();
+		return true;
+	}
+	return false;
+}
+
+int FileTransport::Perform(const std::string &url, const HttpHeaders &requestHeaders, HttpHeaders &responseHeaders, HttpRawContentHandler handler, void *ctx) {
+	std::string path;
+	if (!ResolveLocalPath(url, path)) {
+		return fallback_->Perform(url, requestHeaders, responseHeaders, handler, ctx);
+	}
+
+	std::error_code error;
+	mio::mmap_source mmap = mio::make_mmap_source(path, error);
+	if (error) {
+		return 404;
+	}
+
+	responseHeaders.clear();
+	responseHeaders["Content-Length"] = std::to_string(mmap.size());
+	if (mmap.size() >= sizeof(uint32_t) && *(const uint32_t *)mmap.data() == BINARY_APPCAST_MAGIC) {
+		responseHeaders["Content-Type"] = BINARY_APPCAST_MIME;
+	}
+
+	size_t offset = 0;
+	while (offset < mmap.size()) {
+		auto size = std::min<size_t>(FILE_TRANSPORT_SLICE_SIZE, mmap.size() - offset);
+		if (!handler(ctx, mmap.size(), mmap.data() + offset, size)) {
+			return -1;
+		}
+		offset += size;
+	}
+	return 200;
+}
+
+//
+// MemoryTransport
+//
+void MemoryTransport::SetLink(const Link &link) {
+	std::unique_lock<std::mutex> lck(lock_);
+	link_ = link;
+}
+
+void MemoryTransport::Put(const std::string &url, std::string content, const HttpHeaders &headers, int status) {
+	Response resp;
+	resp.status = status;
+	resp.headers = headers;
+	resp.headers["Content-Length"] = std::to_string(content.size());
+	resp.content = std::make_shared<const std::string>(std::move(content));
+
+	std::unique_lock<std::mutex> lck(lock_);
+	responses_[url] = std::move(resp);
+}
+
+int MemoryTransport::Perform(const std::string &url, const HttpHeaders &, HttpHeaders &responseHeaders, HttpRawContentHandler handler, void *ctx) {
+	Link link;
+	Response resp;
+	{
+		std::unique_lock<std::mutex> lck(lock_);
+		link = link_;
+		auto it = responses_.find(url);
+		if (it == responses_.end()) {
+			resp.status = 404;
+		} else {
+			resp = it->second;
+		}
+	}
+
+	// time is accounted against a fixed schedule, so sleeping jitter doesn't add up
+	auto begin = std::chrono::steady_clock::now() + link.latency;
+	std::this_thread::sleep_until(begin);
+
+	responseHeaders = resp.headers;
+	if (!resp.content) {
+		return resp.status;
+	}
+
+	const auto &content = *resp.content;
+	auto chunkSize = std::max<size_t>(link.chunkSize, 1);
+	size_t offset = 0;
+	while (offset < content.size()) {
+		auto size = std::min(chunkSize, content.size() - offset);
+		if (link.bandwidth) {
+			auto due = begin + std::chrono::microseconds((offset + size) * 1000000ull / link.bandwidth);
+			std::this_thread::sleep_until(due);
+		}
+		if (!handler(ctx, content.size(), content.data() + offset, size)) {
+			return -1;
+		}
+		offset += size;
+	}
+	return resp.status;
+}
+
+} //namespace SparkleLite
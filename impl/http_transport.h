@@ -0,0 +1,122 @@
+#ifndef _HTTP_TRANSPORT_H_
+#define _HTTP_TRANSPORT_H_
+
+#include "simple_http.h"
+#include "single_flight.h"
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace SparkleLite {
+
+//
+// Where SparkleManager gets its bytes from, so the whole check/download/verify pipeline
+// can run against local mirrors or fully in memory
+//
+class HttpTransport {
+public:
+	virtual ~HttpTransport() = default;
+
+	// returns the HTTP status code, or -1 on transport failure
+	virtual int Perform(
+			const std::string &url,
+			const HttpHeaders &requestHeaders,
+			HttpHeaders &responseHeaders,
+			HttpRawContentHandler handler,
+			void *ctx) = 0;
+
+	// identical requests in flight at the same time share one response
+	int Get(const std::string &url, const HttpHeaders &requestHeaders, HttpHeaders &responseHeaders, std::string &responseBody);
+
+	template <typename Handler>
+	int Get(const std::string &url, const HttpHeaders &requestHeaders, HttpHeaders &responseHeaders, Handler &&handler) {
+		using HandlerType = std::remove_reference_t<Handler>;
+		return Perform(
+				url,
+				requestHeaders,
+				responseHeaders,
+				[](void *ctx, size_t total, const void *data, size_t size) -> bool {
+					return (*(HandlerType *)ctx)(total, data, size);
+				},
+				(void *)&handler);
+	}
+
+private:
+	struct BufferedResponse {
+		int status = -1;
+		HttpHeaders headers;
+		std::string body;
+	};
+	SingleFlight<std::shared_ptr<const BufferedResponse>> getFlights_;
+};
+
+//
+// The default one, backed by curl, a [direct] one never goes through a proxy (LAN peers)
+//
+class CurlTransport : public HttpTransport {
+public:
+	explicit CurlTransport(bool direct = false);
+
+	int Perform(const std::string &url, const HttpHeaders &requestHeaders, HttpHeaders &responseHeaders, HttpRawContentHandler handler, void *ctx) override;
+
+private:
+	bool direct_ = false;
+};
+
+//
+// Serves "file://" URLs, and URLs under registered mirror prefixes, straight from a mapping of the file (no copy),
+// everything else goes to [fallback]
+//
+class FileTransport : public HttpTransport {
+public:
+	explicit FileTransport(std::shared_ptr<HttpTransport> fallback = nullptr);
+
+	// e.g. AddMirror("https://example.com/updates/", "/opt/app/offline-bundle/")
+	void AddMirror(const std::string &urlPrefix, const std::string &localDir);
+
+	int Perform(const std::string &url, const HttpHeaders &requestHeaders, HttpHeaders &responseHeaders, HttpRawContentHandler handler, void *ctx) override;
+
+private:
+	bool ResolveLocalPath(const std::string &url, std::string &path);
+
+private:
+	std::shared_ptr<HttpTransport> fallback_;
+	std::mutex lock_;
+	std::map<std::string, std::string> mirrors_;
+};
+
+//
+// Serves registered in-memory responses with a configurable latency and bandwidth,
+// for deterministic benchmarks and load tests of the whole pipeline
+//
+class MemoryTransport : public HttpTransport {
+public:
+	struct Link {
+		std::chrono::microseconds latency{ 0 }; // before the first byte
+		uint64_t bandwidth = 0; // bytes per second, 0 for unlimited
+		size_t chunkSize = 16 * 1024;
+	};
+
+	void SetLink(const Link &link);
+
+	void Put(const std::string &url, std::string content, const HttpHeaders &headers = {}, int status = 200);
+
+	int Perform(const std::string &url, const HttpHeaders &requestHeaders, HttpHeaders &responseHeaders, HttpRawContentHandler handler, void *ctx) override;
+
+private:
+	struct Response {
+		int status = 200;
+		HttpHeaders headers;
+		std::shared_ptr<const std::string> content;
+	};
+
+	std::mutex lock_;
+	Link link_;
+	std::map<std::string, Response> responses_;
+};
+
+} //namespace SparkleLite
+
+#endif //_HTTP_TRANSPORT_H_
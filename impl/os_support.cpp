@@ -0,0 +1,55 @@
+#include "os_support.h"
+#include "sparkle_internal.h"
+#include <algorithm>
+
+namespace SparkleLite {
+
+const OSFacts &get_os_facts() {
+	static const OSFacts facts = collect_os_facts();
+	return facts;
+}
+
+bool is_acceptable_os_version(const OSFacts &facts, std::string_view osMinRequiredVersion) {
+	if (osMinRequiredVersion.empty()) {
+		return true;
+	}
+	return SafeVersionCompare(facts.version, osMinRequiredVersion) >= 0;
+}
+
+bool is_matched_os_name(const OSFacts &facts, std::string_view osName) {
+	return get_os_fit(facts, osName) >= 0;
+}
+
+int get_os_fit(const OSFacts &facts, std::string_view osName) {
+	if (osName.empty()) {
+		// not restricted
+		return 0;
+	}
+
+	// "<name>" or "<name>-<arch>", where name is the OS family or the distribution
+	auto fitFamily = [&](const std::string &family) -> int {
+		if (family.empty() || osName.size() < family.size() || strncasecmp(osName.data(), family.data(), family.size()) != 0) {
+			return -1;
+		}
+		auto rest = osName.substr(family.size());
+		if (rest.empty()) {
+			return 1;
+		}
+		return rest.front() == '-' && equals_no_case(rest.substr(1), facts.arch) ? 2 : -1;
+	};
+	return std::max(fitFamily(facts.name), fitFamily(facts.distro));
+}
+
+bool is_acceptable_os_version(const std::string &osMinRequiredVersion) {
+	return is_acceptable_os_version(get_os_facts(), osMinRequiredVersion);
+}
+
+bool is_matched_os_name(const std::string &osName) {
+	return is_matched_os_name(get_os_facts(), osName);
+}
+
+std::string get_iso639_user_lang() {
+	return get_os_facts().lang;
+}
+
+} //namespace SparkleLite
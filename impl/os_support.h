@@ -1,9 +1,48 @@
 #ifndef _OS_SUPPORT_H_
 #define _OS_SUPPORT_H_
 
+#include <cstdint>
 #include <string>
+#include <string_view>
 
 namespace SparkleLite {
+//
+// Facts about the running OS, collected once and never changed afterwards,
+// so filtering a large appcast doesn't have to ask the OS again and again
+//
+struct OSFacts {
+	std::string name; // "windows", "linux"
+	std::string distro; // distribution id from /etc/os-release, e.g. "ubuntu" (empty on windows)
+	std::string arch; // "x86", "x64", "arm64"
+	std::string version; // dotted OS version, compared against <sparkle:minimumSystemVersion> (VERSION_ID of /etc/os-release on linux)
+	std::string lang; // ISO-639 code of the user language
+};
+
+//
+// the snapshot of the current OS, the first call collects it
+//
+const OSFacts &get_os_facts();
+
+//
+// platform backend, collect the facts (os_support_win.cpp / os_support_linux.cpp)
+//
+OSFacts collect_os_facts();
+
+// check if the given [osMinRequiredVersion] is accepted by the OS described by [facts]
+//
+bool is_acceptable_os_version(const OSFacts &facts, std::string_view osMinRequiredVersion);
+
+//
+// check if the name of os is matched with the OS described by [facts]
+//
+bool is_matched_os_name(const OSFacts &facts, std::string_view osName);
+
+//
+// how closely the name of os fits the OS described by [facts]:
+// -1 not at all, 0 not restricted, 1 the OS family or distribution, 2 that and the architecture too
+//
+int get_os_fit(const OSFacts &facts, std::string_view osName);
+
 // check if the given [osMinRequiredVersion] is accepted by the current running platform
 //
 bool is_acceptable_os_version(const std::string &osMinRequiredVersion);
@@ -18,10 +57,52 @@ bool is_matched_os_name(const std::string &osName);
 //
 bool execute(const std::string &package, const std::string &args);
 
+//
+// swap two existing paths (e.g. directories) in one step, nobody sees either of them missing,
+// false where it isn't supported (renameat2 RENAME_EXCHANGE on Linux only)
+//
+bool exchange_paths(const std::string &x, const std::string &y);
+
+//
+// Packages held in memory only (memfd on Linux), -1 / false where it isn't supported:
+//	+ create an anonymous file to download into, and append to it
+//	+ seal it once written, it can't be changed any more (verify it after that), the returned fd replaces [fd]
+//	+ view its content in place (mapped), [viewer] gets it all at once
+//	+ execute it (as fexecve would), the installer also inherits it, with its number in $SPARKLE_PACKAGE_FD
+//
+int create_memory_file(const std::string &name);
+
+bool write_memory_file(int fd, const void *data, size_t size);
+
+int seal_memory_file(int fd);
+
+bool view_memory_file(int fd, bool (*viewer)(void *ctx, const void *data, size_t size), void *ctx);
+
+bool execute(int packageFd, const std::string &args);
+
+void close_memory_file(int fd);
+
+//
+// What tells a file changed without reading it: its size, last write time and id on its volume (inode / NTFS file index),
+// a file replaced by another one gets another id even with the same size and time
+//
+struct FileIdentity {
+	uint64_t size = 0;
+	int64_t mtime = 0; // nanoseconds, in the platform's own epoch
+	uint64_t device = 0;
+	uint64_t inode = 0;
+
+	bool operator==(const FileIdentity &other) const {
+		return size == other.size && mtime == other.mtime && device == other.device && inode == other.inode;
+	}
+};
+
+bool get_file_identity(const std::string &path, FileIdentity &identity);
+
 //
 // get the language (ISO-639 code) setting of the current OS user
 //
 std::string get_iso639_user_lang();
 }; //namespace SparkleLite
 
-#endif //_OS_SUPPORT_H_
\ No newline at end of file
+#endif //_OS_SUPPORT_H_
@@ -0,0 +1,321 @@
+#include "os_support.h"
+#if defined(__linux__)
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+extern char **environ;
+
+namespace SparkleLite {
+
+// "ID=ubuntu" / "ID=\"rhel\"" -> the value
+static std::string os_release_value(const std::string &line, size_t offset) {
+	auto value = line.substr(offset);
+	if (value.size() >= 2 && (value.front() == '"' || value.front() == '\'') && value.back() == value.front()) {
+		value = value.substr(1, value.size() - 2);
+	}
+	return value;
+}
+
+// the distribution id (lower case) and its version, e.g. "ubuntu" / "22.04"
+static void read_os_release(std::string &id, std::string &versionId) {
+	std::ifstream file("/etc/os-release");
+	if (!file) {
+		file.open("/usr/lib/os-release");
+	}
+
+	std::string line;
+	while (std::getline(file, line)) {
+		if (line.compare(0, 3, "ID=") == 0) {
+			id = os_release_value(line, 3);
+			for (auto &c : id) {
+				c = (char)tolower((unsigned char)c);
+			}
+		} else if (line.compare(0, 11, "VERSION_ID=") == 0) {
+			versionId = os_release_value(line, 11);
+		}
+	}
+}
+
+static std::string normalize_arch(const char *machine) {
+	if (strcmp(machine, "x86_64") == 0 || strcmp(machine, "amd64") == 0) {
+		return "x64";
+	}
+	if (strcmp(machine, "aarch64") == 0 || strcmp(machine, "arm64") == 0) {
+		return "arm64";
+	}
+	if (machine[0] == 'i' && strcmp(machine + 2, "86") == 0) {
+		return "x86";
+	}
+	return machine;
+}
+
+// "de_DE.UTF-8" -> "de", "C" / "POSIX" -> "en"
+static std::string read_user_lang() {
+	const char *names[] = { "LC_ALL", "LC_MESSAGES", "LANG" };
+	for (auto name : names) {
+		auto value = getenv(name);
+		if (!value || !*value) {
+			continue;
+		}
+		if (strcmp(value, "C") == 0 || strncmp(value, "C.", 2) == 0 || strcmp(value, "POSIX") == 0) {
+			return "en";
+		}
+
+		std::string lang;
+		for (auto p = value; isalpha((unsigned char)*p); ++p) {
+			lang.push_back((char)tolower((unsigned char)*p));
+		}
+		if (!lang.empty()) {
+			return lang;
+		}
+	}
+	return "en";
+}
+
+OSFacts collect_os_facts() {
+	OSFacts facts;
+	facts.name = "linux";
+	facts.lang = read_user_lang();
+
+	// the distribution's release, not the kernel's: "22.04", "9.3", "39" (rolling ones have none)
+	std::string versionId;
+	read_os_release(facts.distro, versionId);
+	for (auto p = versionId.c_str(); isdigit((unsigned char)*p) || *p == '.'; ++p) {
+		facts.version.push_back(*p);
+	}
+
+	struct utsname uts;
+	if (uname(&uts) == 0) {
+		facts.arch = normalize_arch(uts.machine);
+	}
+	return facts;
+}
+
+// split the argument string like a shell does, honoring quotes and backslash escapes
+static std::vector<std::string> split_args(const std::string &args) {
+	std::vector<std::string> argv;
+	std::string current;
+	bool inArg = false;
+	char quote = 0;
+	for (size_t i = 0; i < args.size(); ++i) {
+		auto c = args[i];
+		if (quote) {
+			if (c == quote) {
+				quote = 0;
+			} else if (c == '\\' && quote == '"' && i + 1 < args.size()) {
+				current.push_back(args[++i]);
+			} else {
+				current.push_back(c);
+			}
+		} else if (c == '"' || c == '\'') {
+			quote = c;
+			inArg = true;
+		} else if (c == '\\' && i + 1 < args.size()) {
+			current.push_back(args[++i]);
+			inArg = true;
+		} else if (isspace((unsigned char)c)) {
+			if (inArg) {
+				argv.push_back(std::move(current));
+				current.clear();
+				inArg = false;
+			}
+		} else {
+			current.push_back(c);
+			inArg = true;
+		}
+	}
+	if (inArg) {
+		argv.push_back(std::move(current));
+	}
+	return argv;
+}
+
+// the installer may well exit before us, don't leave a zombie behind (nor take the host's SIGCHLD)
+static void reap_in_background(pid_t pid) {
+	std::thread([pid]() {
+		while (waitpid(pid, nullptr, 0) < 0 && errno == EINTR) {
+		}
+	}).detach();
+}
+
+bool execute(const std::string &package, const std::string &args) {
+	// a downloaded package doesn't carry the exec bit
+	struct stat st;
+	if (stat(package.c_str(), &st) != 0) {
+		return false;
+	}
+	if ((st.st_mode & S_IXUSR) == 0 && chmod(package.c_str(), st.st_mode | S_IXUSR) != 0) {
+		return false;
+	}
+
+	auto params = split_args(args);
+	std::vector<char *> argv;
+	argv.reserve(params.size() + 2);
+	argv.push_back((char *)package.c_str());
+	for (auto &param : params) {
+		argv.push_back(&param[0]);
+	}
+	argv.push_back(nullptr);
+
+	posix_spawnattr_t attr;
+	if (posix_spawnattr_init(&attr) != 0) {
+		return false;
+	}
+#ifdef POSIX_SPAWN_SETSID
+	// the installer outlives us, keep it out of our session
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID);
+#endif
+
+	pid_t pid = 0;
+	auto ret = posix_spawn(&pid, package.c_str(), nullptr, &attr, argv.data(), environ);
+	posix_spawnattr_destroy(&attr);
+	if (ret != 0) {
+		return false;
+	}
+	reap_in_background(pid);
+	return true;
+}
+
+bool exchange_paths(const std::string &x, const std::string &y) {
+#if defined(SYS_renameat2) && defined(RENAME_EXCHANGE)
+	return syscall(SYS_renameat2, AT_FDCWD, x.c_str(), AT_FDCWD, y.c_str(), RENAME_EXCHANGE) == 0;
+#else
+	return false;
+#endif
+}
+
+int create_memory_file(const std::string &name) {
+	return memfd_create(name.c_str(), MFD_CLOEXEC | MFD_ALLOW_SEALING);
+}
+
+bool write_memory_file(int fd, const void *data, size_t size) {
+	auto p = (const char *)data;
+	while (size) {
+		auto n = write(fd, p, size);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+int seal_memory_file(int fd) {
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	// a file open for writing can't be executed (ETXTBSY), keep a read-only one
+	auto path = "/proc/self/fd/" + std::to_string(fd);
+	auto readOnly = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	close(fd);
+	return readOnly;
+}
+
+bool view_memory_file(int fd, bool (*viewer)(void *ctx, const void *data, size_t size), void *ctx) {
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		return false;
+	}
+	if (!st.st_size) {
+		return viewer(ctx, nullptr, 0);
+	}
+
+	auto data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	auto ret = viewer(ctx, data, st.st_size);
+	munmap(data, st.st_size);
+	return ret;
+}
+
+bool execute(int packageFd, const std::string &args) {
+	// a copy without O_CLOEXEC, so a script's interpreter can still open it after the exec
+	auto inherited = fcntl(packageFd, F_DUPFD, 3);
+	if (inherited < 0) {
+		return false;
+	}
+	auto path = "/proc/self/fd/" + std::to_string(inherited);
+
+	auto params = split_args(args);
+	std::vector<char *> argv;
+	argv.reserve(params.size() + 2);
+	argv.push_back((char *)path.c_str());
+	for (auto &param : params) {
+		argv.push_back(&param[0]);
+	}
+	argv.push_back(nullptr);
+
+	// tell the installer where its own bytes are
+	auto fdVar = "SPARKLE_PACKAGE_FD=" + std::to_string(inherited);
+	std::vector<char *> envp;
+	for (auto env = environ; *env; ++env) {
+		if (strncmp(*env, "SPARKLE_PACKAGE_FD=", 19) != 0) {
+			envp.push_back(*env);
+		}
+	}
+	envp.push_back((char *)fdVar.c_str());
+	envp.push_back(nullptr);
+
+	posix_spawnattr_t attr;
+	if (posix_spawnattr_init(&attr) != 0) {
+		close(inherited);
+		return false;
+	}
+#ifdef POSIX_SPAWN_SETSID
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID);
+#endif
+
+	// /proc/self/fd/N is resolved in the child, that's what fexecve does as well
+	pid_t pid = 0;
+	auto ret = posix_spawn(&pid, path.c_str(), nullptr, &attr, argv.data(), envp.data());
+	posix_spawnattr_destroy(&attr);
+	close(inherited);
+	if (ret != 0) {
+		return false;
+	}
+	reap_in_background(pid);
+	return true;
+}
+
+void close_memory_file(int fd) {
+	if (fd >= 0) {
+		close(fd);
+	}
+}
+
+bool get_file_identity(const std::string &path, FileIdentity &identity) {
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+		return false;
+	}
+	identity.size = (uint64_t)st.st_size;
+	identity.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	identity.device = (uint64_t)st.st_dev;
+	identity.inode = (uint64_t)st.st_ino;
+	return true;
+}
+
+} //namespace SparkleLite
+
+#endif //__linux__
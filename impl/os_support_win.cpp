@@ -10,34 +10,31 @@
 
 namespace SparkleLite {
 
-bool is_acceptable_os_version(const std::string &osMinRequiredVersion) {
-	if (osMinRequiredVersion.empty()) {
-		return true;
-	}
+OSFacts collect_os_facts() {
+	OSFacts facts;
+	facts.name = "windows";
+#if defined(_M_ARM64)
+	facts.arch = "arm64";
+#elif defined(_WIN64)
+	facts.arch = "x64";
+#else
+	facts.arch = "x86";
+#endif
 
+	// GetVersionEx() lies to the unmanifested, ask ntdll directly
+	using RtlGetVersionFn = LONG(WINAPI *)(OSVERSIONINFOEXW *);
 	OSVERSIONINFOEXW osvi = { sizeof(osvi), 0, 0, 0, 0, { 0 }, 0, 0 };
-	DWORDLONG const dwlConditionMask = VerSetConditionMask(
-			VerSetConditionMask(
-					VerSetConditionMask(
-							0, VER_MAJORVERSION, VER_GREATER_EQUAL),
-					VER_MINORVERSION, VER_GREATER_EQUAL),
-			VER_SERVICEPACKMAJOR, VER_GREATER_EQUAL);
-
-	sscanf_s(osMinRequiredVersion.c_str(), "%lu.%lu.%hu", &osvi.dwMajorVersion, &osvi.dwMinorVersion, &osvi.wServicePackMajor);
-	return !VerifyVersionInfoW(&osvi, VER_MAJORVERSION | VER_MINORVERSION | VER_SERVICEPACKMAJOR, dwlConditionMask);
-}
+	auto ntdll = GetModuleHandleW(L"ntdll.dll");
+	auto rtlGetVersion = ntdll ? (RtlGetVersionFn)GetProcAddress(ntdll, "RtlGetVersion") : nullptr;
+	if (rtlGetVersion && rtlGetVersion(&osvi) == 0) {
+		facts.version = std::to_string(osvi.dwMajorVersion) + "." + std::to_string(osvi.dwMinorVersion) + "." + std::to_string(osvi.dwBuildNumber);
+	}
 
-bool is_matched_os_name(const std::string &osName) {
-	if (_stricmp(osName.c_str(), "windows") == 0)
-		return true;
-#ifdef _WIN64
-	if (_stricmp(osName.c_str(), "windows-x64") != 0)
-		return true;
-#else
-	if (_stricmp(osName.c_str(), "windows-x86") != 0)
-		return true;
-#endif
-	return false;
+	char lang[9] = { 0 };
+	if (GetLocaleInfoA(GetUserDefaultLangID(), LOCALE_SISO639LANGNAME, lang, sizeof(lang))) {
+		facts.lang = lang;
+	}
+	return facts;
 }
 
 bool execute(const std::string &package, const std::string &args) {
@@ -54,12 +51,56 @@ bool execute(const std::string &package, const std::string &args) {
 	return !!ShellExecuteExA(&sei);
 }
 
-std::string get_iso639_user_lang() {
-	std::string lang;
-	lang.resize(2);
-	auto langid = GetUserDefaultLangID();
-	GetLocaleInfoA(langid, LOCALE_SISO639LANGNAME, &lang[0], lang.size());
-	return std::move(lang);
+//
+// #NOTE: no atomic swap of directories on Windows, the caller renames them one after the other
+//
+bool exchange_paths(const std::string &, const std::string &) {
+	return false;
+}
+
+//
+// #NOTE: no in-memory packages on Windows, a process can only be created from a file
+//
+int create_memory_file(const std::string &) {
+	return -1;
+}
+
+bool write_memory_file(int, const void *, size_t) {
+	return false;
+}
+
+int seal_memory_file(int) {
+	return -1;
+}
+
+bool view_memory_file(int, bool (*)(void *, const void *, size_t), void *) {
+	return false;
+}
+
+bool execute(int, const std::string &) {
+	return false;
+}
+
+void close_memory_file(int) {
+}
+
+bool get_file_identity(const std::string &path, FileIdentity &identity) {
+	auto file = CreateFileA(path.c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	BY_HANDLE_FILE_INFORMATION info = { 0 };
+	auto ok = !!GetFileInformationByHandle(file, &info) && !(info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY);
+	CloseHandle(file);
+	if (!ok) {
+		return false;
+	}
+	identity.size = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+	identity.mtime = (int64_t)((((uint64_t)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime) * 100);
+	identity.device = info.dwVolumeSerialNumber;
+	identity.inode = ((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+	return true;
 }
 
 } //namespace SparkleLite
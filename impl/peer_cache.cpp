@@ -0,0 +1,476 @@
+#include "peer_cache.h"
+#include <openssl/sha.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <mswsock.h>
+#include <io.h>
+#pragma comment(lib, "ws2_32.lib")
+#pragma comment(lib, "mswsock.lib")
+using socket_t = SOCKET;
+#define INVALID_SOCK INVALID_SOCKET
+#define close_socket closesocket
+#define poll_sockets WSAPoll
+#define release_sockets WSACleanup // once for every successful WSAStartup
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+using socket_t = int;
+#define INVALID_SOCK (-1)
+#define close_socket close
+#define poll_sockets poll
+#define release_sockets()
+#endif
+
+namespace SparkleLite {
+
+#define PEER_PATH_PREFIX ("/sparkle-peer/")
+#define PEER_QUERY_MAGIC ("SPARKLE-PEER? ")
+#define PEER_REPLY_MAGIC ("SPARKLE-PEER! ")
+#define PEER_MAX_CONNECTIONS (16)
+#define PEER_DISCOVERY_TIMEOUT_MS (300)
+#define PEER_REQUEST_TIMEOUT (5) // seconds, for the request head once connected
+#define PEER_SEND_TIMEOUT (30) // seconds, a peer that stops reading is let go
+
+static void set_io_timeouts(socket_t s, int recvSeconds, int sendSeconds) {
+#ifdef _WIN32
+	DWORD recvMs = recvSeconds * 1000;
+	DWORD sendMs = sendSeconds * 1000;
+	setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char *)&recvMs, sizeof(recvMs));
+	setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, (const char *)&sendMs, sizeof(sendMs));
+#else
+	timeval tv = {};
+	tv.tv_sec = recvSeconds;
+	setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	tv.tv_sec = sendSeconds;
+	setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+#endif
+}
+
+static bool send_all(socket_t s, const char *data, size_t len) {
+	while (len) {
+		auto sent = send(s, data, (int)len, 0);
+		if (sent <= 0) {
+			return false;
+		}
+		data += sent;
+		len -= sent;
+	}
+	return true;
+}
+
+//
+// zero-copy file transfer, the kernel moves the page cache straight to the socket
+//
+static bool send_file(socket_t s, const std::string &file, uint64_t size) {
+#ifdef _WIN32
+	auto fh = CreateFileA(file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (fh == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	// TransmitFile can't send more than 2GB - 1 at once
+	bool ok = true;
+	uint64_t offset = 0;
+	while (ok && offset < size) {
+		auto chunk = (DWORD)std::min<uint64_t>(size - offset, 0x7fffffff - 1);
+		LARGE_INTEGER pos;
+		pos.QuadPart = (LONGLONG)offset;
+		SetFilePointerEx(fh, pos, nullptr, FILE_BEGIN);
+		ok = !!TransmitFile(s, fh, chunk, 0, nullptr, nullptr, 0);
+		offset += chunk;
+	}
+	CloseHandle(fh);
+	return ok;
+#else
+	auto fd = open(file.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	bool ok = true;
+#if defined(__linux__)
+	off_t offset = 0;
+	while (ok && (uint64_t)offset < size) {
+		auto sent = sendfile(s, fd, &offset, (size_t)(size - offset));
+		ok = sent > 0;
+	}
+#else
+	// no sendfile(2) with Linux semantics, fall back to a plain copy
+	char buf[64 * 1024];
+	uint64_t left = size;
+	while (ok && left) {
+		auto n = read(fd, buf, sizeof(buf));
+		ok = n > 0 && send_all(s, buf, (size_t)n);
+		left -= n > 0 ? (uint64_t)n : 0;
+	}
+#endif
+	close(fd);
+	return ok;
+#endif
+}
+
+static bool file_size(const std::string &file, uint64_t &size) {
+#ifdef _WIN32
+	struct _stat64 st;
+	if (_stat64(file.c_str(), &st) != 0) {
+		return false;
+	}
+#else
+	struct stat st;
+	if (stat(file.c_str(), &st) != 0) {
+		return false;
+	}
+#endif
+	size = (uint64_t)st.st_size;
+	return true;
+}
+
+static void reply_status(socket_t s, const char *status) {
+	std::string resp = std::string("HTTP/1.1 ") + status + "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+	send_all(s, resp.data(), resp.size());
+}
+
+PeerCache::~PeerCache() {
+	Disable();
+}
+
+bool PeerCache::Enable(const PeerCacheOptions &opts) {
+	Disable();
+
+#ifdef _WIN32
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+		return false;
+	}
+#endif
+
+	std::unique_lock<std::mutex> lck(lock_);
+	opts_ = opts;
+	stopping_ = false;
+
+	if (opts.port) {
+		// HTTP listener
+		auto s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (s == INVALID_SOCK) {
+			release_sockets();
+			return false;
+		}
+		int yes = 1;
+		setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *)&yes, sizeof(yes));
+
+		sockaddr_in addr = { 0 };
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_ANY);
+		addr.sin_port = htons(opts.port);
+		if (bind(s, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(s, 64) != 0) {
+			close_socket(s);
+			release_sockets();
+			return false;
+		}
+		listenSock_ = (intptr_t)s;
+
+		// discovery responder, it's optional so failures are not fatal
+		if (opts.multicast) {
+			auto d = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+			if (d != INVALID_SOCK) {
+				setsockopt(d, SOL_SOCKET, SO_REUSEADDR, (const char *)&yes, sizeof(yes));
+				addr.sin_port = htons(SPARKLE_PEER_DISCOVERY_PORT);
+
+				ip_mreq mreq = { 0 };
+				inet_pton(AF_INET, SPARKLE_PEER_DISCOVERY_GROUP, &mreq.imr_multiaddr);
+				mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+				if (bind(d, (sockaddr *)&addr, sizeof(addr)) == 0 &&
+						setsockopt(d, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char *)&mreq, sizeof(mreq)) == 0) {
+					discoverySock_ = (intptr_t)d;
+				} else {
+					close_socket(d);
+				}
+			}
+		}
+
+		server_ = std::thread(&PeerCache::ServeLoop, this);
+	}
+
+	enabled_ = true;
+	return true;
+}
+
+void PeerCache::Disable() {
+	std::thread server;
+	{
+		std::unique_lock<std::mutex> lck(lock_);
+		if (!enabled_) {
+			return;
+		}
+		enabled_ = false;
+		stopping_ = true;
+		server = std::move(server_);
+	}
+	if (server.joinable()) {
+		server.join();
+	}
+
+	std::unique_lock<std::mutex> lck(lock_);
+	idleCond_.wait(lck, [this]() { return activeConns_ == 0; });
+	if (listenSock_ != -1) {
+		close_socket((socket_t)listenSock_);
+		listenSock_ = -1;
+	}
+	if (discoverySock_ != -1) {
+		close_socket((socket_t)discoverySock_);
+		discoverySock_ = -1;
+	}
+
+	release_sockets();
+}
+
+bool PeerCache::IsEnabled() {
+	std::unique_lock<std::mutex> lck(lock_);
+	return enabled_;
+}
+
+void PeerCache::Publish(const std::string &key, const std::string &file) {
+	if (key.empty() || file.empty()) {
+		return;
+	}
+	std::unique_lock<std::mutex> lck(lock_);
+	published_[key] = file;
+}
+
+std::vector<std::string> PeerCache::Locate(const std::string &key) {
+	std::vector<std::string> peers;
+	bool multicast = false;
+	{
+		std::unique_lock<std::mutex> lck(lock_);
+		if (!enabled_ || key.empty()) {
+			return {};
+		}
+		peers = opts_.peers;
+		multicast = opts_.multicast;
+	}
+	if (multicast) {
+		for (auto &peer : Discover(key)) {
+			if (std::find(peers.begin(), peers.end(), peer) == peers.end()) {
+				peers.emplace_back(std::move(peer));
+			}
+		}
+	}
+
+	std::vector<std::string> urls;
+	for (const auto &peer : peers) {
+		urls.emplace_back("http://" + peer + PEER_PATH_PREFIX + key);
+	}
+	return urls;
+}
+
+std::string PeerCache::PackageKey(const AppcastEnclosure &enclosure) {
+	if (enclosure.signType == SignatureAlgo::kNone || enclosure.signature.empty()) {
+		return {};
+	}
+
+	// the signature already identifies the package content, hash it into a URL-safe token
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	SHA256((const unsigned char *)enclosure.signature.data(), enclosure.signature.size(), digest);
+
+	static const char hex[] = "0123456789abcdef";
+	std::string key;
+	key.reserve(SHA256_DIGEST_LENGTH * 2);
+	for (auto c : digest) {
+		key.push_back(hex[c >> 4]);
+		key.push_back(hex[c & 0x0f]);
+	}
+	return key;
+}
+
+void PeerCache::ServeLoop() {
+	while (!stopping_) {
+		pollfd fds[2] = {};
+		int count = 0;
+		fds[count].fd = (socket_t)listenSock_;
+		fds[count++].events = POLLIN;
+		if (discoverySock_ != -1) {
+			fds[count].fd = (socket_t)discoverySock_;
+			fds[count++].events = POLLIN;
+		}
+
+		// wake up periodically so Disable() doesn't wait for the next client
+		if (poll_sockets(fds, count, 200) <= 0) {
+			continue;
+		}
+
+		if (count > 1 && (fds[1].revents & POLLIN)) {
+			ReplyDiscovery();
+		}
+
+		if (fds[0].revents & POLLIN) {
+			auto conn = accept((socket_t)listenSock_, nullptr, nullptr);
+			if (conn == INVALID_SOCK) {
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lck(lock_);
+			if (activeConns_ >= PEER_MAX_CONNECTIONS) {
+				lck.unlock();
+				reply_status(conn, "503 Service Unavailable");
+				close_socket(conn);
+				continue;
+			}
+			++activeConns_;
+			std::thread(&PeerCache::ServeConnection, this, (intptr_t)conn).detach();
+		}
+	}
+}
+
+void PeerCache::ServeConnection(intptr_t connHandle) {
+	auto conn = (socket_t)connHandle;
+	set_io_timeouts(conn, PEER_REQUEST_TIMEOUT, PEER_SEND_TIMEOUT);
+
+	// read the request head, we only serve "GET /sparkle-peer/<key>"
+	char head[2048];
+	size_t len = 0;
+	while (len < sizeof(head) - 1) {
+		auto n = recv(conn, head + len, (int)(sizeof(head) - 1 - len), 0);
+		if (n <= 0) {
+			break;
+		}
+		len += n;
+		head[len] = '\0';
+		if (strstr(head, "\r\n\r\n")) {
+			break;
+		}
+	}
+	head[len] = '\0';
+
+	std::string file;
+	std::string prefix = std::string("GET ") + PEER_PATH_PREFIX;
+	if (strncmp(head, prefix.c_str(), prefix.size()) == 0) {
+		auto keyBegin = head + prefix.size();
+		auto keyEnd = strchr(keyBegin, ' ');
+		if (keyEnd) {
+			std::unique_lock<std::mutex> lck(lock_);
+			auto it = published_.find(std::string(keyBegin, keyEnd));
+			if (it != published_.end()) {
+				file = it->second;
+			}
+		}
+	}
+
+	uint64_t size = 0;
+	if (file.empty() || !file_size(file, size)) {
+		reply_status(conn, "404 Not Found");
+	} else {
+		std::string resp = "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nConnection: close\r\nContent-Length: " + std::to_string(size) + "\r\n\r\n";
+		if (send_all(conn, resp.data(), resp.size())) {
+			send_file(conn, file, size);
+		}
+	}
+	close_socket(conn);
+
+	std::unique_lock<std::mutex> lck(lock_);
+	--activeConns_;
+	idleCond_.notify_all();
+}
+
+void PeerCache::ReplyDiscovery() {
+	char buf[256];
+	sockaddr_in from = { 0 };
+	socklen_t fromLen = sizeof(from);
+	auto n = recvfrom((socket_t)discoverySock_, buf, sizeof(buf) - 1, 0, (sockaddr *)&from, &fromLen);
+	if (n <= 0) {
+		return;
+	}
+	buf[n] = '\0';
+
+	auto magicLen = strlen(PEER_QUERY_MAGIC);
+	if ((size_t)n <= magicLen || strncmp(buf, PEER_QUERY_MAGIC, magicLen) != 0) {
+		return;
+	}
+	std::string key(buf + magicLen);
+
+	unsigned short port = 0;
+	{
+		std::unique_lock<std::mutex> lck(lock_);
+		if (published_.find(key) == published_.end()) {
+			// keep quiet, someone else may have it
+			return;
+		}
+		port = opts_.port;
+	}
+
+	std::string reply = PEER_REPLY_MAGIC + key + " " + std::to_string(port);
+	sendto((socket_t)discoverySock_, reply.data(), (int)reply.size(), 0, (sockaddr *)&from, fromLen);
+}
+
+std::vector<std::string> PeerCache::Discover(const std::string &key) {
+	auto s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (s == INVALID_SOCK) {
+		return {};
+	}
+
+	// stay on the local network
+	int ttl = 1;
+	setsockopt(s, IPPROTO_IP, IP_MULTICAST_TTL, (const char *)&ttl, sizeof(ttl));
+
+	sockaddr_in group = { 0 };
+	group.sin_family = AF_INET;
+	group.sin_port = htons(SPARKLE_PEER_DISCOVERY_PORT);
+	inet_pton(AF_INET, SPARKLE_PEER_DISCOVERY_GROUP, &group.sin_addr);
+
+	std::vector<std::string> peers;
+	std::string query = PEER_QUERY_MAGIC + key;
+	if (sendto(s, query.data(), (int)query.size(), 0, (sockaddr *)&group, sizeof(group)) > 0) {
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(PEER_DISCOVERY_TIMEOUT_MS);
+		while (true) {
+			auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+			if (left <= 0) {
+				break;
+			}
+
+			pollfd pfd = {};
+			pfd.fd = s;
+			pfd.events = POLLIN;
+			if (poll_sockets(&pfd, 1, (int)left) <= 0) {
+				break;
+			}
+
+			char buf[256];
+			sockaddr_in from = { 0 };
+			socklen_t fromLen = sizeof(from);
+			auto n = recvfrom(s, buf, sizeof(buf) - 1, 0, (sockaddr *)&from, &fromLen);
+			if (n <= 0) {
+				continue;
+			}
+			buf[n] = '\0';
+
+			// "SPARKLE-PEER! <key> <port>"
+			auto expected = PEER_REPLY_MAGIC + key + " ";
+			if ((size_t)n <= expected.size() || strncmp(buf, expected.c_str(), expected.size()) != 0) {
+				continue;
+			}
+			auto port = strtoul(buf + expected.size(), nullptr, 10);
+			if (!port || port > 0xffff) {
+				continue;
+			}
+
+			char host[INET_ADDRSTRLEN] = { 0 };
+			inet_ntop(AF_INET, &from.sin_addr, host, sizeof(host));
+			peers.emplace_back(std::string(host) + ":" + std::to_string(port));
+		}
+	}
+
+	close_socket(s);
+	return peers;
+}
+
+} //namespace SparkleLite
@@ -0,0 +1,72 @@
+#ifndef _PEER_CACHE_H_
+#define _PEER_CACHE_H_
+
+#include "sparkle_internal.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace SparkleLite {
+
+// UDP port (and multicast group) used by peers to find each other on the LAN
+#define SPARKLE_PEER_DISCOVERY_GROUP ("239.255.83.76")
+#define SPARKLE_PEER_DISCOVERY_PORT (28381)
+
+struct PeerCacheOptions {
+	unsigned short port = 0; // port to serve verified packages on, 0 for client only
+	std::vector<std::string> peers; // explicitly configured peers, "host:port"
+	bool multicast = false; // discover peers through local multicast
+};
+
+//
+// A tiny LAN cache, it serves packages that were already downloaded and verified by this process,
+// and locates peers that have the package we need
+//
+class PeerCache {
+public:
+	~PeerCache();
+
+	bool Enable(const PeerCacheOptions &opts);
+
+	void Disable();
+
+	bool IsEnabled();
+
+	// make a verified package available to other peers
+	void Publish(const std::string &key, const std::string &file);
+
+	// all candidate URLs the package with [key] may be fetched from, configured peers go first
+	std::vector<std::string> Locate(const std::string &key);
+
+	// a stable identity of an enclosure, empty if it's not signed (we never trust unsigned packages from peers)
+	static std::string PackageKey(const AppcastEnclosure &enclosure);
+
+private:
+	void ServeLoop();
+
+	void ServeConnection(intptr_t conn);
+
+	void ReplyDiscovery();
+
+	std::vector<std::string> Discover(const std::string &key);
+
+private:
+	std::mutex lock_;
+	std::condition_variable idleCond_;
+	PeerCacheOptions opts_;
+	std::map<std::string, std::string> published_;
+	std::thread server_;
+	std::atomic<bool> stopping_{ false };
+	bool enabled_ = false;
+	int activeConns_ = 0;
+	intptr_t listenSock_ = -1;
+	intptr_t discoverySock_ = -1;
+};
+} //namespace SparkleLite
+
+#endif //_PEER_CACHE_H_
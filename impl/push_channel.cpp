@@ -0,0 +1,258 @@
+#include "push_channel.h"
+#include "update_scheduler.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace SparkleLite {
+
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+
+#define EVENT_STREAM_MIME "text/event-stream"
+#define APPCAST_CHANGED_EVENT "appcast-changed"
+
+// one connection worth of server-sent events
+struct EventStream {
+	std::function<void()> onChanged;
+	bool checked = false; // is it an event stream at all
+	bool isEventStream = false;
+	bool connected = false;
+	bool resync = false; // the previous connection was lost, events may have been missed
+	bool lastCR = false;
+	std::string line;
+	std::string eventType;
+	bool hasEvent = false;
+	std::string lastEventId; // across connections
+	long long retryMs = -1;
+
+	void Feed(const char *data, size_t size) {
+		for (size_t idx = 0; idx < size; idx++) {
+			auto c = data[idx];
+			// lines end with CRLF, LF or CR
+			if (c == '\n' && lastCR) {
+				lastCR = false;
+				continue;
+			}
+			lastCR = (c == '\r');
+			if (c == '\r' || c == '\n') {
+				OnLine();
+				line.clear();
+			} else {
+				line.push_back(c);
+			}
+		}
+	}
+
+	void OnLine() {
+		if (line.empty()) {
+			Dispatch();
+			return;
+		}
+		if (line[0] == ':') {
+			// a comment, servers send them as heartbeats
+			return;
+		}
+
+		auto pos = line.find(':');
+		auto field = line.substr(0, pos);
+		std::string value;
+		if (pos != std::string::npos) {
+			value = line.substr(pos + 1);
+			if (!value.empty() && value[0] == ' ') {
+				value.erase(0, 1);
+			}
+		}
+
+		if (field == "event") {
+			eventType = value;
+			hasEvent = true;
+		} else if (field == "data") {
+			hasEvent = true;
+		} else if (field == "id") {
+			if (value.find('\0') == std::string::npos) {
+				lastEventId = value;
+			}
+		} else if (field == "retry") {
+			if (!value.empty() && std::all_of(value.begin(), value.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+				retryMs = std::strtoll(value.c_str(), nullptr, 10);
+			}
+		}
+	}
+
+	void Dispatch() {
+		// #NOTE: unlike browsers, an event without data still counts ("event: appcast-changed" alone)
+		if (hasEvent && (eventType.empty() || eventType == "message" || eventType == APPCAST_CHANGED_EVENT)) {
+			onChanged();
+		}
+		eventType.clear();
+		hasEvent = false;
+	}
+};
+
+static bool on_stream_data(void *ctx, const HttpHeaders &headers, const void *data, size_t size) {
+	auto stream = (EventStream *)ctx;
+	if (!stream->checked) {
+		stream->checked = true;
+		auto contentType = simple_http_find_header(headers, "Content-Type");
+		stream->isEventStream = contentType && strncasecmp(contentType->c_str(), EVENT_STREAM_MIME, strlen(EVENT_STREAM_MIME)) == 0;
+		if (stream->isEventStream && stream->resync) {
+			// back again, catch up with what may have happened meanwhile
+			stream->onChanged();
+		}
+	}
+	stream->connected = true;
+
+	// the body of a long poll doesn't matter, only that it's been answered
+	if (stream->isEventStream) {
+		stream->Feed((const char *)data, size);
+	}
+	return true;
+}
+
+PushChannel::~PushChannel() {
+	Stop();
+}
+
+bool PushChannel::Start(const Options &opts, PushCheckTask &&check) {
+	if (!check || opts.url.empty() || opts.idleTimeout.count() <= 0) {
+		return false;
+	}
+
+	Stop();
+
+	std::unique_lock<std::mutex> lck(lock_);
+	stop_ = std::make_shared<std::atomic<bool>>(false);
+	checkPending_ = false;
+	checker_ = std::thread(&PushChannel::RunChecks, this, std::move(check), stop_);
+	listener_ = std::thread(&PushChannel::Listen, this, opts, stop_);
+	return true;
+}
+
+void PushChannel::Stop() {
+	std::thread listener, checker;
+	{
+		std::unique_lock<std::mutex> lck(lock_);
+		if (stop_) {
+			*stop_ = true;
+			stop_.reset();
+		}
+		listener = std::move(listener_);
+		checker = std::move(checker_);
+	}
+	cond_.notify_all();
+
+	// the listener notices within a second even when blocked on a quiet connection,
+	// and a check may stop the channel from inside the new-version callback
+	for (auto worker : { &listener, &checker }) {
+		if (worker->joinable()) {
+			if (worker->get_id() == std::this_thread::get_id()) {
+				worker->detach();
+			} else {
+				worker->join();
+			}
+		}
+	}
+}
+
+bool PushChannel::IsRunning() {
+	std::unique_lock<std::mutex> lck(lock_);
+	return listener_.joinable();
+}
+
+void PushChannel::Listen(Options opts, StopFlag stop) {
+	unsigned failures = 0;
+	bool lost = false; // we may have missed an event
+	std::string lastEventId;
+	long long serverRetryMs = -1;
+
+	while (!*stop) {
+		auto headers = opts.headers;
+		headers["Accept"] = EVENT_STREAM_MIME ", */*;q=0.5";
+		headers["Cache-Control"] = "no-cache";
+		if (!lastEventId.empty()) {
+			headers["Last-Event-ID"] = lastEventId;
+		}
+
+		EventStream stream;
+		stream.lastEventId = lastEventId;
+		stream.resync = lost;
+		stream.onChanged = [this]() { RequestCheck(); };
+
+		auto start = std::chrono::steady_clock::now();
+		HttpHeaders respHeaders;
+		auto status = simple_http_stream(opts.url, headers, respHeaders, opts.idleTimeout, *stop, on_stream_data, &stream);
+		if (*stop) {
+			break;
+		}
+
+		lastEventId = stream.lastEventId;
+		if (stream.retryMs >= 0) {
+			serverRetryMs = stream.retryMs;
+		}
+		if (stream.connected) {
+			failures = 0;
+			lost = false;
+		}
+
+		milliseconds delay{ 0 };
+		bool answered = (status >= 200 && status < 300) || status == 304;
+		if (answered && stream.isEventStream) {
+			// the server closed the stream, come back as it asked
+			delay = serverRetryMs >= 0 ? milliseconds(serverRetryMs) : opts.retryBase;
+			// without an id the server can't replay what happens meanwhile
+			lost = lastEventId.empty();
+		} else if (answered) {
+			// a long poll was answered, ask again right away (but not in a busy loop)
+			failures = 0;
+			if (status == 200 || lost) {
+				RequestCheck();
+			}
+			lost = false;
+			auto elapsed = std::chrono::duration_cast<milliseconds>(std::chrono::steady_clock::now() - start);
+			delay = std::max<milliseconds>(opts.retryBase - elapsed, milliseconds(0));
+		} else {
+			delay = jittered_backoff(opts.retryBase, opts.retryCap, failures++, rng_);
+			auto retryAfter = simple_http_retry_after(respHeaders);
+			if (retryAfter >= 0) {
+				delay = std::min<milliseconds>(std::max<milliseconds>(delay, seconds(retryAfter)), opts.retryCap);
+			}
+			lost = true;
+		}
+
+		if (!Wait(delay, stop)) {
+			break;
+		}
+	}
+}
+
+void PushChannel::RunChecks(PushCheckTask check, StopFlag stop) {
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lck(lock_);
+			cond_.wait(lck, [&]() { return checkPending_ || *stop; });
+			if (*stop) {
+				break;
+			}
+			checkPending_ = false;
+		}
+
+		// a burst of events while it runs is a single check afterwards
+		check();
+	}
+}
+
+void PushChannel::RequestCheck() {
+	{
+		std::unique_lock<std::mutex> lck(lock_);
+		checkPending_ = true;
+	}
+	cond_.notify_all();
+}
+
+bool PushChannel::Wait(milliseconds delay, const StopFlag &stop) {
+	std::unique_lock<std::mutex> lck(lock_);
+	return !cond_.wait_for(lck, delay, [&]() { return stop->load(); });
+}
+
+} //namespace SparkleLite
@@ -0,0 +1,71 @@
+#ifndef _PUSH_CHANNEL_H_
+#define _PUSH_CHANNEL_H_
+
+#include "simple_http.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+
+namespace SparkleLite {
+
+//
+// What the server tells through the notification URL:
+//	+ server-sent events (Content-Type: text/event-stream): an "appcast-changed" (or unnamed) event means the appcast changed,
+//	  other events (e.g. "ping") and comments only keep the connection alive, "id:" is sent back as Last-Event-ID on reconnect
+//	  and "retry:" sets the reconnect delay
+//	+ anything else is a long poll: the server holds the request until the appcast changes (200),
+//	  or answers 204 / 304 when nothing did
+//
+using PushCheckTask = std::function<void()>;
+
+class PushChannel {
+public:
+	struct Options {
+		std::string url;
+		HttpHeaders headers;
+		std::chrono::seconds idleTimeout{ 90 }; // without a byte (event or heartbeat) the connection is dead
+		std::chrono::milliseconds retryBase{ 1000 };
+		std::chrono::milliseconds retryCap{ 5 * 60 * 1000 };
+	};
+
+	~PushChannel();
+
+	// [check] runs on a worker thread of its own, events arriving meanwhile are coalesced into one more run
+	bool Start(const Options &opts, PushCheckTask &&check);
+
+	void Stop();
+
+	bool IsRunning();
+
+private:
+	// the workers of one Start share [stop], a detached worker still sees it set when the channel is started again
+	using StopFlag = std::shared_ptr<std::atomic<bool>>;
+
+	// keep a connection open, reconnect with a jittered backoff when it's lost
+	void Listen(Options opts, StopFlag stop);
+
+	void RunChecks(PushCheckTask check, StopFlag stop);
+
+	void RequestCheck();
+
+	// false if stopping
+	bool Wait(std::chrono::milliseconds delay, const StopFlag &stop);
+
+private:
+	std::mutex lock_;
+	std::condition_variable cond_;
+	std::thread listener_;
+	std::thread checker_;
+	StopFlag stop_;
+	bool checkPending_ = false;
+	std::mt19937 rng_{ std::random_device{}() };
+};
+} //namespace SparkleLite
+
+#endif //_PUSH_CHANNEL_H_
@@ -0,0 +1,289 @@
+#include "session_state.h"
+#include "sparkle_internal.h"
+#include "third_party/mio.hpp"
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <string_view>
+#include <system_error>
+
+namespace SparkleLite {
+
+namespace fs = std::filesystem;
+
+#define SESSION_STATE_MAGIC ("SPARKLE-SESSION 1\n")
+
+// how much of the head and of the tail the memo hashes
+#define SAMPLE_SIZE (64 * 1024)
+
+static std::string HexDigest(const unsigned char *digest, size_t size) {
+	static const char hex[] = "0123456789abcdef";
+	std::string out;
+	out.reserve(size * 2);
+	for (size_t idx = 0; idx < size; idx++) {
+		out.push_back(hex[digest[idx] >> 4]);
+		out.push_back(hex[digest[idx] & 0x0f]);
+	}
+	return out;
+}
+
+// one field a line, so line breaks (descriptions have them) are escaped
+static std::string Escape(const std::string &value) {
+	std::string out;
+	out.reserve(value.size());
+	for (auto c : value) {
+		switch (c) {
+			case '\\':
+				out += "\\\\";
+				break;
+			case '\n':
+				out += "\\n";
+				break;
+			case '\r':
+				out += "\\r";
+				break;
+			default:
+				out.push_back(c);
+		}
+	}
+	return out;
+}
+
+static std::string Unescape(std::string_view value) {
+	std::string out;
+	out.reserve(value.size());
+	for (size_t idx = 0; idx < value.size(); idx++) {
+		auto c = value[idx];
+		if (c == '\\' && idx + 1 < value.size()) {
+			c = value[++idx];
+			if (c == 'n') {
+				c = '\n';
+			} else if (c == 'r') {
+				c = '\r';
+			}
+		}
+		out.push_back(c);
+	}
+	return out;
+}
+
+static bool SampleFile(const std::string &path, uint64_t size, std::string &sample) {
+	std::error_code error;
+	mio::mmap_source mmap;
+	if (size > 0) {
+		mmap = mio::make_mmap_source(path, error);
+		if (error || mmap.size() != size) {
+			return false;
+		}
+	}
+
+	// only the pages touched are read
+	auto head = std::min<size_t>(mmap.size(), SAMPLE_SIZE);
+	auto tail = std::min<size_t>(mmap.size() - head, SAMPLE_SIZE);
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	unsigned int digestSize = 0;
+	auto ctx = EVP_MD_CTX_new();
+	auto ok = ctx &&
+			EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr) == 1 &&
+			EVP_DigestUpdate(ctx, mmap.data(), head) == 1 &&
+			EVP_DigestUpdate(ctx, mmap.data() + mmap.size() - tail, tail) == 1 &&
+			EVP_DigestFinal_ex(ctx, digest, &digestSize) == 1;
+	EVP_MD_CTX_free(ctx);
+	if (!ok) {
+		return false;
+	}
+	sample = HexDigest(digest, digestSize);
+	return true;
+}
+
+bool SessionState::Enable(const std::string &path) {
+	std::error_code error;
+	auto dir = fs::path(path).parent_path();
+	if (!dir.empty()) {
+		fs::create_directories(dir, error);
+		if (!fs::is_directory(dir, error)) {
+			return false;
+		}
+	}
+
+	std::unique_lock<std::mutex> lck(lock_);
+	path_ = path;
+	return true;
+}
+
+void SessionState::Disable() {
+	std::unique_lock<std::mutex> lck(lock_);
+	path_.clear();
+}
+
+bool SessionState::IsEnabled() {
+	std::unique_lock<std::mutex> lck(lock_);
+	return !path_.empty();
+}
+
+//
+// the file is a list of fields after the magic line:
+//
+//	SPARKLE-SESSION 1
+//	<name>: <escaped value>
+//	...
+//
+bool SessionState::Read(Fields &fields) {
+	std::unique_lock<std::mutex> lck(lock_);
+	if (path_.empty()) {
+		return false;
+	}
+
+	std::error_code error;
+	mio::mmap_source mmap = mio::make_mmap_source(path_, error);
+	if (error || mmap.size() < strlen(SESSION_STATE_MAGIC)) {
+		return false;
+	}
+
+	std::string_view content(mmap.data(), mmap.size());
+	if (content.compare(0, strlen(SESSION_STATE_MAGIC), SESSION_STATE_MAGIC) != 0) {
+		return false;
+	}
+	return Parse(content.substr(strlen(SESSION_STATE_MAGIC)), fields);
+}
+
+bool SessionState::Write(const Fields &fields) {
+	std::unique_lock<std::mutex> lck(lock_);
+	if (path_.empty()) {
+		return false;
+	}
+
+	auto content = SESSION_STATE_MAGIC + Serialize(fields);
+
+	// write aside, then swap it in
+	std::random_device rd;
+	auto tmpPath = path_ + "." + std::to_string(rd()) + ".tmp";
+	FILE *fd = nullptr;
+	if (fopen_s(&fd, tmpPath.c_str(), "wb") != 0 || !fd) {
+		return false;
+	}
+	auto ok = fwrite(content.data(), 1, content.size(), fd) == content.size();
+	ok = fclose(fd) == 0 && ok;
+
+	std::error_code error;
+	if (ok) {
+		fs::rename(tmpPath, path_, error);
+		ok = !error;
+	}
+	if (!ok) {
+		fs::remove(tmpPath, error);
+	}
+	return ok;
+}
+
+std::string SessionState::Serialize(const Fields &fields) {
+	std::string content;
+	for (const auto &[name, value] : fields) {
+		content += name + ": " + Escape(value) + "\n";
+	}
+	return content;
+}
+
+bool SessionState::Parse(std::string_view content, Fields &fields) {
+	fields.clear();
+	size_t pos = 0;
+	while (pos < content.size()) {
+		auto end = content.find('\n', pos);
+		if (end == std::string_view::npos) {
+			// cut short, don't trust any of it
+			fields.clear();
+			return false;
+		}
+		auto line = content.substr(pos, end - pos);
+		pos = end + 1;
+
+		auto colon = line.find(": ");
+		if (colon == std::string_view::npos) {
+			continue;
+		}
+		fields[std::string(line.substr(0, colon))] = Unescape(line.substr(colon + 2));
+	}
+	return true;
+}
+
+bool SessionState::Stamp(const std::string &path, const std::string &signature, const std::string &key, VerifiedFile &verified) {
+	VerifiedFile stamped;
+	stamped.path = path;
+	stamped.signature = signature;
+	stamped.key = key;
+	if (!get_file_identity(path, stamped.identity) ||
+			!SampleFile(path, stamped.identity.size, stamped.sample)) {
+		return false;
+	}
+	verified = std::move(stamped);
+	return true;
+}
+
+bool SessionState::IsUnchanged(const VerifiedFile &verified, const std::string &path, const std::string &signature, const std::string &key) {
+	if (verified.IsEmpty() || verified.path != path || verified.signature != signature || verified.key != key) {
+		return false;
+	}
+
+	FileIdentity identity;
+	if (!get_file_identity(path, identity) || !(identity == verified.identity)) {
+		return false;
+	}
+
+	// the identity can be faked (a copy with the time set back), the ends of the content hardly at the same time
+	std::string sample;
+	return SampleFile(path, identity.size, sample) && sample == verified.sample;
+}
+
+std::string SessionState::KeyDigest(const std::string &key) {
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	SHA256((const unsigned char *)key.data(), key.size(), digest);
+	return HexDigest(digest, sizeof(digest));
+}
+
+void SessionState::PutVerifiedFile(const VerifiedFile &verified, Fields &fields) {
+	if (verified.IsEmpty()) {
+		return;
+	}
+	fields["package"] = verified.path;
+	fields["package-signature"] = verified.signature;
+	fields["package-key"] = verified.key;
+	fields["package-size"] = std::to_string(verified.identity.size);
+	fields["package-mtime"] = std::to_string(verified.identity.mtime);
+	fields["package-device"] = std::to_string(verified.identity.device);
+	fields["package-inode"] = std::to_string(verified.identity.inode);
+	fields["package-sample"] = verified.sample;
+}
+
+bool SessionState::GetVerifiedFile(const Fields &fields, VerifiedFile &verified) {
+	auto field = [&](const char *name) -> const std::string * {
+		auto it = fields.find(name);
+		return it == fields.end() ? nullptr : &it->second;
+	};
+	auto path = field("package");
+	auto signature = field("package-signature");
+	auto key = field("package-key");
+	auto size = field("package-size");
+	auto mtime = field("package-mtime");
+	auto device = field("package-device");
+	auto inode = field("package-inode");
+	auto sample = field("package-sample");
+	if (!path || path->empty() || !signature || !key || !size || !mtime || !device || !inode || !sample) {
+		return false;
+	}
+
+	verified.path = *path;
+	verified.signature = *signature;
+	verified.key = *key;
+	verified.identity.size = std::strtoull(size->c_str(), nullptr, 10);
+	verified.identity.mtime = std::strtoll(mtime->c_str(), nullptr, 10);
+	verified.identity.device = std::strtoull(device->c_str(), nullptr, 10);
+	verified.identity.inode = std::strtoull(inode->c_str(), nullptr, 10);
+	verified.sample = *sample;
+	return true;
+}
+
+} //namespace SparkleLite
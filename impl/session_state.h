@@ -0,0 +1,74 @@
+#ifndef _SESSION_STATE_H_
+#define _SESSION_STATE_H_
+
+#include "os_support.h"
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+namespace SparkleLite {
+
+//
+// What a restart between download and install shouldn't lose, kept in one small file:
+//
+//	+ the selected update, as named fields, for the app version and appcast it was selected for
+//	+ the downloaded package and its verification memo: the file's identity when its signature passed,
+//	  and a hash of its head and tail, so it's trusted again without hashing it whole
+//	+ replaced by rename, a crash leaves either the old state or the new one
+//
+// #NOTE: the memo is only as trustworthy as the state file and the package directory,
+// both must not be writable by anyone the package itself wouldn't be
+//
+class SessionState {
+public:
+	using Fields = std::map<std::string, std::string>;
+
+	// a file whose signature passed, and how it was then
+	struct VerifiedFile {
+		std::string path;
+		std::string signature;
+		std::string key; // digest of the public key it was verified with
+		FileIdentity identity;
+		std::string sample; // digest of the head and the tail
+
+		bool IsEmpty() const {
+			return path.empty();
+		}
+	};
+
+	bool Enable(const std::string &path);
+
+	void Disable();
+
+	bool IsEnabled();
+
+	bool Read(Fields &fields);
+
+	bool Write(const Fields &fields);
+
+	// one "<name>: <value>" line a field, line breaks in values are escaped
+	static std::string Serialize(const Fields &fields);
+
+	static bool Parse(std::string_view content, Fields &fields);
+
+	// memo a file just verified, false if it can't be read
+	static bool Stamp(const std::string &path, const std::string &signature, const std::string &key, VerifiedFile &verified);
+
+	// is [path] still the very file verified with [signature] and [key]
+	static bool IsUnchanged(const VerifiedFile &verified, const std::string &path, const std::string &signature, const std::string &key);
+
+	static std::string KeyDigest(const std::string &key);
+
+	static void PutVerifiedFile(const VerifiedFile &verified, Fields &fields);
+
+	static bool GetVerifiedFile(const Fields &fields, VerifiedFile &verified);
+
+private:
+	std::mutex lock_;
+	std::string path_;
+};
+
+} //namespace SparkleLite
+
+#endif //_SESSION_STATE_H_
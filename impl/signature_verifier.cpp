@@ -3,10 +3,18 @@
 #include <openssl/dsa.h>
 #include <openssl/err.h>
 #include <openssl/pem.h>
-#include <openssl/sha.h>
+#include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <vector>
 
+#ifdef _WIN32
+#include <io.h>
+#endif
+
 #ifdef _MSC_VER
 #pragma comment(lib, "crypt32.lib")
 #endif
@@ -96,35 +104,90 @@ std::string base64Decode(const std::string &base64String) {
 	return std::move(result);
 }
 
-bool DSAVerifySHA1(const std::string &sha1Data, SignatureAlgo type, const std::string &signatureBase64, const std::string &pemPubKey) {
-	if (sha1Data.empty()) {
-		return false;
+//
+// a public key parsed once and shared by every verification with it
+//
+struct VerifyKey {
+	DSA *dsa = nullptr;
+	EVP_PKEY *ed25519 = nullptr;
+
+	~VerifyKey() {
+		if (dsa) {
+			DSA_free(dsa);
+		}
+		if (ed25519) {
+			EVP_PKEY_free(ed25519);
+		}
+	}
+};
+
+static std::mutex verifyKeysLock;
+static std::map<std::pair<SignatureAlgo, std::string>, std::shared_ptr<const VerifyKey>> verifyKeys;
+
+// a key pasted from a file often comes with a line break, or blanks around it
+static std::string trim_key(const std::string &key) {
+	auto begin = std::find_if(key.begin(), key.end(), [](char c) { return !std::isspace((unsigned char)c); });
+	auto end = std::find_if(key.rbegin(), key.rend(), [](char c) { return !std::isspace((unsigned char)c); }).base();
+	return begin < end ? std::string(begin, end) : std::string();
+}
+
+static std::shared_ptr<const VerifyKey> ParseVerifyKey(SignatureAlgo type, const std::string &key) {
+	auto parsed = std::make_shared<VerifyKey>();
+	if (type == SignatureAlgo::kDSA) {
+		// resolve PEM PUBLIC KEY
+		BIO *bio = BIO_new_mem_buf(key.data(), (int)key.size());
+		if (bio) {
+			PEM_read_bio_DSA_PUBKEY(bio, &parsed->dsa, nullptr, nullptr);
+			BIO_free(bio);
+		}
+		return parsed->dsa ? parsed : nullptr;
+	}
+	if (type == SignatureAlgo::kEd25519) {
+		// decode the base64 encoded ed25519 public key
+		auto rawPubKey = base64Decode(trim_key(key));
+		if (!rawPubKey.empty()) {
+			parsed->ed25519 = EVP_PKEY_new_raw_public_key(EVP_PKEY_ED25519, nullptr, (const unsigned char *)rawPubKey.data(), rawPubKey.size());
+		}
+		return parsed->ed25519 ? parsed : nullptr;
+	}
+	return nullptr;
+}
+
+// nullptr if it's not a valid key, which is remembered as well
+static std::shared_ptr<const VerifyKey> GetVerifyKey(SignatureAlgo type, const std::string &key) {
+	if (key.empty()) {
+		return nullptr;
 	}
 
-	BIO *bio = BIO_new_mem_buf(pemPubKey.data(), (int)pemPubKey.size());
-	if (!bio) {
+	std::unique_lock<std::mutex> lck(verifyKeysLock);
+	auto it = verifyKeys.find({ type, key });
+	if (it != verifyKeys.end()) {
+		return it->second;
+	}
+	auto parsed = ParseVerifyKey(type, key);
+	verifyKeys[{ type, key }] = parsed;
+	return parsed;
+}
+
+bool DSAVerifySHA1(const std::string &sha1Data, SignatureAlgo type, const std::string &signatureBase64, const std::string &pemPubKey) {
+	if (sha1Data.empty()) {
 		return false;
 	}
 
-	// resolve PEM PUBLIC KEY
-	DSA *dsa = nullptr;
-	if (!PEM_read_bio_DSA_PUBKEY(bio, &dsa, nullptr, nullptr)) {
-		BIO_free(bio);
+	auto key = GetVerifyKey(SignatureAlgo::kDSA, pemPubKey);
+	if (!key) {
 		return false;
 	}
 
 	// decode the base64 encoded signature
 	auto signature = base64Decode(signatureBase64);
 	if (signature.empty()) {
-		BIO_free(bio);
 		return false;
 	}
 
 	// verify data = sha1(sha1Data)
 	auto verifyData = sha1MemBuffer(sha1Data.data(), sha1Data.size());
 	if (verifyData.empty()) {
-		BIO_free(bio);
-		DSA_free(dsa);
 		return false;
 	}
 
@@ -132,11 +195,9 @@ bool DSAVerifySHA1(const std::string &sha1Data, SignatureAlgo type, const std::s
 	auto ret = DSA_verify(0,
 			(const unsigned char *)verifyData.data(), (int)verifyData.size(),
 			(const unsigned char *)signature.c_str(), (int)signature.size(),
-			dsa);
+			key->dsa);
 
 	// done
-	BIO_free(bio);
-	DSA_free(dsa);
 	return ret == 1;
 }
 
@@ -148,17 +209,12 @@ bool Ed25519Verify(const std::string_view p, SignatureAlgo type, const std::stri
 		return false;
 	}
 
-	// decode the base64 encoded ed25519 public key
-	auto rawPubKey = base64Decode(base64RawPubKey);
-	if (rawPubKey.empty()) {
-		return false;
-	}
-
 	// resolve the public key
-	auto pubKey = EVP_PKEY_new_raw_public_key(EVP_PKEY_ED25519, nullptr, (const unsigned char *)rawPubKey.data(), rawPubKey.size());
-	if (!pubKey) {
+	auto key = GetVerifyKey(SignatureAlgo::kEd25519, base64RawPubKey);
+	if (!key) {
 		return false;
 	}
+	auto pubKey = key->ed25519;
 
 	int ret = -1;
 	EVP_MD_CTX *md_ctx = nullptr;
@@ -199,7 +255,6 @@ bool Ed25519Verify(const std::string_view p, SignatureAlgo type, const std::stri
 	if (fd) {
 		fclose(fd);
 	}
-	EVP_PKEY_free(pubKey);
 	return ret == 1;
 }
 
@@ -235,46 +290,106 @@ bool VerifyDataBuffer(const void *dataBuffer, size_t dataSize, SignatureAlgo typ
 	}
 }
 
-bool IsValidDSAPubKey(const std::string &pem) {
-	if (pem.empty()) {
-		return false;
+StreamVerifier::StreamVerifier(SignatureAlgo type, const std::string &signatureBase64, const std::string &pemPubKey) :
+		type_(type), signature_(signatureBase64), pubKey_(pemPubKey) {
+	assert(type != SignatureAlgo::kNone);
+	if (signature_.empty() || pubKey_.empty()) {
+		failed_ = true;
+		return;
 	}
 
-	BIO *bio = BIO_new_mem_buf(pem.data(), (int)pem.size());
-	if (!bio) {
-		return false;
+	switch (type_) {
+		case SignatureAlgo::kDSA:
+			SHA1_Init(&sha1_);
+			break;
+		case SignatureAlgo::kEd25519:
+			spool_ = tmpfile();
+			failed_ = spool_ == nullptr;
+			break;
+		default:
+			failed_ = true;
+			break;
 	}
+}
 
-	// resolve PEM PUBLIC KEY
-	DSA *dsa = nullptr;
-	if (!PEM_read_bio_DSA_PUBKEY(bio, &dsa, nullptr, nullptr)) {
-		BIO_free(bio);
+StreamVerifier::~StreamVerifier() {
+	if (spool_) {
+		// it's deleted automatically once closed
+		fclose(spool_);
+	}
+}
+
+bool StreamVerifier::Update(const void *data, size_t size) {
+	if (failed_) {
 		return false;
 	}
+	if (!size) {
+		return true;
+	}
 
-	DSA_free(dsa);
-	BIO_free(bio);
-	return true;
+	if (type_ == SignatureAlgo::kDSA) {
+		SHA1_Update(&sha1_, data, size);
+	} else if (fwrite(data, 1, size, spool_) != size) {
+		failed_ = true;
+	}
+	return !failed_;
 }
 
-bool IsValidEd25519Key(const std::string &key) {
-	if (key.empty()) {
+bool StreamVerifier::Final() {
+	if (failed_) {
+		return false;
+	}
+
+	if (type_ == SignatureAlgo::kDSA) {
+		std::string digest;
+		digest.resize(SHA_DIGEST_LENGTH);
+		SHA1_Final((unsigned char *)&digest[0], &sha1_);
+		return DSAVerifySHA1(digest, type_, signature_, pubKey_);
+	}
+
+	if (fflush(spool_) != 0) {
 		return false;
 	}
 
-	// decode the base64 encoded ed25519 public key
-	auto rawPubKey = base64Decode(key);
-	if (rawPubKey.empty()) {
+	std::error_code error;
+#ifdef _WIN32
+	auto handle = (mio::file_handle_type)_get_osfhandle(_fileno(spool_));
+#else
+	auto handle = fileno(spool_);
+#endif
+	mio::mmap_source mmap = mio::make_mmap_source(handle, error);
+	if (error) {
 		return false;
 	}
+	return VerifyDataBuffer(mmap.data(), mmap.size(), type_, signature_, pubKey_);
+}
 
-	// resolve the public key
-	auto pubKey = EVP_PKEY_new_raw_public_key(EVP_PKEY_ED25519, nullptr, (const unsigned char *)rawPubKey.data(), rawPubKey.size());
-	if (!pubKey) {
+bool IsValidDSAPubKey(const std::string &pem) {
+	return PrepareVerifyKey(SignatureAlgo::kDSA, pem);
+}
+
+bool IsValidEd25519Key(const std::string &key) {
+	return PrepareVerifyKey(SignatureAlgo::kEd25519, key);
+}
+
+bool PrepareVerifyKey(SignatureAlgo type, const std::string &key) {
+	return GetVerifyKey(type, key) != nullptr;
+}
+
+bool IsWellFormedDSAPubKey(const std::string &pem) {
+	auto begin = pem.find("-----BEGIN PUBLIC KEY-----");
+	return begin != std::string::npos && pem.find("-----END PUBLIC KEY-----", begin) != std::string::npos;
+}
+
+bool IsWellFormedEd25519Key(const std::string &untrimmed) {
+	// 32 bytes, base64 encoded
+	auto key = trim_key(untrimmed);
+	if (key.size() != 44 || key.back() != '=') {
 		return false;
 	}
-	EVP_PKEY_free(pubKey);
-	return true;
+	return std::all_of(key.begin(), key.end() - 1, [](char c) {
+		return std::isalnum((unsigned char)c) || c == '+' || c == '/';
+	});
 }
 
 } //namespace SparkleLite
@@ -2,7 +2,9 @@
 #define _signatureverifier_h_
 
 #include "sparkle_internal.h"
+#include <openssl/sha.h>
 #include <cstdint>
+#include <cstdio>
 #include <string>
 
 namespace SparkleLite {
@@ -10,10 +12,52 @@ bool IsValidDSAPubKey(const std::string &pem);
 
 bool IsValidEd25519Key(const std::string &key);
 
+//
+// parse a public key once, every later verification with it takes the parsed one,
+// false if it's not a valid key
+//
+bool PrepareVerifyKey(SignatureAlgo type, const std::string &key);
+
+//
+// cheap shape checks without parsing anything, for the startup path
+//
+bool IsWellFormedDSAPubKey(const std::string &pem);
+
+bool IsWellFormedEd25519Key(const std::string &key);
+
 bool VerifyFile(const std::string &fileName, SignatureAlgo type, const std::string &signatureBase64, const std::string &pemPubKey);
 
 bool VerifyDataBuffer(const void *dataBuffer, size_t dataSize, SignatureAlgo type, const std::string &signatureBase64, const std::string &pemPubKey);
 
+//
+// Verify data that arrives chunk by chunk, feed every chunk to Update() and get the verdict from Final()
+//
+// #NOTE
+// DSA signs the SHA1 digest so it's verified on the fly, while Ed25519 (PureEdDSA) needs the whole message at once,
+// so the chunks are spooled to an anonymous temporary file and verified from a mapping of it in Final()
+//
+class StreamVerifier {
+public:
+	StreamVerifier(SignatureAlgo type, const std::string &signatureBase64, const std::string &pemPubKey);
+
+	~StreamVerifier();
+
+	StreamVerifier(const StreamVerifier &) = delete;
+	StreamVerifier &operator=(const StreamVerifier &) = delete;
+
+	bool Update(const void *data, size_t size);
+
+	bool Final();
+
+private:
+	SignatureAlgo type_;
+	std::string signature_;
+	std::string pubKey_;
+	bool failed_ = false;
+	SHA_CTX sha1_ = { 0 };
+	FILE *spool_ = nullptr;
+};
+
 } //namespace SparkleLite
 
 #endif // _signatureverifier_h_
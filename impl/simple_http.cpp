@@ -1,7 +1,19 @@
 #include "simple_http.h"
 #include "sparkle_internal.h"
+#include "update_scheduler.h"
 #include <curl/curl.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <algorithm>
+#include <cctype>
+#include <ctime>
+#include <fstream>
+#include <memory>
 #include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 namespace SparkleLite {
@@ -9,6 +21,38 @@ namespace SparkleLite {
 static std::once_flag curlInitFlag;
 static std::string curlProxyInfo;
 static std::mutex curlProxyLock;
+static std::string curlCAPath;
+//
+// the CA bundle read into memory, and parsed into a certificate store only once
+//
+struct CABundle {
+	std::string pem;
+	X509_STORE *store = nullptr;
+
+	~CABundle() {
+		if (store) {
+			X509_STORE_free(store);
+		}
+	}
+};
+static std::shared_ptr<const CABundle> curlCABundle; // loaded on the first https request
+static bool curlCABundleLoaded = false;
+static std::mutex curlCALock;
+static CURLSH *curlShare = nullptr;
+static std::mutex curlShareLocks[CURL_LOCK_DATA_LAST];
+static HttpRetryPolicy curlRetryPolicy;
+static std::mutex curlRetryPolicyLock;
+
+//
+// smoothed latencies per host (like TCP's SRTT), the timeouts are derived from them
+//
+struct HostLatency {
+	double connectMs = -1;
+	double firstByteMs = -1;
+};
+static std::unordered_map<std::string, HostLatency> hostLatencies;
+static std::mutex hostLatencyLock;
+#define HOST_LATENCY_LIMIT (256) // hosts remembered, they're only hints
 
 enum class HttpMethod {
 	kGET,
@@ -18,214 +62,904 @@ enum class HttpMethod {
 	kDELETE
 };
 
-template <typename T>
-std::vector<T> split_string(const T &str, const T &delim) {
-	if (str.empty()) {
-		return {};
-	}
-	std::vector<T> result;
-	size_t last = 0;
-	size_t index = str.find_first_of(delim, last);
-	while (index != T::npos) {
-		T tt = str.substr(last, index - last);
-		result.push_back(tt);
-		last = index + delim.size();
-		index = str.find_first_of(delim, last);
-	}
-	if (index - last > 0) {
-		result.push_back(str.substr(last, index - last));
-	}
-	return result;
-}
+// bigger transfer chunks mean fewer callbacks per MB
+#define HTTP_RECEIVE_BUFFER_SIZE (256 * 1024)
 
 struct HttpResponseContext {
 	HttpHeaders respHeaders;
-	HttpContentHandler handler;
+	HttpRawContentHandler handler = nullptr;
+	void *handlerCtx = nullptr;
 	size_t contentLength = 0;
+
+	// state of the current attempt
+	long status = 0;
+	bool headersDone = false;
+	bool discardBody = false; // a retryable error response, keep it away from the handler
+	bool handlerAborted = false;
+	bool resumeMismatch = false;
+	bool mayRetry = false;
+	std::chrono::steady_clock::time_point start;
+	std::chrono::milliseconds firstByteTimeout{ 0 };
+	bool firstByteExpired = false;
+	const std::atomic<bool> *cancel = nullptr; // checked about once a second, even while idle
+	std::chrono::milliseconds idleTimeout{ 0 }; // of a long-lived stream, since the last byte of the body
+	std::chrono::steady_clock::time_point lastData;
+
+	// across attempts
+	HttpHeaders firstHeaders; // of the response the body comes from
+	size_t totalLength = 0; // of the whole body, 0 if unknown
+	size_t delivered = 0; // bytes handed to the handler
 };
 
+static bool is_retryable_status(long status) {
+	return status == 408 || status == 429 || status == 500 || status == 502 || status == 503 || status == 504;
+}
+
+static bool is_transient_error(CURLcode code) {
+	switch (code) {
+		case CURLE_COULDNT_RESOLVE_HOST:
+		case CURLE_COULDNT_CONNECT:
+		case CURLE_OPERATION_TIMEDOUT:
+		case CURLE_PARTIAL_FILE:
+		case CURLE_GOT_NOTHING:
+		case CURLE_SEND_ERROR:
+		case CURLE_RECV_ERROR:
+		case CURLE_SSL_CONNECT_ERROR:
+		case CURLE_HTTP2:
+		case CURLE_HTTP2_STREAM:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// "https://host:port/path" -> "host:port", the key of the latency table
+static std::string url_host_key(const std::string &url) {
+	auto begin = url.find("://");
+	begin = begin == std::string::npos ? 0 : begin + 3;
+	auto end = url.find_first_of("/?#", begin);
+	return url.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+}
+
+static std::chrono::milliseconds derive_timeout(double smoothedMs, const HttpRetryPolicy &policy, std::chrono::milliseconds lower, std::chrono::milliseconds upper) {
+	if (smoothedMs < 0) {
+		// nothing observed yet
+		return upper;
+	}
+	auto timeout = std::chrono::milliseconds((long long)(smoothedMs * policy.rttMultiplier));
+	return std::clamp(timeout, lower, upper);
+}
+
+static void update_latency(double &smoothed, double sample) {
+	smoothed = smoothed < 0 ? sample : smoothed * 7 / 8 + sample / 8;
+}
+
+// "bytes 100-199/1000" -> 100
+static bool parse_content_range_start(const std::string &value, size_t &start) {
+	if (strncasecmp(value.c_str(), "bytes ", 6) != 0 || !std::isdigit((unsigned char)value[6])) {
+		return false;
+	}
+	start = (size_t)std::strtoull(value.c_str() + 6, nullptr, 10);
+	return true;
+}
+
+// the end of a response header block, decide what happens to its body
+static bool on_headers_done(HttpResponseContext *ctx) {
+	ctx->headersDone = true;
+	ctx->discardBody = ctx->mayRetry && is_retryable_status(ctx->status);
+	if (ctx->discardBody || ctx->status < 200) {
+		return true;
+	}
+
+	if (!ctx->delivered) {
+		if (ctx->status < 300) {
+			ctx->firstHeaders = ctx->respHeaders;
+			ctx->totalLength = ctx->contentLength;
+		}
+		return true;
+	}
+
+	// resuming, only the rest of the very same entity may follow what was delivered
+	size_t start = 0;
+	auto range = simple_http_find_header(ctx->respHeaders, "Content-Range");
+	if (ctx->status != 206 || !range || !parse_content_range_start(*range, start) || start != ctx->delivered) {
+		ctx->resumeMismatch = true;
+		return false;
+	}
+	return true;
+}
+
+static std::string_view trim_http_space(std::string_view v) {
+	while (!v.empty() && (v.front() == ' ' || v.front() == '\t')) {
+		v.remove_prefix(1);
+	}
+	while (!v.empty() && (v.back() == ' ' || v.back() == '\t' || v.back() == '\r' || v.back() == '\n')) {
+		v.remove_suffix(1);
+	}
+	return v;
+}
+
 static size_t header_callback(
 		char *buffer,
 		size_t size,
 		size_t nitems,
 		void *userdata) {
 	auto ctx = (HttpResponseContext *)userdata;
-	std::string_view text(buffer, nitems * size);
-	auto lines = split_string<std::string_view>(text, "\r\n");
-	for (const auto &line : lines) {
-		if (line.empty()) {
-			continue;
-		}
-		auto pos = line.find_first_of(L':');
-		if (pos > 0 && pos < line.size() - 2) {
-			auto key = line.substr(0, pos);
-			auto value = line.substr(pos + 2);
-			if (!key.empty() && !value.empty()) {
-				ctx->respHeaders.emplace(std::make_pair(key, value));
-				if (!ctx->contentLength) {
-					auto it = ctx->respHeaders.find("Content-Length");
-					if (it != ctx->respHeaders.end()) {
-						ctx->contentLength = std::strtoul(it->second.c_str(), nullptr, 10);
-					}
-				}
+
+	// curl hands over exactly one header line per call
+	std::string_view line(buffer, nitems * size);
+	if (line.size() > 5 && strncasecmp(line.data(), "HTTP/", 5) == 0) {
+		// status line of a new response (e.g. after "100 Continue"), forget the previous one
+		ctx->respHeaders.clear();
+		ctx->contentLength = 0;
+		ctx->headersDone = false;
+		auto pos = line.find(' ');
+		ctx->status = pos == std::string_view::npos ? 0 : std::strtol(line.data() + pos + 1, nullptr, 10);
+		return nitems * size;
+	}
+	if (trim_http_space(line).empty()) {
+		return on_headers_done(ctx) ? nitems * size : 0;
+	}
+
+	auto pos = line.find(':');
+	if (pos == std::string_view::npos || pos == 0) {
+		return nitems * size;
+	}
+	auto key = trim_http_space(line.substr(0, pos));
+	auto value = trim_http_space(line.substr(pos + 1));
+	if (key.empty() || value.empty()) {
+		return nitems * size;
+	}
+
+	if (key.size() == 14 && strncasecmp(key.data(), "Content-Length", 14) == 0) {
+		size_t length = 0;
+		for (auto c : value) {
+			if (c < '0' || c > '9') {
+				break;
+			}
+			// one that doesn't fit is a broken response
+			if (length > (SIZE_MAX - (c - '0')) / 10) {
+				return 0;
 			}
+			length = length * 10 + (c - '0');
 		}
+		ctx->contentLength = length;
 	}
+	ctx->respHeaders.emplace(key, value);
 	return nitems * size;
 }
 
 static size_t body_callback(void *data, size_t size, size_t nmemb, void *userp) {
 	size_t realsize = size * nmemb;
 	auto ctx = (HttpResponseContext *)userp;
-	if (!ctx->handler(ctx->contentLength, data, realsize)) {
+	if (ctx->discardBody) {
+		return realsize;
+	}
+
+	if (!ctx->handler(ctx->handlerCtx, ctx->totalLength, data, realsize)) {
 		// error occurred
+		ctx->handlerAborted = true;
 		return 0;
 	}
+	ctx->delivered += realsize;
+	if (ctx->idleTimeout.count()) {
+		ctx->lastData = std::chrono::steady_clock::now();
+	}
 	return realsize;
 }
 
+static int progress_callback(void *userp, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+	auto ctx = (HttpResponseContext *)userp;
+	if (ctx->cancel && ctx->cancel->load()) {
+		return 1;
+	}
+	auto now = std::chrono::steady_clock::now();
+	if (!ctx->headersDone && now - ctx->start > ctx->firstByteTimeout) {
+		// connected (or not) but the server doesn't answer
+		ctx->firstByteExpired = true;
+		return 1;
+	}
+	if (ctx->headersDone && ctx->idleTimeout.count() && now - std::max(ctx->start, ctx->lastData) > ctx->idleTimeout) {
+		// not even a heartbeat, the connection is gone
+		return 1;
+	}
+	return 0;
+}
+
+#ifndef _WIN32
+// where the distributions keep their CA bundle
+static const char *systemCABundles[] = {
+	"/etc/ssl/certs/ca-certificates.crt", // Debian, Ubuntu, Arch, Alpine
+	"/etc/pki/tls/certs/ca-bundle.crt", // Fedora, RHEL, CentOS
+	"/etc/ssl/ca-bundle.pem", // openSUSE
+	"/etc/pki/tls/cacert.pem", // OpenELEC
+	"/etc/ssl/cert.pem", // macOS, FreeBSD
+};
+#endif
+
+static bool read_whole_file(const std::string &path, std::string &content) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		return false;
+	}
+	content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	return !content.empty();
+}
+
+static std::shared_ptr<const CABundle> make_ca_bundle(std::string &&pem) {
+	auto bundle = std::make_shared<CABundle>();
+	bundle->pem = std::move(pem);
+
+	auto bio = BIO_new_mem_buf(bundle->pem.data(), (int)bundle->pem.size());
+	auto infos = bio ? PEM_X509_INFO_read_bio(bio, nullptr, nullptr, nullptr) : nullptr;
+	if (infos) {
+		bundle->store = X509_STORE_new();
+		int certs = 0;
+		for (int idx = 0; bundle->store && idx < sk_X509_INFO_num(infos); idx++) {
+			auto info = sk_X509_INFO_value(infos, idx);
+			if (info->x509 && X509_STORE_add_cert(bundle->store, info->x509) == 1) {
+				++certs;
+			}
+		}
+		if (!certs && bundle->store) {
+			X509_STORE_free(bundle->store);
+			bundle->store = nullptr;
+		}
+		sk_X509_INFO_pop_free(infos, X509_INFO_free);
+	}
+	if (bio) {
+		BIO_free(bio);
+	}
+	return bundle;
+}
+
+//
+// the CA bundle is read once and handed to every handle from memory,
+// nullptr means the platform store (Windows) or curl's own default,
+// [usable] is false if the configured one can't be read or holds no certificate (https fails then)
+//
+static std::shared_ptr<const CABundle> get_ca_bundle(bool &usable) {
+	std::unique_lock<std::mutex> lck(curlCALock);
+	usable = curlCAPath.empty() || (curlCABundle && curlCABundle->store);
+	if (curlCABundleLoaded) {
+		return curlCABundle;
+	}
+	curlCABundleLoaded = true;
+
+	std::string content;
+	if (!curlCAPath.empty()) {
+		if (read_whole_file(curlCAPath, content)) {
+			curlCABundle = make_ca_bundle(std::move(content));
+		}
+		usable = curlCABundle && curlCABundle->store;
+		return curlCABundle;
+	}
+#ifndef _WIN32
+	for (auto path : systemCABundles) {
+		if (read_whole_file(path, content)) {
+			curlCABundle = make_ca_bundle(std::move(content));
+			break;
+		}
+	}
+#endif
+	return curlCABundle;
+}
+
+// every SSL_CTX takes a reference to the one parsed store
+static CURLcode ssl_ctx_callback(CURL *, void *sslctx, void *userp) {
+	SSL_CTX_set1_cert_store((SSL_CTX *)sslctx, (X509_STORE *)userp);
+	return CURLE_OK;
+}
+
+static void share_lock(CURL *, curl_lock_data data, curl_lock_access, void *) {
+	curlShareLocks[data].lock();
+}
+
+static void share_unlock(CURL *, curl_lock_data data, void *) {
+	curlShareLocks[data].unlock();
+}
+
 std::string get_proxy_info() {
 	std::unique_lock<std::mutex> lck(curlProxyLock);
 	return curlProxyInfo;
 }
 
-int simple_http_perform(
-		HttpMethod method,
-		const std::string &url,
-		const HttpHeaders &requestHeaders,
-		const std::string &requestBody,
-		HttpHeaders &responseHeaders,
-		HttpContentHandler &&handler) {
-	if (url.empty()) {
-		return -1;
+HttpRetryPolicy get_retry_policy() {
+	std::unique_lock<std::mutex> lck(curlRetryPolicyLock);
+	return curlRetryPolicy;
+}
+
+static struct curl_slist *build_header_list(const std::vector<std::string> &fields, bool &err) {
+	struct curl_slist *list = nullptr;
+	for (const auto &field : fields) {
+		auto next = curl_slist_append(list, field.c_str());
+		if (!next) {
+			err = true;
+			break;
+		}
+		list = next;
 	}
+	return list;
+}
 
+//
+// one request across all its attempts, on a blocking perform or on the event driver
+//
+struct HttpTransfer {
+	HttpMethod method = HttpMethod::kGET;
+	std::string url;
+	HttpHeaders requestHeaders;
+	std::string requestBody; // curl doesn't copy it
+	std::vector<std::string> fields;
+	CURL *inst = nullptr;
+	struct curl_slist *list = nullptr;
+	struct curl_slist *resumeList = nullptr;
+	std::shared_ptr<const CABundle> caBundle; // kept alive until the handle is gone, curl doesn't copy it
+	HttpResponseContext ctx;
+	HttpRetryPolicy policy;
+	std::string hostKey;
+	bool direct = false; // not even through the *_proxy environment
+	unsigned maxAttempts = 1;
+	unsigned attempt = 0;
+	std::mt19937 rng{ std::random_device{}() };
+
+	// the outcome
+	long statusCode = -1;
+	HttpHeaders responseHeaders;
+
+	// only used by HttpEventDriver
+	HttpEventDriver::ContentHandler content;
+	HttpEventDriver::CompletionHandler done;
+	std::chrono::steady_clock::time_point retryAt;
+
+	~HttpTransfer() {
+		if (resumeList) {
+			curl_slist_free_all(resumeList);
+		}
+		if (list) {
+			curl_slist_free_all(list);
+		}
+		if (inst) {
+			curl_easy_cleanup(inst);
+		}
+	}
+};
+
+static void http_global_init() {
 	std::call_once(curlInitFlag, []() {
 		curl_global_init(CURL_GLOBAL_ALL);
+
+		// TLS sessions, DNS entries and live connections are shared by all handles,
+		// so later requests resume sessions (or reuse connections) instead of full handshakes
+		curlShare = curl_share_init();
+		if (curlShare) {
+			curl_share_setopt(curlShare, CURLSHOPT_LOCKFUNC, share_lock);
+			curl_share_setopt(curlShare, CURLSHOPT_UNLOCKFUNC, share_unlock);
+			curl_share_setopt(curlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+			curl_share_setopt(curlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+			curl_share_setopt(curlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+		}
 	});
+}
+
+// configure the handle of a transfer, once for all its attempts
+static bool transfer_setup(HttpTransfer &t) {
+	http_global_init();
 
-	CURL *inst = curl_easy_init();
+	CURL *inst = t.inst = curl_easy_init();
 	if (!inst) {
-		return -1;
+		return false;
 	}
 
-	int statusCode = -1;
-	struct curl_slist *list = nullptr;
-	do {
-		bool err = false;
+	// configure HTTP method
+	switch (t.method) {
+		case HttpMethod::kGET:
+			break;
+		case HttpMethod::kPOST:
+			curl_easy_setopt(inst, CURLOPT_POST, 1);
+			break;
+		case HttpMethod::kPUT:
+			curl_easy_setopt(inst, CURLOPT_PUT, 1);
+			break;
+		case HttpMethod::kHEAD:
+			curl_easy_setopt(inst, CURLOPT_NOBODY, 1);
+			break;
+		case HttpMethod::kDELETE:
+			curl_easy_setopt(inst, CURLOPT_CUSTOMREQUEST, "DELETE");
+			break;
+		default:
+			return false;
+	}
 
-		// configure HTTP method
-		switch (method) {
-			case HttpMethod::kGET:
-				break;
-			case HttpMethod::kPOST:
-				curl_easy_setopt(inst, CURLOPT_POST, 1);
-				break;
-			case HttpMethod::kPUT:
-				curl_easy_setopt(inst, CURLOPT_PUT, 1);
-				break;
-			case HttpMethod::kHEAD:
-				curl_easy_setopt(inst, CURLOPT_NOBODY, 1);
-				break;
-			case HttpMethod::kDELETE:
-				curl_easy_setopt(inst, CURLOPT_CUSTOMREQUEST, "DELETE");
-				break;
-			default:
-				err = true;
-				break;
+	// add headers
+	for (const auto &row : t.requestHeaders) {
+		if (row.first.empty() || row.second.empty()) {
+			return false;
 		}
-		if (err)
-			break;
 
-		// add headers
-		std::vector<std::string> fields;
-		for (const auto &row : requestHeaders) {
-			if (row.first.empty() || row.second.empty()) {
-				err = true;
-				break;
-			}
+		t.fields.emplace_back(row.first + ": " + row.second);
+	}
+
+	bool err = false;
+	t.list = build_header_list(t.fields, err);
+	if (err) {
+		return false;
+	}
+
+	if (t.list) {
+		curl_easy_setopt(inst, CURLOPT_HTTPHEADER, t.list);
+	}
 
-			fields.emplace_back(row.first + ": " + row.second);
+	// add User-Agent
+	if (t.requestHeaders.find("User-Agent") == t.requestHeaders.end()) {
+		curl_easy_setopt(inst, CURLOPT_USERAGENT, DEFAULT_SPARKLE_UA);
+	}
+
+	// set Accept-Encoding (all builtin encoding algorithms)
+	curl_easy_setopt(inst, CURLOPT_ACCEPT_ENCODING, "");
+
+	// add body
+	if (!t.requestBody.empty()) {
+		curl_easy_setopt(inst, CURLOPT_POSTFIELDS, t.requestBody.data());
+		curl_easy_setopt(inst, CURLOPT_POSTFIELDSIZE, t.requestBody.size());
+	}
+
+	// set proxy, an empty one keeps a direct transfer off the *_proxy environment too
+	auto proxyInfo = t.direct ? std::string() : get_proxy_info();
+	if (!proxyInfo.empty() || t.direct) {
+		curl_easy_setopt(inst, CURLOPT_PROXY, proxyInfo.c_str());
+	}
+
+	// set URL
+	curl_easy_setopt(inst, CURLOPT_URL, t.url.c_str());
+
+	if (curlShare) {
+		curl_easy_setopt(inst, CURLOPT_SHARE, curlShare);
+	}
+
+	if (strncasecmp(t.url.c_str(), "https://", 8) == 0) {
+		// never the system's trust instead of the one we were told to use
+		auto usable = false;
+		t.caBundle = get_ca_bundle(usable);
+		if (!usable) {
+			return false;
+		}
+		if (t.caBundle && t.caBundle->store &&
+				curl_easy_setopt(inst, CURLOPT_SSL_CTX_FUNCTION, ssl_ctx_callback) == CURLE_OK) {
+			// curl is on OpenSSL, hand over the parsed store and don't let curl load any file
+			curl_easy_setopt(inst, CURLOPT_SSL_CTX_DATA, (void *)t.caBundle->store);
+			curl_easy_setopt(inst, CURLOPT_CAINFO, nullptr);
+			curl_easy_setopt(inst, CURLOPT_CAPATH, nullptr);
+		} else if (t.caBundle) {
+			// other TLS backends parse it per connection, but at least not from disk
+			struct curl_blob blob = { (void *)t.caBundle->pem.data(), t.caBundle->pem.size(), CURL_BLOB_NOCOPY };
+			curl_easy_setopt(inst, CURLOPT_CAINFO_BLOB, &blob);
+		} else {
+#ifdef _WIN32
+			curl_easy_setopt(inst, CURLOPT_SSL_OPTIONS, CURLSSLOPT_NATIVE_CA);
+#endif
 		}
+	}
 
-		for (const auto &field : fields) {
-			list = curl_slist_append(list, field.c_str());
-			if (!list) {
-				err = true;
-				break;
+	curl_easy_setopt(inst, CURLOPT_BUFFERSIZE, (long)HTTP_RECEIVE_BUFFER_SIZE);
+
+	// set response header reader
+	curl_easy_setopt(inst, CURLOPT_HEADERFUNCTION, header_callback);
+	curl_easy_setopt(inst, CURLOPT_HEADERDATA, (void *)&t.ctx);
+
+	// set response body reader
+	curl_easy_setopt(inst, CURLOPT_WRITEFUNCTION, body_callback);
+	curl_easy_setopt(inst, CURLOPT_WRITEDATA, (void *)&t.ctx);
+
+	// watch the time to first byte
+	curl_easy_setopt(inst, CURLOPT_NOPROGRESS, 0L);
+	curl_easy_setopt(inst, CURLOPT_XFERINFOFUNCTION, progress_callback);
+	curl_easy_setopt(inst, CURLOPT_XFERINFODATA, (void *)&t.ctx);
+
+	// a transfer slower than this is considered stalled
+	t.policy = get_retry_policy();
+	if (t.policy.lowSpeedLimit && t.policy.lowSpeedTime.count()) {
+		curl_easy_setopt(inst, CURLOPT_LOW_SPEED_LIMIT, (long)t.policy.lowSpeedLimit);
+		curl_easy_setopt(inst, CURLOPT_LOW_SPEED_TIME, (long)t.policy.lowSpeedTime.count());
+	}
+
+	// POST isn't idempotent, it's never retried
+	t.maxAttempts = t.method == HttpMethod::kPOST ? 1u : std::max(1u, t.policy.maxAttempts);
+	t.hostKey = url_host_key(t.url);
+	return true;
+}
+
+// timeouts of the next attempt, from what this host has shown so far
+static void transfer_begin_attempt(HttpTransfer &t) {
+	HostLatency latency;
+	{
+		std::unique_lock<std::mutex> lck(hostLatencyLock);
+		auto it = hostLatencies.find(t.hostKey);
+		if (it != hostLatencies.end()) {
+			latency = it->second;
+		}
+	}
+	auto connectTimeout = derive_timeout(latency.connectMs, t.policy, t.policy.minConnectTimeout, t.policy.maxConnectTimeout);
+	curl_easy_setopt(t.inst, CURLOPT_CONNECTTIMEOUT_MS, (long)connectTimeout.count());
+
+	auto &ctx = t.ctx;
+	ctx.status = 0;
+	ctx.headersDone = false;
+	ctx.discardBody = false;
+	ctx.firstByteExpired = false;
+	ctx.mayRetry = t.attempt + 1 < t.maxAttempts;
+	ctx.start = std::chrono::steady_clock::now();
+	ctx.firstByteTimeout = connectTimeout + derive_timeout(latency.firstByteMs, t.policy, t.policy.minFirstByteTimeout, t.policy.maxFirstByteTimeout);
+	if (ctx.idleTimeout.count()) {
+		// a long poll may hold the response back until something happens
+		ctx.firstByteTimeout = connectTimeout + ctx.idleTimeout;
+	}
+}
+
+//
+// true if the transfer is over ([statusCode] and [responseHeaders] are set),
+// false if it goes on with another attempt after [delay]
+//
+static bool transfer_end_attempt(HttpTransfer &t, CURLcode errCode, std::chrono::milliseconds &delay) {
+	auto inst = t.inst;
+	auto &ctx = t.ctx;
+
+	// learn the latencies of this host
+	curl_off_t nameLookup = 0, connect = 0, preTransfer = 0, startTransfer = 0;
+	curl_easy_getinfo(inst, CURLINFO_NAMELOOKUP_TIME_T, &nameLookup);
+	curl_easy_getinfo(inst, CURLINFO_CONNECT_TIME_T, &connect);
+	curl_easy_getinfo(inst, CURLINFO_PRETRANSFER_TIME_T, &preTransfer);
+	curl_easy_getinfo(inst, CURLINFO_STARTTRANSFER_TIME_T, &startTransfer);
+	if (connect > nameLookup || startTransfer > preTransfer) {
+		std::unique_lock<std::mutex> lck(hostLatencyLock);
+		if (hostLatencies.size() >= HOST_LATENCY_LIMIT && hostLatencies.find(t.hostKey) == hostLatencies.end()) {
+			hostLatencies.erase(hostLatencies.begin());
+		}
+		auto &smoothed = hostLatencies[t.hostKey];
+		if (connect > nameLookup) {
+			update_latency(smoothed.connectMs, (connect - nameLookup) / 1000.0);
+		}
+		if (startTransfer > preTransfer) {
+			update_latency(smoothed.firstByteMs, (startTransfer - preTransfer) / 1000.0);
+		}
+	}
+
+	t.statusCode = -1;
+	long retryAfter = -1;
+	if (errCode == CURLE_OK) {
+		long statusCode = -1;
+		curl_easy_getinfo(inst, CURLINFO_RESPONSE_CODE, &statusCode);
+		if (!ctx.discardBody) {
+			// done, a resumed body is a complete one for the caller
+			if (statusCode == 206 && ctx.delivered && !simple_http_find_header(t.requestHeaders, "Range")) {
+				statusCode = 200;
 			}
+			t.statusCode = statusCode;
+			t.responseHeaders = ctx.delivered ? std::move(ctx.firstHeaders) : std::move(ctx.respHeaders);
+			return true;
 		}
+		retryAfter = (long)simple_http_retry_after(ctx.respHeaders);
+	} else if (ctx.handlerAborted ||
+			ctx.resumeMismatch ||
+			!ctx.mayRetry ||
+			(!is_transient_error(errCode) && !ctx.firstByteExpired)) {
+		return true;
+	}
 
-		if (list) {
-			curl_easy_setopt(inst, CURLOPT_HTTPHEADER, list);
+	// go on from where it broke, only if we can tell it's the same entity
+	if (ctx.delivered) {
+		auto validator = simple_http_find_header(ctx.firstHeaders, "ETag");
+		if (!validator || strncmp(validator->c_str(), "W/", 2) == 0) {
+			validator = simple_http_find_header(ctx.firstHeaders, "Last-Modified");
+		}
+		auto encoding = simple_http_find_header(ctx.firstHeaders, "Content-Encoding");
+		if (t.method != HttpMethod::kGET || !validator || (encoding && _stricmp(encoding->c_str(), "identity") != 0) ||
+				simple_http_find_header(t.requestHeaders, "Range")) {
+			return true;
 		}
 
-		// add User-Agent
-		if (requestHeaders.find("User-Agent") == requestHeaders.end()) {
-			curl_easy_setopt(inst, CURLOPT_USERAGENT, DEFAULT_SPARKLE_UA);
+		auto resumeFields = t.fields;
+		resumeFields.emplace_back("Range: bytes=" + std::to_string(ctx.delivered) + "-");
+		resumeFields.emplace_back("If-Range: " + *validator);
+		if (t.resumeList) {
+			curl_slist_free_all(t.resumeList);
 		}
+		bool err = false;
+		t.resumeList = build_header_list(resumeFields, err);
+		if (err) {
+			return true;
+		}
+		curl_easy_setopt(inst, CURLOPT_HTTPHEADER, t.resumeList);
+		// the offsets are of the raw representation, don't let curl decode it
+		curl_easy_setopt(inst, CURLOPT_ACCEPT_ENCODING, nullptr);
+	}
 
-		// set Accept-Encoding (all builtin encoding algorithms)
-		curl_easy_setopt(inst, CURLOPT_ACCEPT_ENCODING, "");
+	delay = jittered_backoff(t.policy.retryBase, t.policy.retryCap, t.attempt++, t.rng);
+	if (retryAfter >= 0) {
+		delay = std::min<std::chrono::milliseconds>(std::max<std::chrono::milliseconds>(delay, std::chrono::seconds(retryAfter)), t.policy.retryCap);
+	}
+	return false;
+}
 
-		// add body
-		if (!requestBody.empty()) {
-			curl_easy_setopt(inst, CURLOPT_POSTFIELDS, requestBody.data());
-			curl_easy_setopt(inst, CURLOPT_POSTFIELDSIZE, requestBody.size());
+int simple_http_perform(
+		HttpMethod method,
+		const std::string &url,
+		const HttpHeaders &requestHeaders,
+		const std::string &requestBody,
+		HttpHeaders &responseHeaders,
+		HttpRawContentHandler handler,
+		void *handlerCtx,
+		bool direct) {
+	if (url.empty() || !handler) {
+		return -1;
+	}
+
+	HttpTransfer t;
+	t.method = method;
+	t.url = url;
+	t.requestHeaders = requestHeaders;
+	t.requestBody = requestBody;
+	t.direct = direct;
+	t.ctx.handler = handler;
+	t.ctx.handlerCtx = handlerCtx;
+	if (!transfer_setup(t)) {
+		return -1;
+	}
+
+	for (;;) {
+		transfer_begin_attempt(t);
+		auto errCode = curl_easy_perform(t.inst);
+
+		std::chrono::milliseconds delay{ 0 };
+		if (transfer_end_attempt(t, errCode, delay)) {
+			break;
 		}
+		std::this_thread::sleep_for(delay);
+	}
 
-		// set proxy
-		auto proxyInfo = get_proxy_info();
-		if (!proxyInfo.empty()) {
-			curl_easy_setopt(inst, CURLOPT_PROXY, curlProxyInfo.c_str());
+	// done
+	responseHeaders = std::move(t.responseHeaders);
+	return (int)t.statusCode;
+}
+
+int simple_http_stream(
+		const std::string &url,
+		const HttpHeaders &requestHeaders,
+		HttpHeaders &responseHeaders,
+		std::chrono::seconds idleTimeout,
+		const std::atomic<bool> &cancel,
+		HttpStreamHandler handler,
+		void *handlerCtx) {
+	if (url.empty() || !handler || idleTimeout.count() <= 0) {
+		return -1;
+	}
+
+	struct StreamContext {
+		HttpStreamHandler handler;
+		void *handlerCtx;
+		const HttpResponseContext *response;
+	};
+
+	HttpTransfer t;
+	StreamContext stream = { handler, handlerCtx, &t.ctx };
+	t.url = url;
+	t.requestHeaders = requestHeaders;
+	t.ctx.handlerCtx = &stream;
+	t.ctx.handler = [](void *ctx, size_t, const void *data, size_t size) -> bool {
+		// error pages are no events
+		auto stream = (StreamContext *)ctx;
+		auto status = stream->response->status;
+		if (status < 200 || status >= 300) {
+			return true;
 		}
+		return stream->handler(stream->handlerCtx, stream->response->respHeaders, data, size);
+	};
+	t.ctx.cancel = &cancel;
+	if (!transfer_setup(t)) {
+		return -1;
+	}
 
-		// set URL
-		curl_easy_setopt(inst, CURLOPT_URL, url.c_str());
+	// the caller reconnects on its own terms, and a quiet stream isn't a stalled download
+	t.maxAttempts = 1;
+	t.ctx.idleTimeout = idleTimeout;
+	curl_easy_setopt(t.inst, CURLOPT_LOW_SPEED_LIMIT, 0L);
+	curl_easy_setopt(t.inst, CURLOPT_LOW_SPEED_TIME, 0L);
 
-		if (strncasecmp(url.c_str(), "https://", 8) == 0) {
-#ifdef _WIN32
-			curl_easy_setopt(inst, CURLOPT_SSL_OPTIONS, CURLSSLOPT_NATIVE_CA);
-#else
-			// #TODO
-			// Handle *unix system SSL properly
-#endif
+	transfer_begin_attempt(t);
+	auto errCode = curl_easy_perform(t.inst);
+	std::chrono::milliseconds delay{ 0 };
+	transfer_end_attempt(t, errCode, delay);
+
+	responseHeaders = std::move(t.responseHeaders);
+	return (int)t.statusCode;
+}
+
+//
+// HttpEventDriver
+//
+static_assert(HttpEventDriver::kWatchRemove == CURL_POLL_REMOVE && HttpEventDriver::kWatchInOut == CURL_POLL_INOUT, "watch values mismatch");
+static_assert(HttpEventDriver::kReadyIn == CURL_CSELECT_IN && HttpEventDriver::kReadyError == CURL_CSELECT_ERR, "ready values mismatch");
+
+static bool driver_content_handler(void *ctx, size_t total, const void *data, size_t size) {
+	return (*(HttpEventDriver::ContentHandler *)ctx)(total, data, size);
+}
+
+HttpEventDriver::HttpEventDriver(SocketWatcher watcher, TimerSetter timer) :
+		watcher_(std::move(watcher)), timer_(std::move(timer)) {
+	http_global_init();
+	multi_ = (void *)curl_multi_init();
+	if (!multi_) {
+		return;
+	}
+
+	// curl asks for the sockets to watch, the host watches them
+	curl_socket_callback onSocket = [](CURL *, curl_socket_t socket, int what, void *userp, void *) -> int {
+		auto self = (HttpEventDriver *)userp;
+		self->watcher_((intptr_t)socket, what);
+		return 0;
+	};
+	// and for one timer, which is merged with the retries' ones
+	curl_multi_timer_callback onTimer = [](CURLM *, long timeoutMs, void *userp) -> int {
+		auto self = (HttpEventDriver *)userp;
+		self->curlDue_ = timeoutMs >= 0;
+		self->curlDeadline_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(timeoutMs, 0L));
+		self->Arm();
+		return 0;
+	};
+	curl_multi_setopt((CURLM *)multi_, CURLMOPT_SOCKETFUNCTION, onSocket);
+	curl_multi_setopt((CURLM *)multi_, CURLMOPT_SOCKETDATA, (void *)this);
+	curl_multi_setopt((CURLM *)multi_, CURLMOPT_TIMERFUNCTION, onTimer);
+	curl_multi_setopt((CURLM *)multi_, CURLMOPT_TIMERDATA, (void *)this);
+}
+
+HttpEventDriver::~HttpEventDriver() {
+	// abandoned transfers don't complete, their handlers may be gone already
+	for (auto &[inst, t] : transfers_) {
+		if (t->retryAt == std::chrono::steady_clock::time_point()) {
+			curl_multi_remove_handle((CURLM *)multi_, inst);
 		}
+	}
+	transfers_.clear();
+	if (multi_) {
+		curl_multi_cleanup((CURLM *)multi_);
+	}
+	if (armed_) {
+		timer_(-1);
+	}
+}
 
-		// prepare context
-		HttpResponseContext ctx;
-		ctx.handler = handler;
+bool HttpEventDriver::IsValid() const {
+	return multi_ != nullptr;
+}
 
-		// set response header reader
-		curl_easy_setopt(inst, CURLOPT_HEADERFUNCTION, header_callback);
-		curl_easy_setopt(inst, CURLOPT_HEADERDATA, (void *)&ctx);
+size_t HttpEventDriver::Pending() const {
+	return transfers_.size();
+}
 
-		// set response body reader
-		curl_easy_setopt(inst, CURLOPT_WRITEFUNCTION, body_callback);
-		curl_easy_setopt(inst, CURLOPT_WRITEDATA, (void *)&ctx);
+bool HttpEventDriver::Get(const std::string &url, const HttpHeaders &requestHeaders, ContentHandler &&content, CompletionHandler &&done, bool direct) {
+	if (!multi_ || url.empty() || !content || !done) {
+		return false;
+	}
 
-		// perform
-		auto errCode = curl_easy_perform(inst);
-		if (errCode != CURLE_OK) {
-			err = true;
-			break;
+	auto t = std::make_unique<HttpTransfer>();
+	t->url = url;
+	t->requestHeaders = requestHeaders;
+	t->direct = direct;
+	t->content = std::move(content);
+	t->done = std::move(done);
+	t->ctx.handler = driver_content_handler;
+	t->ctx.handlerCtx = (void *)&t->content;
+	if (!transfer_setup(*t)) {
+		return false;
+	}
+
+	transfer_begin_attempt(*t);
+	auto inst = t->inst;
+	transfers_[inst] = std::move(t);
+	if (curl_multi_add_handle((CURLM *)multi_, inst) != CURLM_OK) {
+		transfers_.erase(inst);
+		return false;
+	}
+	Arm();
+	return true;
+}
+
+void HttpEventDriver::SocketAction(intptr_t socket, int ready) {
+	if (!multi_) {
+		return;
+	}
+	int running = 0;
+	curl_multi_socket_action((CURLM *)multi_, (curl_socket_t)socket, ready, &running);
+	Drain();
+}
+
+void HttpEventDriver::Timeout() {
+	if (!multi_) {
+		return;
+	}
+	auto now = std::chrono::steady_clock::now();
+	int running = 0;
+	if (curlDue_ && now >= curlDeadline_) {
+		curlDue_ = false;
+		curl_multi_socket_action((CURLM *)multi_, CURL_SOCKET_TIMEOUT, 0, &running);
+	}
+
+	// attempts whose backoff is over, one that can't be started ends with the last attempt's failure
+	std::vector<std::unique_ptr<HttpTransfer>> failed;
+	for (auto it = transfers_.begin(); it != transfers_.end();) {
+		auto &t = it->second;
+		if (t->retryAt != std::chrono::steady_clock::time_point() && now >= t->retryAt) {
+			t->retryAt = {};
+			transfer_begin_attempt(*t);
+			if (curl_multi_add_handle((CURLM *)multi_, it->first) != CURLM_OK) {
+				failed.push_back(std::move(t));
+				it = transfers_.erase(it);
+				continue;
+			}
 		}
+		++it;
+	}
+	for (auto &t : failed) {
+		t->done((int)t->statusCode, std::move(t->responseHeaders));
+	}
+	Drain();
+}
 
-		// get status code
-		curl_easy_getinfo(inst, CURLINFO_RESPONSE_CODE, &statusCode);
+void HttpEventDriver::Drain() {
+	int pending = 0;
+	while (auto msg = curl_multi_info_read((CURLM *)multi_, &pending)) {
+		if (msg->msg != CURLMSG_DONE) {
+			continue;
+		}
+		auto inst = msg->easy_handle;
+		auto result = msg->data.result;
+		curl_multi_remove_handle((CURLM *)multi_, inst);
 
-		// save headers
-		responseHeaders = std::move(ctx.respHeaders);
+		auto it = transfers_.find(inst);
+		if (it == transfers_.end()) {
+			continue;
+		}
+		std::chrono::milliseconds delay{ 0 };
+		if (!transfer_end_attempt(*it->second, result, delay)) {
+			// backoff on our timer, never sleep in the host's loop
+			it->second->retryAt = std::chrono::steady_clock::now() + delay;
+			continue;
+		}
 
-	} while (false);
+		// it's gone before the completion runs, which may well start new transfers
+		auto t = std::move(it->second);
+		transfers_.erase(it);
+		t->done((int)t->statusCode, std::move(t->responseHeaders));
+	}
+	Arm();
+}
 
-	if (list) {
-		curl_slist_free_all(list);
+void HttpEventDriver::Arm() {
+	// the host sees one timer, the earliest of curl's and the retries'
+	auto due = std::chrono::steady_clock::time_point::max();
+	if (curlDue_) {
+		due = curlDeadline_;
+	}
+	for (auto &[inst, t] : transfers_) {
+		if (t->retryAt != std::chrono::steady_clock::time_point()) {
+			due = std::min(due, t->retryAt);
+		}
 	}
-	curl_easy_cleanup(inst);
 
-	// done
-	return statusCode;
+	if (due == std::chrono::steady_clock::time_point::max()) {
+		if (armed_) {
+			armed_ = false;
+			timer_(-1);
+		}
+		return;
+	}
+	if (armed_ && due == armedAt_) {
+		return;
+	}
+	armed_ = true;
+	armedAt_ = due;
+	auto wait = std::chrono::ceil<std::chrono::milliseconds>(due - std::chrono::steady_clock::now());
+	timer_((long)std::max<long long>(wait.count(), 0));
 }
 
 int simple_http_get(
@@ -233,19 +967,16 @@ int simple_http_get(
 		const HttpHeaders &requestHeaders,
 		HttpHeaders &responseHeaders,
 		std::string &responseBody) {
-	return simple_http_perform(
-			HttpMethod::kGET,
+	return simple_http_get(
 			url,
 			requestHeaders,
-			{},
 			responseHeaders,
-			[&](size_t, const void *data, size_t size) -> bool {
-				responseBody.resize(responseBody.size() + size);
-				if (responseBody.empty()) {
-					// out of memory
-					return false;
+			[&](size_t total, const void *data, size_t size) -> bool {
+				// grow once to the announced size rather than chunk by chunk (a server can announce anything)
+				if (total && responseBody.capacity() < total) {
+					responseBody.reserve(std::min<size_t>(total, HTTP_MAX_BODY_RESERVE));
 				}
-				memcpy(&responseBody[0] + responseBody.size() - size, data, size);
+				responseBody.append((const char *)data, size);
 				return true;
 			});
 }
@@ -254,14 +985,36 @@ int simple_http_get(
 		const std::string &url,
 		const HttpHeaders &requestHeaders,
 		HttpHeaders &responseHeaders,
-		HttpContentHandler &&cb) {
+		HttpRawContentHandler handler,
+		void *ctx,
+		bool direct) {
 	return simple_http_perform(
 			HttpMethod::kGET,
 			url,
 			requestHeaders,
 			{},
 			responseHeaders,
-			std::forward<HttpContentHandler>(cb));
+			handler,
+			ctx,
+			direct);
+}
+
+void simple_http_ca_path(const std::string &path) {
+	std::unique_lock<std::mutex> lck(curlCALock);
+	curlCAPath = path;
+	curlCABundle.reset();
+	curlCABundleLoaded = false;
+}
+
+void simple_http_warm_up() {
+	http_global_init();
+	auto usable = false;
+	get_ca_bundle(usable);
+}
+
+void simple_http_retry_policy(const HttpRetryPolicy &policy) {
+	std::unique_lock<std::mutex> lck(curlRetryPolicyLock);
+	curlRetryPolicy = policy;
 }
 
 int simple_http_proxy_config(const std::string &cfg) {
@@ -279,4 +1032,58 @@ int simple_http_proxy_config(const std::string &cfg) {
 	return -1;
 }
 
+const std::string *simple_http_find_header(const HttpHeaders &headers, const char *key) {
+	auto it = headers.find(key);
+	return it != headers.end() ? &it->second : nullptr;
+}
+
+long long simple_http_retry_after(const HttpHeaders &headers) {
+	auto value = simple_http_find_header(headers, "Retry-After");
+	if (!value || value->empty()) {
+		return -1;
+	}
+
+	// delta-seconds
+	if (std::isdigit((unsigned char)value->front())) {
+		return std::strtoll(value->c_str(), nullptr, 10);
+	}
+
+	// HTTP-date
+	auto when = simple_http_parse_date(*value);
+	if (when == -1) {
+		return -1;
+	}
+	auto now = time(nullptr);
+	return when > now ? (long long)(when - now) : 0;
+}
+
+long long simple_http_parse_date(const std::string &date) {
+	return date.empty() ? -1 : (long long)curl_getdate(date.c_str(), nullptr);
+}
+
+long long simple_http_max_age(const HttpHeaders &headers) {
+	auto value = simple_http_find_header(headers, "Cache-Control");
+	if (!value) {
+		return -1;
+	}
+
+	// directives are comma separated, e.g. "public, max-age=3600"
+	const char *p = value->c_str();
+	while (*p) {
+		while (*p == ' ' || *p == ',') {
+			++p;
+		}
+		if (strncasecmp(p, "no-cache", 8) == 0 || strncasecmp(p, "no-store", 8) == 0) {
+			return 0;
+		}
+		if (strncasecmp(p, "max-age=", 8) == 0) {
+			return std::strtoll(p + 8, nullptr, 10);
+		}
+		while (*p && *p != ',') {
+			++p;
+		}
+	}
+	return -1;
+}
+
 } //namespace SparkleLite
\ No newline at end of file
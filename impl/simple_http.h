@@ -1,14 +1,67 @@
 #ifndef _SIMPLE_HTTP_H_
 #define _SIMPLE_HTTP_H_
 
+#include "sparkle_internal.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <functional>
 #include <map>
+#include <memory>
 #include <string>
+#include <type_traits>
 
 namespace SparkleLite {
 
-using HttpContentHandler = std::function<bool(size_t, const void *, size_t)>;
-using HttpHeaders = std::map<std::string, std::string>;
+// header field names are case-insensitive (and HTTP/2 sends them in lower case)
+struct HttpHeaderLess {
+	bool operator()(const std::string &a, const std::string &b) const {
+		return _stricmp(a.c_str(), b.c_str()) < 0;
+	}
+};
+using HttpHeaders = std::map<std::string, std::string, HttpHeaderLess>;
+
+// receives the body chunk by chunk: (ctx, content length or 0 if unknown, data, size), return false to abort
+using HttpRawContentHandler = bool (*)(void *, size_t, const void *, size_t);
+
+// the most a buffered body reserves up front for its announced length, it grows past that as the data really arrives
+#define HTTP_MAX_BODY_RESERVE (64 * 1024 * 1024)
+
+//
+// How requests survive bad networks:
+//	+ connect / first byte timeouts are [rttMultiplier] times the smoothed latencies seen for the host, clamped
+//	+ a transfer slower than [lowSpeedLimit] bytes/s for [lowSpeedTime] is a stall
+//	+ transient failures (and 408/429/5xx responses) are retried with a jittered exponential backoff,
+//	  a broken GET goes on from where it stopped (Range + If-Range) rather than from the start, it fails if the server doesn't answer 206
+//
+struct HttpRetryPolicy {
+	unsigned maxAttempts = 4; // 1 disables retries
+	std::chrono::milliseconds retryBase{ 500 };
+	std::chrono::milliseconds retryCap{ 30000 };
+	double rttMultiplier = 4;
+	std::chrono::milliseconds minConnectTimeout{ 3000 };
+	std::chrono::milliseconds maxConnectTimeout{ 30000 };
+	std::chrono::milliseconds minFirstByteTimeout{ 5000 };
+	std::chrono::milliseconds maxFirstByteTimeout{ 60000 };
+	unsigned lowSpeedLimit = 1024; // 0 disables stall detection
+	std::chrono::seconds lowSpeedTime{ 30 };
+};
+
+void simple_http_retry_policy(const HttpRetryPolicy &policy);
+
+//
+// CA bundle for https, read into memory once on first use and shared by all requests,
+// the system bundle is used if it's empty (the certificate store on Windows),
+// https requests fail if it can't be read or holds no certificate
+//
+void simple_http_ca_path(const std::string &path);
+
+//
+// initialize curl and the TLS library and load the CA bundle now, rather than on the first request,
+// safe to call from any thread and any number of times
+//
+void simple_http_warm_up();
 
 int simple_http_get(
 		const std::string &url,
@@ -16,14 +69,143 @@ int simple_http_get(
 		HttpHeaders &responseHeaders,
 		std::string &responseBody);
 
+//
+// [direct]: never through a proxy, not even the *_proxy environment (LAN peers)
+//
 int simple_http_get(
 		const std::string &url,
 		const HttpHeaders &requestHeaders,
 		HttpHeaders &responseHeaders,
-		HttpContentHandler &&cb);
+		HttpRawContentHandler handler,
+		void *ctx,
+		bool direct = false);
+
+//
+// any callable `bool(size_t total, const void *data, size_t size)`, called without type erasure or allocation
+//
+template <typename Handler>
+int simple_http_get(
+		const std::string &url,
+		const HttpHeaders &requestHeaders,
+		HttpHeaders &responseHeaders,
+		Handler &&handler) {
+	using HandlerType = std::remove_reference_t<Handler>;
+	return simple_http_get(
+			url,
+			requestHeaders,
+			responseHeaders,
+			[](void *ctx, size_t total, const void *data, size_t size) -> bool {
+				return (*(HandlerType *)ctx)(total, data, size);
+			},
+			(void *)&handler);
+}
+
+// receives the body of a 2xx response as it arrives: (ctx, response headers, data, size), return false to end it
+using HttpStreamHandler = bool (*)(void *, const HttpHeaders &, const void *, size_t);
+
+//
+// A long-lived GET (server-sent events, long polls): a single attempt without stall detection,
+// it fails once nothing at all (not even a heartbeat) arrives for [idleTimeout], or once [cancel] is set
+//
+int simple_http_stream(
+		const std::string &url,
+		const HttpHeaders &requestHeaders,
+		HttpHeaders &responseHeaders,
+		std::chrono::seconds idleTimeout,
+		const std::atomic<bool> &cancel,
+		HttpStreamHandler handler,
+		void *ctx);
+
+struct HttpTransfer;
+
+//
+// Non-blocking requests for hosts running their own event loop (epoll, kqueue, libuv...), no threads involved:
+//	+ [watcher] is told which sockets to watch for what (a Watch value), [timer] when to call Timeout (-1 cancels it)
+//	+ the host reports readiness through SocketAction (Ready bits) and calls Timeout when the timer fires
+//	+ content and completion handlers run inside those calls, on the host's thread
+// Requests get the same timeouts, retries (on a timer rather than a sleep) and resuming as the blocking ones.
+// #NOTE: not thread-safe, every call goes on the loop thread
+//
+class HttpEventDriver {
+public:
+	// same values as curl's CURL_POLL_* and CURL_CSELECT_*
+	enum Watch {
+		kWatchNone = 0,
+		kWatchIn = 1,
+		kWatchOut = 2,
+		kWatchInOut = 3,
+		kWatchRemove = 4
+	};
+	enum Ready {
+		kReadyIn = 1,
+		kReadyOut = 2,
+		kReadyError = 4
+	};
+
+	using SocketWatcher = std::function<void(intptr_t socket, int watch)>;
+	using TimerSetter = std::function<void(long timeoutMs)>;
+	using ContentHandler = std::function<bool(size_t total, const void *data, size_t size)>;
+	// (HTTP status code or -1, response headers)
+	using CompletionHandler = std::function<void(int status, HttpHeaders &&responseHeaders)>;
+
+	HttpEventDriver(SocketWatcher watcher, TimerSetter timer);
+	HttpEventDriver(const HttpEventDriver &) = delete;
+	HttpEventDriver &operator=(const HttpEventDriver &) = delete;
+
+	// transfers still in flight are dropped without completing
+	~HttpEventDriver();
+
+	bool IsValid() const;
+
+	// requests in flight (or waiting to retry)
+	size_t Pending() const;
+
+	// false if it couldn't be started, [done] is never called then, [direct] as for simple_http_get
+	bool Get(const std::string &url, const HttpHeaders &requestHeaders, ContentHandler &&content, CompletionHandler &&done, bool direct = false);
+
+	void SocketAction(intptr_t socket, int ready);
+
+	void Timeout();
+
+private:
+	// hand the finished attempts over, and re-arm the host timer
+	void Drain();
+
+	void Arm();
+
+private:
+	SocketWatcher watcher_;
+	TimerSetter timer_;
+	void *multi_ = nullptr;
+	std::map<void *, std::unique_ptr<HttpTransfer>> transfers_; // by easy handle
+	bool curlDue_ = false;
+	std::chrono::steady_clock::time_point curlDeadline_;
+	bool armed_ = false;
+	std::chrono::steady_clock::time_point armedAt_;
+};
 
 int simple_http_proxy_config(const std::string &cfg);
 
+//
+// look up a response header field by its name, case-insensitively (HTTP/2 servers send lower-case names)
+//
+const std::string *simple_http_find_header(const HttpHeaders &headers, const char *key);
+
+//
+// get the delay (in seconds) requested by a "Retry-After" header (delta-seconds or HTTP-date), -1 if absent
+//
+long long simple_http_retry_after(const HttpHeaders &headers);
+
+//
+// parse an HTTP-date / RFC 822 date (as in <pubDate>) into seconds since the epoch, -1 if it isn't one
+//
+long long simple_http_parse_date(const std::string &date);
+
+//
+// get the freshness lifetime (in seconds) declared by "Cache-Control: max-age", -1 if absent
+//
+long long simple_http_max_age(const HttpHeaders &headers);
+
 } //namespace SparkleLite
 
 #endif //_SIMPLE_HTTP_H_
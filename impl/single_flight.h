@@ -0,0 +1,134 @@
+#ifndef _SINGLE_FLIGHT_H_
+#define _SINGLE_FLIGHT_H_
+
+#include <condition_variable>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace SparkleLite {
+
+//
+// Coalesces identical concurrent operations: the first caller of a key (the leader) does the work,
+// callers arriving meanwhile (followers) wait for its result instead of doing it again.
+// The leader may publish its progress, each follower reports it on its own thread.
+//
+template <typename Result>
+class SingleFlight {
+public:
+	struct Flight {
+		std::mutex lock;
+		std::condition_variable cond;
+		bool done = false;
+		Result result;
+		std::exception_ptr error; // what the leader's work threw (Do only)
+		size_t total = 0; // 0 if unknown
+		size_t received = 0;
+	};
+	using FlightPtr = std::shared_ptr<Flight>;
+
+	// the flight of [key], and whether the caller leads it (then it must Land it, whatever happens)
+	std::pair<FlightPtr, bool> Join(const std::string &key) {
+		std::unique_lock<std::mutex> lck(lock_);
+		auto &flight = flights_[key];
+		if (flight) {
+			return { flight, false };
+		}
+		flight = std::make_shared<Flight>();
+		return { flight, true };
+	}
+
+	void Land(const std::string &key, const FlightPtr &flight, Result result, std::exception_ptr error = nullptr) {
+		{
+			// callers from now on start a new flight
+			std::unique_lock<std::mutex> lck(lock_);
+			auto it = flights_.find(key);
+			if (it != flights_.end() && it->second == flight) {
+				flights_.erase(it);
+			}
+		}
+		{
+			std::unique_lock<std::mutex> lck(flight->lock);
+			flight->result = std::move(result);
+			flight->error = error;
+			flight->done = true;
+		}
+		flight->cond.notify_all();
+	}
+
+	// by the leader, as its work goes
+	static void Progress(Flight &flight, size_t total, size_t size) {
+		{
+			std::unique_lock<std::mutex> lck(flight.lock);
+			flight.total = total;
+			flight.received += size;
+		}
+		flight.cond.notify_all();
+	}
+
+	//
+	// by a follower, [onProgress] `bool(size_t total, size_t size)` is called on this thread for what the leader got meanwhile,
+	// false if it returned false (the follower leaves, the flight goes on)
+	//
+	template <typename ProgressHandler>
+	static bool Wait(Flight &flight, ProgressHandler &&onProgress, Result &result) {
+		size_t reported = 0;
+		std::unique_lock<std::mutex> lck(flight.lock);
+		while (true) {
+			flight.cond.wait(lck, [&]() { return flight.done || flight.received != reported; });
+			if (flight.received != reported) {
+				auto total = flight.total;
+				auto size = flight.received - reported;
+				reported = flight.received;
+
+				lck.unlock();
+				if (!onProgress(total, size)) {
+					return false;
+				}
+				lck.lock();
+				continue;
+			}
+			result = flight.result;
+			return true;
+		}
+	}
+
+	// without progress, what [work] throws is thrown to the followers too (they'd wait forever otherwise)
+	template <typename Work>
+	Result Do(const std::string &key, Work &&work) {
+		auto [flight, leader] = Join(key);
+		if (leader) {
+			Result result;
+			try {
+				result = work();
+			} catch (...) {
+				Land(key, flight, Result(), std::current_exception());
+				throw;
+			}
+			Land(key, flight, result);
+			return result;
+		}
+		Result result;
+		Wait(*flight, [](size_t, size_t) { return true; }, result);
+		std::exception_ptr error;
+		{
+			std::unique_lock<std::mutex> lck(flight->lock);
+			error = flight->error;
+		}
+		if (error) {
+			std::rethrow_exception(error);
+		}
+		return result;
+	}
+
+private:
+	std::mutex lock_;
+	std::map<std::string, FlightPtr> flights_;
+};
+
+} //namespace SparkleLite
+
+#endif //_SINGLE_FLIGHT_H_
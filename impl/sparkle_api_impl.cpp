@@ -1,7 +1,10 @@
+#include "appcast_index.h"
+#include "appcast_parser.h"
 #include "os_support.h"
 #include "signature_verifier.h"
 #include "simple_http.h"
 #include "sparkle_manager.h"
+#include "update_decision.h"
 
 #define IS_STRING_PARAM_VALID(_s_) ((_s_) != nullptr && strlen(_s_) != 0)
 
@@ -10,6 +13,31 @@
 //
 SparkleLite::SparkleManager gMgr;
 
+static int ResolveCheckParams(
+		const char *preferLang,
+		const char **acceptChannels,
+		int acceptChannelCount,
+		std::string &lang,
+		std::vector<std::string> &channels) {
+	// use system default lang is preferLang is not valid
+	if (IS_STRING_PARAM_VALID(preferLang)) {
+		lang = preferLang;
+	} else {
+		lang = SparkleLite::get_iso639_user_lang();
+	}
+
+	// check out channels
+	if (acceptChannels && acceptChannelCount) {
+		for (auto idx = 0; idx < acceptChannelCount; idx++) {
+			if (!IS_STRING_PARAM_VALID(acceptChannels[idx])) {
+				return SparkleError::kInvalidParameter;
+			}
+			channels.emplace_back(acceptChannels[idx]);
+		}
+	}
+	return SparkleError::kNoError;
+}
+
 extern "C" {
 SPARKLE_API_DELC(int)
 sparkle_setup(
@@ -35,10 +63,10 @@ sparkle_setup(
 			!IS_STRING_PARAM_VALID(signVerifyPubKey)) {
 		return SparkleError::kInvalidParameter;
 	} else if (signVerifyAlgo == SignAlgo::kDSA &&
-			!SparkleLite::IsValidDSAPubKey(signVerifyPubKey)) {
+			!SparkleLite::IsWellFormedDSAPubKey(signVerifyPubKey)) {
 		return SparkleError::kInvalidParameter;
 	} else if (signVerifyAlgo == SignAlgo::kEd25519 &&
-			!SparkleLite::IsValidEd25519Key(signVerifyPubKey)) {
+			!SparkleLite::IsWellFormedEd25519Key(signVerifyPubKey)) {
 		return SparkleError::kInvalidParameter;
 	}
 
@@ -62,6 +90,13 @@ sparkle_setup(
 	return gMgr.IsReady() ? SparkleError::kNoError : SparkleError::kFail;
 }
 
+SPARKLE_API_DELC(void)
+sparkle_warm_up() {
+	if (gMgr.IsReady()) {
+		gMgr.WarmUp();
+	}
+}
+
 SPARKLE_API_DELC(void)
 sparkle_customize_http_header(const char *key, const char *value) {
 	if (IS_STRING_PARAM_VALID(key) && IS_STRING_PARAM_VALID(value)) {
@@ -69,6 +104,44 @@ sparkle_customize_http_header(const char *key, const char *value) {
 	}
 }
 
+SPARKLE_API_DELC(int)
+sparkle_set_enclosure_preference(const char **formats, int formatCount) {
+	if (formatCount < 0 || (formatCount && !formats)) {
+		return SparkleError::kInvalidParameter;
+	}
+
+	SparkleLite::EnclosureFormats preference;
+	for (auto idx = 0; idx < formatCount; idx++) {
+		if (!IS_STRING_PARAM_VALID(formats[idx])) {
+			return SparkleError::kInvalidParameter;
+		}
+		preference.emplace_back(formats[idx]);
+	}
+	gMgr.SetEnclosurePreference(preference);
+	return SparkleError::kNoError;
+}
+
+SPARKLE_API_DELC(void)
+sparkle_set_appcast_parse_threads(unsigned int threads) {
+	gMgr.SetAppcastParseThreads(threads);
+}
+
+SPARKLE_API_DELC(int)
+sparkle_set_local_mirror(const char *urlPrefix, const char *localDir) {
+	if (!IS_STRING_PARAM_VALID(urlPrefix) || !IS_STRING_PARAM_VALID(localDir)) {
+		return SparkleError::kInvalidParameter;
+	}
+
+	// stack on the current transport, so mirrors add up
+	auto fileTransport = std::dynamic_pointer_cast<SparkleLite::FileTransport>(gMgr.Transport());
+	if (!fileTransport) {
+		fileTransport = std::make_shared<SparkleLite::FileTransport>(gMgr.Transport());
+		gMgr.SetTransport(fileTransport);
+	}
+	fileTransport->AddMirror(urlPrefix, localDir);
+	return SparkleError::kNoError;
+}
+
 SPARKLE_API_DELC(void)
 sparkle_clean() {
 	gMgr.Clean();
@@ -84,26 +157,102 @@ sparkle_check_update(
 		return SparkleError::kNotReady;
 	}
 
-	// use system default lang is preferLang is not valid
 	std::string lang;
-	if (IS_STRING_PARAM_VALID(preferLang)) {
-		lang = preferLang;
-	} else {
-		lang = SparkleLite::get_iso639_user_lang();
+	std::vector<std::string> channels;
+	auto err = ResolveCheckParams(preferLang, acceptChannels, acceptChannelCount, lang, channels);
+	if (err != SparkleError::kNoError) {
+		return err;
 	}
 
-	// check out channels
+	return gMgr.CheckUpdate(lang, channels, userdata);
+}
+
+SPARKLE_API_DELC(int)
+sparkle_requery_update(
+		const char *preferLang,
+		const char **acceptChannels,
+		int acceptChannelCount,
+		void *userdata) {
+	if (!gMgr.IsReady()) {
+		return SparkleError::kNotReady;
+	}
+
+	std::string lang;
 	std::vector<std::string> channels;
-	if (acceptChannels && acceptChannelCount) {
-		for (auto idx = 0; idx < acceptChannelCount; idx++) {
-			if (!IS_STRING_PARAM_VALID(acceptChannels[idx])) {
-				return SparkleError::kInvalidParameter;
-			}
-			channels.emplace_back(acceptChannels[idx]);
-		}
+	auto err = ResolveCheckParams(preferLang, acceptChannels, acceptChannelCount, lang, channels);
+	if (err != SparkleError::kNoError) {
+		return err;
 	}
 
-	return gMgr.CheckUpdate(lang, channels, userdata);
+	return gMgr.RequeryUpdate(lang, channels, userdata);
+}
+
+SPARKLE_API_DELC(int)
+sparkle_start_scheduled_check(
+		unsigned int intervalSeconds,
+		unsigned int startupDelaySeconds,
+		const char *preferLang,
+		const char **acceptChannels,
+		int acceptChannelCount,
+		void *userdata) {
+	if (!intervalSeconds) {
+		return SparkleError::kInvalidParameter;
+	}
+	if (!gMgr.IsReady()) {
+		return SparkleError::kNotReady;
+	}
+
+	std::string lang;
+	std::vector<std::string> channels;
+	auto err = ResolveCheckParams(preferLang, acceptChannels, acceptChannelCount, lang, channels);
+	if (err != SparkleError::kNoError) {
+		return err;
+	}
+
+	SparkleLite::UpdateScheduler::Options opts;
+	opts.interval = std::chrono::seconds(intervalSeconds);
+	opts.startupDelay = std::chrono::seconds(startupDelaySeconds);
+	return gMgr.StartScheduledCheck(lang, channels, userdata, opts);
+}
+
+SPARKLE_API_DELC(void)
+sparkle_stop_scheduled_check() {
+	gMgr.StopScheduledCheck();
+}
+
+SPARKLE_API_DELC(int)
+sparkle_start_push_channel(
+		const char *notifyURL,
+		unsigned int idleTimeoutSeconds,
+		const char *preferLang,
+		const char **acceptChannels,
+		int acceptChannelCount,
+		void *userdata) {
+	if (!IS_STRING_PARAM_VALID(notifyURL)) {
+		return SparkleError::kInvalidParameter;
+	}
+	if (!gMgr.IsReady()) {
+		return SparkleError::kNotReady;
+	}
+
+	std::string lang;
+	std::vector<std::string> channels;
+	auto err = ResolveCheckParams(preferLang, acceptChannels, acceptChannelCount, lang, channels);
+	if (err != SparkleError::kNoError) {
+		return err;
+	}
+
+	SparkleLite::PushChannel::Options opts;
+	opts.url = notifyURL;
+	if (idleTimeoutSeconds) {
+		opts.idleTimeout = std::chrono::seconds(idleTimeoutSeconds);
+	}
+	return gMgr.StartPushChannel(lang, channels, userdata, opts);
+}
+
+SPARKLE_API_DELC(void)
+sparkle_stop_push_channel() {
+	gMgr.StopPushChannel();
 }
 
 SPARKLE_API_DELC(int)
@@ -128,6 +277,299 @@ sparkle_download_to_buffer(void *buffer, size_t *bufferSize, void *userdata) {
 	return gMgr.Dowload(buffer, *bufferSize, bufferSize, userdata);
 }
 
+SPARKLE_API_DELC(int)
+sparkle_download_to_memory(void *userdata) {
+	if (!gMgr.IsReady()) {
+		return SparkleError::kNotReady;
+	}
+	return gMgr.DowloadToMemory(userdata);
+}
+
+SPARKLE_API_DELC(int)
+sparkle_download_to_stream(SparkleStreamWriter writer, void *userdata) {
+	if (!writer) {
+		return SparkleError::kInvalidParameter;
+	}
+	if (!gMgr.IsReady()) {
+		return SparkleError::kNotReady;
+	}
+	return gMgr.Dowload(writer, userdata);
+}
+
+SPARKLE_API_DELC(int)
+sparkle_download_and_extract(const char *dstDir, void *userdata) {
+	if (!IS_STRING_PARAM_VALID(dstDir)) {
+		return SparkleError::kInvalidParameter;
+	}
+	if (!gMgr.IsReady()) {
+		return SparkleError::kNotReady;
+	}
+	return gMgr.DowloadAndExtract(dstDir, userdata);
+}
+
+SPARKLE_API_DELC(int)
+sparkle_loop_attach(SparkleWatchSocket watchSocket, SparkleSetTimer setTimer, void *loopdata) {
+	static_assert((unsigned)SparkleLite::HttpEventDriver::kWatchRemove == (unsigned)kWatchRemove &&
+					(unsigned)SparkleLite::HttpEventDriver::kWatchInOut == (unsigned)kWatchReadWrite &&
+					(unsigned)SparkleLite::HttpEventDriver::kReadyError == (unsigned)kSocketError,
+			"event values mismatch");
+	if (!watchSocket || !setTimer) {
+		return SparkleError::kInvalidParameter;
+	}
+	return gMgr.AttachEventLoop(
+			[=](intptr_t socket, int watch) {
+				watchSocket((SparkleSocket)socket, watch, loopdata);
+			},
+			[=](long timeoutMs) {
+				setTimer(timeoutMs, loopdata);
+			});
+}
+
+SPARKLE_API_DELC(void)
+sparkle_loop_detach() {
+	gMgr.DetachEventLoop();
+}
+
+SPARKLE_API_DELC(void)
+sparkle_loop_socket_action(SparkleSocket socket, int ready) {
+	gMgr.LoopSocketAction((intptr_t)socket, ready);
+}
+
+SPARKLE_API_DELC(void)
+sparkle_loop_timeout() {
+	gMgr.LoopTimeout();
+}
+
+SPARKLE_API_DELC(int)
+sparkle_check_update_async(
+		const char *preferLang,
+		const char **acceptChannels,
+		int acceptChannelCount,
+		void *userdata,
+		SparkleAsyncDone done) {
+	if (!done) {
+		return SparkleError::kInvalidParameter;
+	}
+	if (!gMgr.IsReady()) {
+		return SparkleError::kNotReady;
+	}
+
+	std::string lang;
+	std::vector<std::string> channels;
+	auto err = ResolveCheckParams(preferLang, acceptChannels, acceptChannelCount, lang, channels);
+	if (err != SparkleError::kNoError) {
+		return err;
+	}
+
+	return gMgr.CheckUpdateAsync(lang, channels, userdata, [=](SparkleError err) {
+		done(err, userdata);
+	});
+}
+
+SPARKLE_API_DELC(int)
+sparkle_download_to_file_async(const char *dstFile, void *userdata, SparkleAsyncDone done) {
+	if (!IS_STRING_PARAM_VALID(dstFile) || !done) {
+		return SparkleError::kInvalidParameter;
+	}
+	if (!gMgr.IsReady()) {
+		return SparkleError::kNotReady;
+	}
+	return gMgr.DowloadAsync(dstFile, userdata, [=](SparkleError err) {
+		done(err, userdata);
+	});
+}
+
+SPARKLE_API_DELC(int)
+sparkle_enable_peer_cache(
+		unsigned short servePort,
+		const char **peers,
+		int peerCount,
+		int useMulticast) {
+	SparkleLite::PeerCacheOptions opts;
+	opts.port = servePort;
+	opts.multicast = !!useMulticast;
+	if (peers && peerCount) {
+		for (auto idx = 0; idx < peerCount; idx++) {
+			if (!IS_STRING_PARAM_VALID(peers[idx])) {
+				return SparkleError::kInvalidParameter;
+			}
+			opts.peers.emplace_back(peers[idx]);
+		}
+	}
+	if (!opts.port && !opts.multicast && opts.peers.empty()) {
+		return SparkleError::kInvalidParameter;
+	}
+	return gMgr.EnablePeerCache(opts);
+}
+
+SPARKLE_API_DELC(void)
+sparkle_disable_peer_cache() {
+	gMgr.DisablePeerCache();
+}
+
+SPARKLE_API_DELC(int)
+sparkle_enable_shared_cache(const char *cacheDir, unsigned int ttlSeconds) {
+	if (!IS_STRING_PARAM_VALID(cacheDir)) {
+		return SparkleError::kInvalidParameter;
+	}
+	return gMgr.EnableSharedCache(cacheDir, ttlSeconds);
+}
+
+SPARKLE_API_DELC(void)
+sparkle_disable_shared_cache() {
+	gMgr.DisableSharedCache();
+}
+
+SPARKLE_API_DELC(int)
+sparkle_enable_decision_cache(unsigned int ttlSeconds) {
+	return gMgr.EnableDecisionCache(std::chrono::seconds(ttlSeconds));
+}
+
+SPARKLE_API_DELC(void)
+sparkle_disable_decision_cache() {
+	gMgr.DisableDecisionCache();
+}
+
+SPARKLE_API_DELC(int)
+sparkle_appcast_load(const char *xml, size_t size, void **appcast) {
+	if (!xml || !size || !appcast) {
+		return SparkleError::kInvalidParameter;
+	}
+
+	std::string content(xml, size);
+	// gateways load large feeds, all cores then
+	auto parsed = SparkleLite::ParseAppcastXML(content, 0);
+	if (parsed.items.empty()) {
+		return SparkleError::kInvalidAppcast;
+	}
+	*appcast = new SparkleLite::AppcastIndex(std::move(parsed));
+	return SparkleError::kNoError;
+}
+
+SPARKLE_API_DELC(int)
+sparkle_appcast_decide(
+		void *appcast,
+		const char **channelNames,
+		int channelCount,
+		const char **formats,
+		int formatCount,
+		long long now,
+		const SparkleClientColumns *clients,
+		SparkleDecisionColumns *decisions,
+		int threads) {
+	static_assert((unsigned)SparkleLite::AppcastIndex::kInformationalUpdate == (unsigned)kDecisionInformational &&
+					(unsigned)SparkleLite::AppcastIndex::kCriticalUpdate == (unsigned)kDecisionCritical &&
+					(unsigned)SparkleLite::AppcastIndex::kAutoUpdateSupported == (unsigned)kDecisionAutoUpdate,
+			"decision flags mismatch");
+	static_assert(sizeof(int) == sizeof(int32_t) && sizeof(unsigned long long) == sizeof(uint64_t), "column types mismatch");
+
+	if (!appcast || !clients || !decisions || clients->count < 0 || threads < 0 ||
+			channelCount < 0 || channelCount > UPDATE_DECISION_MAX_CHANNELS || (channelCount > 0 && !channelNames) ||
+			formatCount < 0 || (formatCount > 0 && !formats)) {
+		return SparkleError::kInvalidParameter;
+	}
+
+	std::vector<std::string> channels;
+	for (auto idx = 0; idx < channelCount; idx++) {
+		if (!IS_STRING_PARAM_VALID(channelNames[idx])) {
+			return SparkleError::kInvalidParameter;
+		}
+		channels.emplace_back(channelNames[idx]);
+	}
+
+	SparkleLite::EnclosureFormats preference;
+	for (auto idx = 0; idx < formatCount; idx++) {
+		if (!IS_STRING_PARAM_VALID(formats[idx])) {
+			return SparkleError::kInvalidParameter;
+		}
+		preference.emplace_back(formats[idx]);
+	}
+
+	SparkleLite::ClientColumns columns;
+	columns.count = (size_t)clients->count;
+	columns.appVersions = clients->appVersions;
+	columns.osNames = clients->osNames;
+	columns.osDistros = clients->osDistros;
+	columns.osArchs = clients->osArchs;
+	columns.osVersions = clients->osVersions;
+	columns.channelMasks = (const uint64_t *)clients->channelMasks;
+	columns.rolloutGroups = (const int8_t *)clients->rolloutGroups;
+
+	SparkleLite::DecisionColumns out;
+	out.items = (int32_t *)decisions->itemIndex;
+	out.enclosures = (int32_t *)decisions->enclosureIndex;
+	out.flags = (uint32_t *)decisions->flags;
+
+	auto index = (const SparkleLite::AppcastIndex *)appcast;
+	if (!SparkleLite::EvaluateUpdateDecisions(*index, channels, preference, now, columns, out, (unsigned)threads)) {
+		return SparkleError::kInvalidParameter;
+	}
+	return SparkleError::kNoError;
+}
+
+SPARKLE_API_DELC(int)
+sparkle_appcast_item_info(
+		void *appcast,
+		int itemIndex,
+		int enclosureIndex,
+		const char *preferLang,
+		SparkleNewVersionInfo *info) {
+	auto index = (const SparkleLite::AppcastIndex *)appcast;
+	if (!index || !info || itemIndex < 0 || (size_t)itemIndex >= index->Feed().items.size()) {
+		return SparkleError::kInvalidParameter;
+	}
+	auto &item = index->Feed().items[itemIndex];
+	if (enclosureIndex < 0 || (size_t)enclosureIndex >= item.enclosures.size()) {
+		return SparkleError::kInvalidParameter;
+	}
+	auto &enclosure = item.enclosures[enclosureIndex];
+
+	std::string lang = IS_STRING_PARAM_VALID(preferLang) ? preferLang : "";
+	auto description = index->Description((uint32_t)itemIndex, lang);
+	auto releaseNoteLink = index->ReleaseNoteLink((uint32_t)itemIndex, lang);
+
+#define PURE_C_STR_FIELD(_s_) ((_s_).empty() ? nullptr : (_s_).c_str())
+	*info = {};
+	info->channel = PURE_C_STR_FIELD(item.channel);
+	info->version = PURE_C_STR_FIELD(item.version);
+	info->title = PURE_C_STR_FIELD(item.title);
+	info->pubData = PURE_C_STR_FIELD(item.pubDate);
+	info->description = description ? PURE_C_STR_FIELD(*description) : nullptr;
+	info->releaseNoteURL = releaseNoteLink ? PURE_C_STR_FIELD(*releaseNoteLink) : nullptr;
+	info->downloadSize = enclosure.size;
+	info->downloadLink = PURE_C_STR_FIELD(enclosure.url);
+	info->downloadWebsite = PURE_C_STR_FIELD(item.link);
+	info->installArgs = PURE_C_STR_FIELD(enclosure.installArgs);
+#undef PURE_C_STR_FIELD
+	return SparkleError::kNoError;
+}
+
+SPARKLE_API_DELC(void)
+sparkle_appcast_free(void *appcast) {
+	delete (SparkleLite::AppcastIndex *)appcast;
+}
+
+SPARKLE_API_DELC(int)
+sparkle_enable_session_state(const char *stateFile, void *userdata) {
+	if (!IS_STRING_PARAM_VALID(stateFile)) {
+		return SparkleError::kInvalidParameter;
+	}
+	if (!gMgr.IsReady()) {
+		return SparkleError::kNotReady;
+	}
+	return gMgr.EnableSessionState(stateFile, userdata);
+}
+
+SPARKLE_API_DELC(void)
+sparkle_disable_session_state() {
+	gMgr.DisableSessionState();
+}
+
+SPARKLE_API_DELC(int)
+sparkle_use_agent(const char *socketPath) {
+	return gMgr.UseAgent(socketPath ? socketPath : "");
+}
+
 SPARKLE_API_DELC(int)
 sparkle_install(const char *overrideArgs, void *userdata) {
 	if (!gMgr.IsReady()) {
@@ -141,3 +583,24 @@ SPARKLE_API_DELC(int)
 sparkle_set_http_proxy(const char *proxy) {
 	return SparkleLite::simple_http_proxy_config(proxy) == 0 ? SparkleError::kNoError : SparkleError::kInvalidParameter;
 }
+
+SPARKLE_API_DELC(int)
+sparkle_set_retry_policy(
+		int maxAttempts,
+		unsigned int retryBaseMs,
+		unsigned int retryCapMs,
+		unsigned int lowSpeedBytesPerSec,
+		unsigned int lowSpeedSeconds) {
+	if (maxAttempts < 1 || retryCapMs < retryBaseMs || (lowSpeedBytesPerSec && !lowSpeedSeconds)) {
+		return SparkleError::kInvalidParameter;
+	}
+
+	SparkleLite::HttpRetryPolicy policy;
+	policy.maxAttempts = (unsigned)maxAttempts;
+	policy.retryBase = std::chrono::milliseconds(retryBaseMs);
+	policy.retryCap = std::chrono::milliseconds(retryCapMs);
+	policy.lowSpeedLimit = lowSpeedBytesPerSec;
+	policy.lowSpeedTime = std::chrono::seconds(lowSpeedSeconds);
+	SparkleLite::simple_http_retry_policy(policy);
+	return SparkleError::kNoError;
+}
@@ -1,9 +1,28 @@
 #ifndef _SPARKLE_INTERNAL_H_
 #define _SPARKLE_INTERNAL_H_
 
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
 #include <map>
 #include <string>
+#include <string_view>
 #include <vector>
+#ifndef _WIN32
+#include <strings.h>
+#endif
+
+// portability shims for the MSVC CRT names used across the code
+#ifdef _WIN32
+#define strncasecmp _strnicmp
+#else
+#define _stricmp strcasecmp
+#define _strnicmp strncasecmp
+inline int fopen_s(FILE **fp, const char *path, const char *mode) {
+	*fp = fopen(path, mode);
+	return *fp ? 0 : errno;
+}
+#endif
 
 namespace SparkleLite {
 enum class SignatureAlgo {
@@ -39,6 +58,7 @@ struct AppcastItem {
 	std::vector<std::string> informationalUpdateVers;
 	std::string minAutoUpdateVerRequire;
 	uint64_t rollOutInterval = 0;
+	uint64_t versionKey = 0; // MakeVersionKey(version), 0 if not computed
 };
 
 struct Appcast {
@@ -49,12 +69,47 @@ struct Appcast {
 	std::vector<AppcastItem> items;
 };
 
-#ifdef _WIN32
-#define strncasecmp _strnicmp
-#endif
-
 #define DEFAULT_SPARKLE_UA	("sparkle-lite-agent")
 
+//
+// compare two version strings part by part, numeric parts are compared as numbers
+//
+int SafeVersionCompare(std::string_view x, std::string_view y);
+
+//
+// Plain versions ("1.2.3", up to 4 numeric parts below 32768) packed into one integer ordered as SafeVersionCompare,
+// 0 for the others. Sorting a large feed compares integers then, instead of parsing both strings every time
+//
+uint64_t MakeVersionKey(std::string_view version);
+
+// SafeVersionCompare, through the keys when both versions have one
+inline int SafeVersionCompare(uint64_t xKey, std::string_view x, uint64_t yKey, std::string_view y) {
+	if (xKey && yKey) {
+		return xKey == yKey ? 0 : (xKey > yKey ? 1 : -1);
+	}
+	return SafeVersionCompare(x, y);
+}
+
+inline bool equals_no_case(std::string_view a, std::string_view b) {
+	return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+// without leading & trailing blanks (spaces and tabs)
+inline std::string_view trim_spaces(std::string_view value) {
+	while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+		value.remove_prefix(1);
+	}
+	while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) {
+		value.remove_suffix(1);
+	}
+	return value;
+}
+
+//
+// the key of MultiLangString for an ISO-639 code, 0 if it's not one
+//
+uint16_t LangCode(std::string_view lang);
+
 }; //namespace SparkleLite
 
 #endif //_SPARKLE_INTERNAL_H_
\ No newline at end of file
@@ -1,23 +1,32 @@
 #include "sparkle_manager.h"
+#include "appcast_binary.h"
+#include "appcast_index.h"
 #include "appcast_parser.h"
+#include "archive_extractor.h"
 #include "os_support.h"
 #include "signature_verifier.h"
 #include "simple_http.h"
+#include "stream_codec.h"
+#include "update_agent.h"
 #include <openssl/x509.h>
 #include <algorithm>
 #include <cassert>
 #include <cctype>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <random>
 
 namespace SparkleLite {
 
-static std::tuple<size_t, bool> FindVersionPart(const std::string &v, size_t off) {
+static std::tuple<size_t, bool> FindVersionPart(std::string_view v, size_t off) {
 	auto idx = off;
 	auto isDigit = true;
 	while (idx < v.size()) {
-		if (v.at(idx) == '.') {
+		if (v[idx] == '.') {
 			return { idx, isDigit };
 		}
-		if (isDigit && !std::isdigit(v.at(idx))) {
+		if (isDigit && !std::isdigit((unsigned char)v[idx])) {
 			isDigit = false;
 		}
 		++idx;
@@ -25,19 +34,49 @@ static std::tuple<size_t, bool> FindVersionPart(const std::string &v, size_t off
 	return { idx, isDigit };
 }
 
-int SafeVersionCompare(const std::string &x, const std::string &y) {
+static int CompareNumberPart(std::string_view x, std::string_view y) {
+	// strip leading zeros, then the longer one is the bigger one (never overflows)
+	while (x.size() > 1 && x.front() == '0') {
+		x.remove_prefix(1);
+	}
+	while (y.size() > 1 && y.front() == '0') {
+		y.remove_prefix(1);
+	}
+	if (x.size() != y.size()) {
+		return x.size() > y.size() ? 1 : -1;
+	}
+	auto ret = x.compare(y);
+	return ret == 0 ? 0 : (ret > 0 ? 1 : -1);
+}
+
+static int CompareTextPart(std::string_view x, std::string_view y) {
+	auto len = std::min(x.size(), y.size());
+	for (size_t idx = 0; idx < len; idx++) {
+		int cx = std::tolower((unsigned char)x[idx]);
+		int cy = std::tolower((unsigned char)y[idx]);
+		if (cx != cy) {
+			return cx > cy ? 1 : -1;
+		}
+	}
+	if (x.size() != y.size()) {
+		return x.size() > y.size() ? 1 : -1;
+	}
+	return 0;
+}
+
+int SafeVersionCompare(std::string_view x, std::string_view y) {
 	size_t xOff = 0, yOff = 0;
 	while (true) {
 		auto [xPos, xIsDigit] = FindVersionPart(x, xOff);
 		auto [yPos, yIsDigit] = FindVersionPart(y, yOff);
 
-		if (xPos == xOff && yPos == yOff) {
+		if (xPos <= xOff && yPos <= yOff) {
 			// both reach tail
 			return 0;
-		} else if (xPos == yOff && yPos > yOff) {
+		} else if (xPos <= xOff && yPos > yOff) {
 			// y wins
 			return -1;
-		} else if (xPos > xOff && yPos == yOff) {
+		} else if (xPos > xOff && yPos <= yOff) {
 			// x wins
 			return 1;
 		}
@@ -45,19 +84,9 @@ int SafeVersionCompare(const std::string &x, const std::string &y) {
 		// compare this part
 		auto xPart = x.substr(xOff, xPos - xOff);
 		auto yPart = y.substr(yOff, yPos - yOff);
-		if (xIsDigit && yIsDigit) {
-			// compare as number
-			auto vX = std::stoll(xPart);
-			auto vY = std::stoll(yPart);
-			if (vX != vY) {
-				return vX > vY ? 1 : -1;
-			}
-		} else {
-			// compare as string
-			int ret = _stricmp(xPart.c_str(), yPart.c_str());
-			if (ret != 0) {
-				return ret;
-			}
+		auto ret = (xIsDigit && yIsDigit) ? CompareNumberPart(xPart, yPart) : CompareTextPart(xPart, yPart);
+		if (ret != 0) {
+			return ret;
 		}
 
 		// update offsets
@@ -67,6 +96,44 @@ int SafeVersionCompare(const std::string &x, const std::string &y) {
 	return 0;
 }
 
+//
+// [valid:1][part0:15][part1:15][part2:15][part3:15][parts:3], missing parts are 0 and the part count breaks ties,
+// as SafeVersionCompare has "1.0" newer than "1"
+//
+#define VERSION_KEY_PARTS (4)
+#define VERSION_KEY_PART_BITS (15)
+
+uint64_t MakeVersionKey(std::string_view version) {
+	uint64_t key = 1;
+	size_t parts = 0;
+	size_t off = 0;
+	while (off <= version.size()) {
+		auto end = std::min(version.find('.', off), version.size());
+		if (end == off || parts == VERSION_KEY_PARTS) {
+			// empty parts end a version early, leave those to SafeVersionCompare
+			return 0;
+		}
+
+		uint64_t value = 0;
+		for (auto idx = off; idx < end; idx++) {
+			if (!std::isdigit((unsigned char)version[idx])) {
+				return 0;
+			}
+			value = value * 10 + (uint64_t)(version[idx] - '0');
+			if (value >> VERSION_KEY_PART_BITS) {
+				return 0;
+			}
+		}
+		key = (key << VERSION_KEY_PART_BITS) | value;
+		++parts;
+		off = end + 1;
+	}
+	for (auto idx = parts; idx < VERSION_KEY_PARTS; idx++) {
+		key <<= VERSION_KEY_PART_BITS;
+	}
+	return (key << 3) | parts;
+}
+
 void SparkleManager::SetCallbacks(const SparkleCallbacks &callbacks) {
 	handlers_ = callbacks;
 }
@@ -88,12 +155,46 @@ void SparkleManager::SetSignatureVerifyParams(SignatureAlgo algo, const std::str
 
 void SparkleManager::SetHttpsCAPath(const std::string &caPath) {
 	caPath_ = caPath;
+	simple_http_ca_path(caPath);
+}
+
+void SparkleManager::WarmUp() {
+	std::unique_lock<std::mutex> lck(cacheLock_);
+	if (warmUp_.valid()) {
+		return;
+	}
+	warmUp_ = std::async(std::launch::async, [algo = signAlgo_, pubkey = signPubKey_]() {
+		if (algo != SignatureAlgo::kNone) {
+			PrepareVerifyKey(algo, pubkey);
+		}
+		simple_http_warm_up();
+	});
+}
+
+void SparkleManager::SetTransport(std::shared_ptr<HttpTransport> transport) {
+	std::unique_lock<std::mutex> lck(cacheLock_);
+	transport_ = transport ? transport : std::make_shared<CurlTransport>();
+}
+
+std::shared_ptr<HttpTransport> SparkleManager::Transport() {
+	std::unique_lock<std::mutex> lck(cacheLock_);
+	return transport_;
 }
 
 void SparkleManager::SetHttpHeader(const std::string &key, const std::string &value) {
 	headers_.insert({ key, value });
 }
 
+void SparkleManager::SetEnclosurePreference(const EnclosureFormats &formats) {
+	std::unique_lock<std::mutex> lck(cacheLock_);
+	enclosureFormats_ = formats;
+	decisions_.clear();
+}
+
+void SparkleManager::SetAppcastParseThreads(unsigned threads) {
+	parseThreads_ = threads;
+}
+
 bool SparkleManager::IsReady() {
 	return (handlers_.sparkle_download_progress != nullptr &&
 			handlers_.sparkle_new_version_found != nullptr &&
@@ -102,48 +203,369 @@ bool SparkleManager::IsReady() {
 			!appVer_.empty());
 }
 
+SparkleManager::~SparkleManager() {
+	close_memory_file(memoryPackage_);
+}
+
 void SparkleManager::Clean() {
+	// a revalidation still running reports to its caller's userdata, done once this returns
+	std::future<void> revalidation;
+	{
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		revalidation = std::move(revalidation_);
+	}
+	if (revalidation.valid()) {
+		revalidation.wait();
+	}
+
+	std::unique_lock<std::mutex> lck(cacheLock_);
 	cacheAppcast_ = {};
+	appcastIndex_.reset();
 	downloadedPackage_.clear();
+	close_memory_file(memoryPackage_);
+	memoryPackage_ = -1;
+	verifiedPackage_ = {};
+	decisions_.clear();
 }
 
 SparkleError SparkleManager::CheckUpdate(const std::string &preferLang, const std::vector<std::string> &channels, void *userdata) {
-	// prepare
-	HttpHeaders respHeaders;
-	std::string respBody;
-	auto status = simple_http_get(appcastUrl_, headers_, respHeaders, respBody);
-	if (status != 200 ||
-			respBody.empty()) {
-		return SparkleError::kNetworkFail;
+	SparkleError agentErr;
+	if (CheckThroughAgent(preferLang, channels, userdata, agentErr)) {
+		return agentErr;
 	}
 
-#if 0
-		auto it = respHeaders.find("Content-Type");
-		if (_strnicmp(it->second.c_str(), XML_MIME, sizeof(XML_MIME) - 1) != 0)
-		{
-			return SparkleError::kNetworkFail;
+	auto key = DecisionKey(preferLang, channels);
+	std::shared_ptr<const CheckOutcome> cached;
+	bool stale = false;
+	{
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		auto it = decisions_.find(key);
+		if (decisionTTL_.count() > 0 && it != decisions_.end()) {
+			cached = it->second.outcome;
+			stale = std::chrono::steady_clock::now() - it->second.decidedAt >= decisionTTL_;
+		}
+	}
+	if (!cached) {
+		HttpHeaders respHeaders;
+		return CheckUpdate(preferLang, channels, userdata, respHeaders, -1);
+	}
+
+	// answer at once, a stale answer is refreshed behind it
+	auto err = NotifyOutcome(*cached, userdata);
+	if (stale) {
+		Revalidate(preferLang, channels, userdata, cached);
+	}
+	return err;
+}
+
+SparkleError SparkleManager::CheckUpdate(const std::string &preferLang, const std::vector<std::string> &channels, void *userdata, HttpHeaders &respHeaders, long long changedAt) {
+	auto outcome = RunCheck(preferLang, channels, changedAt);
+	respHeaders = outcome->respHeaders;
+	return NotifyOutcome(*outcome, userdata);
+}
+
+std::shared_ptr<const SparkleManager::CheckOutcome> SparkleManager::RunCheck(const std::string &preferLang, const std::vector<std::string> &channels, long long changedAt) {
+	// identical checks at the same time share the fetch and the selection, each caller is notified on its own
+	auto key = DecisionKey(preferLang, channels);
+	auto outcome = checkFlights_.Do(key + "\n" + std::to_string(changedAt), [&]() {
+		auto checked = std::make_shared<CheckOutcome>();
+		std::string respBody;
+		auto status = FetchAppcast(AppcastRequestHeaders(), checked->respHeaders, respBody, changedAt);
+		if (status != 200 ||
+				respBody.empty()) {
+			checked->err = SparkleError::kNetworkFail;
+		} else {
+			checked->err = SelectAppcast(checked->respHeaders, respBody, preferLang, channels, checked->selected);
+		}
+		return std::shared_ptr<const CheckOutcome>(checked);
+	});
+
+	// only decisions are remembered, not failures
+	if (outcome->err == SparkleError::kNoError || outcome->err == SparkleError::kNoUpdateFound) {
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		if (decisionTTL_.count() > 0) {
+			decisions_[key] = { outcome, std::chrono::steady_clock::now() };
 		}
-#endif
+	}
+	return outcome;
+}
 
-	// assume the body is appcast formatted xml, so we should parse it
-	auto appcast = ParseAppcastXML(respBody);
-	if (appcast.items.empty()) {
-		return SparkleError::kInvalidAppcast;
+SparkleError SparkleManager::NotifyOutcome(const CheckOutcome &outcome, void *userdata) {
+	if (outcome.err != SparkleError::kNoError) {
+		return outcome.err;
 	}
+	return SelectUpdate(outcome.selected, userdata);
+}
 
-	FilteredAppcast selectedAppcast;
+std::string SparkleManager::DecisionKey(const std::string &preferLang, const std::vector<std::string> &channels) {
+	auto key = appcastUrl_ + "\n" + appVer_ + "\n" + preferLang;
+	for (const auto &channel : channels) {
+		key.append("\n").append(channel);
+	}
+	return key;
+}
+
+void SparkleManager::Revalidate(const std::string &preferLang, const std::vector<std::string> &channels, void *userdata, std::shared_ptr<const CheckOutcome> stale) {
+	// one at a time, a stale decision seen meanwhile is refreshed by a later call
+	std::unique_lock<std::mutex> lck(cacheLock_);
+	if (revalidation_.valid() && revalidation_.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+		return;
+	}
+	revalidation_ = std::async(std::launch::async, [=]() {
+		auto fresh = RunCheck(preferLang, channels, -1);
 
-	std::sort(appcast.items.begin(), appcast.items.end(), [&](const AppcastItem &a, const AppcastItem &b) -> bool {
-		return SafeVersionCompare(a.version, b.version) > 0;
+		// tell again only what's different from the answer already given
+		auto &before = stale->selected;
+		auto &now = fresh->selected;
+		if (fresh->err == SparkleError::kNoError &&
+				(stale->err != SparkleError::kNoError ||
+						before.version != now.version ||
+						before.enclosure.url != now.enclosure.url ||
+						before.enclosure.signature != now.enclosure.signature)) {
+			SelectUpdate(now, userdata);
+		} else if (fresh->err == SparkleError::kNoUpdateFound && stale->err == SparkleError::kNoError) {
+			WithdrawUpdate(before, userdata);
+		}
 	});
-	if (!FilterSortedAppcast(appcast, preferLang, channels, selectedAppcast)) {
+}
+
+void SparkleManager::WithdrawUpdate(const FilteredAppcast &withdrawn, void *userdata) {
+	{
+		// a check selected another update meanwhile, that's what the caller was told last
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		if (cacheAppcast_.version != withdrawn.version ||
+				cacheAppcast_.enclosure.url != withdrawn.enclosure.url ||
+				cacheAppcast_.enclosure.signature != withdrawn.enclosure.signature) {
+			return;
+		}
+		cacheAppcast_ = {};
+	}
+	if (session_.IsEnabled()) {
+		// nothing left to restore from
+		std::unique_lock<std::mutex> saving(sessionLock_);
+		session_.Write({ { "appcast", appcastUrl_ }, { "app-version", appVer_ } });
+	}
+
+	// the update told about is gone
+	handlers_.sparkle_new_version_found(nullptr, userdata);
+}
+
+SparkleError SparkleManager::EnableDecisionCache(std::chrono::seconds ttl) {
+	if (ttl.count() <= 0) {
+		return SparkleError::kInvalidParameter;
+	}
+	std::unique_lock<std::mutex> lck(cacheLock_);
+	decisionTTL_ = ttl;
+	return SparkleError::kNoError;
+}
+
+void SparkleManager::DisableDecisionCache() {
+	std::unique_lock<std::mutex> lck(cacheLock_);
+	decisionTTL_ = std::chrono::seconds(0);
+	decisions_.clear();
+}
+
+HttpHeaders SparkleManager::AppcastRequestHeaders() {
+	// let the server know we can take the binary appcast
+	auto reqHeaders = headers_;
+	if (!simple_http_find_header(reqHeaders, "Accept")) {
+		reqHeaders["Accept"] = std::string(BINARY_APPCAST_MIME) + ", application/rss+xml;q=0.9, */*;q=0.8";
+	}
+	return reqHeaders;
+}
+
+SparkleError SparkleManager::ProcessAppcast(const HttpHeaders &respHeaders, std::string &respBody, const std::string &preferLang, const std::vector<std::string> &channels, void *userdata) {
+	FilteredAppcast selectedAppcast;
+	auto err = SelectAppcast(respHeaders, respBody, preferLang, channels, selectedAppcast);
+	if (err != SparkleError::kNoError) {
+		return err;
+	}
+	return SelectUpdate(selectedAppcast, userdata);
+}
+
+SparkleError SparkleManager::SelectAppcast(const HttpHeaders &respHeaders, std::string &respBody, const std::string &preferLang, const std::vector<std::string> &channels, FilteredAppcast &selectedAppcast) {
+
+	// pick the loader by Content-Type, xml is the default
+	auto contentType = simple_http_find_header(respHeaders, "Content-Type");
+	if (contentType && strncasecmp(contentType->c_str(), BINARY_APPCAST_MIME, strlen(BINARY_APPCAST_MIME)) == 0) {
+		// there's no index of it, requeries don't get to select from the feed fetched before
+		{
+			std::unique_lock<std::mutex> lck(cacheLock_);
+			appcastIndex_.reset();
+		}
+
+		// already sorted by version, items are read in place
+		BinaryAppcast appcast;
+		if (!appcast.Load(std::move(respBody)) || !appcast.ItemCount()) {
+			return SparkleError::kInvalidAppcast;
+		}
+		if (!FilterBinaryAppcast(appcast, preferLang, channels, selectedAppcast)) {
+			return SparkleError::kNoUpdateFound;
+		}
+	} else {
+		// assume the body is appcast formatted xml, so we should parse it
+		auto appcast = ParseAppcastXML(respBody, parseThreads_);
+		if (appcast.items.empty()) {
+			return SparkleError::kInvalidAppcast;
+		}
+
+		// index it once, later queries against this feed don't parse or sort again
+		auto index = std::make_shared<const AppcastIndex>(std::move(appcast));
+		{
+			std::unique_lock<std::mutex> lck(cacheLock_);
+			appcastIndex_ = index;
+		}
+		if (!FilterIndexedAppcast(*index, preferLang, channels, selectedAppcast)) {
+			return SparkleError::kNoUpdateFound;
+		}
+	}
+	return SparkleError::kNoError;
+}
+
+int SparkleManager::FetchAppcast(const HttpHeaders &reqHeaders, HttpHeaders &respHeaders, std::string &respBody, long long changedAt) {
+	auto lockPath = appcastCache_.LockPath(appcastUrl_);
+	if (lockPath.empty()) {
+		if (changedAt < 0) {
+			return Transport()->Get(appcastUrl_, reqHeaders, respHeaders, respBody);
+		}
+		return FetchPushedAppcast(reqHeaders, respHeaders, respBody);
+	}
+
+	auto serve = [&](SharedAppcastCache::Entry &entry) -> int {
+		respHeaders = std::move(entry.headers);
+		respBody = std::move(entry.body);
+		return 200;
+	};
+	// after a change was pushed, only what's been fetched since then is fresh
+	auto isFresh = [&](const SharedAppcastCache::Entry &entry, long long now) {
+		return now < entry.expires && (changedAt < 0 || entry.fetched > changedAt);
+	};
+
+	SharedAppcastCache::Entry entry;
+	auto now = (long long)time(nullptr);
+	if (appcastCache_.Read(appcastUrl_, entry) && isFresh(entry, now)) {
+		return serve(entry);
+	}
+
+	// one process revalidates, the others wait for it and take what it stored
+	SharedAppcastCache::EntryLock lock(lockPath);
+	if (!lock.IsLocked()) {
+		// can't take part (no access to the lock), fetch it for ourselves and leave the entry alone
+		return Transport()->Get(appcastUrl_, reqHeaders, respHeaders, respBody);
+	}
+	auto cached = appcastCache_.Read(appcastUrl_, entry);
+	now = (long long)time(nullptr);
+	if (cached && isFresh(entry, now)) {
+		return serve(entry);
+	}
+
+	auto status = Transport()->Get(appcastUrl_, cached ? RevalidationHeaders(reqHeaders, entry) : reqHeaders, respHeaders, respBody);
+	return StoreAppcast(status, cached ? &entry : nullptr, respHeaders, respBody);
+}
+
+int SparkleManager::FetchPushedAppcast(const HttpHeaders &reqHeaders, HttpHeaders &respHeaders, std::string &respBody) {
+	// only the push checks use (and keep) the last response, a restarted channel may forget it meanwhile
+	SharedAppcastCache::Entry last;
+	{
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		last = pushedAppcast_;
+	}
+	auto status = Transport()->Get(appcastUrl_, last.body.empty() ? reqHeaders : RevalidationHeaders(reqHeaders, last), respHeaders, respBody);
+	if (status == 304 && !last.body.empty()) {
+		respHeaders = std::move(last.headers);
+		respBody = std::move(last.body);
+		return 200;
+	}
+	if (status == 200 && !respBody.empty() &&
+			(simple_http_find_header(respHeaders, "ETag") || simple_http_find_header(respHeaders, "Last-Modified"))) {
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		pushedAppcast_.headers = respHeaders;
+		pushedAppcast_.body = respBody;
+	}
+	return status;
+}
+
+HttpHeaders SparkleManager::RevalidationHeaders(const HttpHeaders &reqHeaders, const SharedAppcastCache::Entry &entry) {
+	auto condHeaders = reqHeaders;
+	auto etag = simple_http_find_header(entry.headers, "ETag");
+	auto lastModified = simple_http_find_header(entry.headers, "Last-Modified");
+	if (etag) {
+		condHeaders["If-None-Match"] = *etag;
+	}
+	if (lastModified) {
+		condHeaders["If-Modified-Since"] = *lastModified;
+	}
+	return condHeaders;
+}
+
+int SparkleManager::StoreAppcast(int status, SharedAppcastCache::Entry *cached, HttpHeaders &respHeaders, std::string &respBody) {
+	if (!appcastCache_.IsEnabled()) {
+		return status;
+	}
+
+	auto now = (long long)time(nullptr);
+	auto ttl = std::max(appcastCache_.TTL(), simple_http_max_age(respHeaders));
+	if (status == 304 && cached) {
+		// still the same feed, just good for another while
+		cached->fetched = now;
+		cached->expires = now + ttl;
+		appcastCache_.Write(appcastUrl_, *cached);
+		respHeaders = std::move(cached->headers);
+		respBody = std::move(cached->body);
+		return 200;
+	}
+	if (status == 200 && !respBody.empty()) {
+		SharedAppcastCache::Entry fresh;
+		fresh.fetched = now;
+		fresh.expires = now + ttl;
+		fresh.headers = respHeaders;
+		fresh.body = respBody;
+		appcastCache_.Write(appcastUrl_, fresh);
+	}
+	return status;
+}
+
+SparkleError SparkleManager::EnableSharedCache(const std::string &dir, long long ttl) {
+	return appcastCache_.Enable(dir, ttl) ? SparkleError::kNoError : SparkleError::kFileIOFail;
+}
+
+void SparkleManager::DisableSharedCache() {
+	appcastCache_.Disable();
+}
+
+SparkleError SparkleManager::RequeryUpdate(const std::string &preferLang, const std::vector<std::string> &channels, void *userdata) {
+	auto index = CurrentAppcastIndex();
+	if (!index) {
+		return SparkleError::kNotReady;
+	}
+
+	FilteredAppcast selectedAppcast;
+	if (!FilterIndexedAppcast(*index, preferLang, channels, selectedAppcast)) {
 		return SparkleError::kNoUpdateFound;
 	}
+	return SelectUpdate(selectedAppcast, userdata);
+}
 
+std::shared_ptr<const AppcastIndex> SparkleManager::CurrentAppcastIndex() {
+	std::unique_lock<std::mutex> lck(cacheLock_);
+	return appcastIndex_;
+}
+
+SparkleError SparkleManager::SelectUpdate(const FilteredAppcast &selectedAppcast, void *userdata) {
 	if (selectedAppcast.enclosure.signType != signAlgo_) {
 		return SparkleError::kUnsupportedSignAlgo;
 	}
-	cacheAppcast_ = selectedAppcast;
+	bool changed = false;
+	{
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		changed = cacheAppcast_.version != selectedAppcast.version ||
+				cacheAppcast_.enclosure.url != selectedAppcast.enclosure.url ||
+				cacheAppcast_.enclosure.signature != selectedAppcast.enclosure.signature;
+		cacheAppcast_ = selectedAppcast;
+	}
+	if (changed) {
+		SaveSession();
+	}
 
 	// we have an update, notify it
 #define PURE_C_STR_FIELD(_s_) ((_s_).empty() ? nullptr : (_s_).c_str())
@@ -166,36 +588,345 @@ SparkleError SparkleManager::CheckUpdate(const std::string &preferLang, const st
 	return SparkleError::kNoError;
 }
 
+bool SparkleManager::IsVerifiedPackage(const std::string &file, const AppcastEnclosure &enclosure) {
+	if (enclosure.signType == SignatureAlgo::kNone) {
+		return true;
+	}
+
+	SessionState::VerifiedFile memo;
+	{
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		memo = verifiedPackage_;
+	}
+	if (SessionState::IsUnchanged(memo, file, enclosure.signature, SessionState::KeyDigest(signPubKey_))) {
+		return true;
+	}
+
+	// not the file we know, the whole of it then
+	if (!VerifyFile(file, enclosure.signType, enclosure.signature, signPubKey_)) {
+		return false;
+	}
+	SetDownloadedPackage(file, enclosure);
+	return true;
+}
+
+void SparkleManager::SetDownloadedPackage(const std::string &file, const AppcastEnclosure &enclosure) {
+	SessionState::VerifiedFile memo;
+	SessionState::Stamp(file, enclosure.signature, SessionState::KeyDigest(signPubKey_), memo);
+	{
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		downloadedPackage_ = file;
+		verifiedPackage_ = memo;
+	}
+	SaveSession();
+}
+
+//
+// the selected update is kept with the package verified for it, a package of another update isn't
+//
+void SparkleManager::SaveSession() {
+	if (!session_.IsEnabled()) {
+		return;
+	}
+
+	std::unique_lock<std::mutex> saving(sessionLock_);
+	SessionState::Fields fields;
+	{
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		if (cacheAppcast_.version.empty()) {
+			return;
+		}
+		fields["appcast"] = appcastUrl_;
+		fields["app-version"] = appVer_;
+		PutUpdateFields(cacheAppcast_, fields);
+		if (!downloadedPackage_.empty() && downloadedPackage_ == verifiedPackage_.path &&
+				verifiedPackage_.signature == cacheAppcast_.enclosure.signature) {
+			SessionState::PutVerifiedFile(verifiedPackage_, fields);
+		}
+	}
+	session_.Write(fields);
+}
+
+SparkleError SparkleManager::EnableSessionState(const std::string &path, void *userdata) {
+	if (!session_.Enable(path)) {
+		return SparkleError::kFileIOFail;
+	}
+
+	// only what this very app version left, for the same appcast
+	SessionState::Fields fields;
+	if (!session_.Read(fields) || fields["appcast"] != appcastUrl_ || fields["app-version"] != appVer_) {
+		return SparkleError::kNoUpdateFound;
+	}
+
+	FilteredAppcast update;
+	if (!GetUpdateFields(fields, update) || update.enclosure.signType != signAlgo_) {
+		return SparkleError::kNoUpdateFound;
+	}
+
+	// the package must still be the very file verified then, nothing is downloaded nor hashed whole
+	SessionState::VerifiedFile memo;
+	if (!SessionState::GetVerifiedFile(fields, memo) ||
+			!SessionState::IsUnchanged(memo, memo.path, update.enclosure.signature, SessionState::KeyDigest(signPubKey_))) {
+		return SparkleError::kNoUpdateFound;
+	}
+	{
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		downloadedPackage_ = memo.path;
+		verifiedPackage_ = memo;
+	}
+	return SelectUpdate(update, userdata);
+}
+
+void SparkleManager::DisableSessionState() {
+	session_.Disable();
+}
+
+SparkleError SparkleManager::UseAgent(const std::string &socketPath) {
+	std::unique_lock<std::mutex> lck(cacheLock_);
+	agentSocket_ = socketPath;
+	agentProduct_.clear();
+	return SparkleError::kNoError;
+}
+
+bool SparkleManager::CheckThroughAgent(const std::string &preferLang, const std::vector<std::string> &channels, void *userdata, SparkleError &err) {
+	std::string socketPath;
+	{
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		socketPath = agentSocket_;
+	}
+	if (socketPath.empty()) {
+		return false;
+	}
+
+	// what tells our product apart at the agent, the download asks for the same
+	AgentMessage product;
+	product["appcast"] = appcastUrl_;
+	product["app-version"] = appVer_;
+	product["sign-algo"] = std::to_string((int)signAlgo_);
+	product["pub-key"] = signPubKey_;
+	product["lang"] = preferLang;
+	for (const auto &channel : channels) {
+		product["channels"].append(channel).append("\n");
+	}
+	{
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		for (const auto &format : enclosureFormats_) {
+			product["formats"].append(format).append("\n");
+		}
+	}
+
+	auto request = product;
+	request["op"] = "check";
+	AgentMessage reply;
+	int fd = -1;
+	auto status = agent_request(socketPath, request, [](uint64_t, uint64_t) { return true; }, reply, fd);
+	if (status == AgentStatus::kUnreachable) {
+		// on our own then
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		agentProduct_.clear();
+		return false;
+	}
+	if (fd >= 0) {
+		close_memory_file(fd);
+	}
+
+	FilteredAppcast update;
+	err = status == AgentStatus::kReplied ? (SparkleError)std::atoi(reply["err"].c_str()) : SparkleError::kNetworkFail;
+	if (err != SparkleError::kNoError) {
+		return true;
+	}
+	if (!GetUpdateFields(reply, update)) {
+		err = SparkleError::kInvalidAppcast;
+		return true;
+	}
+	{
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		agentProduct_ = std::move(product);
+	}
+	err = SelectUpdate(update, userdata);
+	return true;
+}
+
+static bool VerifyMemoryFile(int fd, const AppcastEnclosure &enclosure, const std::string &pubKey) {
+	struct Verification {
+		const AppcastEnclosure &enclosure;
+		const std::string &pubKey;
+	} verification = { enclosure, pubKey };
+	return view_memory_file(
+			fd,
+			[](void *ctx, const void *data, size_t size) -> bool {
+				auto v = (Verification *)ctx;
+				return VerifyDataBuffer(data, size, v->enclosure.signType, v->enclosure.signature, v->pubKey);
+			},
+			&verification);
+}
+
+bool SparkleManager::DowloadThroughAgent(void *userdata, SparkleError &err) {
+	std::string socketPath;
+	AgentMessage request;
+	AppcastEnclosure enclosure;
+	{
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		if (agentSocket_.empty() || agentProduct_.empty()) {
+			return false;
+		}
+		socketPath = agentSocket_;
+		request = agentProduct_;
+		request["version"] = cacheAppcast_.version;
+		enclosure = cacheAppcast_.enclosure;
+	}
+
+	request["op"] = "download";
+	AgentMessage reply;
+	int fd = -1;
+	auto status = agent_request(
+			socketPath, request,
+			[&](uint64_t total, uint64_t size) -> bool {
+				return handlers_.sparkle_download_progress(total, size, userdata) != 0;
+			},
+			reply, fd);
+	if (status == AgentStatus::kUnreachable) {
+		return false;
+	}
+
+	if (status == AgentStatus::kCancelled) {
+		err = SparkleError::kCancel;
+	} else if (status == AgentStatus::kLost) {
+		err = SparkleError::kNetworkFail;
+	} else {
+		err = (SparkleError)std::atoi(reply["err"].c_str());
+		if (err == SparkleError::kNoError && fd < 0) {
+			err = SparkleError::kFail;
+		}
+	}
+
+	// the agent verified it, we don't install what we didn't verify ourselves
+	if (err == SparkleError::kNoError && enclosure.signType != SignatureAlgo::kNone &&
+			!VerifyMemoryFile(fd, enclosure, signPubKey_)) {
+		err = SparkleError::kBadSignature;
+	}
+	if (err != SparkleError::kNoError) {
+		close_memory_file(fd);
+		return true;
+	}
+
+	// installed from the descriptor like our own memory package
+	std::unique_lock<std::mutex> lck(cacheLock_);
+	close_memory_file(memoryPackage_);
+	memoryPackage_ = fd;
+	downloadedPackage_.clear();
+	return true;
+}
+
+bool SparkleManager::CurrentUpdate(SessionState::Fields &fields) {
+	std::unique_lock<std::mutex> lck(cacheLock_);
+	if (cacheAppcast_.version.empty()) {
+		return false;
+	}
+	PutUpdateFields(cacheAppcast_, fields);
+	return true;
+}
+
+void SparkleManager::PutUpdateFields(const FilteredAppcast &update, SessionState::Fields &fields) {
+	fields["informational"] = update.isInformationalUpdate ? "1" : "0";
+	fields["critical"] = update.isCriticalUpdate ? "1" : "0";
+	fields["auto-update"] = update.canAutoUpdateSupported ? "1" : "0";
+	fields["channel"] = update.channel;
+	fields["version"] = update.version;
+	fields["short-version"] = update.shortVersion;
+	fields["pub-date"] = update.pubDate;
+	fields["title"] = update.title;
+	fields["description"] = update.description;
+	fields["release-notes"] = update.releaseNoteLink;
+	fields["download-website"] = update.downloadWebsite;
+	fields["enclosure-url"] = update.enclosure.url;
+	fields["enclosure-sign-type"] = std::to_string((int)update.enclosure.signType);
+	fields["enclosure-signature"] = update.enclosure.signature;
+	fields["enclosure-size"] = std::to_string(update.enclosure.size);
+	fields["enclosure-mime"] = update.enclosure.mime;
+	fields["enclosure-install-args"] = update.enclosure.installArgs;
+	fields["enclosure-os"] = update.enclosure.os;
+}
+
+bool SparkleManager::GetUpdateFields(SessionState::Fields &fields, FilteredAppcast &update) {
+	update = {};
+	update.valid = true;
+	update.isInformationalUpdate = fields["informational"] == "1";
+	update.isCriticalUpdate = fields["critical"] == "1";
+	update.canAutoUpdateSupported = fields["auto-update"] == "1";
+	update.channel = fields["channel"];
+	update.version = fields["version"];
+	update.shortVersion = fields["short-version"];
+	update.pubDate = fields["pub-date"];
+	update.title = fields["title"];
+	update.description = fields["description"];
+	update.releaseNoteLink = fields["release-notes"];
+	update.downloadWebsite = fields["download-website"];
+	update.enclosure.url = fields["enclosure-url"];
+	update.enclosure.signType = (SignatureAlgo)std::atoi(fields["enclosure-sign-type"].c_str());
+	update.enclosure.signature = fields["enclosure-signature"];
+	update.enclosure.size = std::strtoull(fields["enclosure-size"].c_str(), nullptr, 10);
+	update.enclosure.mime = fields["enclosure-mime"];
+	update.enclosure.installArgs = fields["enclosure-install-args"];
+	update.enclosure.os = fields["enclosure-os"];
+	return !update.version.empty();
+}
+
 SparkleError SparkleManager::Dowload(void *buf, size_t bufsize, size_t *resultLen, void *userdata) {
-	auto &enclousure = cacheAppcast_.enclosure;
+	AppcastEnclosure enclousure;
+	{
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		enclousure = cacheAppcast_.enclosure;
+	}
 
-	if (enclousure.url.empty()) {
+	StreamCodec codec;
+	if (enclousure.url.empty() || !parse_enclosure_encoding(enclousure.mime, codec)) {
 		return SparkleError::kFail;
 	}
 
-	// download
+	// decoded (if it's served encoded) into the buffer
 	size_t offset = 0;
 	bool overSize = false;
+	DecodingPipe pipe(codec, [&](const void *data, size_t size) -> bool {
+		if (offset + size > bufsize) {
+			overSize = true;
+			return false;
+		}
+		memcpy((char *)buf + offset, data, size);
+		offset += size;
+		return true;
+	});
+	if (!pipe.Start()) {
+		return SparkleError::kFail;
+	}
+
+	// download
 	HttpHeaders respHeaders;
-	auto status = simple_http_get(enclousure.url, headers_, respHeaders,
+	auto status = Transport()->Get(enclousure.url, headers_, respHeaders,
 			// content handler
 			[&](size_t total, const void *data, size_t data_length) -> bool {
-				if (offset + data_length > bufsize) {
-					overSize = true;
+				if (!pipe.Feed(data, data_length)) {
 					return false;
 				}
-				memcpy((char *)buf + offset, data, data_length);
-				offset += data_length;
 
 				// notify progress
 				return handlers_.sparkle_download_progress(total, data_length, userdata) != 0;
 			});
+	auto decoded = false;
+	if (status == 200) {
+		decoded = pipe.Finish();
+	} else {
+		pipe.Abort();
+	}
 	if (overSize) {
 		return SparkleError::kFileIOFail;
 	}
 	if (status != 200) {
 		return SparkleError::kNetworkFail;
 	}
+	if (!decoded) {
+		return SparkleError::kFileIOFail;
+	}
 
 	// verify data buffer
 	if (!VerifyDataBuffer(buf, offset, enclousure.signType, enclousure.signature, signPubKey_)) {
@@ -208,51 +939,368 @@ SparkleError SparkleManager::Dowload(void *buf, size_t bufsize, size_t *resultLe
 	return SparkleError::kNoError;
 }
 
-SparkleError SparkleManager::Dowload(const std::string &dstFile, void *userdata) {
-	auto &enclosure = cacheAppcast_.enclosure;
+SparkleError SparkleManager::DowloadToMemory(void *userdata) {
+	SparkleError agentErr;
+	if (DowloadThroughAgent(userdata, agentErr)) {
+		return agentErr;
+	}
 
-	// try to use the cache
-	if (!downloadedPackage_.empty()) {
-		// already downloaded
-		if (enclosure.signType == SignatureAlgo::kNone || VerifyFile(dstFile, enclosure.signType, enclosure.signature, signPubKey_)) {
-			return SparkleError::kNoError;
-		}
-		downloadedPackage_.clear();
+	AppcastEnclosure enclosure;
+	{
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		enclosure = cacheAppcast_.enclosure;
 	}
 
-	if (enclosure.url.empty()) {
+	StreamCodec codec;
+	if (enclosure.url.empty() || !parse_enclosure_encoding(enclosure.mime, codec)) {
 		return SparkleError::kFail;
 	}
 
-	// prepare
-	FILE *fd = nullptr;
-	auto e = fopen_s(&fd, dstFile.c_str(), "wb");
-	if (e != 0) {
-		return SparkleError::kFileIOFail;
+	auto fd = create_memory_file("sparkle-package");
+	if (fd < 0) {
+		return SparkleError::kFail;
+	}
+	DecodingPipe pipe(codec, [fd](const void *data, size_t size) -> bool {
+		return write_memory_file(fd, data, size);
+	});
+	if (!pipe.Start()) {
+		close_memory_file(fd);
+		return SparkleError::kFail;
 	}
 
-	// download with progress callback
+	// download
 	bool hasIoError = false;
+	bool canceled = false;
 	HttpHeaders respHeaders;
-	auto status = simple_http_get(enclosure.url, headers_, respHeaders,
+	auto status = Transport()->Get(enclosure.url, headers_, respHeaders,
 			// content handler
 			[&](size_t total, const void *data, size_t data_length) -> bool {
-				auto size = fwrite(data, sizeof(char), data_length, fd);
-				if (!size) {
+				if (!pipe.Feed(data, data_length)) {
 					hasIoError = true;
 					return false;
 				}
 
 				// notify progress
-				return handlers_.sparkle_download_progress(total, data_length, userdata) != 0;
+				if (!handlers_.sparkle_download_progress(total, data_length, userdata)) {
+					canceled = true;
+					return false;
+				}
+				return true;
 			});
-	fclose(fd);
+	auto decoded = false;
+	if (status == 200) {
+		decoded = pipe.Finish();
+	} else {
+		pipe.Abort();
+	}
+	auto err = SparkleError::kNoError;
+	if (hasIoError) {
+		err = SparkleError::kFileIOFail;
+	} else if (canceled) {
+		err = SparkleError::kCancel;
+	} else if (status != 200) {
+		err = SparkleError::kNetworkFail;
+	} else if (!decoded) {
+		err = SparkleError::kFileIOFail;
+	}
+	if (err != SparkleError::kNoError) {
+		close_memory_file(fd);
+		return err;
+	}
+
+	// seal it first, then what's verified is what gets executed
+	fd = seal_memory_file(fd);
+	if (fd < 0) {
+		return SparkleError::kFileIOFail;
+	}
+	if (enclosure.signType != SignatureAlgo::kNone && !VerifyMemoryFile(fd, enclosure, signPubKey_)) {
+		close_memory_file(fd);
+		return SparkleError::kBadSignature;
+	}
+
+	// the file one, if any, is older now
+	std::unique_lock<std::mutex> lck(cacheLock_);
+	close_memory_file(memoryPackage_);
+	memoryPackage_ = fd;
+	downloadedPackage_.clear();
+	return SparkleError::kNoError;
+}
+
+SparkleError SparkleManager::Dowload(SparkleStreamWriter writer, void *userdata) {
+	AppcastEnclosure enclosure;
+	{
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		enclosure = cacheAppcast_.enclosure;
+	}
+
+	StreamCodec codec;
+	if (enclosure.url.empty() || !parse_enclosure_encoding(enclosure.mime, codec)) {
+		return SparkleError::kFail;
+	}
+
+	// chunks go to the writer as they arrive (no copy unless decoded), the signature is verified alongside
+	std::unique_ptr<StreamVerifier> verifier;
+	if (enclosure.signType != SignatureAlgo::kNone) {
+		verifier = std::make_unique<StreamVerifier>(enclosure.signType, enclosure.signature, signPubKey_);
+	}
+
+	bool rejected = false;
+	DecodingPipe pipe(codec, [&](const void *data, size_t size) -> bool {
+		if (verifier && !verifier->Update(data, size)) {
+			return false;
+		}
+		if (!writer(data, size, userdata)) {
+			rejected = true;
+			return false;
+		}
+		return true;
+	});
+	if (!pipe.Start()) {
+		return SparkleError::kFail;
+	}
+
+	bool canceled = false;
+	bool hasIoError = false;
+	HttpHeaders respHeaders;
+	auto status = Transport()->Get(enclosure.url, headers_, respHeaders,
+			// content handler
+			[&](size_t total, const void *data, size_t data_length) -> bool {
+				if (!pipe.Feed(data, data_length)) {
+					hasIoError = true;
+					return false;
+				}
+
+				// notify progress
+				if (!handlers_.sparkle_download_progress(total, data_length, userdata)) {
+					canceled = true;
+					return false;
+				}
+				return true;
+			});
+	auto decoded = false;
+	if (status == 200) {
+		decoded = pipe.Finish();
+	} else {
+		pipe.Abort();
+	}
+	if (canceled || rejected) {
+		return SparkleError::kCancel;
+	}
 	if (hasIoError) {
 		return SparkleError::kFileIOFail;
 	}
 	if (status != 200) {
 		return SparkleError::kNetworkFail;
 	}
+	if (!decoded) {
+		return SparkleError::kFileIOFail;
+	}
+
+	// final verdict, the consumer commits or discards what it has received according to it
+	if (verifier && !verifier->Final()) {
+		return SparkleError::kBadSignature;
+	}
+	return SparkleError::kNoError;
+}
+
+SparkleError SparkleManager::DowloadAndExtract(const std::string &dstDir, void *userdata) {
+	AppcastEnclosure enclosure;
+	{
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		enclosure = cacheAppcast_.enclosure;
+	}
+
+	StreamCodec codec;
+	if (enclosure.url.empty() || !parse_enclosure_encoding(enclosure.mime, codec)) {
+		return SparkleError::kFail;
+	}
+
+	// extract into a staging directory next to the destination, so publishing it is a rename,
+	// named for this call alone, what another one (or a crashed one) left there isn't ours to remove
+	std::error_code ec;
+	std::random_device rd;
+	auto tmpBase = dstDir + "." + std::to_string(rd());
+	auto stagingDir = tmpBase + ".staging";
+
+	ArchiveExtractor extractor(stagingDir);
+	if (!extractor.Start()) {
+		return SparkleError::kFileIOFail;
+	}
+
+	std::unique_ptr<StreamVerifier> verifier;
+	if (enclosure.signType != SignatureAlgo::kNone) {
+		verifier = std::make_unique<StreamVerifier>(enclosure.signType, enclosure.signature, signPubKey_);
+	}
+
+	// the signature covers the package as decoded from its encoding (the archive itself)
+	DecodingPipe pipe(codec, [&](const void *data, size_t size) -> bool {
+		return (!verifier || verifier->Update(data, size)) && extractor.Feed(data, size);
+	});
+	if (!pipe.Start()) {
+		extractor.Abort();
+		std::filesystem::remove_all(stagingDir, ec);
+		return SparkleError::kFail;
+	}
+
+	// download, decompress and extract all at once
+	bool hasIoError = false;
+	bool canceled = false;
+	HttpHeaders respHeaders;
+	auto status = Transport()->Get(enclosure.url, headers_, respHeaders,
+			// content handler
+			[&](size_t total, const void *data, size_t data_length) -> bool {
+				if (!pipe.Feed(data, data_length)) {
+					hasIoError = true;
+					return false;
+				}
+
+				// notify progress
+				if (!handlers_.sparkle_download_progress(total, data_length, userdata)) {
+					canceled = true;
+					return false;
+				}
+				return true;
+			});
+
+	auto err = SparkleError::kNoError;
+	if (status != 200) {
+		pipe.Abort();
+		extractor.Abort();
+		err = hasIoError ? SparkleError::kFileIOFail : (canceled ? SparkleError::kCancel : SparkleError::kNetworkFail);
+	} else if (!pipe.Finish()) {
+		extractor.Abort();
+		err = SparkleError::kFileIOFail;
+	} else if (!extractor.Finish()) {
+		err = SparkleError::kFileIOFail;
+	} else if (verifier && !verifier->Final()) {
+		err = SparkleError::kBadSignature;
+	}
+	if (err != SparkleError::kNoError) {
+		std::filesystem::remove_all(stagingDir, ec);
+		return err;
+	}
+
+	// verified, publish the staging directory, swapped in at once where the OS can
+	if (std::filesystem::exists(dstDir, ec) && exchange_paths(stagingDir, dstDir)) {
+		std::filesystem::remove_all(stagingDir, ec);
+		return SparkleError::kNoError;
+	}
+
+	// otherwise [dstDir] is missing for a moment, between moving the old one away and the new one in
+	auto oldDir = tmpBase + ".old";
+	if (std::filesystem::exists(dstDir, ec)) {
+		std::filesystem::rename(dstDir, oldDir, ec);
+		if (ec) {
+			std::filesystem::remove_all(stagingDir, ec);
+			return SparkleError::kFileIOFail;
+		}
+	}
+	std::filesystem::rename(stagingDir, dstDir, ec);
+	if (ec) {
+		std::filesystem::rename(oldDir, dstDir, ec);
+		std::filesystem::remove_all(stagingDir, ec);
+		return SparkleError::kFileIOFail;
+	}
+	std::filesystem::remove_all(oldDir, ec);
+	return SparkleError::kNoError;
+}
+
+SparkleError SparkleManager::Dowload(const std::string &dstFile, void *userdata) {
+	AppcastEnclosure enclosure;
+	std::string downloadedPackage;
+	{
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		enclosure = cacheAppcast_.enclosure;
+		downloadedPackage = downloadedPackage_;
+	}
+
+	// try to use the cache
+	if (!downloadedPackage.empty()) {
+		// already downloaded
+		if (IsVerifiedPackage(dstFile, enclosure)) {
+			return SparkleError::kNoError;
+		}
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		downloadedPackage_.clear();
+	}
+
+	if (enclosure.url.empty()) {
+		return SparkleError::kFail;
+	}
+
+	// identical downloads at the same time share one transfer, the others get a copy of the verified package
+	auto key = enclosure.url + "\n" + enclosure.signature;
+	while (true) {
+		auto [flight, leader] = downloadFlights_.Join(key);
+		if (leader) {
+			auto err = DownloadPackage(enclosure, dstFile, userdata, flight.get());
+			downloadFlights_.Land(key, flight, { err, dstFile });
+			return err;
+		}
+
+		DownloadOutcome outcome;
+		auto stayed = SingleFlight<DownloadOutcome>::Wait(
+				*flight,
+				[&](size_t total, size_t size) -> bool {
+					return handlers_.sparkle_download_progress(total, size, userdata) != 0;
+				},
+				outcome);
+		if (!stayed) {
+			return SparkleError::kCancel;
+		}
+		if (outcome.err == SparkleError::kCancel) {
+			// the one who did it gave up, not us
+			continue;
+		}
+		if (outcome.err != SparkleError::kNoError) {
+			return outcome.err;
+		}
+
+		std::error_code ec;
+		if (outcome.file != dstFile) {
+			std::filesystem::copy_file(outcome.file, dstFile, std::filesystem::copy_options::overwrite_existing, ec);
+		}
+		if (ec) {
+			// gone already, on our own then
+			continue;
+		}
+
+		// the copy is what we install, it passes the same check as our own download
+		return IsVerifiedPackage(dstFile, enclosure) ? SparkleError::kNoError : SparkleError::kBadSignature;
+	}
+}
+
+SparkleError SparkleManager::DownloadPackage(const AppcastEnclosure &enclosure, const std::string &dstFile, void *userdata, DownloadFlight *flight) {
+	StreamCodec codec;
+	if (!parse_enclosure_encoding(enclosure.mime, codec)) {
+		return SparkleError::kFail;
+	}
+
+	// try the LAN peers first, their copy must pass the very same signature check
+	auto peerKey = PeerCache::PackageKey(enclosure);
+	if (!peerKey.empty() && peerCache_.IsEnabled()) {
+		// peers share the package as decoded, the host's headers are for the origin only
+		auto peerTransport = PeerTransport();
+		auto peerMaxSize = decoded_size_limit(codec, enclosure.size);
+		for (const auto &url : peerCache_.Locate(peerKey)) {
+			auto err = DownloadToFile(*peerTransport, url, {}, dstFile, StreamCodec::kNone, peerMaxSize, userdata, flight);
+			if (err == SparkleError::kCancel) {
+				return err;
+			}
+			if (err == SparkleError::kNoError &&
+					VerifyFile(dstFile, enclosure.signType, enclosure.signature, signPubKey_)) {
+				peerCache_.Publish(peerKey, dstFile);
+				SetDownloadedPackage(dstFile, enclosure);
+				return SparkleError::kNoError;
+			}
+		}
+	}
+
+	// fall back to the origin, decoded on the way if it's served encoded
+	auto err = DownloadToFile(*Transport(), enclosure.url, headers_, dstFile, codec, 0, userdata, flight);
+	if (err != SparkleError::kNoError) {
+		return err;
+	}
 
 	// validate it signature
 	if (enclosure.signType != SignatureAlgo::kNone &&
@@ -260,42 +1308,484 @@ SparkleError SparkleManager::Dowload(const std::string &dstFile, void *userdata)
 		return SparkleError::kBadSignature;
 	}
 
+	// share it with the peers
+	if (!peerKey.empty() && peerCache_.IsEnabled()) {
+		peerCache_.Publish(peerKey, dstFile);
+	}
+
 	// we done, save this downloaded file
-	downloadedPackage_ = dstFile;
+	SetDownloadedPackage(dstFile, enclosure);
 	return SparkleError::kNoError;
 }
 
-SparkleError SparkleManager::Install(const char *overideArgs, void *userdata) {
-	if (downloadedPackage_.empty()) {
+SparkleError SparkleManager::DownloadToFile(HttpTransport &transport, const std::string &url, const HttpHeaders &headers, const std::string &dstFile, StreamCodec codec,
+		uint64_t maxSize, void *userdata, DownloadFlight *flight) {
+	// prepare
+	FILE *fd = nullptr;
+	auto e = fopen_s(&fd, dstFile.c_str(), "wb");
+	if (e != 0) {
+		return SparkleError::kFileIOFail;
+	}
+	DecodingPipe pipe(codec, [fd](const void *data, size_t size) -> bool {
+		return fwrite(data, sizeof(char), size, fd) == size;
+	});
+	if (!pipe.Start()) {
+		fclose(fd);
+		return SparkleError::kFail;
+	}
+
+	// download with progress callback
+	bool hasIoError = false;
+	bool canceled = false;
+	bool oversized = false;
+	uint64_t received = 0;
+	HttpHeaders respHeaders;
+	auto status = transport.Get(url, headers, respHeaders,
+			// content handler
+			[&](size_t total, const void *data, size_t data_length) -> bool {
+				received += data_length;
+				if (maxSize && received > maxSize) {
+					oversized = true;
+					return false;
+				}
+				if (!pipe.Feed(data, data_length)) {
+					hasIoError = true;
+					return false;
+				}
+
+				// notify progress, to whoever waits for the same package too
+				if (flight) {
+					SingleFlight<DownloadOutcome>::Progress(*flight, total, data_length);
+				}
+				if (!handlers_.sparkle_download_progress(total, data_length, userdata)) {
+					canceled = true;
+					return false;
+				}
+				return true;
+			});
+	auto decoded = false;
+	if (status == 200) {
+		decoded = pipe.Finish();
+	} else {
+		pipe.Abort();
+	}
+	fclose(fd);
+	if (hasIoError) {
+		return SparkleError::kFileIOFail;
+	}
+	if (canceled) {
+		return SparkleError::kCancel;
+	}
+	if (oversized || status != 200) {
+		return SparkleError::kNetworkFail;
+	}
+	if (!decoded) {
+		return SparkleError::kFileIOFail;
+	}
+	return SparkleError::kNoError;
+}
+
+//
+// the host's event loop
+//
+struct SparkleManager::AsyncDownload {
+	AppcastEnclosure enclosure;
+	std::string dstFile;
+	void *userdata = nullptr;
+	std::string peerKey;
+	std::vector<std::string> sources; // LAN peers first, the origin last
+	size_t next = 0;
+	StreamCodec codec = StreamCodec::kNone; // the origin's
+	uint64_t peerMaxSize = 0; // a peer sending more isn't sending the package
+	uint64_t received = 0; // from the current source
+	FILE *fd = nullptr;
+	std::unique_ptr<DecodingPipe> pipe;
+	bool hasIoError = false;
+	bool oversized = false;
+	bool canceled = false; // by the progress callback, no other source is tried
+	AsyncCompletion done;
+};
+
+SparkleError SparkleManager::AttachEventLoop(HttpEventDriver::SocketWatcher &&watcher, HttpEventDriver::TimerSetter &&timer) {
+	if (loop_) {
+		return SparkleError::kAlreadyInitialized;
+	}
+	auto loop = std::make_unique<HttpEventDriver>(std::move(watcher), std::move(timer));
+	if (!loop->IsValid()) {
+		return SparkleError::kFail;
+	}
+	loop_ = std::move(loop);
+	return SparkleError::kNoError;
+}
+
+void SparkleManager::DetachEventLoop() {
+	loop_.reset();
+}
+
+void SparkleManager::LoopSocketAction(intptr_t socket, int ready) {
+	if (loop_) {
+		loop_->SocketAction(socket, ready);
+	}
+}
+
+void SparkleManager::LoopTimeout() {
+	if (loop_) {
+		loop_->Timeout();
+	}
+}
+
+bool SparkleManager::IsCurlTransport() {
+	return std::dynamic_pointer_cast<CurlTransport>(Transport()) != nullptr;
+}
+
+std::shared_ptr<HttpTransport> SparkleManager::PeerTransport() {
+	return IsCurlTransport() ? peerTransport_ : Transport();
+}
+
+SparkleError SparkleManager::CheckUpdateAsync(const std::string &preferLang, const std::vector<std::string> &channels, void *userdata, AsyncCompletion &&done) {
+	if (!loop_) {
 		return SparkleError::kNotReady;
 	}
-	auto &enclosure = cacheAppcast_.enclosure;
 
-	// execute update package
-	if (!execute(downloadedPackage_, overideArgs ? overideArgs : enclosure.installArgs)) {
+	// other transports (local mirrors, in memory) don't wait on the network
+	if (!IsCurlTransport()) {
+		done(CheckUpdate(preferLang, channels, userdata));
+		return SparkleError::kNoError;
+	}
+
+	// a fresh entry of the shared cache takes no request at all,
+	// a stale one is revalidated without the entry lock, which would block the loop
+	auto reqHeaders = AppcastRequestHeaders();
+	auto cached = std::make_shared<SharedAppcastCache::Entry>();
+	auto hasCached = appcastCache_.IsEnabled() && appcastCache_.Read(appcastUrl_, *cached);
+	if (hasCached && (long long)time(nullptr) < cached->expires) {
+		done(ProcessAppcast(cached->headers, cached->body, preferLang, channels, userdata));
+		return SparkleError::kNoError;
+	}
+	if (hasCached) {
+		reqHeaders = RevalidationHeaders(reqHeaders, *cached);
+	}
+
+	auto respBody = std::make_shared<std::string>();
+	auto started = loop_->Get(appcastUrl_, reqHeaders,
+			// content handler
+			[respBody](size_t total, const void *data, size_t size) -> bool {
+				if (total && respBody->capacity() < total) {
+					respBody->reserve(std::min<size_t>(total, HTTP_MAX_BODY_RESERVE));
+				}
+				respBody->append((const char *)data, size);
+				return true;
+			},
+			// completion
+			[=, done = std::move(done)](int status, HttpHeaders &&respHeaders) {
+				status = StoreAppcast(status, hasCached ? cached.get() : nullptr, respHeaders, *respBody);
+				if (status != 200 ||
+						respBody->empty()) {
+					done(SparkleError::kNetworkFail);
+					return;
+				}
+				done(ProcessAppcast(respHeaders, *respBody, preferLang, channels, userdata));
+			});
+	return started ? SparkleError::kNoError : SparkleError::kNetworkFail;
+}
+
+SparkleError SparkleManager::DowloadAsync(const std::string &dstFile, void *userdata, AsyncCompletion &&done) {
+	if (!loop_) {
+		return SparkleError::kNotReady;
+	}
+	if (!IsCurlTransport()) {
+		done(Dowload(dstFile, userdata));
+		return SparkleError::kNoError;
+	}
+
+	auto task = std::make_shared<AsyncDownload>();
+	std::string downloadedPackage;
+	{
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		task->enclosure = cacheAppcast_.enclosure;
+		downloadedPackage = downloadedPackage_;
+	}
+	auto &enclosure = task->enclosure;
+
+	// try to use the cache
+	if (!downloadedPackage.empty()) {
+		if (IsVerifiedPackage(dstFile, enclosure)) {
+			done(SparkleError::kNoError);
+			return SparkleError::kNoError;
+		}
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		downloadedPackage_.clear();
+	}
+
+	if (enclosure.url.empty() || !parse_enclosure_encoding(enclosure.mime, task->codec)) {
 		return SparkleError::kFail;
 	}
 
+	task->peerMaxSize = decoded_size_limit(task->codec, enclosure.size);
+	task->dstFile = dstFile;
+	task->userdata = userdata;
+	task->done = std::move(done);
+	task->peerKey = PeerCache::PackageKey(enclosure);
+	if (!task->peerKey.empty() && peerCache_.IsEnabled()) {
+		task->sources = peerCache_.Locate(task->peerKey);
+	}
+	task->sources.emplace_back(enclosure.url);
+	DownloadNextSource(task);
+	return SparkleError::kNoError;
+}
+
+void SparkleManager::DownloadNextSource(std::shared_ptr<AsyncDownload> task) {
+	while (task->next < task->sources.size()) {
+		const auto &url = task->sources[task->next++];
+		auto isOrigin = task->next == task->sources.size();
+
+		if (fopen_s(&task->fd, task->dstFile.c_str(), "wb") != 0) {
+			task->done(SparkleError::kFileIOFail);
+			return;
+		}
+		task->hasIoError = false;
+		task->oversized = false;
+		task->received = 0;
+
+		// peers share the package as decoded, the decoding stays off the loop thread
+		auto fd = task->fd;
+		task->pipe = std::make_unique<DecodingPipe>(isOrigin ? task->codec : StreamCodec::kNone, [fd](const void *data, size_t size) -> bool {
+			return fwrite(data, sizeof(char), size, fd) == size;
+		});
+		if (!task->pipe->Start()) {
+			fclose(task->fd);
+			task->fd = nullptr;
+			task->done(SparkleError::kFail);
+			return;
+		}
+
+		// the host's headers (and proxy) are for the origin only
+		auto started = loop_->Get(url, isOrigin ? headers_ : HttpHeaders(),
+				// content handler
+				[this, task, isOrigin](size_t total, const void *data, size_t data_length) -> bool {
+					task->received += data_length;
+					if (!isOrigin && task->received > task->peerMaxSize) {
+						task->oversized = true;
+						return false;
+					}
+					if (!task->pipe->Feed(data, data_length)) {
+						task->hasIoError = true;
+						return false;
+					}
+
+					// notify progress
+					if (handlers_.sparkle_download_progress(total, data_length, task->userdata) == 0) {
+						task->canceled = true;
+						return false;
+					}
+					return true;
+				},
+				// completion, the same checks as Dowload
+				[this, task, isOrigin](int status, HttpHeaders &&) {
+					auto decoded = false;
+					if (status == 200) {
+						decoded = task->pipe->Finish();
+					} else {
+						task->pipe->Abort();
+					}
+					task->pipe.reset();
+					fclose(task->fd);
+					task->fd = nullptr;
+
+					const auto &enclosure = task->enclosure;
+					auto err = SparkleError::kNoError;
+					if (task->canceled) {
+						err = SparkleError::kCancel;
+					} else if (task->hasIoError) {
+						err = SparkleError::kFileIOFail;
+					} else if (task->oversized || status != 200) {
+						err = SparkleError::kNetworkFail;
+					} else if (!decoded) {
+						err = SparkleError::kFileIOFail;
+					} else if (enclosure.signType != SignatureAlgo::kNone &&
+							!VerifyFile(task->dstFile, enclosure.signType, enclosure.signature, signPubKey_)) {
+						err = SparkleError::kBadSignature;
+					}
+
+					if (err != SparkleError::kNoError) {
+						if (isOrigin || err == SparkleError::kCancel) {
+							task->done(err);
+						} else {
+							DownloadNextSource(task);
+						}
+						return;
+					}
+
+					if (!task->peerKey.empty() && peerCache_.IsEnabled()) {
+						peerCache_.Publish(task->peerKey, task->dstFile);
+					}
+					SetDownloadedPackage(task->dstFile, enclosure);
+					task->done(SparkleError::kNoError);
+				},
+				!isOrigin);
+		if (started) {
+			return;
+		}
+		task->pipe.reset();
+		fclose(task->fd);
+		task->fd = nullptr;
+	}
+	task->done(SparkleError::kNetworkFail);
+}
+
+SparkleError SparkleManager::EnablePeerCache(const PeerCacheOptions &opts) {
+	return peerCache_.Enable(opts) ? SparkleError::kNoError : SparkleError::kNetworkFail;
+}
+
+void SparkleManager::DisablePeerCache() {
+	peerCache_.Disable();
+}
+
+SparkleError SparkleManager::Install(const char *overideArgs, void *userdata) {
+	std::string downloadedPackage;
+	std::string installArgs;
+	std::unique_lock<std::mutex> lck(cacheLock_);
+	downloadedPackage = downloadedPackage_;
+	installArgs = cacheAppcast_.enclosure.installArgs;
+	if (downloadedPackage.empty() && memoryPackage_ < 0) {
+		return SparkleError::kNotReady;
+	}
+
+	// execute update package, a newer file download wins over the one in memory
+	std::string args = overideArgs ? overideArgs : installArgs;
+	if (!downloadedPackage.empty()) {
+		lck.unlock();
+		if (!execute(downloadedPackage, args)) {
+			return SparkleError::kFail;
+		}
+	} else {
+		// the memory package is kept open (under the lock) as long as we need it
+		auto started = execute(memoryPackage_, args);
+		lck.unlock();
+		if (!started) {
+			return SparkleError::kFail;
+		}
+	}
+
 	// request shutdown and go on
 	handlers_.sparkle_request_shutdown(userdata);
 
 	return SparkleError::kNoError;
 }
 
-bool SparkleManager::FilterSortedAppcast(const Appcast &appcast, const std::string &preferLang, const std::vector<std::string> &channels, FilteredAppcast &filterOut) {
-	// sort by version
-	for (auto &item : appcast.items) {
-		if (SafeVersionCompare(appcast.items[0].version, appVer_) <= 0) {
+SparkleError SparkleManager::StartScheduledCheck(const std::string &preferLang, const std::vector<std::string> &channels, void *userdata, const UpdateScheduler::Options &opts) {
+	auto started = scheduler_.Start(opts, [=]() -> ScheduledCheckOutcome {
+		HttpHeaders respHeaders;
+		auto err = CheckUpdate(preferLang, channels, userdata, respHeaders, -1);
+
+		// results are delivered through [sparkle_new_version_found], we only care about the timing here
+		ScheduledCheckOutcome outcome;
+		outcome.failed = (err == SparkleError::kNetworkFail || err == SparkleError::kInvalidAppcast);
+		outcome.retryAfter = simple_http_retry_after(respHeaders);
+		outcome.maxAge = simple_http_max_age(respHeaders);
+		return outcome;
+	});
+	return started ? SparkleError::kNoError : SparkleError::kInvalidParameter;
+}
+
+void SparkleManager::StopScheduledCheck() {
+	scheduler_.Stop();
+}
+
+SparkleError SparkleManager::StartPushChannel(const std::string &preferLang, const std::vector<std::string> &channels, void *userdata, const PushChannel::Options &opts) {
+	push_.Stop();
+	{
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		pushedAppcast_ = {};
+	}
+
+	auto pushOpts = opts;
+	pushOpts.headers = headers_;
+	auto started = push_.Start(pushOpts, [=]() {
+		// results are delivered through [sparkle_new_version_found]
+		HttpHeaders respHeaders;
+		CheckUpdate(preferLang, channels, userdata, respHeaders, (long long)time(nullptr));
+	});
+	return started ? SparkleError::kNoError : SparkleError::kInvalidParameter;
+}
+
+void SparkleManager::StopPushChannel() {
+	push_.Stop();
+}
+
+bool SparkleManager::FilterIndexedAppcast(const AppcastIndex &index, const std::string &preferLang, const std::vector<std::string> &channels, FilteredAppcast &filterOut) {
+	auto channelIds = index.ChannelIds(channels);
+
+	AppcastIndex::Query query;
+	query.os = &get_os_facts();
+	query.channels = channelIds.data();
+	query.channelCount = channelIds.size();
+	query.appVersion = appVer_;
+	EnclosureFormats formats;
+	{
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		formats = enclosureFormats_;
+	}
+	query.formats = &formats;
+
+	AppcastIndex::Match match;
+	if (!index.Select(query, match)) {
+		return false;
+	}
+
+	//
+	// #NOTE
+	// this version is good to go
+	//
+	auto &item = index.Feed().items[match.item];
+	auto flags = index.ItemFlags(match.item, appVer_);
+	filterOut.isInformationalUpdate = (flags & AppcastIndex::kInformationalUpdate) != 0;
+	filterOut.isCriticalUpdate = (flags & AppcastIndex::kCriticalUpdate) != 0;
+	filterOut.canAutoUpdateSupported = (flags & AppcastIndex::kAutoUpdateSupported) != 0;
+
+	// get other fields
+	auto releaseNoteLink = index.ReleaseNoteLink(match.item, preferLang);
+	auto description = index.Description(match.item, preferLang);
+	filterOut.enclosure = item.enclosures[match.enclosure];
+	filterOut.channel = item.channel;
+	filterOut.version = item.version;
+	filterOut.shortVersion = item.shortVersion;
+	filterOut.title = item.title;
+	filterOut.pubDate = item.pubDate;
+	filterOut.releaseNoteLink = releaseNoteLink ? *releaseNoteLink : std::string();
+	filterOut.description = description ? *description : std::string();
+	filterOut.downloadWebsite = item.link;
+	return true;
+}
+
+bool SparkleManager::FilterBinaryAppcast(const BinaryAppcast &appcast, const std::string &preferLang, const std::vector<std::string> &channels, FilteredAppcast &filterOut) {
+	// same rules as AppcastIndex::Select, but only the selected item gets copied out
+	const auto &os = get_os_facts();
+	EnclosureFormats formats;
+	{
+		std::unique_lock<std::mutex> lck(cacheLock_);
+		formats = enclosureFormats_;
+	}
+	for (size_t idx = 0; idx < appcast.ItemCount(); idx++) {
+		auto item = appcast.Item(idx);
+		if (SafeVersionCompare(item.Version(), appVer_) <= 0) {
 			// no more match, cause they all must less than current app version
 			break;
 		}
 
-		// match enclosure
+		// match enclosure, the cheapest of the matched ones
 		int enclosureIndex = -1;
-		for (auto idx = 0; idx < item.enclosures.size(); idx++) {
-			if (is_matched_os_name(item.enclosures[idx].os)) {
-				enclosureIndex = idx;
-				break;
+		EnclosureCost cheapest;
+		for (size_t e = 0; e < item.EnclosureCount(); e++) {
+			auto enclosure = item.Enclosure(e);
+			auto fit = get_os_fit(os, enclosure.OS());
+			if (fit < 0) {
+				continue;
+			}
+			EnclosureCost cost{ fit, enclosure_format_rank(formats, enclosure.Mime(), enclosure.Url()), enclosure.Size() };
+			if (enclosureIndex == -1 || cost.IsCheaperThan(cheapest)) {
+				enclosureIndex = (int)e;
+				cheapest = cost;
 			}
 		}
 		if (enclosureIndex == -1) {
@@ -304,21 +1794,18 @@ bool SparkleManager::FilterSortedAppcast(const Appcast &appcast, const std::stri
 		}
 
 		// match system version
-		if (!item.minSystemVerRequire.empty() &&
-				!is_acceptable_os_version(item.minSystemVerRequire)) {
+		auto minSystemVer = item.MinSystemVerRequire();
+		if (!minSystemVer.empty() &&
+				!is_acceptable_os_version(os, minSystemVer)) {
 			// not acceptable
 			continue;
 		}
 
 		// match channel
-		if (!item.channel.empty()) {
-			if (channels.empty()) {
-				// we don't have any explicitly specified channel
-				continue;
-			}
-
+		auto channel = item.Channel();
+		if (!channel.empty()) {
 			auto it = std::find_if(channels.begin(), channels.end(), [&](const std::string &v) -> bool {
-				return _stricmp(v.c_str(), item.channel.c_str()) == 0;
+				return v.size() == channel.size() && strncasecmp(v.c_str(), channel.data(), channel.size()) == 0;
 			});
 			if (it == channels.end()) {
 				// this channel is not acceptable
@@ -330,32 +1817,36 @@ bool SparkleManager::FilterSortedAppcast(const Appcast &appcast, const std::stri
 		// #NOTE
 		// this version is good to go
 		//
-		for (auto &ver : item.informationalUpdateVers) {
-			if (_stricmp(ver.c_str(), appVer_.c_str()) == 0) {
+		for (size_t v = 0; v < item.InformationalUpdateVerCount(); v++) {
+			auto ver = item.InformationalUpdateVer(v);
+			if (ver.size() == appVer_.size() && strncasecmp(ver.data(), appVer_.c_str(), ver.size()) == 0) {
 				filterOut.isInformationalUpdate = true;
 			}
 		}
 
-		if (!item.criticalUpdateVerBarrier.empty() &&
-				_stricmp(item.criticalUpdateVerBarrier.c_str(), appVer_.c_str()) > 0) {
+		auto criticalBarrier = std::string(item.CriticalUpdateVerBarrier());
+		if (!criticalBarrier.empty() &&
+				_stricmp(criticalBarrier.c_str(), appVer_.c_str()) > 0) {
 			filterOut.isCriticalUpdate = true;
 		}
 
-		if (!item.minAutoUpdateVerRequire.empty() &&
-				_stricmp(item.minAutoUpdateVerRequire.c_str(), appVer_.c_str()) <= 0) {
+		auto minAutoUpdateVer = std::string(item.MinAutoUpdateVerRequire());
+		if (!minAutoUpdateVer.empty() &&
+				_stricmp(minAutoUpdateVer.c_str(), appVer_.c_str()) <= 0) {
 			filterOut.canAutoUpdateSupported = true;
 		}
 
 		// get other fields
-		filterOut.enclosure = std::move(item.enclosures[enclosureIndex]);
-		filterOut.channel = item.channel;
-		filterOut.version = item.version;
-		filterOut.shortVersion = item.shortVersion;
-		filterOut.title = item.title;
-		filterOut.pubDate = item.pubDate;
-		filterOut.releaseNoteLink = FilterGetLangString(item.releaseNoteLink, preferLang);
-		filterOut.description = FilterGetLangString(item.description, preferLang);
-		filterOut.downloadWebsite = item.link;
+		auto lang = LangCode(preferLang);
+		filterOut.enclosure = item.Enclosure(enclosureIndex).Materialize();
+		filterOut.channel = channel;
+		filterOut.version = item.Version();
+		filterOut.shortVersion = item.ShortVersion();
+		filterOut.title = item.Title();
+		filterOut.pubDate = item.PubDate();
+		filterOut.releaseNoteLink = lang ? item.ReleaseNoteLink(lang) : std::string_view();
+		filterOut.description = lang ? item.Description(lang) : std::string_view();
+		filterOut.downloadWebsite = item.Link();
 
 		// we done
 		return true;
@@ -363,26 +1854,11 @@ bool SparkleManager::FilterSortedAppcast(const Appcast &appcast, const std::stri
 	return false;
 }
 
-std::string SparkleManager::FilterGetLangString(const MultiLangString &multiLangs, const std::string &lang) {
-	if (multiLangs.empty() || lang.size() != 2) {
-		return {};
+uint16_t LangCode(std::string_view lang) {
+	if (lang.size() != 2) {
+		return 0;
 	}
 	char codeBuf[2] = { (char)std::tolower(lang[0]), (char)std::tolower(lang[1]) };
-	auto code = *(uint16_t *)codeBuf;
-
-	// match with lang-code
-	auto matchIt = multiLangs.find(code);
-	if (matchIt != multiLangs.end()) {
-		return matchIt->second;
-	}
-
-	// find out the default one
-	matchIt = multiLangs.find(0);
-	if (matchIt != multiLangs.end()) {
-		return matchIt->second;
-	}
-
-	// nothing
-	return {};
+	return *(uint16_t *)codeBuf;
 }
 }; //namespace SparkleLite
\ No newline at end of file
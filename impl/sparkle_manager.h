@@ -2,8 +2,24 @@
 #define _SPARKLE_MANAGER_H_
 
 #include "../sparkle_api.h"
+#include "appcast_cache.h"
+#include "enclosure_cost.h"
+#include "http_transport.h"
+#include "peer_cache.h"
+#include "push_channel.h"
+#include "session_state.h"
+#include "simple_http.h"
+#include "single_flight.h"
+#include "stream_codec.h"
 #include "sparkle_internal.h"
+#include "update_scheduler.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <tuple>
 
 namespace httplib {
@@ -11,9 +27,10 @@ class Client;
 };
 
 namespace SparkleLite {
-class SparkleManager {
-	using HttpHeaders = std::map<std::string, std::string>;
+class AppcastIndex;
+class BinaryAppcast;
 
+class SparkleManager {
 	struct FilteredAppcast {
 		bool valid = false;
 		bool isInformationalUpdate = false;
@@ -30,7 +47,26 @@ class SparkleManager {
 		AppcastEnclosure enclosure;
 	};
 
+	// what a check shares with the identical ones running along
+	struct CheckOutcome {
+		SparkleError err = SparkleError::kFail;
+		HttpHeaders respHeaders;
+		FilteredAppcast selected;
+	};
+
+	// what a download shares with the identical ones running along
+	struct DownloadOutcome {
+		SparkleError err = SparkleError::kFail;
+		std::string file; // verified
+	};
+	using DownloadFlight = SingleFlight<DownloadOutcome>::Flight;
+
 public:
+	// the outcome of an asynchronous operation
+	using AsyncCompletion = std::function<void(SparkleError)>;
+
+	~SparkleManager();
+
 	void SetCallbacks(const SparkleCallbacks &callbacks);
 
 	void SetAppcastURL(const std::string &url);
@@ -43,23 +79,181 @@ public:
 
 	void SetHttpHeader(const std::string &key, const std::string &value);
 
+	void SetTransport(std::shared_ptr<HttpTransport> transport);
+
+	// when an item has several enclosures for this OS, the preferred formats are taken first (see EnclosureCost),
+	// takes effect from the next check, decisions made before are dropped
+	void SetEnclosurePreference(const EnclosureFormats &formats);
+
+	// threads resolving the items of an xml appcast, 0 for one per core (see ParseAppcastXML)
+	void SetAppcastParseThreads(unsigned threads);
+
+	std::shared_ptr<HttpTransport> Transport();
+
 	bool IsReady();
 
+	// parse the public key and initialize the transport on a background thread,
+	// so the first check doesn't pay for it (it's done on first use otherwise)
+	void WarmUp();
+
 public:
 	void Clean();
 
 	SparkleError CheckUpdate(const std::string &preferLang, const std::vector<std::string> &channels, void *userdata);
 
+	// run the selection again against the last fetched (xml) feed, e.g. for other channels or languages
+	SparkleError RequeryUpdate(const std::string &preferLang, const std::vector<std::string> &channels, void *userdata);
+
+	std::shared_ptr<const AppcastIndex> CurrentAppcastIndex();
+
 	SparkleError Dowload(void *buf, size_t bufsize, size_t *resultLen, void *userdata);
 
 	SparkleError Dowload(const std::string &dstFile, void *userdata);
 
+	SparkleError Dowload(SparkleStreamWriter writer, void *userdata);
+
+	// into a sealed in-memory file (Linux), verified there and installed from there, nothing touches the disk
+	SparkleError DowloadToMemory(void *userdata);
+
+	SparkleError DowloadAndExtract(const std::string &dstDir, void *userdata);
+
 	SparkleError Install(const char *overideArgs, void *userdata);
 
+	SparkleError StartScheduledCheck(const std::string &preferLang, const std::vector<std::string> &channels, void *userdata, const UpdateScheduler::Options &opts);
+
+	void StopScheduledCheck();
+
+	// keep a connection to a notification URL open, and check (conditionally) as soon as it tells the appcast changed
+	SparkleError StartPushChannel(const std::string &preferLang, const std::vector<std::string> &channels, void *userdata, const PushChannel::Options &opts);
+
+	void StopPushChannel();
+
+	SparkleError EnablePeerCache(const PeerCacheOptions &opts);
+
+	void DisablePeerCache();
+
+	SparkleError EnableSharedCache(const std::string &dir, long long ttl);
+
+	void DisableSharedCache();
+
+	//
+	// Checks answer from the last decision for the same (lang, channels, app version) for [ttl], without asking the server.
+	// After that the stale decision is still answered at once while a background check refreshes it,
+	// the new-version callback fires again (on that background thread) only if the decision changed
+	//
+	SparkleError EnableDecisionCache(std::chrono::seconds ttl);
+
+	void DisableDecisionCache();
+
+	//
+	// Keep the selected update and the verified package in [path], and resume from what an earlier run
+	// of the same app version left there: kNoError (and notified) if its package is still the verified one, ready to install,
+	// kNoUpdateFound if there's nothing to resume
+	//
+	SparkleError EnableSessionState(const std::string &path, void *userdata);
+
+	void DisableSessionState();
+
+	//
+	// Go through the update agent listening at [socketPath] (see UpdateAgent), empty to go direct again:
+	// checks are answered by it, and DowloadToMemory receives its verified package as a descriptor.
+	// When it can't be reached the check goes direct
+	//
+	SparkleError UseAgent(const std::string &socketPath);
+
+	// the update selected last as named fields (see SaveSession), false if none
+	bool CurrentUpdate(SessionState::Fields &fields);
+
+	//
+	// Checks & downloads on the host's event loop, see HttpEventDriver. All of these (and the completions)
+	// run on the loop thread, and the loop isn't detached from within a completion
+	//
+	SparkleError AttachEventLoop(HttpEventDriver::SocketWatcher &&watcher, HttpEventDriver::TimerSetter &&timer);
+
+	void DetachEventLoop();
+
+	void LoopSocketAction(intptr_t socket, int ready);
+
+	void LoopTimeout();
+
+	// [done] is called exactly once if kNoError is returned, maybe before returning (e.g. served by the shared cache)
+	SparkleError CheckUpdateAsync(const std::string &preferLang, const std::vector<std::string> &channels, void *userdata, AsyncCompletion &&done);
+
+	SparkleError DowloadAsync(const std::string &dstFile, void *userdata, AsyncCompletion &&done);
+
 private:
-	bool FilterSortedAppcast(const Appcast &appcast, const std::string &preferLang, const std::vector<std::string> &channels, FilteredAppcast &filterOut);
+	struct AsyncDownload;
+
+	// [changedAt] (seconds since the epoch) is when the appcast was told changed, -1 if it wasn't
+	SparkleError CheckUpdate(const std::string &preferLang, const std::vector<std::string> &channels, void *userdata, HttpHeaders &respHeaders, long long changedAt);
+
+	// fetch and select without notifying, the decision is remembered for the decision cache
+	std::shared_ptr<const CheckOutcome> RunCheck(const std::string &preferLang, const std::vector<std::string> &channels, long long changedAt);
+
+	SparkleError NotifyOutcome(const CheckOutcome &outcome, void *userdata);
+
+	std::string DecisionKey(const std::string &preferLang, const std::vector<std::string> &channels);
+
+	void Revalidate(const std::string &preferLang, const std::vector<std::string> &channels, void *userdata, std::shared_ptr<const CheckOutcome> stale);
+
+	HttpHeaders AppcastRequestHeaders();
+
+	// load the fetched appcast, select and notify the update
+	SparkleError ProcessAppcast(const HttpHeaders &respHeaders, std::string &respBody, const std::string &preferLang, const std::vector<std::string> &channels, void *userdata);
+
+	// load the fetched appcast and select the update, without notifying it
+	SparkleError SelectAppcast(const HttpHeaders &respHeaders, std::string &respBody, const std::string &preferLang, const std::vector<std::string> &channels, FilteredAppcast &selectedAppcast);
+
+	// the appcast response, through the machine-wide cache when it's on
+	int FetchAppcast(const HttpHeaders &reqHeaders, HttpHeaders &respHeaders, std::string &respBody, long long changedAt);
+
+	// a conditional request against the last pushed check's response, without the shared cache
+	int FetchPushedAppcast(const HttpHeaders &reqHeaders, HttpHeaders &respHeaders, std::string &respBody);
+
+	HttpHeaders RevalidationHeaders(const HttpHeaders &reqHeaders, const SharedAppcastCache::Entry &entry);
+
+	// put a fetched appcast into the shared cache, a 304 is answered with the cached one
+	int StoreAppcast(int status, SharedAppcastCache::Entry *cached, HttpHeaders &respHeaders, std::string &respBody);
 
-	std::string FilterGetLangString(const MultiLangString &multiLangs, const std::string &lang);
+	bool IsCurlTransport();
+
+	// LAN peers are reached directly (without the proxy), a custom transport gets them as any other URL
+	std::shared_ptr<HttpTransport> PeerTransport();
+
+	void DownloadNextSource(std::shared_ptr<AsyncDownload> task);
+
+	SparkleError SelectUpdate(const FilteredAppcast &selectedAppcast, void *userdata);
+
+	// forget the selected update if it's still [withdrawn], and tell with a null info
+	void WithdrawUpdate(const FilteredAppcast &withdrawn, void *userdata);
+
+	// the package at [file] passed the signature check of [enclosure], by the memo if it's still the file verified before
+	bool IsVerifiedPackage(const std::string &file, const AppcastEnclosure &enclosure);
+
+	// [file] just passed the signature check of [enclosure], memo and keep it
+	void SetDownloadedPackage(const std::string &file, const AppcastEnclosure &enclosure);
+
+	void SaveSession();
+
+	// false if there's no agent to go through, or it can't be reached
+	bool CheckThroughAgent(const std::string &preferLang, const std::vector<std::string> &channels, void *userdata, SparkleError &err);
+
+	bool DowloadThroughAgent(void *userdata, SparkleError &err);
+
+	static void PutUpdateFields(const FilteredAppcast &update, SessionState::Fields &fields);
+
+	static bool GetUpdateFields(SessionState::Fields &fields, FilteredAppcast &update);
+
+	// from the peers or the origin, then verified, the progress goes to the followers of [flight] too
+	SparkleError DownloadPackage(const AppcastEnclosure &enclosure, const std::string &dstFile, void *userdata, DownloadFlight *flight);
+
+	// decoded from [codec] on the way, aborted once more than [maxSize] bytes came (0 for no limit)
+	SparkleError DownloadToFile(HttpTransport &transport, const std::string &url, const HttpHeaders &headers, const std::string &dstFile, StreamCodec codec,
+			uint64_t maxSize, void *userdata, DownloadFlight *flight);
+
+	bool FilterIndexedAppcast(const AppcastIndex &index, const std::string &preferLang, const std::vector<std::string> &channels, FilteredAppcast &filterOut);
+
+	bool FilterBinaryAppcast(const BinaryAppcast &appcast, const std::string &preferLang, const std::vector<std::string> &channels, FilteredAppcast &filterOut);
 
 private:
 	SignatureAlgo signAlgo_ = SignatureAlgo::kNone;
@@ -70,8 +264,36 @@ private:
 	std::string caPath_;
 	SparkleCallbacks handlers_ = { nullptr };
 	std::string downloadedPackage_;
+	int memoryPackage_ = -1; // sealed and verified, see DowloadToMemory
+	SessionState::VerifiedFile verifiedPackage_; // the memo of the last package verified
 	HttpHeaders headers_;
 	FilteredAppcast cacheAppcast_;
+	std::shared_ptr<const AppcastIndex> appcastIndex_;
+	EnclosureFormats enclosureFormats_;
+	std::atomic<unsigned> parseThreads_{ 1 }; // set without cacheLock_, read by every check
+	std::mutex cacheLock_;
+	std::shared_ptr<HttpTransport> transport_ = std::make_shared<CurlTransport>();
+	std::shared_ptr<HttpTransport> peerTransport_ = std::make_shared<CurlTransport>(true);
+	PeerCache peerCache_;
+	SharedAppcastCache appcastCache_;
+	SessionState session_;
+	std::mutex sessionLock_; // a snapshot is written before a later one, taken before cacheLock_
+	std::string agentSocket_;
+	SessionState::Fields agentProduct_; // what the last check through the agent was about, empty if it went direct
+	UpdateScheduler scheduler_;
+	SharedAppcastCache::Entry pushedAppcast_;
+	SingleFlight<std::shared_ptr<const CheckOutcome>> checkFlights_;
+	SingleFlight<DownloadOutcome> downloadFlights_;
+	struct Decision {
+		std::shared_ptr<const CheckOutcome> outcome;
+		std::chrono::steady_clock::time_point decidedAt;
+	};
+	std::chrono::seconds decisionTTL_{ 0 }; // 0 if the decision cache is off
+	std::map<std::string, Decision> decisions_; // by DecisionKey
+	PushChannel push_;
+	std::unique_ptr<HttpEventDriver> loop_;
+	std::future<void> revalidation_;
+	std::future<void> warmUp_; // the last ones, joined before anything they touch is gone
 };
 }; //namespace SparkleLite
 
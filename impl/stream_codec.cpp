@@ -0,0 +1,387 @@
+#include "stream_codec.h"
+#include "sparkle_internal.h"
+#include <zlib.h>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#ifdef SPARKLE_WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef SPARKLE_WITH_XZ
+#include <lzma.h>
+#endif
+
+namespace SparkleLite {
+
+#define DECODE_BUFFER_SIZE (256 * 1024)
+#define DECODE_MAX_RATIO (100) // decoded bytes for one byte received, at most
+#define DECODE_MIN_LIMIT (64 * 1024 * 1024) // decoded bytes always allowed, whatever the ratio
+
+class NullDecoder : public StreamDecoder {
+public:
+	bool Decode(const void *data, size_t size, const DecodedDataSink &sink) override {
+		return sink(data, size);
+	}
+
+	bool Finish(const DecodedDataSink &) override {
+		return true;
+	}
+};
+
+class GzipDecoder : public StreamDecoder {
+public:
+	GzipDecoder() {
+		out_.resize(DECODE_BUFFER_SIZE);
+		memset(&zs_, 0, sizeof(zs_));
+		// 15 + 32: max window, detect gzip or zlib header automatically
+		ready_ = inflateInit2(&zs_, 15 + 32) == Z_OK;
+	}
+
+	~GzipDecoder() override {
+		if (ready_) {
+			inflateEnd(&zs_);
+		}
+	}
+
+	bool Decode(const void *data, size_t size, const DecodedDataSink &sink) override {
+		if (!ready_) {
+			return false;
+		}
+
+		if (trailing_) {
+			return true;
+		}
+
+		zs_.next_in = (Bytef *)data;
+		zs_.avail_in = (uInt)size;
+		while (zs_.avail_in) {
+			if (done_) {
+				// padding or garbage after the last member is ignored, as gzip does
+				if (zs_.next_in[0] != 0x1f || (zs_.avail_in > 1 && zs_.next_in[1] != 0x8b)) {
+					trailing_ = true;
+					break;
+				}
+
+				// concatenated members (e.g. pigz output), start over
+				if (inflateReset(&zs_) != Z_OK) {
+					return false;
+				}
+				done_ = false;
+			}
+
+			zs_.next_out = (Bytef *)&out_[0];
+			zs_.avail_out = (uInt)out_.size();
+			auto ret = inflate(&zs_, Z_NO_FLUSH);
+			if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+				return false;
+			}
+			done_ = ret == Z_STREAM_END;
+
+			auto have = out_.size() - zs_.avail_out;
+			if (have && !sink(out_.data(), have)) {
+				return false;
+			}
+			if (ret == Z_BUF_ERROR && !have) {
+				break;
+			}
+		}
+		return true;
+	}
+
+	bool Finish(const DecodedDataSink &) override {
+		return ready_ && done_;
+	}
+
+private:
+	z_stream zs_;
+	std::string out_;
+	bool ready_ = false;
+	bool done_ = false;
+	bool trailing_ = false; // after the last member
+};
+
+#ifdef SPARKLE_WITH_ZSTD
+class ZstdDecoder : public StreamDecoder {
+public:
+	ZstdDecoder() {
+		out_.resize(ZSTD_DStreamOutSize());
+		ds_ = ZSTD_createDStream();
+		if (ds_) {
+			ZSTD_initDStream(ds_);
+		}
+	}
+
+	~ZstdDecoder() override {
+		if (ds_) {
+			ZSTD_freeDStream(ds_);
+		}
+	}
+
+	bool Decode(const void *data, size_t size, const DecodedDataSink &sink) override {
+		if (!ds_) {
+			return false;
+		}
+
+		ZSTD_inBuffer in = { data, size, 0 };
+		while (in.pos < in.size) {
+			ZSTD_outBuffer out = { &out_[0], out_.size(), 0 };
+			auto ret = ZSTD_decompressStream(ds_, &out, &in);
+			if (ZSTD_isError(ret)) {
+				return false;
+			}
+			// 0 means a frame was completely decoded
+			frameDone_ = ret == 0;
+			if (out.pos && !sink(out_.data(), out.pos)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool Finish(const DecodedDataSink &sink) override {
+		if (!ds_) {
+			return false;
+		}
+
+		// flush what's still buffered in the decoder
+		while (!frameDone_) {
+			ZSTD_inBuffer in = { nullptr, 0, 0 };
+			ZSTD_outBuffer out = { &out_[0], out_.size(), 0 };
+			auto ret = ZSTD_decompressStream(ds_, &out, &in);
+			if (ZSTD_isError(ret)) {
+				return false;
+			}
+			frameDone_ = ret == 0;
+			if (!out.pos) {
+				break;
+			}
+			if (!sink(out_.data(), out.pos)) {
+				return false;
+			}
+		}
+		return frameDone_;
+	}
+
+private:
+	ZSTD_DStream *ds_ = nullptr;
+	std::string out_;
+	bool frameDone_ = false;
+};
+#endif //SPARKLE_WITH_ZSTD
+
+#ifdef SPARKLE_WITH_XZ
+class XzDecoder : public StreamDecoder {
+public:
+	XzDecoder() {
+		out_.resize(DECODE_BUFFER_SIZE);
+		// concatenated streams (e.g. pixz output) are decoded as one
+		ready_ = lzma_stream_decoder(&xs_, UINT64_MAX, LZMA_CONCATENATED) == LZMA_OK;
+	}
+
+	~XzDecoder() override {
+		lzma_end(&xs_);
+	}
+
+	bool Decode(const void *data, size_t size, const DecodedDataSink &sink) override {
+		if (!ready_) {
+			return false;
+		}
+
+		xs_.next_in = (const uint8_t *)data;
+		xs_.avail_in = size;
+		while (xs_.avail_in) {
+			if (!Step(LZMA_RUN, sink)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool Finish(const DecodedDataSink &sink) override {
+		if (!ready_) {
+			return false;
+		}
+
+		// LZMA_CONCATENATED only knows the input is over once told so
+		while (!done_) {
+			if (!Step(LZMA_FINISH, sink)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+private:
+	bool Step(lzma_action action, const DecodedDataSink &sink) {
+		xs_.next_out = (uint8_t *)&out_[0];
+		xs_.avail_out = out_.size();
+		auto ret = lzma_code(&xs_, action);
+		if (ret != LZMA_OK && ret != LZMA_STREAM_END) {
+			return false;
+		}
+		done_ = ret == LZMA_STREAM_END;
+
+		auto have = out_.size() - xs_.avail_out;
+		return !have || sink(out_.data(), have);
+	}
+
+private:
+	lzma_stream xs_ = LZMA_STREAM_INIT;
+	std::string out_;
+	bool ready_ = false;
+	bool done_ = false;
+};
+#endif //SPARKLE_WITH_XZ
+
+std::unique_ptr<StreamDecoder> StreamDecoder::Create(StreamCodec codec) {
+	switch (codec) {
+		case StreamCodec::kNone:
+			return std::make_unique<NullDecoder>();
+		case StreamCodec::kGzip:
+			return std::make_unique<GzipDecoder>();
+#ifdef SPARKLE_WITH_ZSTD
+		case StreamCodec::kZstd:
+			return std::make_unique<ZstdDecoder>();
+#endif
+#ifdef SPARKLE_WITH_XZ
+		case StreamCodec::kXz:
+			return std::make_unique<XzDecoder>();
+#endif
+		default:
+			return nullptr;
+	}
+}
+
+StreamCodec sniff_stream_codec(const void *data, size_t size) {
+	auto p = (const unsigned char *)data;
+	if (size >= 2 && p[0] == 0x1f && p[1] == 0x8b) {
+		return StreamCodec::kGzip;
+	}
+	if (size >= 4 && p[0] == 0x28 && p[1] == 0xb5 && p[2] == 0x2f && p[3] == 0xfd) {
+		return StreamCodec::kZstd;
+	}
+	if (size >= 6 && memcmp(p, "\xfd" "7zXZ\0", 6) == 0) {
+		return StreamCodec::kXz;
+	}
+	return StreamCodec::kNone;
+}
+
+bool parse_enclosure_encoding(std::string_view mime, StreamCodec &codec) {
+	codec = StreamCodec::kNone;
+
+	// "<type>; <name>=<value>; ..."
+	auto pos = mime.find(';');
+	while (pos != std::string_view::npos) {
+		mime.remove_prefix(pos + 1);
+		pos = mime.find(';');
+		auto param = mime.substr(0, pos);
+		auto eq = param.find('=');
+		if (eq == std::string_view::npos || !equals_no_case(trim_spaces(param.substr(0, eq)), "encoding")) {
+			continue;
+		}
+
+		auto value = trim_spaces(param.substr(eq + 1));
+		if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+			value = value.substr(1, value.size() - 2);
+		}
+		if (equals_no_case(value, "gzip")) {
+			codec = StreamCodec::kGzip;
+		} else if (equals_no_case(value, "zstd")) {
+			codec = StreamCodec::kZstd;
+		} else if (equals_no_case(value, "xz")) {
+			codec = StreamCodec::kXz;
+		} else if (!equals_no_case(value, "identity")) {
+			return false;
+		}
+	}
+	return true;
+}
+
+uint64_t decoded_size_limit(StreamCodec codec, uint64_t size) {
+	if (codec == StreamCodec::kNone) {
+		return size;
+	}
+	return std::max<uint64_t>(DECODE_MIN_LIMIT, size * DECODE_MAX_RATIO);
+}
+
+//
+// DecodingPipe
+//
+DecodingPipe::DecodingPipe(StreamCodec codec, DecodedDataSink &&sink) :
+		codec_(codec), sink_(std::move(sink)) {
+}
+
+DecodingPipe::~DecodingPipe() {
+	Abort();
+}
+
+bool DecodingPipe::Start() {
+	if (codec_ == StreamCodec::kNone) {
+		return true;
+	}
+	decoder_ = StreamDecoder::Create(codec_);
+	if (!decoder_) {
+		return false;
+	}
+	worker_ = std::thread(&DecodingPipe::DecodeStage, this);
+	return true;
+}
+
+bool DecodingPipe::Feed(const void *data, size_t size) {
+	if (codec_ == StreamCodec::kNone) {
+		ok_ = ok_ && sink_(data, size);
+		return ok_;
+	}
+	fed_ += size;
+
+	// the transfer buffer is reused by curl, so this is the only copy in the pipe
+	return worker_.joinable() && chunks_.Push(std::string((const char *)data, size));
+}
+
+bool DecodingPipe::Finish() {
+	if (codec_ == StreamCodec::kNone) {
+		return ok_;
+	}
+
+	chunks_.Close();
+	if (!worker_.joinable()) {
+		return false;
+	}
+	worker_.join();
+	return ok_;
+}
+
+void DecodingPipe::Abort() {
+	chunks_.Abort();
+	if (worker_.joinable()) {
+		worker_.join();
+	}
+	ok_ = false;
+}
+
+void DecodingPipe::DecodeStage() {
+	// a small download that decodes into gigabytes is a decompression bomb, not a package
+	uint64_t decoded = 0;
+	DecodedDataSink sink = [this, &decoded](const void *data, size_t size) -> bool {
+		decoded += size;
+		if (decoded > decoded_size_limit(codec_, fed_)) {
+			return false;
+		}
+		return sink_(data, size);
+	};
+
+	std::string chunk;
+	while (chunks_.Pop(chunk)) {
+		if (!decoder_->Decode(chunk.data(), chunk.size(), sink)) {
+			// the download stops at its next chunk
+			ok_ = false;
+			chunks_.Abort();
+			return;
+		}
+	}
+
+	// drained, or given up on
+	ok_ = !chunks_.IsAborted() && decoder_->Finish(sink);
+}
+
+} //namespace SparkleLite
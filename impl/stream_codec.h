@@ -0,0 +1,98 @@
+#ifndef _STREAM_CODEC_H_
+#define _STREAM_CODEC_H_
+
+#include "chunk_queue.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <thread>
+
+namespace SparkleLite {
+
+enum class StreamCodec {
+	kNone,
+	kGzip, // gzip or zlib wrapped deflate
+	kZstd, // requires SPARKLE_WITH_ZSTD
+	kXz, // requires SPARKLE_WITH_XZ
+};
+
+// receives decoded data, return false to abort
+using DecodedDataSink = std::function<bool(const void *, size_t)>;
+
+//
+// Incremental decompressor, compressed data goes in chunk by chunk and decoded data comes out through the sink
+//
+class StreamDecoder {
+public:
+	virtual ~StreamDecoder() = default;
+
+	virtual bool Decode(const void *data, size_t size, const DecodedDataSink &sink) = 0;
+
+	// true only if the compressed stream was complete
+	virtual bool Finish(const DecodedDataSink &sink) = 0;
+
+	// nullptr if [codec] is not compiled in
+	static std::unique_ptr<StreamDecoder> Create(StreamCodec codec);
+};
+
+//
+// guess the codec from the leading bytes of a stream, kNone if it's not compressed (or not recognized)
+//
+StreamCodec sniff_stream_codec(const void *data, size_t size);
+
+//
+// the coding an enclosure is served with, told by the "encoding" parameter of its type
+// (type="application/x-msdownload; encoding=zstd"): gzip, zstd or xz, kNone without one.
+// false if it names one we don't know
+//
+bool parse_enclosure_encoding(std::string_view mime, StreamCodec &codec);
+
+//
+// the most [size] bytes coded with [codec] may decode to, beyond that it's a decompression bomb
+//
+uint64_t decoded_size_limit(StreamCodec codec, uint64_t size);
+
+//
+// Decode a download on a thread of its own, so decompression doesn't hold the transfer up:
+//
+//	Feed() (download thread) -> decode thread -> [sink]
+//
+// With kNone there is no thread, the chunks go straight to the sink on the download thread.
+// Decoding fails once the output outgrows the input by far (DECODE_MAX_RATIO, a decompression bomb).
+//
+class DecodingPipe {
+public:
+	DecodingPipe(StreamCodec codec, DecodedDataSink &&sink);
+
+	~DecodingPipe();
+
+	// false if the codec is not compiled in
+	bool Start();
+
+	// false once decoding or the sink failed
+	bool Feed(const void *data, size_t size);
+
+	// end of input, wait for the rest to be decoded, true only if the stream was complete and the sink took it all
+	bool Finish();
+
+	void Abort();
+
+private:
+	void DecodeStage();
+
+private:
+	StreamCodec codec_;
+	DecodedDataSink sink_;
+	std::unique_ptr<StreamDecoder> decoder_;
+	ChunkQueue chunks_{ 64 };
+	std::atomic<uint64_t> fed_{ 0 }; // encoded bytes
+	std::thread worker_;
+	bool ok_ = true; // the decode thread's verdict, read once it's joined
+};
+
+} //namespace SparkleLite
+
+#endif //_STREAM_CODEC_H_
@@ -0,0 +1,697 @@
+#include "update_agent.h"
+#include "signature_verifier.h"
+#include "sparkle_manager.h"
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__linux__)
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <filesystem>
+#include <random>
+#include <vector>
+#endif
+
+namespace SparkleLite {
+
+#define AGENT_MAX_CONNECTIONS (64)
+#define AGENT_MESSAGE_LIMIT (1024 * 1024)
+#define AGENT_REQUEST_TIMEOUT (5) // seconds, for the request once connected
+#define AGENT_SEND_TIMEOUT (30) // seconds, a client that stops reading is let go
+#define AGENT_REPLY_TIMEOUT (120) // seconds between the messages the client waits for
+
+// what the manager's callbacks report to, checks of a product share one
+struct UpdateAgent::Call {
+	UpdateAgent *agent = nullptr;
+	Product *product = nullptr;
+	intptr_t conn = -1; // the client to report the progress to
+	bool connected = true;
+	SingleFlight<DownloadOutcome>::Flight *flight = nullptr;
+};
+
+//
+// the state of one app (appcast, version, key, language, channels & formats) the agent serves,
+// every client asking the same shares it
+//
+struct UpdateAgent::Product {
+	std::string key;
+	std::string lang;
+	std::vector<std::string> channels;
+	std::unique_ptr<Call> checks; // outlives the manager, its scheduled checks report to it
+	std::unique_ptr<SparkleManager> mgr;
+	std::mutex lock;
+	AgentMessage update; // fields of the update selected last
+	std::string packageFile; // verified
+	std::string packageVersion;
+};
+
+#if defined(__linux__)
+
+namespace fs = std::filesystem;
+
+static void set_io_timeouts(int s, int recvSeconds, int sendSeconds) {
+	timeval tv = {};
+	tv.tv_sec = recvSeconds;
+	setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	tv.tv_sec = sendSeconds;
+	setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+// the agent runs as root or as ourselves, anyone else could hand us a package and install arguments of its own
+static bool is_trusted_peer(int s) {
+	ucred cred = {};
+	socklen_t len = sizeof(cred);
+	if (getsockopt(s, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 || len != sizeof(cred)) {
+		return false;
+	}
+	return cred.uid == 0 || cred.uid == getuid();
+}
+
+static bool send_all(int s, const char *data, size_t len) {
+	while (len) {
+		auto sent = send(s, data, len, MSG_NOSIGNAL);
+		if (sent <= 0) {
+			if (sent < 0 && errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		data += sent;
+		len -= sent;
+	}
+	return true;
+}
+
+// [fd] rides along with the first byte
+static bool send_message(int s, const AgentMessage &message, int fd = -1) {
+	auto data = SessionState::Serialize(message) + "\n";
+	if (fd < 0) {
+		return send_all(s, data.data(), data.size());
+	}
+
+	char control[CMSG_SPACE(sizeof(int))] = { 0 };
+	iovec iov = { (void *)data.data(), 1 };
+	msghdr msg = {};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	auto cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	ssize_t sent;
+	do {
+		sent = sendmsg(s, &msg, MSG_NOSIGNAL);
+	} while (sent < 0 && errno == EINTR);
+	return sent == 1 && send_all(s, data.data() + 1, data.size() - 1);
+}
+
+// the next message in [buffer] or from the socket, a passed descriptor goes to [fd] (closed if it isn't wanted)
+static bool recv_message(int s, std::string &buffer, AgentMessage &message, int *fd) {
+	while (true) {
+		auto end = buffer.find("\n\n");
+		if (end != std::string::npos) {
+			auto ok = SessionState::Parse(std::string_view(buffer).substr(0, end + 1), message);
+			buffer.erase(0, end + 2);
+			return ok;
+		}
+		if (buffer.size() > AGENT_MESSAGE_LIMIT) {
+			return false;
+		}
+
+		char data[4096];
+		char control[CMSG_SPACE(sizeof(int))] = { 0 };
+		iovec iov = { data, sizeof(data) };
+		msghdr msg = {};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		auto n = recvmsg(s, &msg, MSG_CMSG_CLOEXEC);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+				int passed = -1;
+				memcpy(&passed, CMSG_DATA(cmsg), sizeof(int));
+				if (fd && *fd < 0) {
+					*fd = passed;
+				} else {
+					close(passed);
+				}
+			}
+		}
+		if (n <= 0) {
+			return false;
+		}
+		buffer.append(data, n);
+	}
+}
+
+void SPARKLE_API_CC UpdateAgent::OnNewVersion(const SparkleNewVersionInfo *info, void *userdata) {
+	auto call = (Call *)userdata;
+	AgentMessage update;
+	if (call->product->mgr->CurrentUpdate(update) || info == nullptr) {
+		// a null info withdraws the update selected before
+		std::unique_lock<std::mutex> lck(call->product->lock);
+		call->product->update = std::move(update);
+	}
+}
+
+int SPARKLE_API_CC UpdateAgent::OnProgress(long long total, long long size, void *userdata) {
+	auto call = (Call *)userdata;
+	call->agent->downloadedBytes_ += size;
+	if (call->flight) {
+		SingleFlight<DownloadOutcome>::Progress(*call->flight, (size_t)total, (size_t)size);
+	}
+	if (call->connected) {
+		call->connected = send_message((int)call->conn, { { "op", "progress" }, { "total", std::to_string(total) }, { "size", std::to_string(size) } });
+	}
+
+	// the package is worth having even when its client is gone, the next one gets it
+	return 1;
+}
+
+int SPARKLE_API_CC UpdateAgent::OnShutdown(void *) {
+	return 0;
+}
+
+UpdateAgent::~UpdateAgent() {
+	Stop();
+}
+
+bool UpdateAgent::Start(const Options &opts) {
+	Stop();
+	if (opts.socketPath.empty() || opts.socketPath.size() >= sizeof(sockaddr_un::sun_path) || opts.packageDir.empty()) {
+		return false;
+	}
+	std::error_code error;
+	fs::create_directories(opts.packageDir, error);
+	if (!fs::is_directory(opts.packageDir, error)) {
+		return false;
+	}
+
+	auto s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (s < 0) {
+		return false;
+	}
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, opts.socketPath.c_str());
+
+	// a stale socket is ours to replace, a live one belongs to a running agent
+	auto probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (probe >= 0) {
+		auto alive = connect(probe, (sockaddr *)&addr, sizeof(addr)) == 0;
+		close(probe);
+		if (alive) {
+			close(s);
+			return false;
+		}
+	}
+	unlink(opts.socketPath.c_str());
+
+	// nobody connects before the permissions are set, it listens after that
+	if (bind(s, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+			chmod(opts.socketPath.c_str(), (mode_t)opts.socketMode) != 0 ||
+			(opts.socketGroup >= 0 && chown(opts.socketPath.c_str(), (uid_t)-1, (gid_t)opts.socketGroup) != 0) ||
+			listen(s, 64) != 0) {
+		close(s);
+		unlink(opts.socketPath.c_str());
+		return false;
+	}
+
+	int m = -1;
+	if (opts.metricsPort) {
+		m = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+		int reuse = 1;
+		setsockopt(m, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+		sockaddr_in maddr = {};
+		maddr.sin_family = AF_INET;
+		maddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		maddr.sin_port = htons(opts.metricsPort);
+		if (m < 0 || bind(m, (sockaddr *)&maddr, sizeof(maddr)) != 0 || listen(m, 16) != 0) {
+			if (m >= 0) {
+				close(m);
+			}
+			close(s);
+			unlink(opts.socketPath.c_str());
+			return false;
+		}
+	}
+
+	std::unique_lock<std::mutex> lck(lock_);
+	opts_ = opts;
+	transport_ = std::make_shared<CurlTransport>();
+	listenSock_ = s;
+	metricsSock_ = m;
+	stopping_ = false;
+	running_ = true;
+	server_ = std::thread(&UpdateAgent::ServeLoop, this);
+	return true;
+}
+
+void UpdateAgent::Stop() {
+	std::unique_lock<std::mutex> lck(lock_);
+	if (!running_) {
+		return;
+	}
+	stopping_ = true;
+	lck.unlock();
+	if (server_.joinable()) {
+		server_.join();
+	}
+
+	// connections finish what they're doing, a download may take a while
+	lck.lock();
+	idleCond_.wait(lck, [this]() { return activeConns_ == 0; });
+	close((int)listenSock_);
+	unlink(opts_.socketPath.c_str());
+	listenSock_ = -1;
+	if (metricsSock_ != -1) {
+		close((int)metricsSock_);
+		metricsSock_ = -1;
+	}
+	products_.clear();
+	running_ = false;
+}
+
+void UpdateAgent::ServeLoop() {
+	while (!stopping_) {
+		pollfd fds[2] = {};
+		int count = 0;
+		fds[count].fd = (int)listenSock_;
+		fds[count++].events = POLLIN;
+		if (metricsSock_ != -1) {
+			fds[count].fd = (int)metricsSock_;
+			fds[count++].events = POLLIN;
+		}
+
+		// wake up periodically so Stop() doesn't wait for the next client
+		if (poll(fds, count, 200) <= 0) {
+			continue;
+		}
+
+		for (int idx = 0; idx < count; idx++) {
+			if (!(fds[idx].revents & POLLIN)) {
+				continue;
+			}
+			auto conn = accept4(fds[idx].fd, nullptr, nullptr, SOCK_CLOEXEC);
+			if (conn < 0) {
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lck(lock_);
+			if (activeConns_ >= AGENT_MAX_CONNECTIONS) {
+				lck.unlock();
+				close(conn);
+				continue;
+			}
+			++activeConns_;
+			auto serve = idx == 0 ? &UpdateAgent::ServeConnection : &UpdateAgent::ServeMetrics;
+			std::thread(serve, this, (intptr_t)conn).detach();
+		}
+	}
+}
+
+void UpdateAgent::ServeConnection(intptr_t connHandle) {
+	auto conn = (int)connHandle;
+	set_io_timeouts(conn, AGENT_REQUEST_TIMEOUT, AGENT_SEND_TIMEOUT);
+
+	std::string buffer;
+	AgentMessage request;
+	AgentMessage reply;
+	int fd = -1;
+	if (recv_message(conn, buffer, request, nullptr)) {
+		auto &opName = request["op"];
+		auto op = opName == "check" ? kOpCheck : opName == "download" ? kOpDownload : opName == "metrics" ? kOpMetrics : kOpCount;
+		auto err = SparkleError::kInvalidParameter;
+		if (op == kOpMetrics) {
+			reply["metrics"] = Metrics();
+			err = SparkleError::kNoError;
+		} else if (op != kOpCount) {
+			auto product = GetProduct(request, err);
+			if (product && op == kOpCheck) {
+				auto start = std::chrono::steady_clock::now();
+				Check(*product, reply);
+				checkMicros_ += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+			} else if (product) {
+				fd = Download(*product, request["version"], conn, reply);
+			}
+			if (product) {
+				err = (SparkleError)std::atoi(reply["err"].c_str());
+			}
+		}
+
+		if (op != kOpCount) {
+			requests_[op]++;
+			if (err != SparkleError::kNoError && err != SparkleError::kNoUpdateFound) {
+				failures_[op]++;
+			}
+		}
+		reply["op"] = "reply";
+		reply["err"] = std::to_string((int)err);
+		if (send_message(conn, reply, fd) && fd >= 0) {
+			packagesShared_++;
+		}
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+	close(conn);
+
+	std::unique_lock<std::mutex> lck(lock_);
+	--activeConns_;
+	idleCond_.notify_all();
+}
+
+void UpdateAgent::ServeMetrics(intptr_t connHandle) {
+	auto conn = (int)connHandle;
+	set_io_timeouts(conn, AGENT_REQUEST_TIMEOUT, AGENT_SEND_TIMEOUT);
+
+	// we only serve "GET /metrics", the request head is all we need
+	char head[2048];
+	size_t len = 0;
+	while (len < sizeof(head) - 1) {
+		auto n = recv(conn, head + len, sizeof(head) - 1 - len, 0);
+		if (n <= 0) {
+			break;
+		}
+		len += n;
+		head[len] = '\0';
+		if (strstr(head, "\r\n\r\n")) {
+			break;
+		}
+	}
+	head[len] = '\0';
+
+	std::string resp;
+	if (strncmp(head, "GET /metrics ", strlen("GET /metrics ")) == 0) {
+		auto body = Metrics();
+		resp = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+	} else {
+		resp = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+	}
+	send_all(conn, resp.data(), resp.size());
+	close(conn);
+
+	std::unique_lock<std::mutex> lck(lock_);
+	--activeConns_;
+	idleCond_.notify_all();
+}
+
+std::shared_ptr<UpdateAgent::Product> UpdateAgent::GetProduct(const AgentMessage &request, SparkleError &err) {
+	auto field = [&](const char *name) -> std::string {
+		auto it = request.find(name);
+		return it == request.end() ? std::string() : it->second;
+	};
+	auto appcast = field("appcast");
+	auto appVer = field("app-version");
+	auto algo = (SignatureAlgo)std::atoi(field("sign-algo").c_str());
+	auto pubKey = field("pub-key");
+	auto lang = field("lang");
+	auto channelList = field("channels");
+
+	// we only hand out what we verified
+	err = SparkleError::kInvalidParameter;
+	if (appcast.empty() || appVer.empty()) {
+		return nullptr;
+	}
+	if ((algo != SignatureAlgo::kDSA || !IsWellFormedDSAPubKey(pubKey)) &&
+			(algo != SignatureAlgo::kEd25519 || !IsWellFormedEd25519Key(pubKey))) {
+		err = SparkleError::kUnsupportedSignAlgo;
+		return nullptr;
+	}
+
+	// one a line
+	auto split = [](const std::string &list) -> std::vector<std::string> {
+		std::vector<std::string> values;
+		size_t pos = 0;
+		while (pos < list.size()) {
+			auto end = list.find('\n', pos);
+			if (end == std::string::npos) {
+				end = list.size();
+			}
+			if (end > pos) {
+				values.emplace_back(list.substr(pos, end - pos));
+			}
+			pos = end + 1;
+		}
+		return values;
+	};
+	auto channels = split(channelList);
+	auto formatList = field("formats");
+
+	auto key = appcast + "\n" + appVer + "\n" + std::to_string((int)algo) + "\n" + SessionState::KeyDigest(pubKey) + "\n" + lang + "\n" + channelList + "\n" + formatList;
+	std::unique_lock<std::mutex> lck(lock_);
+	auto &product = products_[key];
+	if (!product) {
+		product = std::make_shared<Product>();
+		product->key = key;
+		product->lang = lang;
+		product->channels = channels;
+
+		auto checks = new Call{ this, product.get() };
+		product->mgr = std::make_unique<SparkleManager>();
+		auto &mgr = *product->mgr;
+		SparkleCallbacks callbacks = { OnNewVersion, OnProgress, OnShutdown };
+		mgr.SetCallbacks(callbacks);
+		mgr.SetAppcastURL(appcast);
+		mgr.SetAppCurrentVersion(appVer);
+		mgr.SetSignatureVerifyParams(algo, pubKey);
+		mgr.SetTransport(transport_);
+		mgr.SetEnclosurePreference(split(formatList));
+		if (!opts_.cacheDir.empty()) {
+			mgr.EnableSharedCache(opts_.cacheDir, opts_.cacheTTL);
+		}
+		if (opts_.decisionTTL.count() > 0) {
+			mgr.EnableDecisionCache(opts_.decisionTTL);
+		}
+		if (opts_.checkInterval.count() > 0) {
+			UpdateScheduler::Options schedule;
+			schedule.interval = opts_.checkInterval;
+			schedule.startupDelay = opts_.checkInterval;
+			mgr.StartScheduledCheck(lang, channels, checks, schedule);
+		}
+		product->checks.reset(checks);
+	}
+	err = SparkleError::kNoError;
+	return product;
+}
+
+void UpdateAgent::Check(Product &product, AgentMessage &reply) {
+	auto err = product.mgr->CheckUpdate(product.lang, product.channels, product.checks.get());
+	if (err == SparkleError::kNoError) {
+		std::unique_lock<std::mutex> lck(product.lock);
+		reply = product.update;
+	}
+	reply["err"] = std::to_string((int)err);
+}
+
+int UpdateAgent::Download(Product &product, const std::string &version, intptr_t conn, AgentMessage &reply) {
+	auto open_package = [&]() -> int {
+		// under the lock, a newer package doesn't replace it meanwhile
+		std::unique_lock<std::mutex> lck(product.lock);
+		if (version.empty() || product.packageVersion != version) {
+			return -1;
+		}
+		return open(product.packageFile.c_str(), O_RDONLY | O_CLOEXEC);
+	};
+
+	auto fd = open_package();
+	if (fd >= 0) {
+		packagesReused_++;
+		reply["err"] = std::to_string((int)SparkleError::kNoError);
+		return fd;
+	}
+
+	// it's the version the agent selected too (it may not have checked since it started)
+	auto selected = [&]() {
+		std::unique_lock<std::mutex> lck(product.lock);
+		auto it = product.update.find("version");
+		return it != product.update.end() && it->second == version;
+	};
+	if (!selected()) {
+		Check(product, reply);
+		reply.clear();
+		if (!selected()) {
+			reply["err"] = std::to_string((int)SparkleError::kNotReady);
+			return -1;
+		}
+	}
+
+	// clients of the same product asking at the same time share one download
+	Call call{ this, &product, conn };
+	auto key = product.key + "\n" + version;
+	auto [flight, leader] = downloadFlights_.Join(key);
+	DownloadOutcome outcome;
+	if (leader) {
+		// a new file every time, clients may still hold the old one
+		std::random_device rd;
+		outcome.file = (fs::path(opts_.packageDir) / (SessionState::KeyDigest(product.key) + "-" + std::to_string(rd()) + ".pkg")).string();
+		call.flight = flight.get();
+		downloads_++;
+		outcome.err = product.mgr->Dowload(outcome.file, &call);
+		if (outcome.err == SparkleError::kNoError) {
+			// executable (installed from the descriptor) and read-only
+			chmod(outcome.file.c_str(), 0555);
+
+			std::unique_lock<std::mutex> lck(product.lock);
+			if (!product.packageFile.empty()) {
+				unlink(product.packageFile.c_str());
+			}
+			product.packageFile = outcome.file;
+			product.packageVersion = version;
+		} else {
+			unlink(outcome.file.c_str());
+		}
+		downloadFlights_.Land(key, flight, outcome);
+	} else {
+		SingleFlight<DownloadOutcome>::Wait(
+				*flight,
+				[&](size_t total, size_t size) -> bool {
+					if (call.connected) {
+						call.connected = send_message((int)conn, { { "op", "progress" }, { "total", std::to_string(total) }, { "size", std::to_string(size) } });
+					}
+					return true;
+				},
+				outcome);
+	}
+
+	if (outcome.err != SparkleError::kNoError) {
+		reply["err"] = std::to_string((int)outcome.err);
+		return -1;
+	}
+	fd = open_package();
+	reply["err"] = std::to_string((int)(fd >= 0 ? SparkleError::kNoError : SparkleError::kFileIOFail));
+	return fd;
+}
+
+std::string UpdateAgent::Metrics() {
+	size_t products = 0;
+	int conns = 0;
+	{
+		std::unique_lock<std::mutex> lck(lock_);
+		products = products_.size();
+		conns = activeConns_;
+	}
+
+	static const char *opNames[kOpCount] = { "check", "download", "metrics" };
+	std::string out;
+	auto family = [&](const char *name, const char *type, const char *help) {
+		out += std::string("# HELP ") + name + " " + help + "\n# TYPE " + name + " " + type + "\n";
+	};
+	auto sample = [&](const std::string &name, uint64_t value) {
+		out += name + " " + std::to_string(value) + "\n";
+	};
+
+	family("sparkle_agent_requests_total", "counter", "Requests served, by operation.");
+	for (int op = 0; op < kOpCount; op++) {
+		sample(std::string("sparkle_agent_requests_total{op=\"") + opNames[op] + "\"}", requests_[op]);
+	}
+	family("sparkle_agent_request_failures_total", "counter", "Requests answered with an error, by operation.");
+	for (int op = 0; op < kOpCount; op++) {
+		sample(std::string("sparkle_agent_request_failures_total{op=\"") + opNames[op] + "\"}", failures_[op]);
+	}
+	family("sparkle_agent_check_duration_seconds", "summary", "Time to answer checks.");
+	out += "sparkle_agent_check_duration_seconds_sum " + std::to_string(checkMicros_ / 1e6) + "\n";
+	sample("sparkle_agent_check_duration_seconds_count", requests_[kOpCheck]);
+	family("sparkle_agent_package_downloads_total", "counter", "Packages downloaded and verified.");
+	sample("sparkle_agent_package_downloads_total", downloads_);
+	family("sparkle_agent_package_download_bytes_total", "counter", "Package bytes received.");
+	sample("sparkle_agent_package_download_bytes_total", downloadedBytes_);
+	family("sparkle_agent_packages_shared_total", "counter", "Verified packages passed to clients.");
+	sample("sparkle_agent_packages_shared_total", packagesShared_);
+	family("sparkle_agent_packages_reused_total", "counter", "Packages passed without downloading them again.");
+	sample("sparkle_agent_packages_reused_total", packagesReused_);
+	family("sparkle_agent_products", "gauge", "Distinct apps (appcast, version, key, language and channels) served.");
+	sample("sparkle_agent_products", products);
+	family("sparkle_agent_connections", "gauge", "Connections being served.");
+	sample("sparkle_agent_connections", conns);
+	return out;
+}
+
+AgentStatus agent_request(const std::string &socketPath, const AgentMessage &request,
+		const std::function<bool(uint64_t, uint64_t)> &onProgress, AgentMessage &reply, int &fd) {
+	fd = -1;
+	if (socketPath.empty() || socketPath.size() >= sizeof(sockaddr_un::sun_path)) {
+		return AgentStatus::kUnreachable;
+	}
+	auto s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (s < 0) {
+		return AgentStatus::kUnreachable;
+	}
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socketPath.c_str());
+	if (connect(s, (sockaddr *)&addr, sizeof(addr)) != 0 || !is_trusted_peer(s)) {
+		close(s);
+		return AgentStatus::kUnreachable;
+	}
+
+	// a stalled agent is a lost one
+	set_io_timeouts(s, AGENT_REPLY_TIMEOUT, AGENT_REQUEST_TIMEOUT);
+	if (!send_message(s, request)) {
+		close(s);
+		return AgentStatus::kUnreachable;
+	}
+
+	auto status = AgentStatus::kLost;
+	std::string buffer;
+	AgentMessage message;
+	while (recv_message(s, buffer, message, &fd)) {
+		if (message["op"] != "progress") {
+			reply = std::move(message);
+			status = AgentStatus::kReplied;
+			break;
+		}
+		if (!onProgress(std::strtoull(message["total"].c_str(), nullptr, 10), std::strtoull(message["size"].c_str(), nullptr, 10))) {
+			status = AgentStatus::kCancelled;
+			break;
+		}
+	}
+	close(s);
+	if (status != AgentStatus::kReplied && fd >= 0) {
+		close(fd);
+		fd = -1;
+	}
+	return status;
+}
+
+#else
+
+//
+// #NOTE: no descriptor passing on Windows, clients go on without the agent
+//
+UpdateAgent::~UpdateAgent() {
+}
+
+bool UpdateAgent::Start(const Options &) {
+	return false;
+}
+
+void UpdateAgent::Stop() {
+}
+
+std::string UpdateAgent::Metrics() {
+	return {};
+}
+
+AgentStatus agent_request(const std::string &, const AgentMessage &, const std::function<bool(uint64_t, uint64_t)> &, AgentMessage &, int &fd) {
+	fd = -1;
+	return AgentStatus::kUnreachable;
+}
+
+#endif //__linux__
+
+} //namespace SparkleLite
@@ -0,0 +1,140 @@
+#ifndef _UPDATE_AGENT_H_
+#define _UPDATE_AGENT_H_
+
+#include "../sparkle_api.h"
+#include "http_transport.h"
+#include "session_state.h"
+#include "single_flight.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace SparkleLite {
+
+//
+// Every request and reply is a block of fields (as in the session state file) ended by an empty line,
+// one request a connection:
+//
+//	+ "op: check" with the app's appcast, app-version, sign-algo, pub-key, lang, channels and (enclosure) formats,
+//	  replied with err and the fields of the selected update
+//	+ "op: download" with the same and the version told by the check, answered by any number of
+//	  "op: progress" (total, size) and a reply carrying the verified package as a read-only file descriptor (SCM_RIGHTS)
+//	+ "op: metrics", replied with the Prometheus text in "metrics"
+//
+using AgentMessage = SessionState::Fields;
+
+//
+// A process shared by all the apps on a machine: it owns one transport, the appcast & decision caches,
+// the scheduled checks and the verified packages, so a component shared by many apps is checked, downloaded
+// and verified once. Unix domain socket only (Linux), access to the socket is access to the agent
+//
+// #NOTE: packages must be signed, a client verifies the package it's handed once more (it reads it from memory anyway)
+//
+class UpdateAgent {
+public:
+	struct Options {
+		std::string socketPath;
+		unsigned socketMode = 0666; // who may connect, the apps of every user by default
+		int socketGroup = -1; // the socket's group, -1 to keep ours
+		std::string packageDir; // verified packages, must not be writable by the clients
+		std::string cacheDir; // the shared appcast cache, empty for none
+		long long cacheTTL = 300; // seconds
+		std::chrono::seconds decisionTTL{ 60 }; // 0 for none
+		std::chrono::seconds checkInterval{ 0 }; // scheduled checks of every app once it asked, 0 for none
+		unsigned short metricsPort = 0; // "GET /metrics" on 127.0.0.1, 0 for none (the "metrics" op is always there)
+	};
+
+	~UpdateAgent();
+
+	bool Start(const Options &opts);
+
+	void Stop();
+
+	// the Prometheus text exposition
+	std::string Metrics();
+
+private:
+	struct Product;
+	struct Call;
+	struct DownloadOutcome {
+		SparkleError err = SparkleError::kFail;
+		std::string file;
+	};
+
+	enum Op {
+		kOpCheck,
+		kOpDownload,
+		kOpMetrics,
+		kOpCount
+	};
+
+	// the manager's callbacks, userdata is a Call
+	static void SPARKLE_API_CC OnNewVersion(const SparkleNewVersionInfo *info, void *userdata);
+
+	static int SPARKLE_API_CC OnProgress(long long total, long long size, void *userdata);
+
+	static int SPARKLE_API_CC OnShutdown(void *userdata);
+
+	void ServeLoop();
+
+	void ServeConnection(intptr_t conn);
+
+	void ServeMetrics(intptr_t conn);
+
+	// the product (app, key, language & channels) a request is about, created on first use
+	std::shared_ptr<Product> GetProduct(const AgentMessage &request, SparkleError &err);
+
+	void Check(Product &product, AgentMessage &reply);
+
+	// the verified package of [version], -1 if it can't be had ([reply] tells why)
+	int Download(Product &product, const std::string &version, intptr_t conn, AgentMessage &reply);
+
+private:
+	std::mutex lock_;
+	std::condition_variable idleCond_;
+	Options opts_;
+	std::map<std::string, std::shared_ptr<Product>> products_;
+	std::shared_ptr<HttpTransport> transport_;
+	SingleFlight<DownloadOutcome> downloadFlights_;
+	std::thread server_;
+	std::atomic<bool> stopping_{ false };
+	bool running_ = false;
+	int activeConns_ = 0;
+	intptr_t listenSock_ = -1;
+	intptr_t metricsSock_ = -1;
+
+	// metrics
+	std::atomic<uint64_t> requests_[kOpCount] = {};
+	std::atomic<uint64_t> failures_[kOpCount] = {};
+	std::atomic<uint64_t> checkMicros_{ 0 };
+	std::atomic<uint64_t> downloads_{ 0 };
+	std::atomic<uint64_t> downloadedBytes_{ 0 };
+	std::atomic<uint64_t> packagesShared_{ 0 };
+	std::atomic<uint64_t> packagesReused_{ 0 };
+};
+
+enum class AgentStatus {
+	kUnreachable, // nothing sent, go on without the agent
+	kLost, // the connection broke before the reply
+	kCancelled, // [onProgress] returned false
+	kReplied
+};
+
+//
+// one request to the agent at [socketPath], progress messages go to [onProgress] `bool(uint64_t total, uint64_t size)`,
+// [fd] receives the file descriptor passed with the reply (-1 if none), the caller owns it,
+// an agent running as neither root nor ourselves is unreachable
+//
+AgentStatus agent_request(const std::string &socketPath, const AgentMessage &request,
+		const std::function<bool(uint64_t, uint64_t)> &onProgress, AgentMessage &reply, int &fd);
+
+} //namespace SparkleLite
+
+#endif //_UPDATE_AGENT_H_
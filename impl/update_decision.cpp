@@ -0,0 +1,169 @@
+#include "update_decision.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <unordered_map>
+
+namespace SparkleLite {
+
+// clients handed to a thread at a time
+#define DECISION_CHUNK_SIZE (4096)
+// memoized decisions per thread before starting over
+#define DECISION_MEMO_LIMIT (1 << 20)
+
+namespace {
+struct Decision {
+	int32_t item = -1;
+	int32_t enclosure = -1;
+	uint32_t flags = 0;
+};
+
+class DecisionWorker {
+public:
+	DecisionWorker(const AppcastIndex &index, const std::vector<AppcastIndex::Id> &channelIds, const EnclosureFormats &formats, long long now,
+			const ClientColumns &clients) :
+			index_(index), channelIds_(channelIds), formats_(formats), now_(now), clients_(clients) {}
+
+	void Run(size_t begin, size_t end, const DecisionColumns &out) {
+		for (auto idx = begin; idx < end; idx++) {
+			auto decision = Decide(idx);
+			out.items[idx] = decision.item;
+			out.enclosures[idx] = decision.enclosure;
+			out.flags[idx] = decision.flags;
+		}
+	}
+
+private:
+	static const char *Column(const char *const *column, size_t idx) {
+		return column && column[idx] ? column[idx] : "";
+	}
+
+	Decision Decide(size_t idx) {
+		auto appVer = Column(clients_.appVersions, idx);
+		auto osName = Column(clients_.osNames, idx);
+		auto osDistro = Column(clients_.osDistros, idx);
+		auto osArch = Column(clients_.osArchs, idx);
+		auto osVer = Column(clients_.osVersions, idx);
+		uint64_t mask = clients_.channelMasks ? clients_.channelMasks[idx] : 0;
+		int8_t group = clients_.rolloutGroups ? clients_.rolloutGroups[idx] : -1;
+
+		// the key covers everything a decision depends on
+		key_.clear();
+		key_.append(appVer).push_back('\0');
+		key_.append(osName).push_back('\0');
+		key_.append(osDistro).push_back('\0');
+		key_.append(osArch).push_back('\0');
+		key_.append(osVer).push_back('\0');
+		key_.append((const char *)&mask, sizeof(mask));
+		key_.push_back((char)group);
+
+		auto it = memo_.find(key_);
+		if (it != memo_.end()) {
+			return it->second;
+		}
+
+		facts_.name = osName;
+		facts_.distro = osDistro;
+		facts_.arch = osArch;
+		facts_.version = osVer;
+
+		ids_.clear();
+		for (size_t bit = 0; bit < channelIds_.size(); bit++) {
+			if ((mask & (1ull << bit)) && channelIds_[bit] != AppcastIndex::kNoId) {
+				ids_.push_back(channelIds_[bit]);
+			}
+		}
+
+		AppcastIndex::Query query;
+		query.os = &facts_;
+		query.channels = ids_.data();
+		query.channelCount = ids_.size();
+		query.appVersion = appVer;
+		query.rolloutGroup = group;
+		query.now = now_;
+		query.formats = &formats_;
+
+		Decision decision;
+		AppcastIndex::Match match;
+		if (index_.Select(query, match)) {
+			decision.item = (int32_t)match.item;
+			decision.enclosure = (int32_t)match.enclosure;
+			decision.flags = index_.ItemFlags(match.item, appVer);
+		}
+
+		if (memo_.size() >= DECISION_MEMO_LIMIT) {
+			memo_.clear();
+		}
+		memo_.emplace(key_, decision);
+		return decision;
+	}
+
+private:
+	const AppcastIndex &index_;
+	const std::vector<AppcastIndex::Id> &channelIds_;
+	const EnclosureFormats &formats_; // the same for the whole batch, not part of the memo key
+	long long now_;
+	const ClientColumns &clients_;
+
+	std::string key_;
+	OSFacts facts_;
+	std::vector<AppcastIndex::Id> ids_;
+	std::unordered_map<std::string, Decision> memo_;
+};
+} // namespace
+
+bool EvaluateUpdateDecisions(
+		const AppcastIndex &index,
+		const std::vector<std::string> &channelNames,
+		const EnclosureFormats &formats,
+		long long now,
+		const ClientColumns &clients,
+		const DecisionColumns &out,
+		unsigned threads) {
+	if (channelNames.size() > UPDATE_DECISION_MAX_CHANNELS ||
+			(clients.count && (!clients.appVersions || !clients.osNames || !out.items || !out.enclosures || !out.flags))) {
+		return false;
+	}
+
+	// bit N -> channel id, kNoId if the feed doesn't use that channel
+	std::vector<AppcastIndex::Id> channelIds;
+	channelIds.reserve(channelNames.size());
+	for (auto &name : channelNames) {
+		auto ids = index.ChannelIds({ name });
+		channelIds.push_back(ids.empty() ? AppcastIndex::kNoId : ids.front());
+	}
+
+	if (!threads) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	auto chunks = (clients.count + DECISION_CHUNK_SIZE - 1) / DECISION_CHUNK_SIZE;
+	threads = (unsigned)std::min<size_t>(threads, std::max<size_t>(chunks, 1));
+
+	// threads take the next chunk when they're done with one, so a slow chunk doesn't hold the others
+	std::atomic<size_t> nextChunk{ 0 };
+	auto worker = [&]() {
+		DecisionWorker decider(index, channelIds, formats, now, clients);
+		while (true) {
+			auto chunk = nextChunk.fetch_add(1);
+			if (chunk >= chunks) {
+				break;
+			}
+			auto begin = chunk * DECISION_CHUNK_SIZE;
+			decider.Run(begin, std::min(begin + DECISION_CHUNK_SIZE, clients.count), out);
+		}
+	};
+
+	std::vector<std::thread> pool;
+	pool.reserve(threads - 1);
+	for (unsigned idx = 1; idx < threads; idx++) {
+		pool.emplace_back(worker);
+	}
+	worker();
+	for (auto &thread : pool) {
+		thread.join();
+	}
+	return true;
+}
+
+} //namespace SparkleLite
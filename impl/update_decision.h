@@ -0,0 +1,54 @@
+#ifndef _UPDATE_DECISION_H_
+#define _UPDATE_DECISION_H_
+
+#include "appcast_index.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace SparkleLite {
+
+// at most 64 channel names per batch, a client accepts them through a bit mask
+#define UPDATE_DECISION_MAX_CHANNELS (64)
+
+//
+// Client descriptors, one array per field, all [count] long. Optional ones may be nullptr.
+//
+struct ClientColumns {
+	size_t count = 0;
+	const char *const *appVersions = nullptr; // current <sparkle:version>
+	const char *const *osNames = nullptr; // "windows", "linux" or a distribution id
+	const char *const *osDistros = nullptr; // optional, distribution id, matched like the name (OSFacts::distro)
+	const char *const *osArchs = nullptr; // optional, "x86" / "x64" / "arm64"
+	const char *const *osVersions = nullptr; // optional, dotted OS version
+	const uint64_t *channelMasks = nullptr; // optional, bit N accepts channel N of the batch
+	const int8_t *rolloutGroups = nullptr; // optional, phased rollout group (0 ~ 6), -1 to ignore
+};
+
+//
+// Decisions, one array per field, all [count] long
+//
+struct DecisionColumns {
+	int32_t *items = nullptr; // index into AppcastIndex::Feed().items, -1 if there is no update
+	int32_t *enclosures = nullptr; // index into the enclosures of that item
+	uint32_t *flags = nullptr; // AppcastIndex::Flags
+};
+
+//
+// Decide updates for a batch of clients with the same rules the client uses (AppcastIndex::Select),
+// [formats] ranks the enclosures for all of them (SparkleManager::SetEnclosurePreference),
+// spread over [threads] threads (0 for one per core).
+// Fleets are made of few distinct (version, os, channels) tuples, so each thread memoizes the decisions.
+//
+bool EvaluateUpdateDecisions(
+		const AppcastIndex &index,
+		const std::vector<std::string> &channelNames,
+		const EnclosureFormats &formats,
+		long long now,
+		const ClientColumns &clients,
+		const DecisionColumns &out,
+		unsigned threads = 0);
+
+} //namespace SparkleLite
+
+#endif //_UPDATE_DECISION_H_
@@ -0,0 +1,121 @@
+#include "update_scheduler.h"
+#include <algorithm>
+
+namespace SparkleLite {
+
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+
+std::chrono::milliseconds jittered_backoff(milliseconds base, milliseconds cap, unsigned attempt, std::mt19937 &rng) {
+	// avoid overflow on long failure streaks
+	auto delay = base;
+	while (attempt-- > 0 && delay < cap) {
+		delay *= 2;
+	}
+	delay = std::min(delay, cap);
+	if (delay.count() <= 1) {
+		return delay;
+	}
+
+	std::uniform_int_distribution<long long> dist(delay.count() / 2, delay.count());
+	return milliseconds(dist(rng));
+}
+
+UpdateScheduler::~UpdateScheduler() {
+	Stop();
+}
+
+bool UpdateScheduler::Start(const Options &opts, ScheduledCheckTask &&task) {
+	if (!task || opts.interval.count() <= 0) {
+		return false;
+	}
+
+	Stop();
+
+	std::unique_lock<std::mutex> lck(lock_);
+	failures_ = 0;
+	worker_ = std::thread(&UpdateScheduler::Run, this, opts, std::move(task), generation_);
+	return true;
+}
+
+void UpdateScheduler::Stop() {
+	std::thread worker;
+	{
+		std::unique_lock<std::mutex> lck(lock_);
+		generation_++;
+		worker = std::move(worker_);
+	}
+	cond_.notify_all();
+
+	// a check may stop the scheduler from inside the new-version callback, it ends once the check returns
+	if (worker.joinable()) {
+		if (worker.get_id() == std::this_thread::get_id()) {
+			worker.detach();
+		} else {
+			worker.join();
+		}
+	}
+}
+
+bool UpdateScheduler::IsRunning() {
+	std::unique_lock<std::mutex> lck(lock_);
+	return worker_.joinable();
+}
+
+void UpdateScheduler::Run(Options opts, ScheduledCheckTask task, uint64_t generation) {
+	// defer the first check until the host app is done starting, spread over [startupDelay, 2 * startupDelay]
+	milliseconds delay = opts.startupDelay;
+	{
+		std::unique_lock<std::mutex> lck(lock_);
+		std::uniform_int_distribution<long long> dist(0, milliseconds(opts.startupDelay).count());
+		delay += milliseconds(dist(rng_));
+	}
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lck(lock_);
+			if (cond_.wait_for(lck, delay, [&]() { return generation_ != generation; })) {
+				break;
+			}
+		}
+
+		auto outcome = task();
+
+		std::unique_lock<std::mutex> lck(lock_);
+		if (generation_ != generation) {
+			break;
+		}
+		delay = NextDelay(opts, outcome);
+	}
+}
+
+milliseconds UpdateScheduler::NextDelay(const Options &opts, const ScheduledCheckOutcome &outcome) {
+	if (outcome.failed) {
+		// back off, but never wait longer than a regular interval
+		auto delay = jittered_backoff(opts.retryBase, opts.interval, failures_++, rng_);
+		if (outcome.retryAfter >= 0) {
+			delay = std::max<milliseconds>(delay, seconds(outcome.retryAfter));
+		}
+		return delay;
+	}
+	failures_ = 0;
+
+	// no need to ask again while the feed is still fresh
+	milliseconds delay = opts.interval;
+	if (outcome.maxAge > 0) {
+		delay = std::max<milliseconds>(delay, seconds(outcome.maxAge));
+	}
+	if (outcome.retryAfter > 0) {
+		delay = std::max<milliseconds>(delay, seconds(outcome.retryAfter));
+	}
+
+	// randomize so a fleet started at the same moment doesn't hit the feed in lock-step
+	auto spread = (long long)(delay.count() * opts.jitterRatio);
+	if (spread > 0) {
+		std::uniform_int_distribution<long long> dist(-spread, spread);
+		delay += milliseconds(dist(rng_));
+	}
+	return delay;
+}
+
+} //namespace SparkleLite
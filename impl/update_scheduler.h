@@ -0,0 +1,63 @@
+#ifndef _UPDATE_SCHEDULER_H_
+#define _UPDATE_SCHEDULER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <thread>
+
+namespace SparkleLite {
+
+//
+// What a single scheduled check reported back to the scheduler
+//
+struct ScheduledCheckOutcome {
+	bool failed = false;
+	long long retryAfter = -1; // seconds, from "Retry-After", -1 if absent
+	long long maxAge = -1; // seconds, from "Cache-Control: max-age", -1 if absent
+};
+
+using ScheduledCheckTask = std::function<ScheduledCheckOutcome()>;
+
+//
+// exponential backoff with jitter, the result is a random value in [d/2, d] where d = min(base * 2^attempt, cap)
+//
+std::chrono::milliseconds jittered_backoff(std::chrono::milliseconds base, std::chrono::milliseconds cap, unsigned attempt, std::mt19937 &rng);
+
+class UpdateScheduler {
+public:
+	struct Options {
+		std::chrono::seconds interval{ 24 * 3600 };
+		std::chrono::seconds startupDelay{ 60 };
+		std::chrono::seconds retryBase{ 60 };
+		double jitterRatio = 0.1;
+	};
+
+	~UpdateScheduler();
+
+	bool Start(const Options &opts, ScheduledCheckTask &&task);
+
+	void Stop();
+
+	bool IsRunning();
+
+private:
+	// runs until the scheduler is stopped or started again, i.e. [generation_] moves on
+	void Run(Options opts, ScheduledCheckTask task, uint64_t generation);
+
+	std::chrono::milliseconds NextDelay(const Options &opts, const ScheduledCheckOutcome &outcome);
+
+private:
+	std::mutex lock_;
+	std::condition_variable cond_;
+	std::thread worker_;
+	uint64_t generation_ = 0; // of the current worker, a detached worker sees it's not its own any more
+	unsigned failures_ = 0;
+	std::mt19937 rng_{ std::random_device{}() };
+};
+} //namespace SparkleLite
+
+#endif //_UPDATE_SCHEDULER_H_
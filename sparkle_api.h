@@ -1,6 +1,8 @@
 #ifndef _SPARKLE_API_H_
 #define _SPARKLE_API_H_
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -18,7 +20,8 @@ extern "C" {
 #define SPARKLE_API_DELC(ret) ret SPARKLE_API_CC
 #endif
 #else
-#ifdef defined(__GNUC__) || defined(__SUNPRO_CC) || defined (__SUNPRO_C)
+#define SPARKLE_API_CC
+#if defined(__GNUC__) || defined(__SUNPRO_CC) || defined (__SUNPRO_C)
 // GCC
 #define SPARKLE_API_DELC(ret)   __attribute__((visibility("default"))) ret
 #else
@@ -60,6 +63,36 @@ extern "C" {
 		const char*		installArgs;
 	};
 
+	//
+	// Update decisions for many clients at once (server-side gateways), see sparkle_appcast_decide
+	// Every field is an array of [count] elements, optional ones may be NULL
+	//
+	struct SparkleClientColumns
+	{
+		int						count;
+		const char**			appVersions;	// current <sparkle:version> of every client
+		const char**			osNames;		// "windows", "linux" or a distribution id (e.g. "ubuntu")
+		const char**			osDistros;		// optional, distribution id (e.g. "ubuntu"), <sparkle:os> matches it or the name
+		const char**			osArchs;		// optional, "x86" / "x64" / "arm64"
+		const char**			osVersions;		// optional, dotted OS version, matched against <sparkle:minimumSystemVersion>
+		const unsigned long long* channelMasks;	// optional, bit N accepts channel N of the batch
+		const signed char*		rolloutGroups;	// optional, phased rollout group (0 ~ 6), -1 to ignore <sparkle:phasedRolloutInterval>
+	};
+
+	enum SparkleDecisionFlag
+	{
+		kDecisionInformational = 1,
+		kDecisionCritical = 2,
+		kDecisionAutoUpdate = 4
+	};
+
+	struct SparkleDecisionColumns
+	{
+		int*			itemIndex;		// selected item (see sparkle_appcast_item_info), -1 if there is no update
+		int*			enclosureIndex;	// selected enclosure of that item
+		unsigned int*	flags;			// SparkleDecisionFlag bits
+	};
+
 	struct SparkleCallbacks
 	{
 		void(SPARKLE_API_CC * sparkle_new_version_found)(const SparkleNewVersionInfo* appcast, void* userdata);
@@ -67,6 +100,44 @@ extern "C" {
 		int(SPARKLE_API_CC * sparkle_request_shutdown)(void* userdata);
 	};
 
+	//
+	// Receives downloaded data chunk by chunk, [data] is only valid during the call.
+	// Packages served encoded (see the README) arrive decoded, from the decoding thread
+	// @return: Non-zero to go on, zero to cancel the download
+	//
+	typedef int(SPARKLE_API_CC * SparkleStreamWriter)(const void* data, size_t size, void* userdata);
+
+	//
+	// Event loop integration, see sparkle_loop_attach
+	//
+#ifdef __WINDOWS__
+	typedef size_t SparkleSocket;	// SOCKET
+#else
+	typedef int SparkleSocket;
+#endif
+
+	// what to watch a socket for
+	enum SparkleWatch
+	{
+		kWatchNone = 0,
+		kWatchRead = 1,
+		kWatchWrite = 2,
+		kWatchReadWrite = 3,
+		kWatchRemove = 4
+	};
+
+	// what a socket is ready for
+	enum SparkleSocketReady
+	{
+		kSocketReadable = 1,
+		kSocketWritable = 2,
+		kSocketError = 4
+	};
+
+	typedef void(SPARKLE_API_CC * SparkleWatchSocket)(SparkleSocket socket, int watch, void* loopdata);
+	typedef void(SPARKLE_API_CC * SparkleSetTimer)(long timeoutMs, void* loopdata);
+	typedef void(SPARKLE_API_CC * SparkleAsyncDone)(int err, void* userdata);
+
 	enum SignAlgo
 	{
 		kNoSign,
@@ -85,9 +156,13 @@ extern "C" {
 	//						kDSA: it's a PEM format string
 	//						kEd25519 (EdDSA): it's base64 encoded key string
 	// @param appcastURL: URL reference to the appcast xml file
-	// @param sslCA: CA cert bundle file path, must be explicitly specified when using on non-windows platform and the Appcast URL has "https" scheme
+	// @param sslCA: CA cert bundle file path, must be explicitly specified when using on non-windows platform and the Appcast URL has "https" scheme,
+	//        https requests fail (rather than trust the system's store) if it can't be read or holds no certificate
 	// @return SparkleError code
 	// 
+	// #NOTE: only the shape of the public key is checked here, it's parsed on its first use,
+	// a key that looks right but can't be parsed fails the signature verification (kBadSignature)
+	// 
 	SPARKLE_API_DELC(int) sparkle_setup(
 		const SparkleCallbacks* callbacks, 
 		const char* appCurrentVer, 
@@ -96,6 +171,12 @@ extern "C" {
 		const char* signVerifyPubKey, 
 		const char* sslCA);
 
+	//
+	// Optional, parse the public key and initialize curl / OpenSSL (and load the CA bundle) on a background thread,
+	// so the first check doesn't pay for it. Call it after sparkle_setup, it returns immediately
+	// 
+	SPARKLE_API_DELC(void) sparkle_warm_up();
+
 	//
 	// Customize HTTP headers that sparkle will use to perform HTTP(s) requests
 	// 
@@ -112,6 +193,52 @@ extern "C" {
 	// 
 	SPARKLE_API_DELC(int) sparkle_set_http_proxy(const char* proxy);
 
+	//
+	// Tune how requests survive bad networks. Connect / first byte timeouts follow the latencies observed per host,
+	// transient failures are retried with a jittered exponential backoff and broken downloads go on from where they stopped
+	// 
+	// @param maxAttempts: Attempts per request, 1 disables retries (default 4)
+	// @param retryBaseMs: Delay before the first retry, doubled for every next one (default 500)
+	// @param retryCapMs: Upper bound of a retry delay (default 30000)
+	// @param lowSpeedBytesPerSec: A transfer slower than this for [lowSpeedSeconds] is a stall, 0 disables it (default 1024)
+	// @param lowSpeedSeconds: See [lowSpeedBytesPerSec] (default 30)
+	// @return SparkleError code
+	// 
+	SPARKLE_API_DELC(int) sparkle_set_retry_policy(
+		int maxAttempts,
+		unsigned int retryBaseMs,
+		unsigned int retryCapMs,
+		unsigned int lowSpeedBytesPerSec,
+		unsigned int lowSpeedSeconds);
+
+	//
+	// Serve requests under [urlPrefix] from a local directory (an offline bundle or a mirror), the files are mapped rather than copied
+	// "file://" URLs are always served this way once a mirror is set
+	// 
+	// @param urlPrefix: URL prefix to redirect, e.g. "https://example.com/updates/"
+	// @param localDir: Directory that mirrors [urlPrefix]
+	// @return SparkleError code
+	// 
+	SPARKLE_API_DELC(int) sparkle_set_local_mirror(const char* urlPrefix, const char* localDir);
+
+	//
+	// State the formats to download when an update has several enclosures for this OS. The enclosure built for this
+	// architecture is taken first, then the one whose format comes first in [formats], then the smallest one (by its length)
+	// 
+	// @param formats: MIME types ("application/zstd") or URL suffixes (".msi"), most wanted first
+	// @param formatCount: Count of [formats], 0 to go by architecture & size only
+	// @return SparkleError code
+	// 
+	SPARKLE_API_DELC(int) sparkle_set_enclosure_preference(const char** formats, int formatCount);
+
+	//
+	// Resolve the items of a large xml appcast on several threads, the outcome is the same as on one.
+	// Only feeds of thousands of items gain from it
+	// 
+	// @param threads: Threads to use, 0 for one per core (default 1)
+	// 
+	SPARKLE_API_DELC(void) sparkle_set_appcast_parse_threads(unsigned int threads);
+
 	//
 	// Clean current update information cache if exists
 	// 
@@ -131,6 +258,78 @@ extern "C" {
 		int acceptChannelCount,
 		void* userdata);
 
+	//
+	// Select the update again from the appcast fetched by the last sparkle_check_update, without any network access,
+	// e.g. for other channels or another language. [sparkle_new_version_found] is called the same way.
+	// #NOTE: kNotReady if nothing was fetched yet (or it was a binary appcast)
+	// 
+	// @param prepferLang: Same as sparkle_check_update
+	// @param acceptChannels: Same as sparkle_check_update
+	// @param acceptChannelCount: Count of [acceptChannels]
+	// @param userdata: custom userdata used in callbacks
+	// 
+	SPARKLE_API_DELC(int) sparkle_requery_update(
+		const char* preferLang,
+		const char** acceptChannels,
+		int acceptChannelCount,
+		void* userdata);
+
+	//
+	// Check new update periodically on a background thread, failed checks are retried with a jittered exponential backoff
+	// #NOTE: [sparkle_new_version_found] will be called on that background thread
+	// 
+	// @param intervalSeconds: Interval between two successful checks, it's randomized by 10% and stretched by the "Cache-Control: max-age" of the appcast response
+	// @param startupDelaySeconds: The first check is deferred by a random delay in [startupDelaySeconds, 2 * startupDelaySeconds]
+	// @param prepferLang: Same as sparkle_check_update
+	// @param acceptChannels: Same as sparkle_check_update
+	// @param acceptChannelCount: Count of [acceptChannels]
+	// @param userdata: custom userdata used in callbacks
+	// @return SparkleError code
+	// 
+	SPARKLE_API_DELC(int) sparkle_start_scheduled_check(
+		unsigned int intervalSeconds,
+		unsigned int startupDelaySeconds,
+		const char* preferLang,
+		const char** acceptChannels,
+		int acceptChannelCount,
+		void* userdata);
+
+	//
+	// Stop the periodic check started by sparkle_start_scheduled_check, it waits for an ongoing check to complete
+	// 
+	SPARKLE_API_DELC(void) sparkle_stop_scheduled_check();
+
+	//
+	// Get told about new updates instead of polling: a connection to [notifyURL] is kept open on a background thread,
+	// and the appcast is checked (conditionally) as soon as the server says it changed. Lost connections are re-established
+	// with a jittered exponential backoff. It can run along with sparkle_start_scheduled_check as a fallback
+	// #NOTE: [sparkle_new_version_found] will be called on a background thread
+	// 
+	// The server answers either with server-sent events (Content-Type: text/event-stream), where an "appcast-changed"
+	// (or unnamed) event means a change and comments serve as heartbeats, or as a long poll: holding the request until
+	// the appcast changes (200), or answering 204 when nothing did
+	// 
+	// @param notifyURL: URL of the notification stream
+	// @param idleTimeoutSeconds: The connection is considered dead after that long without a byte, 0 for the default (90)
+	// @param prepferLang: Same as sparkle_check_update
+	// @param acceptChannels: Same as sparkle_check_update
+	// @param acceptChannelCount: Count of [acceptChannels]
+	// @param userdata: custom userdata used in callbacks
+	// @return SparkleError code
+	// 
+	SPARKLE_API_DELC(int) sparkle_start_push_channel(
+		const char* notifyURL,
+		unsigned int idleTimeoutSeconds,
+		const char* preferLang,
+		const char** acceptChannels,
+		int acceptChannelCount,
+		void* userdata);
+
+	//
+	// Close the push channel, it waits for an ongoing check to complete
+	// 
+	SPARKLE_API_DELC(void) sparkle_stop_push_channel();
+
 	//
 	// Download current update package to the destination file
 	// 
@@ -147,6 +346,228 @@ extern "C" {
 	// 
 	SPARKLE_API_DELC(int) sparkle_download_to_buffer(void* buffer, size_t* bufferSize, void* userdata);
 
+	//
+	// Download current update package into memory only (a sealed memfd, Linux only), and verify it signature there.
+	// sparkle_install then executes it straight from memory, the installer also inherits it as a file descriptor
+	// whose number is in the SPARKLE_PACKAGE_FD environment variable
+	// #NOTE: The sealed package can't be modified after it's been verified, kFail where it isn't supported
+	// @param userdata: custom userdata used in callbacks
+	// 
+	SPARKLE_API_DELC(int) sparkle_download_to_memory(void* userdata);
+
+	//
+	// Download current update package chunk by chunk to a user-defined writer (and verify it signature on the fly)
+	// #NOTE: The package is only trustworthy when kNoError is returned, otherwise discard everything the writer received
+	// 
+	// @param writer: Called with every received chunk, without copying it
+	// @param userdata: custom userdata used in callbacks (and [writer])
+	// @return SparkleError code, kBadSignature if the signature doesn't match
+	// 
+	SPARKLE_API_DELC(int) sparkle_download_to_stream(SparkleStreamWriter writer, void* userdata);
+
+	//
+	// Download current update package (a .tar, .tar.gz, .tar.zst or .zip archive) and extract it while downloading
+	// #NOTE: Files are extracted into a "<dstDir>.<random>.staging" sibling first, which replaces [dstDir] only after the signature
+	//        is verified, and is removed on any failure. The replacement is atomic on Linux, on Windows [dstDir] is missing for
+	//        a moment (the old one is renamed to "<dstDir>.<random>.old" first)
+	// 
+	// @param dstDir: An absolute directory path the package will be extracted to
+	// @param userdata: custom userdata used in callbacks
+	// @return SparkleError code, kCancel if the progress callback canceled it
+	// 
+	SPARKLE_API_DELC(int) sparkle_download_and_extract(const char* dstDir, void* userdata);
+
+	//
+	// Drive checks & downloads from the host's own event loop (epoll, kqueue, libuv...) instead of blocking calls,
+	// no thread is created, every callback runs inside sparkle_loop_socket_action / sparkle_loop_timeout
+	// #NOTE: Call every sparkle_loop_* and *_async function on the loop thread
+	// 
+	// @param watchSocket: Start/stop watching a socket, [watch] is a SparkleWatch value (kWatchRemove to forget it)
+	// @param setTimer: (Re)arm the one timer, call sparkle_loop_timeout when it expires, -1 cancels it
+	// @param loopdata: Passed to [watchSocket] & [setTimer]
+	// @return SparkleError code
+	// 
+	SPARKLE_API_DELC(int) sparkle_loop_attach(SparkleWatchSocket watchSocket, SparkleSetTimer setTimer, void* loopdata);
+
+	//
+	// Detach the event loop, ongoing checks & downloads are dropped without completing
+	// #NOTE: Not from within a SparkleAsyncDone
+	// 
+	SPARKLE_API_DELC(void) sparkle_loop_detach();
+
+	//
+	// Report that a watched socket is ready
+	// 
+	// @param socket: The socket
+	// @param ready: SparkleSocketReady bits
+	// 
+	SPARKLE_API_DELC(void) sparkle_loop_socket_action(SparkleSocket socket, int ready);
+
+	//
+	// Report that the timer armed by [setTimer] expired
+	// 
+	SPARKLE_API_DELC(void) sparkle_loop_timeout();
+
+	//
+	// sparkle_check_update on the attached event loop
+	// #NOTE: [done] is called exactly once if kNoError is returned, maybe even before returning (e.g. served by the shared cache)
+	// 
+	// @param done: Receives the SparkleError code sparkle_check_update would return
+	// @return SparkleError code
+	// 
+	SPARKLE_API_DELC(int) sparkle_check_update_async(
+		const char* preferLang,
+		const char** acceptChannels,
+		int acceptChannelCount,
+		void* userdata,
+		SparkleAsyncDone done);
+
+	//
+	// sparkle_download_to_file on the attached event loop, the signature is verified before [done] is called
+	// 
+	// @param done: Receives the SparkleError code sparkle_download_to_file would return
+	// @return SparkleError code
+	// 
+	SPARKLE_API_DELC(int) sparkle_download_to_file_async(const char* dstFile, void* userdata, SparkleAsyncDone done);
+
+	//
+	// Enable the LAN peer cache, verified packages are served to other machines and fetched from them before the origin,
+	// packages from peers are verified against the appcast signature as usual (unsigned packages never go through peers)
+	// 
+	// @param servePort: TCP port to serve verified packages on, 0 means fetch from peers only
+	// @param peers: An optional array of peer addresses ("host:port")
+	// @param peerCount: Count of [peers]
+	// @param useMulticast: Non-zero to discover peers through local multicast
+	// @return SparkleError code
+	// 
+	SPARKLE_API_DELC(int) sparkle_enable_peer_cache(
+		unsigned short servePort,
+		const char** peers,
+		int peerCount,
+		int useMulticast);
+
+	//
+	// Disable the LAN peer cache
+	// 
+	SPARKLE_API_DELC(void) sparkle_disable_peer_cache();
+
+	//
+	// Share fetched appcasts between all processes on this machine through a cache directory,
+	// only one of them asks the server (conditionally) per [ttlSeconds], the others read the cached response
+	// 
+	// @param cacheDir: Directory writable by every process sharing the cache
+	// @param ttlSeconds: How long a cached appcast is used without revalidating it, "Cache-Control: max-age" can extend it
+	// @return SparkleError code
+	// 
+	SPARKLE_API_DELC(int) sparkle_enable_shared_cache(const char* cacheDir, unsigned int ttlSeconds);
+
+	//
+	// Disable the machine-wide appcast cache
+	// 
+	SPARKLE_API_DELC(void) sparkle_disable_shared_cache();
+
+	//
+	// Answer sparkle_check_update from the last decision for the same language, channels and app version,
+	// for [ttlSeconds] without any network access. After that the last decision is still answered at once
+	// while it's checked again in background, sparkle_new_version_found is called again (from another thread) only if it changed,
+	// with a NULL appcast if the update told about is gone. That call gets the userdata of the sparkle_check_update that
+	// started it, which must stay valid until sparkle_clean returns, pass a long-lived context (or NULL) while the cache is enabled
+	// 
+	// @param ttlSeconds: How long a decision is answered without checking it again, must not be 0
+	// @return SparkleError code
+	// 
+	SPARKLE_API_DELC(int) sparkle_enable_decision_cache(unsigned int ttlSeconds);
+
+	//
+	// Disable the decision cache, every sparkle_check_update asks the server again
+	// 
+	SPARKLE_API_DELC(void) sparkle_disable_decision_cache();
+
+	//
+	// Load an appcast for bulk decisions, independent of sparkle_setup, its items are resolved on all cores
+	// 
+	// @param xml: Appcast xml content
+	// @param size: Size of [xml]
+	// @param appcast: Receives the loaded appcast, release it with sparkle_appcast_free
+	// @return SparkleError code
+	// 
+	SPARKLE_API_DELC(int) sparkle_appcast_load(const char* xml, size_t size, void** appcast);
+
+	//
+	// Decide the update of every client with the same rules sparkle_check_update uses, on all cores
+	// 
+	// @param appcast: Loaded by sparkle_appcast_load
+	// @param channelNames: Non-default channels the client masks refer to, at most 64
+	// @param channelCount: Count of [channelNames]
+	// @param formats: Preferred enclosure formats for every client, as for sparkle_set_enclosure_preference
+	// @param formatCount: Count of [formats], 0 to go by architecture & size only
+	// @param now: Seconds since the epoch, for phased rollouts
+	// @param clients: Client descriptors
+	// @param decisions: Receives the decisions, arrays of [clients->count] elements
+	// @param threads: Worker threads, 0 for one per core
+	// @return SparkleError code
+	// 
+	SPARKLE_API_DELC(int) sparkle_appcast_decide(
+		void* appcast,
+		const char** channelNames,
+		int channelCount,
+		const char** formats,
+		int formatCount,
+		long long now,
+		const SparkleClientColumns* clients,
+		SparkleDecisionColumns* decisions,
+		int threads);
+
+	//
+	// Details of a decided item, the strings live as long as [appcast]
+	// #NOTE: [isInformaional] and [isCritical] depend on the client, take them from the decision flags
+	// 
+	// @param appcast: Loaded by sparkle_appcast_load
+	// @param itemIndex: SparkleDecisionColumns::itemIndex
+	// @param enclosureIndex: SparkleDecisionColumns::enclosureIndex
+	// @param preferLang: Two-letter lang code (ISO-639) of the description & release note
+	// @param info: Receives the details
+	// @return SparkleError code
+	// 
+	SPARKLE_API_DELC(int) sparkle_appcast_item_info(
+		void* appcast,
+		int itemIndex,
+		int enclosureIndex,
+		const char* preferLang,
+		SparkleNewVersionInfo* info);
+
+	//
+	// Release an appcast loaded by sparkle_appcast_load
+	// 
+	SPARKLE_API_DELC(void) sparkle_appcast_free(void* appcast);
+
+	//
+	// Keep the selected update and the downloaded package (with a memo of its verification) in [stateFile],
+	// and resume from what an earlier run of the same app version left there: when its package is still
+	// the very file verified then, the update is notified again and sparkle_install can run it without any download or full re-hash
+	// 
+	// @param stateFile: Path of the state file, its directory is created if needed
+	// @param userdata: custom userdata used in callbacks
+	// @return kNoError if a verified package is ready to install, kNoUpdateFound if there is nothing to resume, or SparkleError code
+	// 
+	SPARKLE_API_DELC(int) sparkle_enable_session_state(const char* stateFile, void* userdata);
+
+	//
+	// Stop keeping the session state, the state file is left as it is
+	// 
+	SPARKLE_API_DELC(void) sparkle_disable_session_state();
+
+	//
+	// Go through the update agent shared by all apps on this machine (tools/sparkleagent.cpp): sparkle_check_update is
+	// answered by it, and sparkle_download_to_memory receives the package it downloaded and verified as a file descriptor,
+	// so an update shared by many apps is fetched and verified once. Checks go direct while the agent can't be reached
+	// #NOTE: Linux only, everything goes direct elsewhere
+	// 
+	// @param socketPath: The agent's Unix domain socket, NULL to go direct again
+	// @return SparkleError code
+	// 
+	SPARKLE_API_DELC(int) sparkle_use_agent(const char* socketPath);
+
 	//
 	// Install current update package
 	// @param overrideArgs: An optional parameter that explicitly specify the update package startup argument string, 
@@ -0,0 +1,75 @@
+//
+// appcast2bin: convert an RSS (Sparkle) appcast into the compact binary appcast
+//
+// usage: appcast2bin <appcast.xml> <appcast.bin>
+//
+// Serve the output with "Content-Type: application/vnd.sparkle-lite.appcast", sparkle-lite clients
+// ask for it through the Accept header and fall back to the xml one otherwise.
+//
+#include "../impl/appcast_binary.h"
+#include "../impl/appcast_parser.h"
+#include <cstdio>
+#include <string>
+
+static bool ReadWholeFile(const char *fileName, std::string &content) {
+	FILE *fd = nullptr;
+	if (fopen_s(&fd, fileName, "rb") != 0) {
+		return false;
+	}
+	char buf[64 * 1024];
+	while (auto n = fread(buf, 1, sizeof(buf), fd)) {
+		content.append(buf, n);
+	}
+	fclose(fd);
+	return true;
+}
+
+static bool WriteWholeFile(const char *fileName, const std::string &content) {
+	FILE *fd = nullptr;
+	if (fopen_s(&fd, fileName, "wb") != 0) {
+		return false;
+	}
+	auto ok = fwrite(content.data(), 1, content.size(), fd) == content.size();
+	fclose(fd);
+	return ok;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s <appcast.xml> <appcast.bin>\n", argv[0]);
+		return 1;
+	}
+
+	std::string xml;
+	if (!ReadWholeFile(argv[1], xml)) {
+		fprintf(stderr, "can't read %s\n", argv[1]);
+		return 1;
+	}
+
+	auto appcast = SparkleLite::ParseAppcastXML(xml, 0);
+	if (appcast.items.empty()) {
+		fprintf(stderr, "%s is not a valid appcast\n", argv[1]);
+		return 1;
+	}
+
+	auto bin = SparkleLite::SerializeAppcastBinary(appcast);
+	if (bin.empty()) {
+		fprintf(stderr, "appcast is too large to encode\n");
+		return 1;
+	}
+
+	// make sure the loader accepts what we produced
+	SparkleLite::BinaryAppcast check;
+	if (!check.Load(std::string(bin)) || check.ItemCount() != appcast.items.size()) {
+		fprintf(stderr, "encoded appcast doesn't validate\n");
+		return 1;
+	}
+
+	if (!WriteWholeFile(argv[2], bin)) {
+		fprintf(stderr, "can't write %s\n", argv[2]);
+		return 1;
+	}
+
+	printf("%zu items, %zu bytes xml -> %zu bytes binary\n", appcast.items.size(), xml.size(), bin.size());
+	return 0;
+}
@@ -0,0 +1,891 @@
+//
+// loadharness: drive many concurrent update sessions against a local server that emulates bad networks
+//
+// usage: loadharness [options]
+//	--sessions N		concurrent SparkleManager sessions (default 32)
+//	--rounds N			check + download rounds per session (default 1)
+//	--items N			items of the generated appcast (default 50)
+//	--package-size B	size of the signed package (default 4194304)
+//	--binary			serve the binary appcast instead of the xml one
+//	--stream			download to a stream (memory) instead of a file
+//	--tls				serve https with a generated certificate
+//	--tls-delay MS		hold every TLS handshake for MS milliseconds
+//	--latency MS		delay before the first byte of every response
+//	--jitter MS			random extra delay in [0, MS] on top of --latency
+//	--bandwidth B		bytes per second per connection, 0 for unlimited (default 0)
+//	--reset P			probability (0 ~ 1) of a response reset (RST) midway
+//	--truncate P		probability of a response closed (FIN) before its Content-Length
+//	--seed N			seed of the fault injection
+//	--peer-check		instead of the sessions: one downloads from the server and serves the package
+//						to another one through the peer cache on loopback
+//	--push-check		instead of the sessions: one follows the server-sent events of /events, a burst of them
+//						must be a single check or two, and the reconnect must carry the last event id
+//
+// Reports the percentiles of the time to decision (the check), the download throughput
+// and the CPU time spent per downloaded MB by the session threads (the server isn't accounted).
+//
+#include "../impl/appcast_binary.h"
+#include "../impl/simple_http.h"
+#include "../impl/sparkle_manager.h"
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+using socket_t = SOCKET;
+#define INVALID_SOCK INVALID_SOCKET
+#define close_socket closesocket
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+using socket_t = int;
+#define INVALID_SOCK (-1)
+#define close_socket close
+#endif
+
+using namespace SparkleLite;
+using Clock = std::chrono::steady_clock;
+
+#define HARNESS_APP_VERSION ("1.0")
+#define HARNESS_CHUNK_SIZE (16 * 1024)
+#define HARNESS_PEER_PORT (18779)
+#define HARNESS_EVENT_BURST (20) // events sent at once on the first /events connection
+
+struct HarnessOptions {
+	int sessions = 32;
+	int rounds = 1;
+	int items = 50;
+	size_t packageSize = 4 * 1024 * 1024;
+	bool binary = false;
+	bool stream = false;
+	bool tls = false;
+	int tlsDelayMs = 0;
+	int latencyMs = 0;
+	int jitterMs = 0;
+	uint64_t bandwidth = 0;
+	double resetRatio = 0;
+	double truncateRatio = 0;
+	unsigned seed = 1;
+	bool peerCheck = false;
+	bool pushCheck = false;
+};
+
+//
+// what the sessions are served
+//
+struct HarnessContent {
+	std::string package;
+	std::string signature; // base64 Ed25519
+	std::string pubKey; // base64 raw Ed25519 public key
+	std::string appcast;
+	std::string appcastType;
+	std::string caFile; // the certificate to trust with --tls
+	SSL_CTX *sslCtx = nullptr;
+};
+
+struct ServerCounters {
+	std::atomic<uint64_t> requests{ 0 };
+	std::atomic<uint64_t> ranged{ 0 };
+	std::atomic<uint64_t> resets{ 0 };
+	std::atomic<uint64_t> truncations{ 0 };
+	std::atomic<uint64_t> bytes{ 0 };
+	std::atomic<uint64_t> appcasts{ 0 };
+	std::atomic<uint64_t> packages{ 0 };
+	std::atomic<uint64_t> streams{ 0 };
+	std::atomic<long long> lastEventId{ -1 }; // as sent back by the last /events connection
+};
+
+static std::string Base64(const void *data, size_t size) {
+	std::string out(4 * ((size + 2) / 3) + 1, '\0');
+	auto len = EVP_EncodeBlock((unsigned char *)&out[0], (const unsigned char *)data, (int)size);
+	out.resize(len);
+	return out;
+}
+
+//
+// a random package signed by a fresh Ed25519 key
+//
+static bool MakePackage(HarnessContent &content, size_t size, unsigned seed) {
+	std::mt19937_64 rng(seed);
+	content.package.resize(size);
+	for (size_t idx = 0; idx < size; idx += sizeof(uint64_t)) {
+		auto v = rng();
+		memcpy(&content.package[idx], &v, std::min(sizeof(v), size - idx));
+	}
+
+	auto pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_ED25519, nullptr);
+	EVP_PKEY *key = nullptr;
+	if (!pctx || EVP_PKEY_keygen_init(pctx) != 1 || EVP_PKEY_keygen(pctx, &key) != 1) {
+		EVP_PKEY_CTX_free(pctx);
+		return false;
+	}
+	EVP_PKEY_CTX_free(pctx);
+
+	unsigned char rawPub[32];
+	size_t rawPubLen = sizeof(rawPub);
+	unsigned char sig[64];
+	size_t sigLen = sizeof(sig);
+	auto mctx = EVP_MD_CTX_new();
+	auto ok = EVP_PKEY_get_raw_public_key(key, rawPub, &rawPubLen) == 1 &&
+			EVP_DigestSignInit(mctx, nullptr, nullptr, nullptr, key) == 1 &&
+			EVP_DigestSign(mctx, sig, &sigLen, (const unsigned char *)content.package.data(), content.package.size()) == 1;
+	EVP_MD_CTX_free(mctx);
+	EVP_PKEY_free(key);
+	if (!ok) {
+		return false;
+	}
+	content.pubKey = Base64(rawPub, rawPubLen);
+	content.signature = Base64(sig, sigLen);
+	return true;
+}
+
+static void MakeAppcast(HarnessContent &content, const HarnessOptions &opts, const std::string &baseUrl) {
+	Appcast appcast;
+	appcast.title = "harness";
+	for (int idx = opts.items; idx > 0; idx--) {
+		AppcastItem item;
+		item.version = "1." + std::to_string(idx);
+		item.title = "Version " + item.version;
+		item.pubDate = "Mon, 02 Jan 2023 15:04:05 +0000";
+		item.description[LangCode("en")] = "Load harness build " + item.version;
+		if (idx % 7 == 0) {
+			item.channel = "beta";
+		}
+
+		AppcastEnclosure enclosure;
+		enclosure.url = baseUrl + "/pkg/" + item.version + ".bin";
+		enclosure.signType = SignatureAlgo::kEd25519;
+		enclosure.signature = content.signature;
+		enclosure.size = content.package.size();
+		enclosure.mime = "application/octet-stream";
+		item.enclosures.push_back(enclosure);
+		appcast.items.push_back(std::move(item));
+	}
+
+	if (opts.binary) {
+		content.appcast = SerializeAppcastBinary(appcast);
+		content.appcastType = BINARY_APPCAST_MIME;
+		return;
+	}
+
+	auto &xml = content.appcast;
+	xml = "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+		  "<rss version=\"2.0\" xmlns:sparkle=\"http://www.andymatuschak.org/xml-namespaces/sparkle\">\n"
+		  "<channel>\n<title>harness</title>\n";
+	for (const auto &item : appcast.items) {
+		const auto &enclosure = item.enclosures.front();
+		xml += "<item>\n<title>" + item.title + "</title>\n";
+		xml += "<pubDate>" + item.pubDate + "</pubDate>\n";
+		xml += "<sparkle:version>" + item.version + "</sparkle:version>\n";
+		if (!item.channel.empty()) {
+			xml += "<sparkle:channel>" + item.channel + "</sparkle:channel>\n";
+		}
+		xml += "<description xml:lang=\"en\">" + item.description.begin()->second + "</description>\n";
+		xml += "<enclosure url=\"" + enclosure.url + "\" length=\"" + std::to_string(enclosure.size) +
+				"\" type=\"" + enclosure.mime + "\" sparkle:edSignature=\"" + enclosure.signature + "\"/>\n";
+		xml += "</item>\n";
+	}
+	xml += "</channel>\n</rss>\n";
+	content.appcastType = "application/rss+xml";
+}
+
+//
+// a self-signed certificate for 127.0.0.1, written to [caFile] for the sessions to trust
+//
+static bool MakeTLSContext(HarnessContent &content) {
+	auto pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+	EVP_PKEY *key = nullptr;
+	if (!pctx || EVP_PKEY_keygen_init(pctx) != 1 ||
+			EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1) != 1 ||
+			EVP_PKEY_keygen(pctx, &key) != 1) {
+		EVP_PKEY_CTX_free(pctx);
+		return false;
+	}
+	EVP_PKEY_CTX_free(pctx);
+
+	auto cert = X509_new();
+	X509_set_version(cert, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+	X509_gmtime_adj(X509_getm_notBefore(cert), -3600);
+	X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 3600);
+	X509_set_pubkey(cert, key);
+	auto name = X509_get_subject_name(cert);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)"127.0.0.1", -1, -1, 0);
+	X509_set_issuer_name(cert, name);
+
+	X509V3_CTX v3;
+	X509V3_set_ctx(&v3, cert, cert, nullptr, nullptr, 0);
+	for (auto [nid, value] : { std::pair<int, const char *>{ NID_subject_alt_name, "IP:127.0.0.1" }, { NID_basic_constraints, "critical,CA:TRUE" } }) {
+		auto ext = X509V3_EXT_conf_nid(nullptr, &v3, nid, value);
+		if (ext) {
+			X509_add_ext(cert, ext, -1);
+			X509_EXTENSION_free(ext);
+		}
+	}
+	X509_sign(cert, key, EVP_sha256());
+
+	content.sslCtx = SSL_CTX_new(TLS_server_method());
+	auto ok = content.sslCtx &&
+			SSL_CTX_use_certificate(content.sslCtx, cert) == 1 &&
+			SSL_CTX_use_PrivateKey(content.sslCtx, key) == 1;
+
+	// the sessions read it through sparkle_setup's sslCA
+	FILE *fd = nullptr;
+	content.caFile = "loadharness-ca.pem";
+	if (ok && fopen_s(&fd, content.caFile.c_str(), "wb") == 0) {
+		ok = PEM_write_X509(fd, cert) == 1;
+		fclose(fd);
+	} else {
+		ok = false;
+	}
+	X509_free(cert);
+	EVP_PKEY_free(key);
+	return ok;
+}
+
+//
+// one accepted connection, plain or TLS
+//
+class HarnessConnection {
+public:
+	HarnessConnection(socket_t s, SSL *ssl) :
+			s_(s), ssl_(ssl) {
+	}
+
+	~HarnessConnection() {
+		if (ssl_) {
+			SSL_free(ssl_);
+		}
+		close_socket(s_);
+	}
+
+	bool Send(const char *data, size_t len) {
+		while (len) {
+			auto sent = ssl_ ? SSL_write(ssl_, data, (int)len) : (int)send(s_, data, (int)len, 0);
+			if (sent <= 0) {
+				return false;
+			}
+			data += sent;
+			len -= sent;
+		}
+		return true;
+	}
+
+	int Recv(char *buf, size_t size) {
+		return ssl_ ? SSL_read(ssl_, buf, (int)size) : (int)recv(s_, buf, (int)size, 0);
+	}
+
+	// RST rather than FIN, like a middlebox dropping the connection
+	void Reset() {
+		struct linger lg = { 1, 0 };
+		setsockopt(s_, SOL_SOCKET, SO_LINGER, (const char *)&lg, sizeof(lg));
+	}
+
+private:
+	socket_t s_;
+	SSL *ssl_;
+};
+
+class HarnessServer {
+public:
+	HarnessServer(const HarnessOptions &opts, const HarnessContent &content, ServerCounters &counters) :
+			opts_(opts), content_(content), counters_(counters) {
+	}
+
+	~HarnessServer() {
+		Stop();
+	}
+
+	bool Start() {
+		listener_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (listener_ == INVALID_SOCK) {
+			return false;
+		}
+		sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t len = sizeof(addr);
+		if (bind(listener_, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+				listen(listener_, SOMAXCONN) != 0 ||
+				getsockname(listener_, (sockaddr *)&addr, &len) != 0) {
+			return false;
+		}
+		port_ = ntohs(addr.sin_port);
+		acceptor_ = std::thread(&HarnessServer::Accept, this);
+		return true;
+	}
+
+	void Stop() {
+		if (listener_ == INVALID_SOCK) {
+			return;
+		}
+		stopping_ = true;
+#ifdef _WIN32
+		closesocket(listener_);
+#else
+		shutdown(listener_, SHUT_RDWR);
+		close(listener_);
+#endif
+		listener_ = INVALID_SOCK;
+		if (acceptor_.joinable()) {
+			acceptor_.join();
+		}
+		// wake up the workers waiting on idle keep-alive connections
+		std::vector<std::thread> workers;
+		{
+			std::unique_lock<std::mutex> lck(lock_);
+			for (auto s : connections_) {
+#ifdef _WIN32
+				shutdown(s, SD_BOTH);
+#else
+				shutdown(s, SHUT_RDWR);
+#endif
+			}
+			workers.swap(workers_);
+		}
+		for (auto &worker : workers) {
+			worker.join();
+		}
+	}
+
+	unsigned short Port() const {
+		return port_;
+	}
+
+private:
+	void Accept() {
+		unsigned connections = 0;
+		while (!stopping_) {
+			auto s = accept(listener_, nullptr, nullptr);
+			if (s == INVALID_SOCK) {
+				continue;
+			}
+			int one = 1;
+			setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char *)&one, sizeof(one));
+
+			std::unique_lock<std::mutex> lck(lock_);
+			connections_.push_back(s);
+			workers_.emplace_back(&HarnessServer::Serve, this, s, opts_.seed + connections++);
+		}
+	}
+
+	void Serve(socket_t s, unsigned seed) {
+		Talk(s, seed);
+
+		std::unique_lock<std::mutex> lck(lock_);
+		connections_.erase(std::find(connections_.begin(), connections_.end(), s));
+	}
+
+	void Talk(socket_t s, unsigned seed) {
+		std::mt19937 rng(seed);
+		SSL *ssl = content_.sslCtx ? SSL_new(content_.sslCtx) : nullptr;
+		HarnessConnection conn(s, ssl);
+		if (ssl) {
+			// a slow TLS terminator
+			if (opts_.tlsDelayMs) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(opts_.tlsDelayMs));
+			}
+			SSL_set_fd(ssl, (int)s);
+			if (SSL_accept(ssl) != 1) {
+				return;
+			}
+		}
+
+		std::string pending;
+		char buf[8 * 1024];
+		while (!stopping_) {
+			// a request head, bodies are never sent to us
+			auto end = pending.find("\r\n\r\n");
+			while (end == std::string::npos) {
+				auto n = conn.Recv(buf, sizeof(buf));
+				if (n <= 0) {
+					return;
+				}
+				pending.append(buf, n);
+				end = pending.find("\r\n\r\n");
+			}
+			auto head = pending.substr(0, end + 2);
+			pending.erase(0, end + 4);
+			if (!Respond(conn, head, rng)) {
+				return;
+			}
+		}
+	}
+
+	static std::string HeaderValue(const std::string &head, const char *key) {
+		auto keyLen = strlen(key);
+		size_t pos = 0;
+		while ((pos = head.find("\r\n", pos)) != std::string::npos) {
+			pos += 2;
+			if (strncasecmp(head.c_str() + pos, key, keyLen) == 0 && head[pos + keyLen] == ':') {
+				auto begin = head.find_first_not_of(' ', pos + keyLen + 1);
+				auto end = head.find("\r\n", begin);
+				return head.substr(begin, end - begin);
+			}
+		}
+		return {};
+	}
+
+	// false to drop the connection
+	bool Respond(HarnessConnection &conn, const std::string &head, std::mt19937 &rng) {
+		counters_.requests++;
+		auto pathBegin = head.find(' ') + 1;
+		auto path = head.substr(pathBegin, head.find(' ', pathBegin) - pathBegin);
+
+		if (path == "/events") {
+			return RespondEvents(conn, head);
+		}
+
+		const std::string *body = nullptr;
+		std::string type;
+		const char *etag = nullptr;
+		if (path.compare(0, 8, "/appcast") == 0) {
+			body = &content_.appcast;
+			type = content_.appcastType;
+			etag = "\"harness-appcast\"";
+			counters_.appcasts++;
+		} else if (path.compare(0, 5, "/pkg/") == 0) {
+			body = &content_.package;
+			type = "application/octet-stream";
+			etag = "\"harness-package\"";
+			counters_.packages++;
+		}
+
+		auto latency = opts_.latencyMs + (opts_.jitterMs ? (int)(rng() % (opts_.jitterMs + 1)) : 0);
+		if (latency) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(latency));
+		}
+
+		if (!body) {
+			const char notFound[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+			return conn.Send(notFound, sizeof(notFound) - 1);
+		}
+
+		// resuming, only for the very same entity
+		size_t offset = 0;
+		auto range = HeaderValue(head, "Range");
+		auto ifRange = HeaderValue(head, "If-Range");
+		if (strncmp(range.c_str(), "bytes=", 6) == 0 && (ifRange.empty() || ifRange == etag)) {
+			offset = std::min<size_t>(std::strtoull(range.c_str() + 6, nullptr, 10), body->size());
+			counters_.ranged++;
+		}
+
+		std::string respHead = offset ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n";
+		respHead += "Content-Type: " + type + "\r\n";
+		respHead += "Content-Length: " + std::to_string(body->size() - offset) + "\r\n";
+		if (offset) {
+			respHead += "Content-Range: bytes " + std::to_string(offset) + "-" + std::to_string(body->size() - 1) + "/" + std::to_string(body->size()) + "\r\n";
+		}
+		respHead += std::string("ETag: ") + etag + "\r\nAccept-Ranges: bytes\r\n";
+		respHead += "\r\n";
+		if (!conn.Send(respHead.data(), respHead.size())) {
+			return false;
+		}
+
+		// where this response breaks, if it does
+		std::uniform_real_distribution<double> dice(0, 1);
+		auto roll = dice(rng);
+		auto cutAt = body->size();
+		bool reset = false;
+		if (roll < opts_.resetRatio || roll < opts_.resetRatio + opts_.truncateRatio) {
+			reset = roll < opts_.resetRatio;
+			cutAt = offset + (body->size() - offset) * dice(rng);
+		}
+
+		// paced against a fixed schedule, so the bandwidth holds whatever the chunk timing
+		auto begin = Clock::now();
+		auto sent = offset;
+		while (sent < cutAt) {
+			auto size = std::min<size_t>(HARNESS_CHUNK_SIZE, cutAt - sent);
+			if (opts_.bandwidth) {
+				std::this_thread::sleep_until(begin + std::chrono::microseconds((sent - offset + size) * 1000000ull / opts_.bandwidth));
+			}
+			if (!conn.Send(body->data() + sent, size)) {
+				return false;
+			}
+			sent += size;
+			counters_.bytes += size;
+		}
+		if (cutAt < body->size()) {
+			if (reset) {
+				counters_.resets++;
+				conn.Reset();
+			} else {
+				counters_.truncations++;
+			}
+			return false;
+		}
+		return true;
+	}
+
+	// the first connection gets a burst of changes, the later ones a heartbeat only, every one is closed after
+	bool RespondEvents(HarnessConnection &conn, const std::string &head) {
+		auto lastEventId = HeaderValue(head, "Last-Event-ID");
+		counters_.lastEventId = lastEventId.empty() ? -1 : std::strtoll(lastEventId.c_str(), nullptr, 10);
+
+		std::string resp = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n";
+		resp += "retry: 200\n\n";
+		if (++counters_.streams == 1) {
+			for (int idx = 1; idx <= HARNESS_EVENT_BURST; idx++) {
+				resp += "id: " + std::to_string(idx) + "\nevent: appcast-changed\ndata: " + std::to_string(idx) + "\n\n";
+			}
+		} else {
+			resp += ": ping\n\n";
+		}
+		conn.Send(resp.data(), resp.size());
+		return false;
+	}
+
+private:
+	const HarnessOptions &opts_;
+	const HarnessContent &content_;
+	ServerCounters &counters_;
+	socket_t listener_ = INVALID_SOCK;
+	unsigned short port_ = 0;
+	std::atomic<bool> stopping_{ false };
+	std::thread acceptor_;
+	std::mutex lock_;
+	std::vector<std::thread> workers_;
+	std::vector<socket_t> connections_;
+};
+
+//
+// the sessions
+//
+struct SessionSample {
+	double decisionMs = -1;
+	double downloadMBps = -1;
+	double cpuMsPerMB = -1;
+};
+
+struct HarnessSession {
+	uint64_t downloaded = 0;
+	bool found = false;
+};
+
+static double ThreadCpuMs() {
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+	auto ticks = (((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) + (((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime);
+	return ticks / 10000.0;
+#else
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+#endif
+}
+
+static double ElapsedMs(Clock::time_point since) {
+	return std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+}
+
+static void SPARKLE_API_CC OnNewVersionFound(const SparkleNewVersionInfo *, void *userdata) {
+	((HarnessSession *)userdata)->found = true;
+}
+
+static int SPARKLE_API_CC OnDownloadProgress(long long, long long have, void *userdata) {
+	((HarnessSession *)userdata)->downloaded += have;
+	return 1;
+}
+
+static int SPARKLE_API_CC OnRequestShutdown(void *) {
+	return 0;
+}
+
+static int SPARKLE_API_CC DiscardWriter(const void *, size_t, void *) {
+	return 1;
+}
+
+static void RunSession(int id, const HarnessOptions &opts, const HarnessContent &content, const std::string &baseUrl,
+		std::vector<SessionSample> &samples, std::map<int, unsigned> &errors, std::mutex &lock) {
+	SparkleManager mgr;
+	SparkleCallbacks callbacks = { OnNewVersionFound, OnDownloadProgress, OnRequestShutdown };
+	mgr.SetCallbacks(callbacks);
+	mgr.SetAppcastURL(baseUrl + "/appcast");
+	mgr.SetAppCurrentVersion(HARNESS_APP_VERSION);
+	mgr.SetSignatureVerifyParams(SignatureAlgo::kEd25519, content.pubKey);
+	auto dstFile = "loadharness-" + std::to_string(id) + ".bin";
+
+	for (int round = 0; round < opts.rounds; round++) {
+		HarnessSession state;
+		SessionSample sample;
+		mgr.Clean();
+
+		auto begin = Clock::now();
+		auto err = mgr.CheckUpdate("en", {}, &state);
+		sample.decisionMs = ElapsedMs(begin);
+		if (err == SparkleError::kNoError) {
+			begin = Clock::now();
+			auto cpu = ThreadCpuMs();
+			err = opts.stream ? mgr.Dowload(DiscardWriter, &state) : mgr.Dowload(dstFile, &state);
+			auto ms = ElapsedMs(begin);
+			auto mb = state.downloaded / (1024.0 * 1024.0);
+			if (err == SparkleError::kNoError && mb > 0) {
+				sample.downloadMBps = mb * 1000 / std::max(ms, 0.001);
+				sample.cpuMsPerMB = (ThreadCpuMs() - cpu) / mb;
+			}
+		}
+
+		std::unique_lock<std::mutex> lck(lock);
+		samples.push_back(sample);
+		errors[err]++;
+	}
+	std::remove(dstFile.c_str());
+}
+
+//
+// the package of a session is served to the next one by its peer cache, the server sees a single download
+//
+static bool RunPeerCheck(const HarnessContent &content, const std::string &baseUrl, const ServerCounters &counters) {
+	SparkleManager seeder, leecher;
+	PeerCacheOptions seederOpts, leecherOpts;
+	seederOpts.port = HARNESS_PEER_PORT;
+	leecherOpts.peers.push_back("127.0.0.1:" + std::to_string(HARNESS_PEER_PORT));
+	if (seeder.EnablePeerCache(seederOpts) != SparkleError::kNoError ||
+			leecher.EnablePeerCache(leecherOpts) != SparkleError::kNoError) {
+		printf("peer check: can't enable the peer caches\n");
+		return false;
+	}
+
+	SparkleError errs[2] = { SparkleError::kFail, SparkleError::kFail };
+	uint64_t packages[2] = {};
+	HarnessSession states[2];
+	const char *dstFiles[2] = { "loadharness-seeder.bin", "loadharness-leecher.bin" };
+	SparkleManager *mgrs[2] = { &seeder, &leecher };
+	for (int idx = 0; idx < 2; idx++) {
+		auto &mgr = *mgrs[idx];
+		SparkleCallbacks callbacks = { OnNewVersionFound, OnDownloadProgress, OnRequestShutdown };
+		mgr.SetCallbacks(callbacks);
+		mgr.SetAppcastURL(baseUrl + "/appcast");
+		mgr.SetAppCurrentVersion(HARNESS_APP_VERSION);
+		mgr.SetSignatureVerifyParams(SignatureAlgo::kEd25519, content.pubKey);
+		errs[idx] = mgr.CheckUpdate("en", {}, &states[idx]);
+		if (errs[idx] == SparkleError::kNoError) {
+			errs[idx] = mgr.Dowload(dstFiles[idx], &states[idx]);
+		}
+		packages[idx] = counters.packages;
+	}
+	seeder.DisablePeerCache();
+	leecher.DisablePeerCache();
+	for (auto dstFile : dstFiles) {
+		std::remove(dstFile);
+	}
+
+	auto ok = errs[0] == SparkleError::kNoError && errs[1] == SparkleError::kNoError &&
+			packages[1] == packages[0] && states[1].downloaded == content.package.size();
+	printf("peer check: seeder %d, leecher %d with %llu bytes, %llu package requests to the server: %s\n",
+			errs[0], errs[1], (unsigned long long)states[1].downloaded, (unsigned long long)packages[1], ok ? "ok" : "FAILED");
+	return ok;
+}
+
+//
+// a burst of events is coalesced, the stream is resumed from the last event
+//
+static bool RunPushCheck(const HarnessContent &content, const std::string &baseUrl, const ServerCounters &counters) {
+	SparkleManager mgr;
+	HarnessSession state;
+	SparkleCallbacks callbacks = { OnNewVersionFound, OnDownloadProgress, OnRequestShutdown };
+	mgr.SetCallbacks(callbacks);
+	mgr.SetAppcastURL(baseUrl + "/appcast");
+	mgr.SetAppCurrentVersion(HARNESS_APP_VERSION);
+	mgr.SetSignatureVerifyParams(SignatureAlgo::kEd25519, content.pubKey);
+
+	uint64_t appcasts = counters.appcasts;
+	PushChannel::Options opts;
+	opts.url = baseUrl + "/events";
+	opts.retryBase = std::chrono::milliseconds(200);
+	if (mgr.StartPushChannel("en", {}, &state, opts) != SparkleError::kNoError) {
+		printf("push check: can't start the push channel\n");
+		return false;
+	}
+
+	// the burst, then two reconnects, then the checks may still finish
+	auto deadline = Clock::now() + std::chrono::seconds(10);
+	while (counters.streams < 3 && Clock::now() < deadline) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+	std::this_thread::sleep_for(std::chrono::seconds(1));
+	mgr.StopPushChannel();
+
+	uint64_t checks = counters.appcasts - appcasts;
+	long long lastEventId = counters.lastEventId;
+	auto ok = state.found && checks >= 1 && checks <= 2 && lastEventId == HARNESS_EVENT_BURST;
+	printf("push check: %d events -> %llu checks, found %d, reconnected %llu times with Last-Event-ID %lld: %s\n",
+			HARNESS_EVENT_BURST, (unsigned long long)checks, state.found ? 1 : 0,
+			(unsigned long long)(counters.streams > 0 ? counters.streams - 1 : 0), lastEventId, ok ? "ok" : "FAILED");
+	return ok;
+}
+
+static void PrintPercentiles(const char *title, std::vector<double> values, const char *unit) {
+	if (values.empty()) {
+		printf("%-20s n/a\n", title);
+		return;
+	}
+	std::sort(values.begin(), values.end());
+	auto at = [&](double p) {
+		return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+	};
+	printf("%-20s p50 %10.2f  p90 %10.2f  p99 %10.2f  min %10.2f  max %10.2f  %s\n",
+			title, at(0.5), at(0.9), at(0.99), values.front(), values.back(), unit);
+}
+
+static bool ParseOptions(int argc, char *argv[], HarnessOptions &opts) {
+	for (int idx = 1; idx < argc; idx++) {
+		std::string arg = argv[idx];
+		auto value = [&]() -> const char * {
+			return idx + 1 < argc ? argv[++idx] : "";
+		};
+		if (arg == "--sessions") {
+			opts.sessions = atoi(value());
+		} else if (arg == "--rounds") {
+			opts.rounds = atoi(value());
+		} else if (arg == "--items") {
+			opts.items = atoi(value());
+		} else if (arg == "--package-size") {
+			opts.packageSize = (size_t)std::strtoull(value(), nullptr, 10);
+		} else if (arg == "--binary") {
+			opts.binary = true;
+		} else if (arg == "--stream") {
+			opts.stream = true;
+		} else if (arg == "--tls") {
+			opts.tls = true;
+		} else if (arg == "--tls-delay") {
+			opts.tlsDelayMs = atoi(value());
+		} else if (arg == "--latency") {
+			opts.latencyMs = atoi(value());
+		} else if (arg == "--jitter") {
+			opts.jitterMs = atoi(value());
+		} else if (arg == "--bandwidth") {
+			opts.bandwidth = std::strtoull(value(), nullptr, 10);
+		} else if (arg == "--reset") {
+			opts.resetRatio = atof(value());
+		} else if (arg == "--truncate") {
+			opts.truncateRatio = atof(value());
+		} else if (arg == "--seed") {
+			opts.seed = (unsigned)std::strtoul(value(), nullptr, 10);
+		} else if (arg == "--peer-check") {
+			opts.peerCheck = true;
+		} else if (arg == "--push-check") {
+			opts.pushCheck = true;
+		} else {
+			return false;
+		}
+	}
+	return opts.sessions > 0 && opts.rounds > 0 && opts.items > 0 && opts.packageSize > 0 &&
+			opts.latencyMs >= 0 && opts.jitterMs >= 0 && opts.tlsDelayMs >= 0 &&
+			opts.resetRatio >= 0 && opts.truncateRatio >= 0 && opts.resetRatio + opts.truncateRatio <= 1;
+}
+
+int main(int argc, char *argv[]) {
+	HarnessOptions opts;
+	if (!ParseOptions(argc, argv, opts)) {
+		fprintf(stderr, "usage: %s [--sessions N] [--rounds N] [--items N] [--package-size B] [--binary] [--stream]\n"
+						"       [--tls] [--tls-delay MS] [--latency MS] [--jitter MS] [--bandwidth B] [--reset P] [--truncate P] [--seed N]\n"
+						"       [--peer-check] [--push-check]\n",
+				argv[0]);
+		return 1;
+	}
+
+#ifdef _WIN32
+	WSADATA wsa;
+	WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+
+	HarnessContent content;
+	if (!MakePackage(content, opts.packageSize, opts.seed)) {
+		fprintf(stderr, "can't sign the package\n");
+		return 1;
+	}
+	if (opts.tls && !MakeTLSContext(content)) {
+		fprintf(stderr, "can't set up TLS\n");
+		return 1;
+	}
+
+	ServerCounters counters;
+	HarnessServer server(opts, content, counters);
+	if (!server.Start()) {
+		fprintf(stderr, "can't start the server\n");
+		return 1;
+	}
+	auto baseUrl = std::string(opts.tls ? "https" : "http") + "://127.0.0.1:" + std::to_string(server.Port());
+	MakeAppcast(content, opts, baseUrl);
+	if (opts.tls) {
+		simple_http_ca_path(content.caFile);
+	}
+
+	if (opts.peerCheck || opts.pushCheck) {
+		auto ok = (!opts.peerCheck || RunPeerCheck(content, baseUrl, counters)) &&
+				(!opts.pushCheck || RunPushCheck(content, baseUrl, counters));
+		server.Stop();
+		if (content.sslCtx) {
+			SSL_CTX_free(content.sslCtx);
+			std::remove(content.caFile.c_str());
+		}
+		return ok ? 0 : 2;
+	}
+
+	printf("%d sessions x %d rounds against %s, %zu bytes package, %zu bytes %s appcast\n",
+			opts.sessions, opts.rounds, baseUrl.c_str(), content.package.size(), content.appcast.size(), opts.binary ? "binary" : "xml");
+
+	std::vector<SessionSample> samples;
+	std::map<int, unsigned> errors;
+	std::mutex lock;
+	std::vector<std::thread> sessions;
+	auto begin = Clock::now();
+	for (int idx = 0; idx < opts.sessions; idx++) {
+		sessions.emplace_back(RunSession, idx, std::cref(opts), std::cref(content), std::cref(baseUrl), std::ref(samples), std::ref(errors), std::ref(lock));
+	}
+	for (auto &session : sessions) {
+		session.join();
+	}
+	auto wallMs = ElapsedMs(begin);
+	server.Stop();
+
+	std::vector<double> decisions, throughputs, cpus;
+	for (const auto &sample : samples) {
+		decisions.push_back(sample.decisionMs);
+		if (sample.downloadMBps >= 0) {
+			throughputs.push_back(sample.downloadMBps);
+			cpus.push_back(sample.cpuMsPerMB);
+		}
+	}
+
+	printf("\n");
+	PrintPercentiles("time to decision", decisions, "ms");
+	PrintPercentiles("download throughput", throughputs, "MB/s");
+	PrintPercentiles("cpu per MB", cpus, "ms");
+	printf("\noutcomes:");
+	for (const auto &[err, count] : errors) {
+		printf("  %d x %u", err, count);
+	}
+	printf("\nserver: %llu requests (%llu ranged), %llu resets, %llu truncations, %.1f MB sent, %.0f ms wall\n",
+			(unsigned long long)counters.requests, (unsigned long long)counters.ranged,
+			(unsigned long long)counters.resets, (unsigned long long)counters.truncations,
+			counters.bytes / (1024.0 * 1024.0), wallMs);
+
+	if (content.sslCtx) {
+		SSL_CTX_free(content.sslCtx);
+		std::remove(content.caFile.c_str());
+	}
+	return errors.size() == 1 && errors.count(SparkleError::kNoError) ? 0 : 2;
+}
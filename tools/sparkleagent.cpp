@@ -0,0 +1,85 @@
+//
+// sparkleagent: the update agent shared by all the apps on a machine (see impl/update_agent.h)
+//
+// usage: sparkleagent [options]
+//	--socket PATH			Unix domain socket to listen at (default /run/sparkle-agent.sock)
+//	--socket-mode MODE		permissions of the socket, octal (default 666)
+//	--socket-group GID		group of the socket (default ours)
+//	--packages DIR			verified packages (default /var/cache/sparkle-agent/packages)
+//	--cache DIR				shared appcast cache, none by default
+//	--cache-ttl S			lifetime of a cached appcast in seconds (default 300)
+//	--decision-ttl S		how long a decision is answered without asking again, 0 for never (default 60)
+//	--check-interval S		check every app in background once it asked, 0 for never (default 0)
+//	--metrics-port N		serve Prometheus metrics at http://127.0.0.1:N/metrics
+//
+// Apps go through it with sparkle_use_agent(), it runs until SIGINT / SIGTERM.
+//
+#include "../impl/update_agent.h"
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+using namespace SparkleLite;
+
+static volatile std::sig_atomic_t gStop = 0;
+
+static void OnSignal(int) {
+	gStop = 1;
+}
+
+int main(int argc, char *argv[]) {
+	UpdateAgent::Options opts;
+	opts.socketPath = "/run/sparkle-agent.sock";
+	opts.packageDir = "/var/cache/sparkle-agent/packages";
+	for (int idx = 1; idx < argc; idx++) {
+		auto arg = argv[idx];
+		auto value = idx + 1 < argc ? argv[idx + 1] : nullptr;
+		if (!value) {
+			fprintf(stderr, "usage: %s [--socket PATH] [--socket-mode MODE] [--socket-group GID] [--packages DIR] [--cache DIR]\n"
+							"       [--cache-ttl S] [--decision-ttl S] [--check-interval S] [--metrics-port N]\n",
+					argv[0]);
+			return 1;
+		}
+		if (!strcmp(arg, "--socket")) {
+			opts.socketPath = value;
+		} else if (!strcmp(arg, "--socket-mode")) {
+			opts.socketMode = (unsigned)std::strtoul(value, nullptr, 8);
+		} else if (!strcmp(arg, "--socket-group")) {
+			opts.socketGroup = std::atoi(value);
+		} else if (!strcmp(arg, "--packages")) {
+			opts.packageDir = value;
+		} else if (!strcmp(arg, "--cache")) {
+			opts.cacheDir = value;
+		} else if (!strcmp(arg, "--cache-ttl")) {
+			opts.cacheTTL = std::atoll(value);
+		} else if (!strcmp(arg, "--decision-ttl")) {
+			opts.decisionTTL = std::chrono::seconds(std::atoll(value));
+		} else if (!strcmp(arg, "--check-interval")) {
+			opts.checkInterval = std::chrono::seconds(std::atoll(value));
+		} else if (!strcmp(arg, "--metrics-port")) {
+			opts.metricsPort = (unsigned short)std::atoi(value);
+		} else {
+			fprintf(stderr, "unknown option %s\n", arg);
+			return 1;
+		}
+		idx++;
+	}
+
+	UpdateAgent agent;
+	if (!agent.Start(opts)) {
+		fprintf(stderr, "can't listen at %s\n", opts.socketPath.c_str());
+		return 1;
+	}
+	std::signal(SIGINT, OnSignal);
+	std::signal(SIGTERM, OnSignal);
+	printf("listening at %s\n", opts.socketPath.c_str());
+
+	while (!gStop) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	}
+	agent.Stop();
+	return 0;
+}
@@ -0,0 +1,154 @@
+//
+// startupbench: how long sparkle_setup takes to return, and what the work deferred from it costs
+//
+// Only the key preparation used to run inside sparkle_setup. The transport (curl, TLS and CA bundle) was and still is
+// initialized by the first request, it's timed on its own and left out of the comparison
+//
+// usage: startupbench [options]
+//	--algo A		none, dsa or ed25519 (default ed25519)
+//	--ca PATH		CA bundle loaded by the transport initialization (default: the system one)
+//
+// Everything is measured cold, once per process, as an application sees it on launch.
+// Run it a few times for a distribution.
+//
+#include "../sparkle_api.h"
+#include "../impl/signature_verifier.h"
+#include "../impl/simple_http.h"
+#include <openssl/dsa.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+using namespace SparkleLite;
+
+static void SPARKLE_API_CC OnNewVersion(const SparkleNewVersionInfo *, void *) {
+}
+
+static int SPARKLE_API_CC OnProgress(long long, long long, void *) {
+	return 1;
+}
+
+static int SPARKLE_API_CC OnShutdown(void *) {
+	return 1;
+}
+
+static std::string MakeEd25519PubKey() {
+	std::string key;
+	EVP_PKEY *pkey = nullptr;
+	auto kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_ED25519, nullptr);
+	if (kctx && EVP_PKEY_keygen_init(kctx) == 1 && EVP_PKEY_keygen(kctx, &pkey) == 1) {
+		unsigned char raw[32];
+		size_t rawLen = sizeof(raw);
+		if (EVP_PKEY_get_raw_public_key(pkey, raw, &rawLen) == 1) {
+			unsigned char encoded[64] = { 0 };
+			auto len = EVP_EncodeBlock(encoded, raw, (int)rawLen);
+			key.assign((const char *)encoded, len);
+		}
+	}
+	if (pkey) {
+		EVP_PKEY_free(pkey);
+	}
+	if (kctx) {
+		EVP_PKEY_CTX_free(kctx);
+	}
+	return key;
+}
+
+static std::string MakeDSAPubKey() {
+	std::string pem;
+	auto dsa = DSA_new();
+	if (dsa && DSA_generate_parameters_ex(dsa, 1024, nullptr, 0, nullptr, nullptr, nullptr) == 1 && DSA_generate_key(dsa) == 1) {
+		auto bio = BIO_new(BIO_s_mem());
+		if (bio && PEM_write_bio_DSA_PUBKEY(bio, dsa) == 1) {
+			char *data = nullptr;
+			auto len = BIO_get_mem_data(bio, &data);
+			pem.assign(data, len);
+		}
+		if (bio) {
+			BIO_free(bio);
+		}
+	}
+	if (dsa) {
+		DSA_free(dsa);
+	}
+	return pem;
+}
+
+template <typename Fn>
+static double ElapsedUs(Fn &&fn) {
+	auto start = std::chrono::steady_clock::now();
+	fn();
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+	std::string algo = "ed25519";
+	std::string ca;
+	for (int idx = 1; idx < argc; idx++) {
+		if (!strcmp(argv[idx], "--algo") && idx + 1 < argc) {
+			algo = argv[++idx];
+		} else if (!strcmp(argv[idx], "--ca") && idx + 1 < argc) {
+			ca = argv[++idx];
+		} else {
+			fprintf(stderr, "usage: %s [--algo none|dsa|ed25519] [--ca PATH]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	SignAlgo signAlgo = SignAlgo::kNoSign;
+	SignatureAlgo verifyAlgo = SignatureAlgo::kNone;
+	std::string pubKey;
+	if (algo == "dsa") {
+		signAlgo = SignAlgo::kDSA;
+		verifyAlgo = SignatureAlgo::kDSA;
+		pubKey = MakeDSAPubKey();
+	} else if (algo == "ed25519") {
+		signAlgo = SignAlgo::kEd25519;
+		verifyAlgo = SignatureAlgo::kEd25519;
+		pubKey = MakeEd25519PubKey();
+	} else if (algo != "none") {
+		fprintf(stderr, "unknown algorithm %s\n", algo.c_str());
+		return 1;
+	}
+	if (signAlgo != SignAlgo::kNoSign && pubKey.empty()) {
+		fprintf(stderr, "can't generate the %s key\n", algo.c_str());
+		return 1;
+	}
+
+	SparkleCallbacks callbacks = { OnNewVersion, OnProgress, OnShutdown };
+	int err = SparkleError::kNoError;
+	auto setupUs = ElapsedUs([&]() {
+		err = sparkle_setup(&callbacks, "1.0", "https://127.0.0.1/appcast.xml", signAlgo,
+				pubKey.empty() ? nullptr : pubKey.c_str(), ca.empty() ? nullptr : ca.c_str());
+	});
+	if (err != SparkleError::kNoError) {
+		fprintf(stderr, "sparkle_setup failed: %d\n", err);
+		return 1;
+	}
+
+	// what used to run inside sparkle_setup
+	bool keyValid = true;
+	auto keyUs = verifyAlgo == SignatureAlgo::kNone ? 0 : ElapsedUs([&]() {
+		keyValid = PrepareVerifyKey(verifyAlgo, pubKey);
+	});
+	// what the first request runs, before and after
+	auto transportUs = ElapsedUs([]() {
+		simple_http_warm_up();
+	});
+	auto warmUpUs = ElapsedUs([]() {
+		sparkle_warm_up();
+	});
+
+	printf("key: %s\n", algo.c_str());
+	printf("sparkle_setup to return     %10.1f us\n", setupUs);
+	printf("deferred key preparation    %10.1f us%s\n", keyUs, keyValid ? "" : " (invalid key)");
+	printf("sparkle_warm_up to return   %10.1f us\n", warmUpUs);
+	printf("setup before deferring      %10.1f us\n", setupUs + keyUs);
+	printf("first request's transport   %10.1f us (curl/TLS/CA, not part of either)\n", transportUs);
+
+	sparkle_clean();
+	return 0;
+}